@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2024 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ *  extern uint64_t os_cpu_in_cksum_sse2(const void *data, uint32_t len);
+ *  extern uint64_t os_cpu_in_cksum_avx2(const void *data, uint32_t len);
+ *
+ *  input :
+ *      data : starting address
+ *      len : byte stream length, a non-zero multiple of 64
+ *
+ *  output :
+ *	the function returns the 64-bit sum of the 32-bit words in the
+ *	byte stream; os_cpu_in_cksum_mbuf() folds it into its partial
+ *	sum.
+ *
+ *	Each vector w3 : w2 : w1 : w0 is split into 0 : w2 : 0 : w0
+ *	(masked) and 0 : w3 : 0 : w1 (shifted), which are accumulated
+ *	into the quadword lanes of two vectors; a lane can absorb 2^32
+ *	words before it could carry out.
+ *
+ *	The kernel only gets the legacy SSE (non-VEX) version: a VEX
+ *	encoded save and restore of the ymm registers would zero the upper
+ *	bits of the zmm registers of the interrupted thread on CPUs with
+ *	AVX-512.  User space gets the AVX2 version, selected at runtime
+ *	through kHasAVX2_0.
+ */
+
+#define	data		%rdi
+#define	len		%rsi
+
+#ifdef KERNEL
+
+	.globl	_os_cpu_in_cksum_sse2
+	.text
+	.align	4
+_os_cpu_in_cksum_sse2:
+
+#define	acc0		%xmm0
+#define	acc1		%xmm1
+#define	v0		%xmm2
+#define	v1		%xmm3
+#define	mask		%xmm4
+#define	t		%xmm5
+
+	/* push callee-saved registers and set up base pointer */
+	push	%rbp
+	movq	%rsp, %rbp
+
+	/* allocate stack space and save xmm0-xmm5 */
+	sub	$6*16, %rsp
+	movdqu	%xmm0, 0*16(%rsp)
+	movdqu	%xmm1, 1*16(%rsp)
+	movdqu	%xmm2, 2*16(%rsp)
+	movdqu	%xmm3, 3*16(%rsp)
+	movdqu	%xmm4, 4*16(%rsp)
+	movdqu	%xmm5, 5*16(%rsp)
+
+	mov	%esi, %esi		// len is a uint32_t
+	pxor	acc0, acc0
+	pxor	acc1, acc1
+	pcmpeqd	mask, mask
+	psrlq	$32, mask		// 0x00000000ffffffff in each lane
+
+L_loop64:
+	movdqu	0*16(data), v0
+	movdqu	1*16(data), v1
+	movdqa	v0, t
+	pand	mask, t
+	psrlq	$32, v0
+	paddq	t, acc0
+	paddq	v0, acc1
+	movdqa	v1, t
+	pand	mask, t
+	psrlq	$32, v1
+	paddq	t, acc0
+	paddq	v1, acc1
+	movdqu	2*16(data), v0
+	movdqu	3*16(data), v1
+	add	$64, data
+	movdqa	v0, t
+	pand	mask, t
+	psrlq	$32, v0
+	paddq	t, acc0
+	paddq	v0, acc1
+	movdqa	v1, t
+	pand	mask, t
+	psrlq	$32, v1
+	paddq	t, acc0
+	paddq	v1, acc1
+	sub	$64, len
+	ja	L_loop64
+
+	/* add up the 4 quadword lanes */
+	paddq	acc1, acc0
+	pshufd	$0x4e, acc0, acc1
+	paddq	acc1, acc0
+	movq	acc0, %rax
+
+	/* restore xmm0-xmm5 and deallocate stack space */
+	movdqu	0*16(%rsp), %xmm0
+	movdqu	1*16(%rsp), %xmm1
+	movdqu	2*16(%rsp), %xmm2
+	movdqu	3*16(%rsp), %xmm3
+	movdqu	4*16(%rsp), %xmm4
+	movdqu	5*16(%rsp), %xmm5
+	add	$6*16, %rsp
+
+	/* restore callee-saved registers */
+	pop	%rbp
+	ret
+
+#else /* !KERNEL */
+
+	.globl	_os_cpu_in_cksum_avx2
+	.text
+	.align	4
+_os_cpu_in_cksum_avx2:
+
+#define	acc0		%ymm0
+#define	acc1		%ymm1
+#define	v0		%ymm2
+#define	v1		%ymm3
+#define	mask		%ymm4
+#define	t		%ymm5
+
+	/* push callee-saved registers and set up base pointer */
+	push	%rbp
+	movq	%rsp, %rbp
+
+	mov	%esi, %esi		// len is a uint32_t
+	vpxor	acc0, acc0, acc0
+	vpxor	acc1, acc1, acc1
+	vpcmpeqd mask, mask, mask
+	vpsrlq	$32, mask, mask		// 0x00000000ffffffff in each lane
+
+L_loop64:
+	vmovdqu	0*32(data), v0
+	vmovdqu	1*32(data), v1
+	add	$64, data
+	vpand	mask, v0, t
+	vpsrlq	$32, v0, v0
+	vpaddq	t, acc0, acc0
+	vpaddq	v0, acc1, acc1
+	vpand	mask, v1, t
+	vpsrlq	$32, v1, v1
+	vpaddq	t, acc0, acc0
+	vpaddq	v1, acc1, acc1
+	sub	$64, len
+	ja	L_loop64
+
+	/* add up the 8 quadword lanes */
+	vpaddq	acc1, acc0, acc0
+	vextracti128 $1, acc0, %xmm1
+	vpaddq	%xmm1, %xmm0, %xmm0
+	vpshufd	$0x4e, %xmm0, %xmm1
+	vpaddq	%xmm1, %xmm0, %xmm0
+	vmovq	%xmm0, %rax
+	vzeroupper
+
+	/* restore callee-saved registers */
+	pop	%rbp
+	ret
+
+#endif /* !KERNEL */
@@ -3172,6 +3172,7 @@ enum {
 	LATENCY, LATENCY_MIN, LATENCY_MAX, LONG_TERM_SCAN_LIMIT,
 	LONG_TERM_SCAN_INTERVAL, LONG_TERM_SCAN_PAUSES,
 	SCAN_LIMIT, SCAN_INTERVAL, SCAN_PAUSES, SCAN_POSTPONES,
+	WHEEL_ENQUEUES, WHEEL_EXPIRES,
 };
 extern uint64_t timer_sysctl_get(int);
 extern int      timer_sysctl_set(int, uint64_t);
@@ -3250,6 +3251,12 @@ SYSCTL_PROC(_kern_timer, OID_AUTO, scan_pauses,
 SYSCTL_PROC(_kern_timer, OID_AUTO, scan_postpones,
     CTLTYPE_QUAD | CTLFLAG_RD | CTLFLAG_LOCKED,
     (void *) SCAN_POSTPONES, 0, sysctl_timer, "Q", "");
+SYSCTL_PROC(_kern_timer, OID_AUTO, wheel_enqueues,
+    CTLTYPE_QUAD | CTLFLAG_RD | CTLFLAG_LOCKED,
+    (void *) WHEEL_ENQUEUES, 0, sysctl_timer, "Q", "");
+SYSCTL_PROC(_kern_timer, OID_AUTO, wheel_expires,
+    CTLTYPE_QUAD | CTLFLAG_RD | CTLFLAG_LOCKED,
+    (void *) WHEEL_EXPIRES, 0, sysctl_timer, "Q", "");
 
 STATIC int
 sysctl_usrstack
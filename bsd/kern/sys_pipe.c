@@ -115,6 +115,12 @@
  * Memory usage may be monitored through the sysctls
  * kern.ipc.pipes, kern.ipc.pipekva.
  *
+ * Large writes from page aligned user buffers bypass the pipe buffer: the
+ * writer maps its pages copy-on-write into the kernel, publishes them as a
+ * direct write (PIPE_DIRECTW), and sleeps while the reader copies straight
+ * out of them, so those bytes are only copied once.  The smallest write
+ * eligible for this is kern.ipc.pipe_direct_min (0 disables it).
+ *
  */
 
 #include <sys/param.h>
@@ -144,7 +150,9 @@
 
 #include <kern/zalloc.h>
 #include <kern/kalloc.h>
+#include <mach/mach_vm.h>
 #include <vm/vm_kern.h>
+#include <vm/vm_map.h>
 #include <libkern/OSAtomic.h>
 #include <libkern/section_keywords.h>
 
@@ -257,6 +265,18 @@ SYSCTL_INT(_kern_ipc, OID_AUTO, pipekvawired, CTLFLAG_RD | CTLFLAG_LOCKED,
     &amountpipekvawired, 0, "Pipe wired KVA usage");
 #endif
 
+/*
+ * Direct writes are handed to the reader at most PIPE_DIRECT_MAX bytes
+ * at a time, to bound the kernel mappings they create.
+ */
+#define PIPE_DIRECT_MAX (16 * BIG_PIPE_SIZE)
+
+static unsigned int pipe_direct_min = BIG_PIPE_SIZE;
+
+SYSCTL_DECL(_kern_ipc);
+SYSCTL_UINT(_kern_ipc, OID_AUTO, pipe_direct_min, CTLFLAG_RW | CTLFLAG_LOCKED,
+    &pipe_direct_min, 0, "Smallest pipe write handed directly to the reader");
+
 static int pipepair_alloc(struct pipe **rpipe, struct pipe **wpipe);
 static void pipeclose(struct pipe *cpipe);
 static void pipe_free_kmem(struct pipe *cpipe);
@@ -726,6 +746,21 @@ pipeselwakeup(struct pipe *cpipe, struct pipe *spipe)
 	}
 }
 
+/*
+ * number of bytes a reader can get right now, including what is left of
+ * a pending direct write
+ */
+static inline int64_t
+pipe_rcount(struct pipe *rpipe)
+{
+	int64_t cnt = rpipe->pipe_buffer.cnt;
+
+	if (rpipe->pipe_state & PIPE_DIRECTW) {
+		cnt += rpipe->pipe_map.cnt - rpipe->pipe_map.pos;
+	}
+	return cnt;
+}
+
 static void
 pipe_check_bounds_panic(struct pipe *cpipe)
 {
@@ -771,10 +806,33 @@ pipe_read(struct fileproc *fp, struct uio *uio, __unused int flags,
 
 
 	while (uio_resid(uio)) {
-		/*
-		 * normal pipe buffer receive
-		 */
-		if (rpipe->pipe_buffer.cnt > 0) {
+		if ((rpipe->pipe_state & PIPE_DIRECTW) &&
+		    rpipe->pipe_map.pos < rpipe->pipe_map.cnt) {
+			/*
+			 * direct write receive: copy straight out of the
+			 * writer's pages, and let it know once they're done.
+			 */
+			size = (u_int) MIN(INT_MAX, MIN(
+				    (user_size_t)(rpipe->pipe_map.cnt - rpipe->pipe_map.pos),
+				    (user_size_t)uio_resid(uio)));
+
+			PIPE_UNLOCK(rpipe); /* we still hold io lock.*/
+			error = uiomove((caddr_t)(rpipe->pipe_map.kva +
+			    rpipe->pipe_map.pos), size, uio);
+			PIPE_LOCK(rpipe);
+			if (error) {
+				break;
+			}
+
+			rpipe->pipe_map.pos += size;
+			if (rpipe->pipe_map.pos == rpipe->pipe_map.cnt) {
+				wakeup(rpipe);
+			}
+			nread += size;
+		} else if (rpipe->pipe_buffer.cnt > 0) {
+			/*
+			 * normal pipe buffer receive
+			 */
 			/*
 			 * # bytes to read is min( bytes from read pointer until end of buffer,
 			 *                         total unread bytes,
@@ -903,6 +961,132 @@ unlocked_error:
 	return error;
 }
 
+/*
+ * whether the current iovec of a write can be handed directly to the reader
+ */
+static inline bool
+pipe_direct_write_ok(struct pipe *wpipe, struct fileproc *fp, struct uio *uio)
+{
+	user_size_t len = uio_curriovlen(uio);
+
+	return pipe_direct_min != 0 && len >= pipe_direct_min &&
+	       uio_isuserspace(uio) && (fp->f_flag & FNONBLOCK) == 0 &&
+	       (uio_curriovbase(uio) & vm_map_page_mask(current_map())) == 0 &&
+	       wpipe->pipe_buffer.cnt == 0 &&
+	       (wpipe->pipe_state & PIPE_DIRECTW) == 0;
+}
+
+/*
+ * Hand (up to PIPE_DIRECT_MAX bytes of) the current iovec of a write to the
+ * reader without going through the pipe buffer, and wait for it to be read.
+ *
+ * Called and returns with the pipe mutex held and the pipe busied.  If the
+ * writer's pages could not be mapped, *fallback is set and nothing has been
+ * transferred: the caller must use the pipe buffer instead.
+ */
+static int
+pipe_direct_write(struct pipe *wpipe, struct fileproc *fp, struct uio *uio,
+    bool *fallback)
+{
+	vm_map_address_t kva;
+	vm_map_copy_t copy;
+	vm_map_size_t size;
+	kern_return_t kr;
+	int error;
+
+	error = pipeio_lock(wpipe, 1);
+	if (error) {
+		return error;
+	}
+
+	if ((wpipe->pipe_state & (PIPE_DRAIN | PIPE_EOF)) ||
+	    (fileproc_get_vflags(fp) & FPV_DRAIN)) {
+		pipeio_unlock(wpipe);
+		return EPIPE;
+	}
+
+	/*
+	 * The pipe mutex was dropped while we waited for the io lock:
+	 * buffered data must be read first, let the caller requeue us.
+	 */
+	if (wpipe->pipe_buffer.cnt != 0 || (wpipe->pipe_state & PIPE_DIRECTW)) {
+		pipeio_unlock(wpipe);
+		return 0;
+	}
+
+	size = MIN(uio_curriovlen(uio), PIPE_DIRECT_MAX);
+
+	PIPE_UNLOCK(wpipe);
+	kr = vm_map_copyin(current_map(), uio_curriovbase(uio), size,
+	    FALSE, &copy);
+	if (kr == KERN_SUCCESS) {
+		kr = vm_map_copyout(ipc_kernel_map, &kva, copy);
+		if (kr != KERN_SUCCESS) {
+			vm_map_copy_discard(copy);
+		}
+	}
+	PIPE_LOCK(wpipe);
+
+	if (kr != KERN_SUCCESS) {
+		pipeio_unlock(wpipe);
+		*fallback = true;
+		return 0;
+	}
+
+	wpipe->pipe_map.kva = (vm_offset_t)kva;
+	wpipe->pipe_map.cnt = (vm_size_t)size;
+	wpipe->pipe_map.pos = 0;
+	wpipe->pipe_state |= PIPE_DIRECTW;
+	pipeio_unlock(wpipe);
+
+	if (wpipe->pipe_state & PIPE_WANTR) {
+		wpipe->pipe_state &= ~PIPE_WANTR;
+		wakeup(wpipe);
+	}
+	pipeselwakeup(wpipe, wpipe);
+
+	while (wpipe->pipe_map.pos < wpipe->pipe_map.cnt) {
+		if ((wpipe->pipe_state & (PIPE_DRAIN | PIPE_EOF)) ||
+		    (fileproc_get_vflags(fp) & FPV_DRAIN)) {
+			error = EPIPE;
+			break;
+		}
+		error = msleep(wpipe, PIPE_MTX(wpipe), PRIBIO | PCATCH, "pipedw", 0);
+		if (error) {
+			break;
+		}
+	}
+
+	/*
+	 * Take back whatever was not consumed, once a reader possibly
+	 * still copying out of the mapping is done with it.
+	 */
+	(void)pipeio_lock(wpipe, 0);
+	uio_update(uio, wpipe->pipe_map.pos);
+	wpipe->pipe_state &= ~PIPE_DIRECTW;
+	wpipe->pipe_map.kva = 0;
+	wpipe->pipe_map.cnt = 0;
+	wpipe->pipe_map.pos = 0;
+	/*
+	 * select(FWRITE) and EVFILT_WRITE report no space while the direct
+	 * write is pending, and the pipe buffer is empty so pipe_write()
+	 * won't wake them on the way out: deliver the writable edge here.
+	 */
+	pipeselwakeup(wpipe, wpipe);
+	pipeio_unlock(wpipe);
+
+	if (wpipe->pipe_state & PIPE_WANTW) {
+		wpipe->pipe_state &= ~PIPE_WANTW;
+		wakeup(wpipe);
+	}
+
+	PIPE_UNLOCK(wpipe);
+	(void)mach_vm_deallocate(ipc_kernel_map, kva, size);
+	PIPE_LOCK(wpipe);
+
+	return error;
+}
+
 /*
  * perform a write of n bytes into the read side of buffer. Since
  * pipes are unidirectional a write is meant to be read by the otherside only.
@@ -914,6 +1098,7 @@ pipe_write(struct fileproc *fp, struct uio *uio, __unused int flags,
 	int error = 0;
 	size_t orig_resid;
 	int pipe_size;
+	bool nodirect = false;
 	struct pipe *wpipe, *rpipe;
 	// LP64todo - fix this!
 	orig_resid = (size_t)uio_resid(uio);
@@ -994,6 +1179,13 @@ pipe_write(struct fileproc *fp, struct uio *uio, __unused int flags,
 	}
 
 	while (uio_resid(uio)) {
+		if (!nodirect && pipe_direct_write_ok(wpipe, fp, uio)) {
+			error = pipe_direct_write(wpipe, fp, uio, &nodirect);
+			if (error) {
+				break;
+			}
+			continue;
+		}
 retrywrite:
 		space = wpipe->pipe_buffer.size - wpipe->pipe_buffer.cnt;
 
@@ -1002,6 +1194,11 @@ retrywrite:
 			space = 0;
 		}
 
+		/* Wait for a direct write to be consumed. */
+		if (wpipe->pipe_state & PIPE_DIRECTW) {
+			space = 0;
+		}
+
 		if (space > 0) {
 			if ((error = pipeio_lock(wpipe, 1)) == 0) {
 				size_t size;       /* Transfer size */
@@ -1018,7 +1215,8 @@ retrywrite:
 				 * value for space might be bad... the mutex
 				 * is dropped while we're blocked
 				 */
-				if (space > (int)(wpipe->pipe_buffer.size -
+				if ((wpipe->pipe_state & PIPE_DIRECTW) ||
+				    space > (int)(wpipe->pipe_buffer.size -
 				    wpipe->pipe_buffer.cnt)) {
 					pipeio_unlock(wpipe);
 					goto retrywrite;
@@ -1218,7 +1416,7 @@ pipe_ioctl(struct fileproc *fp, u_long cmd, caddr_t data,
 		return 0;
 
 	case FIONREAD:
-		*(int *)data = mpipe->pipe_buffer.cnt;
+		*(int *)data = (int)MIN(INT_MAX, pipe_rcount(mpipe));
 		PIPE_UNLOCK(mpipe);
 		return 0;
 
@@ -1268,8 +1466,7 @@ pipe_select(struct fileproc *fp, int which, void *wql, vfs_context_t ctx)
 #endif
 	switch (which) {
 	case FREAD:
-		if ((rpipe->pipe_state & PIPE_DIRECTW) ||
-		    (rpipe->pipe_buffer.cnt > 0) ||
+		if ((pipe_rcount(rpipe) > 0) ||
 		    (rpipe->pipe_state & (PIPE_DRAIN | PIPE_EOF)) ||
 		    (fileproc_get_vflags(fp) & FPV_DRAIN)) {
 			retnum = 1;
@@ -1463,7 +1660,7 @@ filt_pipenotsupprocess(struct knote *kn, struct kevent_qos_s *kev)
 static int
 filt_piperead_common(struct knote *kn, struct kevent_qos_s *kev, struct pipe *rpipe)
 {
-	int64_t data = rpipe->pipe_buffer.cnt;
+	int64_t data = pipe_rcount(rpipe);
 	int res = 0;
 
 	if (filt_pipe_draincommon(kn, rpipe)) {
@@ -1528,7 +1725,7 @@ filt_pipewrite_common(struct knote *kn, struct kevent_qos_s *kev, struct pipe *r
 
 	if (filt_pipe_draincommon(kn, rpipe)) {
 		res = 1;
-	} else {
+	} else if ((rpipe->pipe_state & PIPE_DIRECTW) == 0) {
 		data = MAX_PIPESIZE(rpipe) - rpipe->pipe_buffer.cnt;
 		res = data >= filt_pipelowwat(kn, rpipe, PIPE_BUF);
 	}
@@ -206,6 +206,14 @@ static int bpf_hdr_comp_enable = 1;
 SYSCTL_INT(_debug, OID_AUTO, bpf_hdr_comp_enable, CTLFLAG_RW | CTLFLAG_LOCKED,
     &bpf_hdr_comp_enable, 1, "");
 
+/*
+ * Compile filters at BIOCSETF time and run the compiled form; when off,
+ * every descriptor falls back to the interpreter.
+ */
+static int bpf_jit_enable = 1;
+SYSCTL_INT(_debug, OID_AUTO, bpf_jit_enable, CTLFLAG_RW | CTLFLAG_LOCKED,
+    &bpf_jit_enable, 1, "");
+
 static int sysctl_bpf_stats SYSCTL_HANDLER_ARGS;
 SYSCTL_PROC(_debug, OID_AUTO, bpf_stats, CTLTYPE_STRUCT | CTLFLAG_RD | CTLFLAG_LOCKED,
     0, 0,
@@ -2640,6 +2648,7 @@ bpf_setf(struct bpf_d *d, u_int bf_len, user_addr_t bf_insns,
     u_long cmd)
 {
 	struct bpf_insn *fcode, *old;
+	struct bpf_jit *old_jit;
 	u_int flen, size;
 
 	while (d->bd_hbuf_read) {
@@ -2651,15 +2660,20 @@ bpf_setf(struct bpf_d *d, u_int bf_len, user_addr_t bf_insns,
 	}
 
 	old = d->bd_filter;
+	old_jit = d->bd_filter_jit;
 	if (bf_insns == USER_ADDR_NULL) {
 		if (bf_len != 0) {
 			return EINVAL;
 		}
 		d->bd_filter = NULL;
+		d->bd_filter_jit = NULL;
 		reset_d(d);
 		if (old != 0) {
 			kfree_data_addr(old);
 		}
+		if (old_jit != NULL) {
+			bpf_jit_free(old_jit);
+		}
 		return 0;
 	}
 	flen = bf_len;
@@ -2675,6 +2689,8 @@ bpf_setf(struct bpf_d *d, u_int bf_len, user_addr_t bf_insns,
 	if (copyin(bf_insns, (caddr_t)fcode, size) == 0 &&
 	    bpf_validate(fcode, (int)flen)) {
 		d->bd_filter = fcode;
+		/* on failure to compile the interpreter runs the filter */
+		d->bd_filter_jit = bpf_jit_enable ? bpf_jit_compile(fcode, flen) : NULL;
 
 		if (cmd == BIOCSETF32 || cmd == BIOCSETF64) {
 			reset_d(d);
@@ -2683,6 +2699,9 @@ bpf_setf(struct bpf_d *d, u_int bf_len, user_addr_t bf_insns,
 		if (old != 0) {
 			kfree_data_addr(old);
 		}
+		if (old_jit != NULL) {
+			bpf_jit_free(old_jit);
+		}
 
 		return 0;
 	}
@@ -3234,8 +3253,13 @@ bpf_tap_imp(
 		}
 
 		++d->bd_rcount;
-		slen = bpf_filter(d->bd_filter, (u_char *)bpf_pkt,
-		    (u_int)bpf_pkt->bpfp_total_length, 0);
+		if (d->bd_filter_jit != NULL && bpf_jit_enable) {
+			slen = bpf_jit_filter(d->bd_filter_jit, bpf_pkt,
+			    (u_int)bpf_pkt->bpfp_total_length);
+		} else {
+			slen = bpf_filter(d->bd_filter, (u_char *)bpf_pkt,
+			    (u_int)bpf_pkt->bpfp_total_length, 0);
+		}
 
 		if (slen != 0) {
 			if (bp->bif_ifp->if_type == IFT_PKTAP &&
@@ -4216,6 +4240,9 @@ bpf_freed(struct bpf_d *d)
 	if (d->bd_filter) {
 		kfree_data_addr(d->bd_filter);
 	}
+	if (d->bd_filter_jit) {
+		bpf_jit_free(d->bd_filter_jit);
+	}
 }
 
 /*
@@ -1482,6 +1482,11 @@ extern int      bpf_validate(const struct bpf_insn *, int);
 extern void     bpfdetach(struct ifnet *);
 extern void     bpfilterattach(int);
 extern u_int    bpf_filter(const struct bpf_insn *, u_char *, u_int, u_int);
+
+struct bpf_jit;
+extern struct bpf_jit *bpf_jit_compile(const struct bpf_insn *, u_int);
+extern void     bpf_jit_free(struct bpf_jit *);
+extern u_int    bpf_jit_filter(const struct bpf_jit *, struct bpf_packet *, u_int);
 #endif /* KERNEL_PRIVATE */
 
 #endif /* !defined(DRIVERKIT) */
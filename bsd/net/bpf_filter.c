@@ -76,6 +76,7 @@
 
 #ifdef KERNEL
 #include <sys/mbuf.h>
+#include <kern/kalloc.h>
 #endif
 #include <net/bpf.h>
 #ifdef KERNEL
@@ -887,4 +888,557 @@ bpf_validate(const struct bpf_insn *f, int len)
 	}
 	return BPF_CLASS(f[len - 1].code) == BPF_RET;
 }
+
+/*
+ * Compiled filters
+ *
+ * bpf_jit_compile() translates a program accepted by bpf_validate() into
+ * a pre-decoded form that bpf_jit_filter() runs without re-checking what
+ * bpf_validate() already proved:
+ *
+ * - jump targets are resolved to absolute instruction indices;
+ * - scratch memory bounds are not re-checked, and the scratch memory is
+ *   only cleared for programs that use it;
+ * - a packet load immediately followed by a "jeq #k" or "jset #k" that is
+ *   not itself a jump target is fused into a single instruction, which
+ *   covers most of what tcpdump(1) generates;
+ * - packet loads are served straight from the optional header or the
+ *   first mbuf when they fit, instead of walking the chain on every load.
+ *
+ * The kernel cannot map new executable memory, so this stops short of
+ * emitting native code; the compiled form is still run by a (much
+ * tighter) dispatch loop.
+ */
+enum {
+	BJ_RET_K = 0,
+	BJ_RET_A,
+	BJ_LD_ABS,
+	BJ_LD_IND,
+	BJ_LDX_MSH,
+	BJ_LD_LEN,
+	BJ_LDX_LEN,
+	BJ_LD_IMM,
+	BJ_LDX_IMM,
+	BJ_LD_MEM,
+	BJ_LDX_MEM,
+	BJ_ST,
+	BJ_STX,
+	BJ_JA,
+	BJ_JGT_K,
+	BJ_JGE_K,
+	BJ_JEQ_K,
+	BJ_JSET_K,
+	BJ_JGT_X,
+	BJ_JGE_X,
+	BJ_JEQ_X,
+	BJ_JSET_X,
+	BJ_ADD_X,
+	BJ_SUB_X,
+	BJ_MUL_X,
+	BJ_DIV_X,
+	BJ_AND_X,
+	BJ_OR_X,
+	BJ_LSH_X,
+	BJ_RSH_X,
+	BJ_ADD_K,
+	BJ_SUB_K,
+	BJ_MUL_K,
+	BJ_DIV_K,
+	BJ_AND_K,
+	BJ_OR_K,
+	BJ_LSH_K,
+	BJ_RSH_K,
+	BJ_NEG,
+	BJ_TAX,
+	BJ_TXA,
+	BJ_LD_ABS_JEQ_K,        /* A = P[k:size]; A == k2 ? jt : jf */
+	BJ_LD_ABS_JSET_K,       /* A = P[k:size]; A & k2 ? jt : jf */
+};
+
+struct bpf_jit_insn {
+	u_int8_t        bji_op;
+	u_int8_t        bji_size;       /* packet loads: 1, 2 or 4 bytes */
+	u_int16_t       bji_jt;         /* absolute index of the true branch */
+	u_int16_t       bji_jf;         /* absolute index of the false branch */
+	bpf_u_int32     bji_k;
+	bpf_u_int32     bji_k2;         /* fused compare operand */
+};
+
+struct bpf_jit {
+	u_int                   bj_len;
+	bool                    bj_uses_mem;
+	struct bpf_jit_insn     bj_insns[];
+};
+
+static inline size_t
+bpf_jit_size(u_int len)
+{
+	return sizeof(struct bpf_jit) + len * sizeof(struct bpf_jit_insn);
+}
+
+static u_int8_t
+bpf_jit_load_size(u_short code)
+{
+	switch (BPF_SIZE(code)) {
+	case BPF_W:
+		return sizeof(int32_t);
+	case BPF_H:
+		return sizeof(int16_t);
+	case BPF_B:
+		return sizeof(int8_t);
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Returns the compiled form of a program that passed bpf_validate(),
+ * or NULL if it could not be allocated.
+ */
+struct bpf_jit *
+bpf_jit_compile(const struct bpf_insn *f, u_int len)
+{
+	u_int64_t targets[(BPF_MAXINSNS + 63) / 64] = {};
+	struct bpf_jit *bj;
+	u_int i;
+
+	if (len < 1 || len > BPF_MAXINSNS) {
+		return NULL;
+	}
+
+	bj = kalloc_data(bpf_jit_size(len), Z_WAITOK | Z_ZERO);
+	if (bj == NULL) {
+		return NULL;
+	}
+	bj->bj_len = len;
+
+	for (i = 0; i < len; i++) {
+		if (BPF_CLASS(f[i].code) != BPF_JMP) {
+			continue;
+		}
+		if (BPF_OP(f[i].code) == BPF_JA) {
+			targets[(i + 1 + f[i].k) / 64] |= 1ULL << ((i + 1 + f[i].k) % 64);
+		} else {
+			targets[(i + 1 + f[i].jt) / 64] |= 1ULL << ((i + 1 + f[i].jt) % 64);
+			targets[(i + 1 + f[i].jf) / 64] |= 1ULL << ((i + 1 + f[i].jf) % 64);
+		}
+	}
+
+	for (i = 0; i < len; i++) {
+		const struct bpf_insn *pc = &f[i];
+		struct bpf_jit_insn *bji = &bj->bj_insns[i];
+
+		bji->bji_k = pc->k;
+		bji->bji_jt = (u_int16_t)(i + 1 + pc->jt);
+		bji->bji_jf = (u_int16_t)(i + 1 + pc->jf);
+
+		switch (pc->code) {
+		default:
+			/* the interpreter rejects the packet on unknown opcodes */
+			bji->bji_op = BJ_RET_K;
+			bji->bji_k = 0;
+			break;
+		case BPF_RET | BPF_K:
+			bji->bji_op = BJ_RET_K;
+			break;
+		case BPF_RET | BPF_A:
+			bji->bji_op = BJ_RET_A;
+			break;
+		case BPF_LD | BPF_W | BPF_ABS:
+		case BPF_LD | BPF_H | BPF_ABS:
+		case BPF_LD | BPF_B | BPF_ABS:
+			bji->bji_op = BJ_LD_ABS;
+			bji->bji_size = bpf_jit_load_size(pc->code);
+			if (i + 1 < len && (targets[(i + 1) / 64] & (1ULL << ((i + 1) % 64))) == 0) {
+				const struct bpf_insn *next = &f[i + 1];
+
+				if (next->code == (BPF_JMP | BPF_JEQ | BPF_K)) {
+					bji->bji_op = BJ_LD_ABS_JEQ_K;
+				} else if (next->code == (BPF_JMP | BPF_JSET | BPF_K)) {
+					bji->bji_op = BJ_LD_ABS_JSET_K;
+				} else {
+					break;
+				}
+				bji->bji_k2 = next->k;
+				bji->bji_jt = (u_int16_t)(i + 2 + next->jt);
+				bji->bji_jf = (u_int16_t)(i + 2 + next->jf);
+			}
+			break;
+		case BPF_LD | BPF_W | BPF_IND:
+		case BPF_LD | BPF_H | BPF_IND:
+		case BPF_LD | BPF_B | BPF_IND:
+			bji->bji_op = BJ_LD_IND;
+			bji->bji_size = bpf_jit_load_size(pc->code);
+			break;
+		case BPF_LDX | BPF_MSH | BPF_B:
+			bji->bji_op = BJ_LDX_MSH;
+			break;
+		case BPF_LD | BPF_W | BPF_LEN:
+			bji->bji_op = BJ_LD_LEN;
+			break;
+		case BPF_LDX | BPF_W | BPF_LEN:
+			bji->bji_op = BJ_LDX_LEN;
+			break;
+		case BPF_LD | BPF_IMM:
+			bji->bji_op = BJ_LD_IMM;
+			break;
+		case BPF_LDX | BPF_IMM:
+			bji->bji_op = BJ_LDX_IMM;
+			break;
+		case BPF_LD | BPF_MEM:
+			bji->bji_op = BJ_LD_MEM;
+			bj->bj_uses_mem = true;
+			break;
+		case BPF_LDX | BPF_MEM:
+			bji->bji_op = BJ_LDX_MEM;
+			bj->bj_uses_mem = true;
+			break;
+		case BPF_ST:
+			bji->bji_op = BJ_ST;
+			bj->bj_uses_mem = true;
+			break;
+		case BPF_STX:
+			bji->bji_op = BJ_STX;
+			bj->bj_uses_mem = true;
+			break;
+		case BPF_JMP | BPF_JA:
+			bji->bji_op = BJ_JA;
+			bji->bji_jt = (u_int16_t)(i + 1 + pc->k);
+			break;
+		case BPF_JMP | BPF_JGT | BPF_K:
+			bji->bji_op = BJ_JGT_K;
+			break;
+		case BPF_JMP | BPF_JGE | BPF_K:
+			bji->bji_op = BJ_JGE_K;
+			break;
+		case BPF_JMP | BPF_JEQ | BPF_K:
+			bji->bji_op = BJ_JEQ_K;
+			break;
+		case BPF_JMP | BPF_JSET | BPF_K:
+			bji->bji_op = BJ_JSET_K;
+			break;
+		case BPF_JMP | BPF_JGT | BPF_X:
+			bji->bji_op = BJ_JGT_X;
+			break;
+		case BPF_JMP | BPF_JGE | BPF_X:
+			bji->bji_op = BJ_JGE_X;
+			break;
+		case BPF_JMP | BPF_JEQ | BPF_X:
+			bji->bji_op = BJ_JEQ_X;
+			break;
+		case BPF_JMP | BPF_JSET | BPF_X:
+			bji->bji_op = BJ_JSET_X;
+			break;
+		case BPF_ALU | BPF_ADD | BPF_X:
+			bji->bji_op = BJ_ADD_X;
+			break;
+		case BPF_ALU | BPF_SUB | BPF_X:
+			bji->bji_op = BJ_SUB_X;
+			break;
+		case BPF_ALU | BPF_MUL | BPF_X:
+			bji->bji_op = BJ_MUL_X;
+			break;
+		case BPF_ALU | BPF_DIV | BPF_X:
+			bji->bji_op = BJ_DIV_X;
+			break;
+		case BPF_ALU | BPF_AND | BPF_X:
+			bji->bji_op = BJ_AND_X;
+			break;
+		case BPF_ALU | BPF_OR | BPF_X:
+			bji->bji_op = BJ_OR_X;
+			break;
+		case BPF_ALU | BPF_LSH | BPF_X:
+			bji->bji_op = BJ_LSH_X;
+			break;
+		case BPF_ALU | BPF_RSH | BPF_X:
+			bji->bji_op = BJ_RSH_X;
+			break;
+		case BPF_ALU | BPF_ADD | BPF_K:
+			bji->bji_op = BJ_ADD_K;
+			break;
+		case BPF_ALU | BPF_SUB | BPF_K:
+			bji->bji_op = BJ_SUB_K;
+			break;
+		case BPF_ALU | BPF_MUL | BPF_K:
+			bji->bji_op = BJ_MUL_K;
+			break;
+		case BPF_ALU | BPF_DIV | BPF_K:
+			bji->bji_op = BJ_DIV_K;
+			break;
+		case BPF_ALU | BPF_AND | BPF_K:
+			bji->bji_op = BJ_AND_K;
+			break;
+		case BPF_ALU | BPF_OR | BPF_K:
+			bji->bji_op = BJ_OR_K;
+			break;
+		case BPF_ALU | BPF_LSH | BPF_K:
+			bji->bji_op = BJ_LSH_K;
+			break;
+		case BPF_ALU | BPF_RSH | BPF_K:
+			bji->bji_op = BJ_RSH_K;
+			break;
+		case BPF_ALU | BPF_NEG:
+			bji->bji_op = BJ_NEG;
+			break;
+		case BPF_MISC | BPF_TAX:
+			bji->bji_op = BJ_TAX;
+			break;
+		case BPF_MISC | BPF_TXA:
+			bji->bji_op = BJ_TXA;
+			break;
+		}
+	}
+
+	return bj;
+}
+
+void
+bpf_jit_free(struct bpf_jit *bj)
+{
+	kfree_data(bj, bpf_jit_size(bj->bj_len));
+}
+
+/*
+ * Load size bytes at offset k of the packet. The common case of a load
+ * that lies entirely within the optional header or the first mbuf is
+ * handled inline; anything else goes through the generic accessors.
+ */
+static inline int
+bpf_jit_load(struct bpf_packet *bp, bpf_u_int32 k, u_int size, u_int32_t *val)
+{
+	size_t  hdrlen = bp->bpfp_header_length;
+	u_char  *cp = NULL;
+	int     err = 0;
+
+	if ((size_t)k + size <= hdrlen) {
+		cp = (u_char *)bp->bpfp_header + k;
+	} else if (k >= hdrlen && bp->bpfp_type == BPF_PACKET_TYPE_MBUF &&
+	    bp->bpfp_mbuf != NULL &&
+	    (size_t)(k - hdrlen) + size <= (size_t)bp->bpfp_mbuf->m_len) {
+		cp = mtod(bp->bpfp_mbuf, u_char *) + (k - hdrlen);
+	}
+
+	switch (size) {
+	case sizeof(int32_t):
+		*val = cp != NULL ? EXTRACT_LONG(cp) : bp_xword(bp, k, &err);
+		break;
+	case sizeof(int16_t):
+		*val = cp != NULL ? EXTRACT_SHORT(cp) : bp_xhalf(bp, k, &err);
+		break;
+	default:
+		*val = cp != NULL ? *cp : bp_xbyte(bp, k, &err);
+		break;
+	}
+	return cp != NULL ? 0 : err;
+}
+
+/*
+ * Execute a compiled filter on the packet bp.
+ * wirelen is the length of the original packet.
+ */
+u_int
+bpf_jit_filter(const struct bpf_jit *bj, struct bpf_packet *bp, u_int wirelen)
+{
+	const struct bpf_jit_insn *insns = bj->bj_insns;
+	const struct bpf_jit_insn *pc = insns;
+	u_int32_t A = 0, X = 0;
+	int32_t mem[BPF_MEMWORDS];
+
+	if (bj->bj_uses_mem) {
+		bzero(mem, sizeof(mem));
+	}
+
+	for (;; pc++) {
+		switch (pc->bji_op) {
+		case BJ_RET_K:
+			return (u_int)pc->bji_k;
+
+		case BJ_RET_A:
+			return (u_int)A;
+
+		case BJ_LD_ABS:
+			if (bpf_jit_load(bp, pc->bji_k, pc->bji_size, &A) != 0) {
+				return 0;
+			}
+			continue;
+
+		case BJ_LD_ABS_JEQ_K:
+			if (bpf_jit_load(bp, pc->bji_k, pc->bji_size, &A) != 0) {
+				return 0;
+			}
+			pc = &insns[(A == pc->bji_k2) ? pc->bji_jt : pc->bji_jf] - 1;
+			continue;
+
+		case BJ_LD_ABS_JSET_K:
+			if (bpf_jit_load(bp, pc->bji_k, pc->bji_size, &A) != 0) {
+				return 0;
+			}
+			pc = &insns[(A & pc->bji_k2) ? pc->bji_jt : pc->bji_jf] - 1;
+			continue;
+
+		case BJ_LD_IND:
+			if (bpf_jit_load(bp, X + pc->bji_k, pc->bji_size, &A) != 0) {
+				return 0;
+			}
+			continue;
+
+		case BJ_LDX_MSH:
+			if (bpf_jit_load(bp, pc->bji_k, sizeof(int8_t), &X) != 0) {
+				return 0;
+			}
+			X = (X & 0xf) << 2;
+			continue;
+
+		case BJ_LD_LEN:
+			A = wirelen;
+			continue;
+
+		case BJ_LDX_LEN:
+			X = wirelen;
+			continue;
+
+		case BJ_LD_IMM:
+			A = pc->bji_k;
+			continue;
+
+		case BJ_LDX_IMM:
+			X = pc->bji_k;
+			continue;
+
+		case BJ_LD_MEM:
+			A = mem[pc->bji_k];
+			continue;
+
+		case BJ_LDX_MEM:
+			X = mem[pc->bji_k];
+			continue;
+
+		case BJ_ST:
+			mem[pc->bji_k] = A;
+			continue;
+
+		case BJ_STX:
+			mem[pc->bji_k] = X;
+			continue;
+
+		case BJ_JA:
+			pc = &insns[pc->bji_jt] - 1;
+			continue;
+
+		case BJ_JGT_K:
+			pc = &insns[(A > pc->bji_k) ? pc->bji_jt : pc->bji_jf] - 1;
+			continue;
+
+		case BJ_JGE_K:
+			pc = &insns[(A >= pc->bji_k) ? pc->bji_jt : pc->bji_jf] - 1;
+			continue;
+
+		case BJ_JEQ_K:
+			pc = &insns[(A == pc->bji_k) ? pc->bji_jt : pc->bji_jf] - 1;
+			continue;
+
+		case BJ_JSET_K:
+			pc = &insns[(A & pc->bji_k) ? pc->bji_jt : pc->bji_jf] - 1;
+			continue;
+
+		case BJ_JGT_X:
+			pc = &insns[(A > X) ? pc->bji_jt : pc->bji_jf] - 1;
+			continue;
+
+		case BJ_JGE_X:
+			pc = &insns[(A >= X) ? pc->bji_jt : pc->bji_jf] - 1;
+			continue;
+
+		case BJ_JEQ_X:
+			pc = &insns[(A == X) ? pc->bji_jt : pc->bji_jf] - 1;
+			continue;
+
+		case BJ_JSET_X:
+			pc = &insns[(A & X) ? pc->bji_jt : pc->bji_jf] - 1;
+			continue;
+
+		case BJ_ADD_X:
+			A += X;
+			continue;
+
+		case BJ_SUB_X:
+			A -= X;
+			continue;
+
+		case BJ_MUL_X:
+			A *= X;
+			continue;
+
+		case BJ_DIV_X:
+			if (X == 0) {
+				return 0;
+			}
+			A /= X;
+			continue;
+
+		case BJ_AND_X:
+			A &= X;
+			continue;
+
+		case BJ_OR_X:
+			A |= X;
+			continue;
+
+		case BJ_LSH_X:
+			A <<= X;
+			continue;
+
+		case BJ_RSH_X:
+			A >>= X;
+			continue;
+
+		case BJ_ADD_K:
+			A += pc->bji_k;
+			continue;
+
+		case BJ_SUB_K:
+			A -= pc->bji_k;
+			continue;
+
+		case BJ_MUL_K:
+			A *= pc->bji_k;
+			continue;
+
+		case BJ_DIV_K:
+			A /= pc->bji_k;
+			continue;
+
+		case BJ_AND_K:
+			A &= pc->bji_k;
+			continue;
+
+		case BJ_OR_K:
+			A |= pc->bji_k;
+			continue;
+
+		case BJ_LSH_K:
+			A <<= pc->bji_k;
+			continue;
+
+		case BJ_RSH_K:
+			A >>= pc->bji_k;
+			continue;
+
+		case BJ_NEG:
+			A = -A;
+			continue;
+
+		case BJ_TAX:
+			X = A;
+			continue;
+
+		case BJ_TXA:
+			A = X;
+			continue;
+
+		default:
+			return 0;
+		}
+	}
+}
 #endif
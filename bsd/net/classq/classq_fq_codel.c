@@ -150,6 +150,7 @@ fq_alloc(classq_pkt_type_t ptype)
 	CLASSQ_PKT_INIT(&fq->fq_dq_head);
 	CLASSQ_PKT_INIT(&fq->fq_dq_tail);
 	fq->fq_in_dqlist = false;
+	fq->fq_in_pacing_wheel = false;
 
 	return fq;
 }
@@ -158,6 +159,7 @@ void
 fq_destroy(fq_t *fq, classq_pkt_type_t ptype)
 {
 	VERIFY(!fq->fq_in_dqlist);
+	VERIFY(!fq->fq_in_pacing_wheel);
 	VERIFY(fq_empty(fq, ptype));
 	VERIFY(!(fq->fq_flags & (FQF_NEW_FLOW | FQF_OLD_FLOW |
 	    FQF_EMPTY_FLOW)));
@@ -134,7 +134,10 @@ struct flowq {
 	uint8_t        fq_sc_index; /* service_class index */
 	bool           fq_in_dqlist;
 	fq_tfc_type_t  fq_tfc_type;
-	uint8_t        __fq_pad_uint8[4];
+	bool           fq_in_pacing_wheel;
+	uint8_t        fq_pw_level;    /* pacing wheel level */
+	uint8_t        fq_pw_slot;     /* pacing wheel slot */
+	uint8_t        __fq_pad_uint8[1];
 	uint64_t       fq_min_qdelay; /* min queue delay for Codel */
 	uint64_t       fq_getqtime;    /* last dequeue time */
 	/* total pkt count since last congestion event report */
@@ -151,7 +154,8 @@ struct flowq {
 	 * flow queue will only be on either one of the lists.
 	 */
 	union {
-		STAILQ_ENTRY(flowq) fq_actlink; /* for new/old flow queues */
+		/* for new/old flow queues, or a pacing wheel slot */
+		STAILQ_ENTRY(flowq) fq_actlink;
 		/* entry on empty flow queue list */
 		TAILQ_ENTRY(flowq) fq_empty_link;
 	};
@@ -104,6 +104,7 @@
 #include <net/nat464_utils.h>
 #include <netinet6/in6_var.h>
 #include <netinet6/nd6.h>
+#include <netinet6/ip6_var.h>
 #include <netinet6/mld6_var.h>
 #include <netinet6/scope6_var.h>
 #include <netinet/ip6.h>
@@ -438,6 +439,10 @@ static void dlil_rxpoll_input_thread_cont(void *, wait_result_t);
 static int dlil_create_input_thread(ifnet_t, struct dlil_threading_info *,
     thread_continue_t *);
 static void dlil_terminate_input_thread(struct dlil_threading_info *);
+static void dlil_create_rss_input_threads(struct ifnet *);
+static void dlil_terminate_rss_input_threads(struct ifnet *);
+static errno_t dlil_input_rss(struct ifnet *, struct mbuf *, struct mbuf *,
+    const struct ifnet_stat_increment_param *, boolean_t, struct thread *);
 static void dlil_input_stats_add(const struct ifnet_stat_increment_param *,
     struct dlil_threading_info *, struct ifnet *, boolean_t);
 static boolean_t dlil_input_stats_sync(struct ifnet *,
@@ -859,6 +864,43 @@ unsigned int net_rxpoll = 1;
 unsigned int net_affinity = 1;
 unsigned int net_async = 1;     /* 0: synchronous, 1: asynchronous */
 
+/*
+ * Receive side scaling for Ethernet interfaces using the legacy
+ * asynchronous input model: inbound flows are hashed onto up to
+ * `dlil_rss_queues' input threads per interface rather than one.
+ * The threads are created at attach, so changing the sysctl only affects
+ * interfaces attached afterwards.  The number in use can be lowered per
+ * interface (SIOCSIFRSSQUEUES).
+ */
+#define DLIL_RSS_MAX_QUEUES     16
+static TUNABLE_WRITEABLE(uint32_t, dlil_rss_queues, "dlil_rss_queues", 0);
+SYSCTL_UINT(_net_link_generic_system, OID_AUTO, rss_queues,
+    CTLFLAG_RW | CTLFLAG_LOCKED, &dlil_rss_queues, 0,
+    "RSS input threads per Ethernet interface attached from now on");
+static uint32_t dlil_rss_seed;
+
+static int sysctl_rss_queue_stats SYSCTL_HANDLER_ARGS;
+SYSCTL_NODE(_net_link_generic_system, OID_AUTO, rss_queue_stats,
+    CTLFLAG_RD | CTLFLAG_LOCKED, sysctl_rss_queue_stats,
+    "per interface RSS input queue statistics");
+
+/*
+ * Software receive aggregation: in-order TCP segments of a flow that
+ * arrive in the same input batch are merged into one packet before
+ * they are handed to IP.  Off by default; once enabled, interfaces
+ * may still opt out (SIOCSIFNOGRO).
+ */
+#define DLIL_GRO_SLOTS          8
+static TUNABLE_WRITEABLE(uint32_t, dlil_gro, "dlil_gro", 0);
+SYSCTL_UINT(_net_link_generic_system, OID_AUTO, gro,
+    CTLFLAG_RW | CTLFLAG_LOCKED, &dlil_gro, 0,
+    "enable software receive aggregation of TCP segments");
+
+static int sysctl_gro_stats SYSCTL_HANDLER_ARGS;
+SYSCTL_NODE(_net_link_generic_system, OID_AUTO, gro_stats,
+    CTLFLAG_RD | CTLFLAG_LOCKED, sysctl_gro_stats,
+    "per interface software receive aggregation statistics");
+
 static kern_return_t dlil_affinity_set(struct thread *, u_int32_t);
 
 extern u_int32_t        inject_buckets;
@@ -2365,8 +2407,13 @@ dlil_create_input_thread(ifnet_t ifp, struct dlil_threading_info *inp,
 		 */
 		func = dlil_input_thread_func;
 		VERIFY(inp != dlil_main_input_thread);
-		(void) snprintf(inp->dlth_name, DLIL_THREADNAME_LEN,
-		    "%s_input", if_name(ifp));
+		if (inp->dlth_rss_queue != 0) {
+			(void) snprintf(inp->dlth_name, DLIL_THREADNAME_LEN,
+			    "%s_input_%u", if_name(ifp), inp->dlth_rss_queue);
+		} else {
+			(void) snprintf(inp->dlth_name, DLIL_THREADNAME_LEN,
+			    "%s_input", if_name(ifp));
+		}
 	} else {
 		/*
 		 * Synchronous strategy if there's a netif below and
@@ -2440,8 +2487,10 @@ dlil_create_input_thread(ifnet_t ifp, struct dlil_threading_info *inp,
 		 * We create an affinity set so that the matching workloop
 		 * thread or the starter thread (for loopback) can be
 		 * scheduled on the same processor set as the input thread.
+		 * Additional RSS input threads are meant to spread out,
+		 * so they don't get one.
 		 */
-		if (net_affinity) {
+		if (net_affinity && inp->dlth_rss_queue == 0) {
 			struct thread *tp = inp->dlth_thread;
 			u_int32_t tag;
 			/*
@@ -2507,6 +2556,9 @@ dlil_clean_threading_info(struct dlil_threading_info *inp)
 	VERIFY(qhead(&inp->dlth_pkts) == NULL && qempty(&inp->dlth_pkts));
 	qlimit(&inp->dlth_pkts) = 0;
 	bzero(&inp->dlth_stats, sizeof(inp->dlth_stats));
+	inp->dlth_rss_queue = 0;
+	inp->dlth_pkts_in = 0;
+	inp->dlth_bytes_in = 0;
 
 	VERIFY(!inp->dlth_affinity);
 	inp->dlth_thread = THREAD_NULL;
@@ -2567,6 +2619,105 @@ dlil_terminate_input_thread(struct dlil_threading_info *inp)
 	/* NOTREACHED */
 }
 
+/*
+ * Create the additional input threads used for receive side scaling;
+ * queue 0 is the interface's regular input thread (if_inp).
+ */
+static void
+dlil_create_rss_input_threads(struct ifnet *ifp)
+{
+	struct dlil_threading_info *inp;
+	uint32_t n, i;
+
+	n = MIN(dlil_rss_queues, ml_wait_max_cpus());
+	n = MIN(n, DLIL_RSS_MAX_QUEUES);
+	if (n < 2) {
+		return;
+	}
+
+	/* interfaces may be attached concurrently, pick the seed once */
+	if (os_atomic_load(&dlil_rss_seed, relaxed) == 0) {
+		uint32_t seed;
+
+		read_frandom(&seed, sizeof(seed));
+		(void) os_atomic_cmpxchg(&dlil_rss_seed, 0, seed | 1, relaxed);
+	}
+
+	ifp->if_rss_inp = kalloc_type(struct dlil_threading_info, n - 1,
+	    Z_WAITOK | Z_ZERO | Z_NOFAIL);
+	for (i = 1; i < n; i++) {
+		inp = &ifp->if_rss_inp[i - 1];
+		inp->dlth_rss_queue = i;
+		ifnet_incr_pending_thread_count(ifp);
+		(void) dlil_create_input_thread(ifp, inp, NULL);
+	}
+	ifp->if_rss_nqueues = n;
+	ifp->if_rss_active = n;
+}
+
+/*
+ * Called with the ifnet lock held exclusively, once no more input
+ * can be dispatched to the interface.
+ */
+static void
+dlil_terminate_rss_input_threads(struct ifnet *ifp)
+{
+	struct dlil_threading_info *inp;
+	uint32_t n = ifp->if_rss_nqueues, i;
+
+	if (n == 0) {
+		VERIFY(ifp->if_rss_inp == NULL);
+		return;
+	}
+	ifp->if_rss_active = 0;
+	ifp->if_rss_nqueues = 0;
+
+	for (i = 1; i < n; i++) {
+		inp = &ifp->if_rss_inp[i - 1];
+		VERIFY(!inp->dlth_affinity);
+		VERIFY(inp->dlth_thread != THREAD_NULL);
+
+		lck_mtx_lock_spin(&inp->dlth_lock);
+		inp->dlth_flags |= DLIL_INPUT_TERMINATE;
+		if (!(inp->dlth_flags & DLIL_INPUT_RUNNING)) {
+			wakeup_one((caddr_t)&inp->dlth_flags);
+		}
+		lck_mtx_unlock(&inp->dlth_lock);
+		ifnet_lock_done(ifp);
+
+		/* wait for the input thread to terminate */
+		lck_mtx_lock_spin(&inp->dlth_lock);
+		while ((inp->dlth_flags & DLIL_INPUT_TERMINATE_COMPLETE) == 0) {
+			(void) msleep(&inp->dlth_flags, &inp->dlth_lock,
+			    (PZERO - 1) | PSPIN, inp->dlth_name, NULL);
+		}
+		lck_mtx_unlock(&inp->dlth_lock);
+		ifnet_lock_exclusive(ifp);
+
+		dlil_clean_threading_info(inp);
+	}
+
+	kfree_type(struct dlil_threading_info, n - 1, ifp->if_rss_inp);
+	ifp->if_rss_inp = NULL;
+}
+
+/*
+ * Set the number of RSS input threads that inbound flows are spread
+ * over; 1 sends everything to the regular input thread.
+ */
+int
+dlil_set_rss_queues(struct ifnet *ifp, uint32_t n)
+{
+	if (ifp->if_rss_nqueues == 0) {
+		return ENOTSUP;
+	}
+	if (n == 0 || n > ifp->if_rss_nqueues) {
+		return EINVAL;
+	}
+	os_atomic_store(&ifp->if_rss_active, n, relaxed);
+	return 0;
+}
+
 static kern_return_t
 dlil_affinity_set(struct thread *tp, u_int32_t tag)
 {
@@ -3348,8 +3499,13 @@ dlil_input_thread_func(void *v, wait_result_t w)
 
 	/* construct the name for this thread, and then apply it */
 	bzero(thread_name, sizeof(thread_name));
-	(void) snprintf(thread_name, sizeof(thread_name),
-	    "dlil_input_%s", ifp->if_xname);
+	if (inp->dlth_rss_queue != 0) {
+		(void) snprintf(thread_name, sizeof(thread_name),
+		    "dlil_input_%s_%u", ifp->if_xname, inp->dlth_rss_queue);
+	} else {
+		(void) snprintf(thread_name, sizeof(thread_name),
+		    "dlil_input_%s", ifp->if_xname);
+	}
 	thread_set_thread_name(inp->dlth_thread, thread_name);
 
 	lck_mtx_lock(&inp->dlth_lock);
@@ -4154,10 +4310,139 @@ dlil_input_handler(struct ifnet *ifp, struct mbuf *m_head,
 	} else
 #endif /* (DEVELOPMENT || DEBUG) */
 	{
+		if (__improbable(ifp->if_rss_active > 1 && m_head != NULL)) {
+			return dlil_input_rss(ifp, m_head, m_tail, s, poll, tp);
+		}
 		return inp->dlth_strategy(inp, ifp, m_head, m_tail, s, poll, tp);
 	}
 }
 
+/*
+ * Hash the addresses and, when present in the first mbuf of an
+ * unfragmented packet, the TCP/UDP ports.  Fragments hash on the
+ * addresses alone so that they follow the same queue as the rest
+ * of their datagram; anything that isn't IP lands on queue 0.
+ */
+static uint32_t
+dlil_rss_flowhash(struct mbuf *m)
+{
+	struct ether_header *eh = m->m_pkthdr.pkt_hdr;
+	const void *ports = NULL;
+	uint32_t hash, hlen;
+	uint8_t proto;
+
+	if (eh == NULL) {
+		return 0;
+	}
+
+	switch (ntohs(eh->ether_type)) {
+	case ETHERTYPE_IP: {
+		struct ip *ip = mtod(m, struct ip *);
+
+		if (m->m_len < sizeof(*ip)) {
+			return 0;
+		}
+		hash = net_flowhash(&ip->ip_src, 2 * sizeof(struct in_addr),
+		    dlil_rss_seed);
+		if (ip->ip_off & htons(IP_MF | IP_OFFMASK)) {
+			return hash;
+		}
+		proto = ip->ip_p;
+		hlen = ip->ip_hl << 2;
+		break;
+	}
+	case ETHERTYPE_IPV6: {
+		struct ip6_hdr *ip6 = mtod(m, struct ip6_hdr *);
+
+		if (m->m_len < sizeof(*ip6)) {
+			return 0;
+		}
+		hash = net_flowhash(&ip6->ip6_src, 2 * sizeof(struct in6_addr),
+		    dlil_rss_seed);
+		/* extension headers (incl. fragments) hash on addresses */
+		proto = ip6->ip6_nxt;
+		hlen = sizeof(*ip6);
+		break;
+	}
+	default:
+		return 0;
+	}
+
+	if ((proto == IPPROTO_TCP || proto == IPPROTO_UDP) &&
+	    m->m_len >= hlen + 2 * sizeof(uint16_t)) {
+		ports = mtod(m, uint8_t *) + hlen;
+		hash = net_flowhash(ports, 2 * sizeof(uint16_t), hash);
+	}
+	return hash;
+}
+
+/*
+ * Spread a chain of inbound packets over the interface's RSS input
+ * threads.  Packets of a flow always hash to the same thread, which
+ * preserves their order.
+ */
+static errno_t
+dlil_input_rss(struct ifnet *ifp, struct mbuf *m_head, struct mbuf *m_tail,
+    const struct ifnet_stat_increment_param *s, boolean_t poll,
+    struct thread *tp)
+{
+	struct mbuf *qhead[DLIL_RSS_MAX_QUEUES], *qtail[DLIL_RSS_MAX_QUEUES];
+	uint32_t qcnt[DLIL_RSS_MAX_QUEUES], qsize[DLIL_RSS_MAX_QUEUES];
+	struct ifnet_stat_increment_param qs;
+	struct dlil_threading_info *inp;
+	struct mbuf *m, *next;
+	boolean_t first = TRUE;
+	uint32_t nq, q;
+
+	nq = MIN(os_atomic_load(&ifp->if_rss_active, relaxed),
+	    ifp->if_rss_nqueues);
+	if (nq < 2) {
+		/* raced with SIOCSIFRSSQUEUES */
+		return dlil_input_async(ifp->if_inp, ifp, m_head, m_tail, s,
+		           poll, tp);
+	}
+	VERIFY(nq <= DLIL_RSS_MAX_QUEUES);
+	bzero(qhead, nq * sizeof(qhead[0]));
+	bzero(qcnt, nq * sizeof(qcnt[0]));
+	bzero(qsize, nq * sizeof(qsize[0]));
+
+	for (m = m_head; m != NULL; m = next) {
+		next = mbuf_nextpkt(m);
+		mbuf_setnextpkt(m, NULL);
+
+		q = dlil_rss_flowhash(m) % nq;
+		if (qhead[q] == NULL) {
+			qhead[q] = m;
+		} else {
+			mbuf_setnextpkt(qtail[q], m);
+		}
+		qtail[q] = m;
+		qcnt[q]++;
+		qsize[q] += m_pktlen(m);
+	}
+
+	for (q = 0; q < nq; q++) {
+		if (qhead[q] == NULL) {
+			continue;
+		}
+		/* counters not tied to packets are charged to one queue */
+		if (first) {
+			qs = *s;
+			first = FALSE;
+		} else {
+			bzero(&qs, sizeof(qs));
+		}
+		qs.packets_in = qcnt[q];
+		qs.bytes_in = qsize[q];
+
+		/* only the regular input thread has an affinity set */
+		inp = (q == 0) ? ifp->if_inp : &ifp->if_rss_inp[q - 1];
+		(void) dlil_input_async(inp, ifp, qhead[q], qtail[q], &qs,
+		    poll, (q == 0) ? tp : NULL);
+	}
+	return 0;
+}
+
 /*
  * Detect whether a queue contains a burst that needs to be trimmed.
  */
@@ -6157,11 +6442,378 @@ dlil_interface_filters_output(struct ifnet *ifp, struct mbuf **m_p,
 	return 0;
 }
 
+/*
+ * Software receive aggregation.  Each open slot holds an aggregate
+ * whose headers are those of its first segment; that segment stays
+ * on the packet list and is updated in place as later segments of
+ * the flow are merged into it.
+ */
+struct dlil_gro_slot {
+	struct mbuf     *dgs_head;      /* first segment of the aggregate */
+	struct mbuf     *dgs_tail;      /* last mbuf of its chain */
+	struct tcphdr   *dgs_th;        /* TCP header of dgs_head */
+	uint32_t        dgs_seq;        /* next expected sequence number */
+	uint32_t        dgs_iplen;      /* IP length of the aggregate */
+	uint32_t        dgs_segs;       /* segments in the aggregate */
+};
+
+struct dlil_gro_hdrs {
+	struct tcphdr   *dgh_th;
+	uint32_t        dgh_hlen;       /* IP + TCP header length */
+	uint32_t        dgh_iplen;      /* IP length */
+	uint32_t        dgh_plen;       /* TCP payload length */
+};
+
+/* dlil_gro_classify() results */
+#define DLIL_GRO_OTHER          0       /* not TCP */
+#define DLIL_GRO_OPAQUE         1       /* may be TCP, flow unknown */
+#define DLIL_GRO_TCP            2       /* TCP, not eligible to merge */
+#define DLIL_GRO_OK             3       /* TCP, eligible to merge */
+
+static int
+dlil_gro_classify(struct mbuf *m, protocol_family_t pf,
+    struct dlil_gro_hdrs *h)
+{
+	uint32_t mlen = (uint32_t)m->m_len;
+	uint32_t iphlen, iplen, thlen;
+	struct tcphdr *th;
+	boolean_t ok = TRUE;
+
+	if (pf == PF_INET) {
+		struct ip *ip;
+
+		if (mlen < sizeof(*ip)) {
+			return DLIL_GRO_OPAQUE;
+		}
+		ip = mtod(m, struct ip *);
+		if (ip->ip_p != IPPROTO_TCP) {
+			return DLIL_GRO_OTHER;
+		}
+		iphlen = ip->ip_hl << 2;
+		if ((ntohs(ip->ip_off) & (IP_MF | IP_OFFMASK)) != 0 ||
+		    mlen < iphlen + sizeof(*th)) {
+			return DLIL_GRO_OPAQUE;
+		}
+		iplen = ntohs(ip->ip_len);
+		if (iphlen != sizeof(*ip) ||
+		    (m->m_pkthdr.csum_flags & (CSUM_IP_CHECKED | CSUM_IP_VALID)) !=
+		    (CSUM_IP_CHECKED | CSUM_IP_VALID)) {
+			ok = FALSE;
+		}
+	} else {
+		struct ip6_hdr *ip6;
+
+		if (mlen < sizeof(*ip6)) {
+			return DLIL_GRO_OPAQUE;
+		}
+		ip6 = mtod(m, struct ip6_hdr *);
+		switch (ip6->ip6_nxt) {
+		case IPPROTO_TCP:
+			break;
+		case IPPROTO_UDP:
+		case IPPROTO_ICMPV6:
+		case IPPROTO_ESP:
+			return DLIL_GRO_OTHER;
+		default:
+			/* extension headers may hide a TCP segment */
+			return DLIL_GRO_OPAQUE;
+		}
+		iphlen = sizeof(*ip6);
+		if (mlen < iphlen + sizeof(*th)) {
+			return DLIL_GRO_OPAQUE;
+		}
+		iplen = ntohs(ip6->ip6_plen) + sizeof(*ip6);
+	}
+	th = (struct tcphdr *)(void *)(mtod(m, uint8_t *) + iphlen);
+	thlen = th->th_off << 2;
+	h->dgh_th = th;
+
+	/* plain ACKs with data, and at most the timestamp option */
+	if (!ok || iplen != (uint32_t)m->m_pkthdr.len ||
+	    (th->th_flags & ~TH_PUSH) != TH_ACK ||
+	    (thlen != sizeof(*th) &&
+	    thlen != sizeof(*th) + TCPOLEN_TSTAMP_APPA) ||
+	    mlen < iphlen + thlen || iplen <= iphlen + thlen) {
+		return DLIL_GRO_TCP;
+	}
+	if (thlen != sizeof(*th) &&
+	    *(uint32_t *)(void *)(th + 1) != htonl(TCPOPT_TSTAMP_HDR)) {
+		return DLIL_GRO_TCP;
+	}
+
+	/*
+	 * The merged segments keep a stale th_sum, so only take
+	 * packets whose TCP checksum the hardware has verified.
+	 */
+	if ((m->m_flags & (M_BCAST | M_MCAST | M_LOOP)) != 0 ||
+	    (m->m_pkthdr.pkt_flags & (PKTF_WAKE_PKT | PKTF_LOOP)) != 0 ||
+	    (m->m_pkthdr.csum_flags & (CSUM_DATA_VALID | CSUM_PSEUDO_HDR |
+	    CSUM_PARTIAL)) != (CSUM_DATA_VALID | CSUM_PSEUDO_HDR) ||
+	    m->m_pkthdr.csum_rx_val != 0xffff || m_tag_first(m) != NULL) {
+		return DLIL_GRO_TCP;
+	}
+
+	h->dgh_hlen = iphlen + thlen;
+	h->dgh_iplen = iplen;
+	h->dgh_plen = iplen - iphlen - thlen;
+	return DLIL_GRO_OK;
+}
+
+static boolean_t
+dlil_gro_same_flow(protocol_family_t pf, struct dlil_gro_slot *slot,
+    struct mbuf *m, const struct dlil_gro_hdrs *h)
+{
+	struct tcphdr *th = slot->dgs_th;
+
+	if (th->th_sport != h->dgh_th->th_sport ||
+	    th->th_dport != h->dgh_th->th_dport) {
+		return FALSE;
+	}
+	if (pf == PF_INET) {
+		struct ip *ip = mtod(slot->dgs_head, struct ip *);
+		struct ip *ip2 = mtod(m, struct ip *);
+
+		return ip->ip_src.s_addr == ip2->ip_src.s_addr &&
+		       ip->ip_dst.s_addr == ip2->ip_dst.s_addr;
+	} else {
+		struct ip6_hdr *ip6 = mtod(slot->dgs_head, struct ip6_hdr *);
+		struct ip6_hdr *ip62 = mtod(m, struct ip6_hdr *);
+
+		return IN6_ARE_ADDR_EQUAL(&ip6->ip6_src, &ip62->ip6_src) &&
+		       IN6_ARE_ADDR_EQUAL(&ip6->ip6_dst, &ip62->ip6_dst);
+	}
+}
+
+/*
+ * Everything but the length, the sequence number, the timestamps and
+ * PSH must match for a segment to be merged into the aggregate.
+ */
+static boolean_t
+dlil_gro_hdrs_match(protocol_family_t pf, struct dlil_gro_slot *slot,
+    struct mbuf *m, const struct dlil_gro_hdrs *h)
+{
+	struct tcphdr *th = slot->dgs_th, *th2 = h->dgh_th;
+
+	if (th->th_ack != th2->th_ack || th->th_win != th2->th_win ||
+	    th->th_off != th2->th_off) {
+		return FALSE;
+	}
+	if (pf == PF_INET) {
+		struct ip *ip = mtod(slot->dgs_head, struct ip *);
+		struct ip *ip2 = mtod(m, struct ip *);
+
+		return ip->ip_tos == ip2->ip_tos && ip->ip_ttl == ip2->ip_ttl &&
+		       (ip->ip_off & htons(IP_DF)) == (ip2->ip_off & htons(IP_DF));
+	} else {
+		struct ip6_hdr *ip6 = mtod(slot->dgs_head, struct ip6_hdr *);
+		struct ip6_hdr *ip62 = mtod(m, struct ip6_hdr *);
+
+		return ip6->ip6_flow == ip62->ip6_flow &&
+		       ip6->ip6_hlim == ip62->ip6_hlim;
+	}
+}
+
+static void
+dlil_gro_merge(protocol_family_t pf, struct dlil_gro_slot *slot,
+    struct mbuf *m, const struct dlil_gro_hdrs *h)
+{
+	struct mbuf *head = slot->dgs_head;
+	struct tcphdr *th = slot->dgs_th;
+	uint32_t segs = m->m_pkthdr.seg_cnt ? : 1;
+
+	slot->dgs_iplen += h->dgh_plen;
+	slot->dgs_seq += h->dgh_plen;
+	slot->dgs_segs += segs;
+	if (pf == PF_INET) {
+		struct ip *ip = mtod(head, struct ip *);
+
+		ip->ip_len = htons((uint16_t)slot->dgs_iplen);
+		ip->ip_sum = 0;
+		ip->ip_sum = in_cksum_hdr(ip);
+	} else {
+		struct ip6_hdr *ip6 = mtod(head, struct ip6_hdr *);
+
+		ip6->ip6_plen = htons((uint16_t)(slot->dgs_iplen - sizeof(*ip6)));
+	}
+	/* the aggregate carries the newest timestamps */
+	if ((th->th_off << 2) != sizeof(*th)) {
+		bcopy((uint8_t *)(h->dgh_th + 1) + 4, (uint8_t *)(th + 1) + 4,
+		    2 * sizeof(uint32_t));
+	}
+	th->th_flags |= (h->dgh_th->th_flags & TH_PUSH);
+	head->m_pkthdr.len += h->dgh_plen;
+	head->m_pkthdr.seg_cnt = (uint8_t)slot->dgs_segs;
+
+	/* strip the headers and chain the payload onto the aggregate */
+	m_adj(m, h->dgh_hlen);
+	(void) m_reinit(m, 0);
+	while (m->m_len == 0) {
+		m = m_free(m);
+	}
+	slot->dgs_tail->m_next = m;
+	while (m->m_next != NULL) {
+		m = m->m_next;
+	}
+	slot->dgs_tail = m;
+}
+
+static void
+dlil_gro_open(struct dlil_gro_slot *slot, struct mbuf *m,
+    const struct dlil_gro_hdrs *h)
+{
+	struct mbuf *tail = m;
+
+	while (tail->m_next != NULL) {
+		tail = tail->m_next;
+	}
+	slot->dgs_head = m;
+	slot->dgs_tail = tail;
+	slot->dgs_th = h->dgh_th;
+	slot->dgs_seq = ntohl(h->dgh_th->th_seq) + h->dgh_plen;
+	slot->dgs_iplen = h->dgh_iplen;
+	slot->dgs_segs = m->m_pkthdr.seg_cnt ? : 1;
+}
+
+static void
+dlil_gro_close(struct dlil_gro_slot *slot, struct if_gro_stats *st,
+    uint64_t *reason)
+{
+	if (slot->dgs_segs > 1) {
+		st->ifgro_aggs++;
+	}
+	(*reason)++;
+}
+
+/*
+ * Merge in-order TCP segments of the same flow within a list of
+ * inbound packets; returns the (possibly shorter) list.  Packets
+ * that are not merged keep their relative order, and so do the
+ * segments of each flow.  An aggregate is closed on PSH, on an
+ * out-of-order or mismatching segment, when it reaches its size
+ * limit, and at the end of the list; the input batch bounds the
+ * time a segment can wait for another one to be merged with it.
+ */
+static mbuf_t
+dlil_gro_input(struct ifnet *ifp, protocol_family_t pf, mbuf_t m_head)
+{
+	struct dlil_gro_slot slots[DLIL_GRO_SLOTS], *slot;
+	struct if_gro_stats st;
+	struct dlil_gro_hdrs h;
+	struct mbuf *m, **mp;
+	uint32_t nslots = 0, evict = 0, maxlen, segs, i;
+	uint64_t *reason;
+	int kind;
+
+	maxlen = IP_MAXPACKET;
+	if (pf == PF_INET6) {
+		maxlen += sizeof(struct ip6_hdr);
+	}
+	bzero(&st, sizeof(st));
+	mp = &m_head;
+	while ((m = *mp) != NULL) {
+		kind = dlil_gro_classify(m, pf, &h);
+		if (kind == DLIL_GRO_OTHER) {
+			mp = &m->m_nextpkt;
+			continue;
+		}
+		if (kind == DLIL_GRO_OPAQUE) {
+			/* can't tell which flow it belongs to; close them all */
+			while (nslots > 0) {
+				dlil_gro_close(&slots[--nslots], &st,
+				    &st.ifgro_flush_mismatch);
+			}
+			mp = &m->m_nextpkt;
+			continue;
+		}
+		st.ifgro_pkts++;
+
+		slot = NULL;
+		for (i = 0; i < nslots; i++) {
+			if (dlil_gro_same_flow(pf, &slots[i], m, &h)) {
+				slot = &slots[i];
+				break;
+			}
+		}
+		if (slot != NULL) {
+			segs = m->m_pkthdr.seg_cnt ? : 1;
+			if (kind != DLIL_GRO_OK ||
+			    !dlil_gro_hdrs_match(pf, slot, m, &h)) {
+				reason = &st.ifgro_flush_mismatch;
+			} else if (ntohl(h.dgh_th->th_seq) != slot->dgs_seq) {
+				reason = &st.ifgro_flush_ooo;
+			} else if (slot->dgs_iplen + h.dgh_plen > maxlen ||
+			    slot->dgs_segs + segs > UINT8_MAX) {
+				reason = &st.ifgro_flush_size;
+			} else {
+				*mp = m->m_nextpkt;
+				m->m_nextpkt = NULL;
+				if (h.dgh_th->th_flags & TH_PUSH) {
+					reason = &st.ifgro_flush_psh;
+				} else {
+					reason = NULL;
+				}
+				dlil_gro_merge(pf, slot, m, &h);
+				st.ifgro_merged++;
+				if (reason != NULL) {
+					dlil_gro_close(slot, &st, reason);
+					*slot = slots[--nslots];
+				}
+				continue;
+			}
+			/* the segment can't join; it may start a new aggregate */
+			dlil_gro_close(slot, &st, reason);
+			*slot = slots[--nslots];
+		}
+
+		if (kind == DLIL_GRO_OK && !(h.dgh_th->th_flags & TH_PUSH)) {
+			if (nslots == DLIL_GRO_SLOTS) {
+				slot = &slots[evict];
+				evict = (evict + 1) % DLIL_GRO_SLOTS;
+				dlil_gro_close(slot, &st, &st.ifgro_flush_evict);
+			} else {
+				slot = &slots[nslots++];
+			}
+			dlil_gro_open(slot, m, &h);
+		}
+		mp = &m->m_nextpkt;
+	}
+	while (nslots > 0) {
+		dlil_gro_close(&slots[--nslots], &st, &st.ifgro_flush_batch);
+	}
+
+	if (st.ifgro_pkts != 0) {
+		struct if_gro_stats *d = &ifp->if_gro_stats;
+
+		os_atomic_add(&d->ifgro_pkts, st.ifgro_pkts, relaxed);
+		os_atomic_add(&d->ifgro_merged, st.ifgro_merged, relaxed);
+		os_atomic_add(&d->ifgro_aggs, st.ifgro_aggs, relaxed);
+		os_atomic_add(&d->ifgro_flush_psh, st.ifgro_flush_psh, relaxed);
+		os_atomic_add(&d->ifgro_flush_ooo, st.ifgro_flush_ooo, relaxed);
+		os_atomic_add(&d->ifgro_flush_size, st.ifgro_flush_size, relaxed);
+		os_atomic_add(&d->ifgro_flush_mismatch,
+		    st.ifgro_flush_mismatch, relaxed);
+		os_atomic_add(&d->ifgro_flush_evict, st.ifgro_flush_evict,
+		    relaxed);
+		os_atomic_add(&d->ifgro_flush_batch, st.ifgro_flush_batch,
+		    relaxed);
+	}
+	return m_head;
+}
+
 static void
 dlil_ifproto_input(struct if_proto * ifproto, mbuf_t m)
 {
 	int error;
 
+	if (dlil_gro != 0 && hwcksum_rx != 0 && m != NULL &&
+	    m->m_nextpkt != NULL &&
+	    (ifproto->ifp->if_xflags & IFXF_NO_GRO) == 0 &&
+	    ((ifproto->protocol_family == PF_INET && ipforwarding == 0) ||
+	    (ifproto->protocol_family == PF_INET6 && ip6_forwarding == 0))) {
+		/* a merged packet must not be forwarded, so skip on routers */
+		m = dlil_gro_input(ifproto->ifp, ifproto->protocol_family, m);
+	}
+
 	if (ifproto->proto_kpi == kProtoKPI_v1) {
 		/* Version 1 protocols get one packet at a time */
 		while (m != NULL) {
@@ -6197,9 +6849,11 @@ dlil_input_stats_add(const struct ifnet_stat_increment_param *s,
 
 	if (s->packets_in != 0) {
 		d->packets_in += s->packets_in;
+		inp->dlth_pkts_in += s->packets_in;
 	}
 	if (s->bytes_in != 0) {
 		d->bytes_in += s->bytes_in;
+		inp->dlth_bytes_in += s->bytes_in;
 	}
 	if (s->errors_in != 0) {
 		d->errors_in += s->errors_in;
@@ -9163,6 +9817,11 @@ ifnet_attach(ifnet_t ifp, const struct sockaddr_dl *ll_addr)
 			    "err=%d", __func__, ifp, err);
 			/* NOTREACHED */
 		}
+		VERIFY(ifp->if_rss_inp == NULL && ifp->if_rss_nqueues == 0);
+		if (thfunc == dlil_input_thread_func &&
+		    ifp->if_family == IFNET_FAMILY_ETHERNET) {
+			dlil_create_rss_input_threads(ifp);
+		}
 	}
 	/*
 	 * If the driver supports the new transmit model, calculate flow hash
@@ -10135,6 +10794,9 @@ ifnet_detach_final(struct ifnet *ifp)
 		dlil_reset_rxpoll_params(ifp);
 	}
 
+	/* tear down the additional RSS input threads, if any */
+	dlil_terminate_rss_input_threads(ifp);
+
 	/* The driver might unload, so point these to ourselves */
 	if_free = ifp->if_free;
 	ifp->if_output_dlil = ifp_if_output;
@@ -12692,6 +13354,89 @@ ifnet_notify_data_threshold(struct ifnet *ifp)
 	}
 }
 
+static int
+sysctl_rss_queue_stats SYSCTL_HANDLER_ARGS
+{
+#pragma unused(oidp)
+	int *name = (int *)arg1;
+	u_int namelen = arg2;
+	struct if_rss_queue_stats stats[DLIL_RSS_MAX_QUEUES];
+	struct dlil_threading_info *inp;
+	ifnet_t ifp;
+	uint32_t n, i;
+	int idx;
+
+	if (req->newptr != USER_ADDR_NULL) {
+		return EPERM;
+	}
+	if (namelen != 1) {
+		return EINVAL;
+	}
+	idx = name[0];
+
+	ifnet_head_lock_shared();
+	if (!IF_INDEX_IN_RANGE(idx) || (ifp = ifindex2ifnet[idx]) == NULL ||
+	    !ifnet_is_attached(ifp, 1)) {
+		ifnet_head_done();
+		return ENOENT;
+	}
+	ifnet_head_done();
+
+	ifnet_lock_shared(ifp);
+	n = ifp->if_rss_nqueues;
+	if (n == 0 && ifp->if_inp != NULL) {
+		n = 1;
+	}
+	bzero(stats, sizeof(stats));
+	for (i = 0; i < n; i++) {
+		inp = (i == 0) ? ifp->if_inp : &ifp->if_rss_inp[i - 1];
+		lck_mtx_lock_spin(&inp->dlth_lock);
+		stats[i].ifrq_packets = inp->dlth_pkts_in;
+		stats[i].ifrq_bytes = inp->dlth_bytes_in;
+		stats[i].ifrq_qlen = qlen(&inp->dlth_pkts);
+		stats[i].ifrq_trim_cnt = inp->dlth_trim_cnt;
+		stats[i].ifrq_trim_dropped = inp->dlth_trim_pkts_dropped;
+		lck_mtx_unlock(&inp->dlth_lock);
+		stats[i].ifrq_active = (i < MAX(ifp->if_rss_active, 1));
+	}
+	ifnet_lock_done(ifp);
+	ifnet_decr_iorefcnt(ifp);
+
+	return SYSCTL_OUT(req, stats, n * sizeof(stats[0]));
+}
+
+static int
+sysctl_gro_stats SYSCTL_HANDLER_ARGS
+{
+#pragma unused(oidp)
+	int *name = (int *)arg1;
+	u_int namelen = arg2;
+	struct if_gro_stats stats;
+	ifnet_t ifp;
+	int idx;
+
+	if (req->newptr != USER_ADDR_NULL) {
+		return EPERM;
+	}
+	if (namelen != 1) {
+		return EINVAL;
+	}
+	idx = name[0];
+
+	ifnet_head_lock_shared();
+	if (!IF_INDEX_IN_RANGE(idx) || (ifp = ifindex2ifnet[idx]) == NULL ||
+	    !ifnet_is_attached(ifp, 1)) {
+		ifnet_head_done();
+		return ENOENT;
+	}
+	ifnet_head_done();
+
+	stats = ifp->if_gro_stats;
+	ifnet_decr_iorefcnt(ifp);
+
+	return SYSCTL_OUT(req, &stats, sizeof(stats));
+}
+
 #if (DEVELOPMENT || DEBUG)
 /*
  * The sysctl variable name contains the input parameters of
@@ -184,6 +184,11 @@ struct dlil_threading_info {
 	uint32_t        dlth_trim_cnt;          /* # of trim events */
 	uint32_t        dlth_trim_pkts_dropped; /* # of packets dropped
 	                                         * when trimming */
+
+	/* Receive side scaling */
+	uint32_t        dlth_rss_queue;         /* RSS queue index (0: if_inp) */
+	uint64_t        dlth_pkts_in;           /* total # of packets queued */
+	uint64_t        dlth_bytes_in;          /* total # of bytes queued */
 #if IFNET_INPUT_SANITY_CHK
 	/*
 	 * For debugging.
@@ -236,6 +241,7 @@ extern uint32_t if_rxpoll_interval_pkts;
 extern uint32_t if_rcvq_maxlen;
 
 extern void dlil_init(void);
+extern int dlil_set_rss_queues(struct ifnet *, uint32_t);
 
 extern errno_t ifp_if_ioctl(struct ifnet *, unsigned long, void *);
 extern errno_t ifp_if_output(struct ifnet *, struct mbuf *);
@@ -3103,6 +3103,8 @@ ifioctl_restrict_management(unsigned long cmd, const char *ifname,
 	case SIOCGIFCONSTRAINED:
 	case SIOCGIFXFLAGS:
 	case SIOCGIFNOACKPRIO:
+	case SIOCGIFRSSQUEUES:
+	case SIOCGIFNOGRO:
 	case SIOCGETROUTERMODE:
 	case SIOCGIFNOTRAFFICSHAPING:
 	case SIOCGIFGENERATIONID:
@@ -3392,6 +3394,10 @@ ifioctl(struct socket *so, u_long cmd, caddr_t data, struct proc *p)
 	case SIOCGIFXFLAGS:                     /* struct ifreq */
 	case SIOCGIFNOACKPRIO:                  /* struct ifreq */
 	case SIOCSIFNOACKPRIO:                  /* struct ifreq */
+	case SIOCGIFRSSQUEUES:                  /* struct ifreq */
+	case SIOCSIFRSSQUEUES:                  /* struct ifreq */
+	case SIOCSIFNOGRO:                      /* struct ifreq */
+	case SIOCGIFNOGRO:                      /* struct ifreq */
 	case SIOCSIFMARKWAKEPKT:                /* struct ifreq */
 	case SIOCSIFNOTRAFFICSHAPING:           /* struct ifreq */
 	case SIOCGIFNOTRAFFICSHAPING:           /* struct ifreq */
@@ -4658,6 +4664,34 @@ ifioctl_ifreq(struct socket *so, u_long cmd, struct ifreq *ifr, struct proc *p)
 		}
 		break;
 
+	case SIOCGIFRSSQUEUES:
+		ifr->ifr_rss_queues = ifp->if_rss_active;
+		break;
+
+	case SIOCSIFRSSQUEUES:
+		if ((error = priv_check_cred(kauth_cred_get(),
+		    PRIV_NET_INTERFACE_CONTROL, 0)) != 0) {
+			return error;
+		}
+		error = dlil_set_rss_queues(ifp, ifr->ifr_rss_queues);
+		break;
+
+	case SIOCSIFNOGRO:
+		if ((error = priv_check_cred(kauth_cred_get(),
+		    PRIV_NET_INTERFACE_CONTROL, 0)) != 0) {
+			return error;
+		}
+		if (ifr->ifr_intval != 0) {
+			if_set_xflags(ifp, IFXF_NO_GRO);
+		} else {
+			if_clear_xflags(ifp, IFXF_NO_GRO);
+		}
+		break;
+
+	case SIOCGIFNOGRO:
+		ifr->ifr_intval = (ifp->if_xflags & IFXF_NO_GRO) ? 1 : 0;
+		break;
+
 	case SIOCSIFMARKWAKEPKT:
 #if (DEVELOPMENT || DEBUG)
 		if ((error = priv_check_cred(kauth_cred_get(),
@@ -6390,6 +6424,12 @@ ifioctl_cassert(void)
 	case SIOCGIFNOACKPRIO:
 	case SIOCSIFNOACKPRIO:
 
+	case SIOCGIFRSSQUEUES:
+	case SIOCSIFRSSQUEUES:
+
+	case SIOCSIFNOGRO:
+	case SIOCGIFNOGRO:
+
 	case SIOCSIFMARKWAKEPKT:
 
 	case SIOCSIFNOTRAFFICSHAPING:
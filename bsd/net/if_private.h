@@ -156,6 +156,7 @@ struct if_clonereq32 {
 #define IFXF_FAST_PKT_DELIVERY          0x00001000 /* Fast Packet Delivery */
 #define IFXF_NO_TRAFFIC_SHAPING         0x00002000 /* Skip dummynet and netem traffic shaping */
 #define IFXF_MANAGEMENT                 0x00004000 /* Management interface */
+#define IFXF_NO_GRO                     0x00008000 /* Skip software receive aggregation */
 
 /*
  * Current requirements for an AWDL interface.  Setting/clearing IFEF_AWDL
@@ -313,6 +314,7 @@ struct  ifreq {
 		u_int32_t ifru_tcp_kao_max;
 		int ifru_mpk_log; /* Multi Layer Packet Log */
 		u_int32_t ifru_noack_prio;
+		u_int32_t ifru_rss_queues;
 		struct {
 			u_int8_t up_bucket;
 			u_int8_t down_bucket;
@@ -373,6 +375,7 @@ struct  ifreq {
 #define ifr_low_power_mode      ifr_ifru.ifru_low_power_mode
 #define ifr_tcp_kao_max         ifr_ifru.ifru_tcp_kao_max
 #define ifr_mpk_log             ifr_ifru.ifru_mpk_log
+#define ifr_rss_queues          ifr_ifru.ifru_rss_queues
 #define ifr_noack_prio          ifr_ifru.ifru_noack_prio
 #define ifr_estimated_throughput  ifr_ifru.ifru_estimated_throughput
 #define ifr_radio_details       ifr_ifru.ifru_radio_details
@@ -539,6 +542,19 @@ struct if_qstatsreq {
 	int              ifqr_len               __attribute__((aligned(8)));
 };
 
+/*
+ * Per input queue statistics, returned by the
+ * net.link.generic.system.rss_queue_stats sysctl
+ */
+struct if_rss_queue_stats {
+	u_int64_t       ifrq_packets;           /* packets queued */
+	u_int64_t       ifrq_bytes;             /* bytes queued */
+	u_int32_t       ifrq_qlen;              /* current queue length */
+	u_int32_t       ifrq_active;            /* flows currently hash here */
+	u_int32_t       ifrq_trim_cnt;          /* # of trim events */
+	u_int32_t       ifrq_trim_dropped;      /* packets dropped by trims */
+};
+
 /*
  * Node Proximity Metrics
  */
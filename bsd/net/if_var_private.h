@@ -106,6 +106,22 @@ struct if_data_extended {
 	u_int64_t       reserved[12];/* for future */
 };
 
+/*
+ * Software receive aggregation statistics, returned by the
+ * net.link.generic.system.gro_stats sysctl
+ */
+struct if_gro_stats {
+	u_int64_t       ifgro_pkts;             /* TCP segments considered */
+	u_int64_t       ifgro_merged;           /* segments merged into another */
+	u_int64_t       ifgro_aggs;             /* aggregates of 2+ segments */
+	u_int64_t       ifgro_flush_psh;        /* closed by PSH */
+	u_int64_t       ifgro_flush_ooo;        /* closed by out-of-order seg */
+	u_int64_t       ifgro_flush_size;       /* closed at size/seg limit */
+	u_int64_t       ifgro_flush_mismatch;   /* closed by header mismatch */
+	u_int64_t       ifgro_flush_evict;      /* closed to make room */
+	u_int64_t       ifgro_flush_batch;      /* closed at end of batch */
+};
+
 struct if_packet_stats {
 	/* TCP */
 	u_int64_t               ifi_tcp_badformat;
@@ -767,6 +783,18 @@ struct ifnet {
 
 	struct dlil_threading_info *if_inp;
 
+	/*
+	 * Receive side scaling: if_rss_inp holds the input threads beyond
+	 * if_inp (if_rss_nqueues - 1 of them); inbound flows are hashed
+	 * onto the first if_rss_active threads.
+	 */
+	struct dlil_threading_info *if_rss_inp;
+	u_int32_t               if_rss_nqueues;
+	u_int32_t               if_rss_active;
+
+	/* software receive aggregation counters (struct if_gro_stats) */
+	struct if_gro_stats     if_gro_stats;
+
 	/* allocated once along with dlil_ifnet and is never freed */
 	thread_call_t           if_dt_tcall;
 
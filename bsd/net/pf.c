@@ -75,6 +75,7 @@
 #include <sys/time.h>
 #include <sys/proc.h>
 #include <sys/random.h>
+#include <sys/malloc.h>
 #include <sys/mcache.h>
 #include <sys/protosw.h>
 
@@ -163,6 +164,64 @@ struct pf_state_tree_lan_ext     pf_statetbl_lan_ext;
 struct pf_state_tree_ext_gwy     pf_statetbl_ext_gwy;
 static uint32_t pf_state_tree_ext_gwy_nat64_cnt = 0;
 
+/*
+ * Hash indices over the two state key trees, used for per-packet
+ * lookups; the trees are kept for ordered iteration and for detecting
+ * duplicate keys on insertion.
+ */
+LIST_HEAD(pf_statehash, pf_state_key);
+static struct pf_statehash      *pf_statehash_lan_ext;
+static struct pf_statehash      *pf_statehash_ext_gwy;
+static u_long                   pf_statehash_mask;
+static u_int32_t                pf_statehash_seed;
+TUNABLE(uint32_t, pf_statehash_size, "pf_state_hash_size", 16384);
+
+/*
+ * Candidate sets for the main filter ruleset, compiled whenever its
+ * active queue changes.  For each value of the direction, address
+ * family, protocol and destination port fields there is a bitset of
+ * the rules (by position) that may match a packet carrying that value;
+ * intersecting them before the rule walk lets pf_test_rule() step over
+ * every rule that is known not to match.  Address and table checks are
+ * still done by the linear walk over the surviving candidates.
+ */
+enum {
+	PF_DT_DIR_IN = 0,
+	PF_DT_DIR_OUT,
+	PF_DT_AF_INET,
+	PF_DT_AF_INET6,
+	PF_DT_AF_OTHER,
+	PF_DT_PROTO_TCP,
+	PF_DT_PROTO_UDP,
+	PF_DT_PROTO_ICMP,
+	PF_DT_PROTO_ICMP6,
+	PF_DT_PROTO_OTHER,
+	PF_DT_PORT_ANY,
+	PF_DT_CAND,
+	PF_DT_NSETS
+};
+
+struct pf_dt_port {
+	u_int16_t               port;   /* network byte order */
+	u_int32_t               idx;
+};
+
+struct pf_rule_dtree {
+	u_int32_t               dt_ticket;
+	u_int32_t               dt_nrules;
+	u_int32_t               dt_nwords;
+	u_int32_t               dt_nports;
+	struct pf_rule          **dt_rules;
+	u_int64_t               *dt_bits;       /* PF_DT_NSETS * dt_nwords */
+	struct pf_dt_port       *dt_ports;      /* sorted by port */
+};
+
+#define PF_DT_SET(dt, s)        (&(dt)->dt_bits[(s) * (dt)->dt_nwords])
+#define PF_DT_MIN_RULES         32
+
+static struct pf_rule_dtree     *pf_rule_dtree;
+TUNABLE(uint32_t, pf_rule_dtree_enable, "pf_rule_dtree", 1);
+
 struct pf_palist         pf_pabuf;
 struct pf_status         pf_status;
 
@@ -1110,6 +1169,138 @@ pf_addrcpy(struct pf_addr *dst, struct pf_addr *src, sa_family_t af)
 	}
 }
 
+/*
+ * The state key hashes only cover the fields that
+ * pf_state_compare_lan_ext() and pf_state_compare_ext_gwy() always
+ * require to be equal, so that every key comparing equal to a lookup
+ * key lands in the same bucket. Fields compared conditionally (GRE
+ * call ids, ports and addresses ignored by endpoint-independent or
+ * address-dependent UDP filtering, application state) are left out.
+ */
+static __inline void
+pf_statehash_host(struct pf_state_host *dst, struct pf_state_host *src,
+    sa_family_t af, int with_addr)
+{
+	if (!with_addr) {
+		return;
+	}
+	switch (af) {
+#if INET
+	case AF_INET:
+		dst->addr.addr32[0] = src->addr.addr32[0];
+		break;
+#endif /* INET */
+	case AF_INET6:
+		dst->addr.addr32[0] = src->addr.addr32[0];
+		dst->addr.addr32[1] = src->addr.addr32[1];
+		dst->addr.addr32[2] = src->addr.addr32[2];
+		dst->addr.addr32[3] = src->addr.addr32[3];
+		break;
+	}
+}
+
+static u_int32_t
+pf_statehash_compute(u_int8_t proto, u_int8_t variant, sa_family_t af,
+    int nat64, struct pf_state_host *host, struct pf_state_host *ext,
+    union pf_state_xport *esp_spi)
+{
+	struct pf_flowhash_key fh __attribute__((aligned(8)));
+	int extfilter = PF_EXTFILTER_APD;
+
+	bzero(&fh, sizeof(fh));
+	if (proto == IPPROTO_UDP) {
+		extfilter = variant;
+	} else {
+		variant = 0;
+	}
+
+	pf_statehash_host(&fh.ap1, host, af, 1);
+	pf_statehash_host(&fh.ap2, ext, af, extfilter < PF_EXTFILTER_EI);
+
+	switch (proto) {
+	case IPPROTO_ICMP:
+	case IPPROTO_ICMPV6:
+		fh.ap1.xport.port = host->xport.port;
+		break;
+	case IPPROTO_TCP:
+		fh.ap1.xport.port = host->xport.port;
+		fh.ap2.xport.port = ext->xport.port;
+		break;
+	case IPPROTO_UDP:
+		fh.ap1.xport.port = host->xport.port;
+		if (extfilter < PF_EXTFILTER_AD) {
+			fh.ap2.xport.port = ext->xport.port;
+		}
+		break;
+	case IPPROTO_ESP:
+		fh.ap2.xport.spi = esp_spi->spi;
+		break;
+	default:
+		break;
+	}
+	fh.af = af | (nat64 << 8) | (variant << 16);
+	fh.proto = proto;
+
+	return net_flowhash(&fh, sizeof(fh), pf_statehash_seed);
+}
+
+static __inline struct pf_statehash *
+pf_statehash_lan_ext_bucket(struct pf_state_key *sk)
+{
+	u_int32_t h;
+
+	h = pf_statehash_compute(sk->proto, sk->proto_variant, sk->af_lan, 0,
+	    &sk->lan, &sk->ext_lan, &sk->ext_lan.xport);
+	return &pf_statehash_lan_ext[h & pf_statehash_mask];
+}
+
+static __inline struct pf_statehash *
+pf_statehash_ext_gwy_bucket(struct pf_state_key *sk)
+{
+	u_int32_t h;
+
+	h = pf_statehash_compute(sk->proto, sk->proto_variant, sk->af_gwy,
+	    (sk->af_lan == PF_INET6 && sk->af_gwy == PF_INET),
+	    &sk->gwy, &sk->ext_gwy, &sk->gwy.xport);
+	return &pf_statehash_ext_gwy[h & pf_statehash_mask];
+}
+
+static struct pf_state_key *
+pf_find_state_key_lan_ext(struct pf_state_key *key)
+{
+	struct pf_state_key *sk;
+
+	LIST_FOREACH(sk, pf_statehash_lan_ext_bucket(key), hash_lan_ext) {
+		if (pf_state_compare_lan_ext(key, sk) == 0) {
+			return sk;
+		}
+	}
+	return NULL;
+}
+
+static struct pf_state_key *
+pf_find_state_key_ext_gwy(struct pf_state_key *key)
+{
+	struct pf_state_key *sk;
+
+	LIST_FOREACH(sk, pf_statehash_ext_gwy_bucket(key), hash_ext_gwy) {
+		if (pf_state_compare_ext_gwy(key, sk) == 0) {
+			return sk;
+		}
+	}
+	return NULL;
+}
+
+void
+pf_state_hash_init(void)
+{
+	int size = (int)MIN(MAX(pf_statehash_size, 64), 1 << 24);
+
+	pf_statehash_seed = RandomULong();
+	pf_statehash_lan_ext = hashinit(size, M_CACHE, &pf_statehash_mask);
+	pf_statehash_ext_gwy = hashinit(size, M_CACHE, &pf_statehash_mask);
+}
+
 struct pf_state *
 pf_find_state_byid(struct pf_state_cmp *key)
 {
@@ -1129,8 +1320,7 @@ pf_find_state(struct pfi_kif *kif, struct pf_state_key_cmp *key, u_int dir)
 
 	switch (dir) {
 	case PF_OUT:
-		sk = RB_FIND(pf_state_tree_lan_ext, &pf_statetbl_lan_ext,
-		    (struct pf_state_key *)key);
+		sk = pf_find_state_key_lan_ext((struct pf_state_key *)key);
 
 		break;
 	case PF_IN:
@@ -1151,23 +1341,19 @@ pf_find_state(struct pfi_kif *kif, struct pf_state_key_cmp *key, u_int dir)
 		if (pf_state_tree_ext_gwy_nat64_cnt > 0 &&
 		    key->af_lan == PF_INET && key->af_gwy == PF_INET) {
 			key->af_lan = PF_INET6;
-			sk = RB_FIND(pf_state_tree_ext_gwy, &pf_statetbl_ext_gwy,
-			    (struct pf_state_key *) key);
+			sk = pf_find_state_key_ext_gwy((struct pf_state_key *)key);
 			key->af_lan = PF_INET;
 		}
 
 		if (sk == NULL) {
-			sk = RB_FIND(pf_state_tree_ext_gwy, &pf_statetbl_ext_gwy,
-			    (struct pf_state_key *)key);
+			sk = pf_find_state_key_ext_gwy((struct pf_state_key *)key);
 		}
 		/*
 		 * NAT64 is done only on input, for packets coming in from
 		 * from the LAN side, need to lookup the lan_ext tree.
 		 */
 		if (sk == NULL) {
-			sk = RB_FIND(pf_state_tree_lan_ext,
-			    &pf_statetbl_lan_ext,
-			    (struct pf_state_key *)key);
+			sk = pf_find_state_key_lan_ext((struct pf_state_key *)key);
 			if (sk && sk->af_lan == sk->af_gwy) {
 				sk = NULL;
 			}
@@ -1198,20 +1384,16 @@ pf_find_state_all(struct pf_state_key_cmp *key, u_int dir, int *more)
 
 	switch (dir) {
 	case PF_OUT:
-		sk = RB_FIND(pf_state_tree_lan_ext,
-		    &pf_statetbl_lan_ext, (struct pf_state_key *)key);
+		sk = pf_find_state_key_lan_ext((struct pf_state_key *)key);
 		break;
 	case PF_IN:
-		sk = RB_FIND(pf_state_tree_ext_gwy,
-		    &pf_statetbl_ext_gwy, (struct pf_state_key *)key);
+		sk = pf_find_state_key_ext_gwy((struct pf_state_key *)key);
 		/*
 		 * NAT64 is done only on input, for packets coming in from
 		 * from the LAN side, need to lookup the lan_ext tree.
 		 */
 		if ((sk == NULL) && pf_nat64_configured) {
-			sk = RB_FIND(pf_state_tree_lan_ext,
-			    &pf_statetbl_lan_ext,
-			    (struct pf_state_key *)key);
+			sk = pf_find_state_key_lan_ext((struct pf_state_key *)key);
 			if (sk && sk->af_lan == sk->af_gwy) {
 				sk = NULL;
 			}
@@ -1484,6 +1666,10 @@ pf_insert_state_key_ext_gwy(struct pf_state_key *psk)
 {
 	struct pf_state_key * ret = RB_INSERT(pf_state_tree_ext_gwy,
 	    &pf_statetbl_ext_gwy, psk);
+	if (!ret) {
+		LIST_INSERT_HEAD(pf_statehash_ext_gwy_bucket(psk), psk,
+		    hash_ext_gwy);
+	}
 	if (!ret && psk->af_lan == PF_INET6 &&
 	    psk->af_gwy == PF_INET) {
 		pf_state_tree_ext_gwy_nat64_cnt++;
@@ -1496,6 +1682,9 @@ pf_remove_state_key_ext_gwy(struct pf_state_key *psk)
 {
 	struct pf_state_key * ret = RB_REMOVE(pf_state_tree_ext_gwy,
 	    &pf_statetbl_ext_gwy, psk);
+	if (ret) {
+		LIST_REMOVE(psk, hash_ext_gwy);
+	}
 	if (ret && psk->af_lan == PF_INET6 &&
 	    psk->af_gwy == PF_INET) {
 		pf_state_tree_ext_gwy_nat64_cnt--;
@@ -1503,6 +1692,29 @@ pf_remove_state_key_ext_gwy(struct pf_state_key *psk)
 	return ret;
 }
 
+static __inline struct pf_state_key *
+pf_insert_state_key_lan_ext(struct pf_state_key *psk)
+{
+	struct pf_state_key * ret = RB_INSERT(pf_state_tree_lan_ext,
+	    &pf_statetbl_lan_ext, psk);
+	if (!ret) {
+		LIST_INSERT_HEAD(pf_statehash_lan_ext_bucket(psk), psk,
+		    hash_lan_ext);
+	}
+	return ret;
+}
+
+static __inline struct pf_state_key *
+pf_remove_state_key_lan_ext(struct pf_state_key *psk)
+{
+	struct pf_state_key * ret = RB_REMOVE(pf_state_tree_lan_ext,
+	    &pf_statetbl_lan_ext, psk);
+	if (ret) {
+		LIST_REMOVE(psk, hash_lan_ext);
+	}
+	return ret;
+}
+
 int
 pf_insert_state(struct pfi_kif *kif, struct pf_state *s)
 {
@@ -1512,8 +1724,7 @@ pf_insert_state(struct pfi_kif *kif, struct pf_state *s)
 	VERIFY(s->state_key != NULL);
 	s->kif = kif;
 
-	if ((cur = RB_INSERT(pf_state_tree_lan_ext, &pf_statetbl_lan_ext,
-	    s->state_key)) != NULL) {
+	if ((cur = pf_insert_state_key_lan_ext(s->state_key)) != NULL) {
 		/* key exists. check for same kif, if none, add to key */
 		TAILQ_FOREACH(sp, &cur->states, next)
 		if (sp->kif == kif) {           /* collision! */
@@ -2167,6 +2378,263 @@ pf_calc_skip_steps(struct pf_rulequeue *rules)
 	}
 }
 
+static void
+pf_rule_dtree_free(struct pf_rule_dtree *dt)
+{
+	kfree_type(struct pf_rule *, dt->dt_nrules, dt->dt_rules);
+	kfree_data(dt->dt_bits, PF_DT_NSETS * dt->dt_nwords * sizeof(u_int64_t));
+	kfree_data(dt->dt_ports, dt->dt_nports * sizeof(struct pf_dt_port));
+	kfree_type(struct pf_rule_dtree, dt);
+}
+
+extern void qsort(void *a, size_t n, size_t es,
+    int (*cmp)(const void *, const void *));
+
+static int
+pf_dt_port_cmp(const void *a, const void *b)
+{
+	const struct pf_dt_port *pa = a, *pb = b;
+
+	if (pa->port != pb->port) {
+		return pa->port < pb->port ? -1 : 1;
+	}
+	return pa->idx < pb->idx ? -1 : (pa->idx > pb->idx);
+}
+
+static void
+pf_dt_setbit(u_int64_t *set, u_int32_t idx)
+{
+	set[idx >> 6] |= 1ULL << (idx & 63);
+}
+
+/*
+ * Rebuild the candidate sets of the main filter ruleset after its
+ * active queue has been replaced or edited.  Must be called with
+ * pf_lock held, after the active ticket has been updated.
+ */
+void
+pf_rule_dtree_update(struct pf_ruleset *rs, int rs_num)
+{
+	struct pf_rulequeue *rules;
+	struct pf_rule_dtree *dt;
+	struct pf_rule *r;
+	u_int32_t n, nports, i;
+
+	LCK_MTX_ASSERT(&pf_lock, LCK_MTX_ASSERT_OWNED);
+
+	if (rs != &pf_main_ruleset || rs_num != PF_RULESET_FILTER) {
+		return;
+	}
+	if (pf_rule_dtree != NULL) {
+		pf_rule_dtree_free(pf_rule_dtree);
+		pf_rule_dtree = NULL;
+	}
+	if (!pf_rule_dtree_enable) {
+		return;
+	}
+
+	rules = rs->rules[rs_num].active.ptr;
+	n = nports = 0;
+	TAILQ_FOREACH(r, rules, entries) {
+		if ((r->proto == IPPROTO_TCP || r->proto == IPPROTO_UDP) &&
+		    r->dst.xport.range.op == PF_OP_EQ) {
+			nports++;
+		}
+		n++;
+	}
+	if (n < PF_DT_MIN_RULES) {
+		return;
+	}
+
+	dt = kalloc_type(struct pf_rule_dtree, Z_WAITOK | Z_ZERO | Z_NOFAIL);
+	dt->dt_ticket = rs->rules[rs_num].active.ticket;
+	dt->dt_nrules = n;
+	dt->dt_nwords = (n + 63) / 64;
+	dt->dt_nports = nports;
+	dt->dt_rules = kalloc_type(struct pf_rule *, n, Z_WAITOK | Z_ZERO);
+	dt->dt_bits = kalloc_data(PF_DT_NSETS * dt->dt_nwords *
+	    sizeof(u_int64_t), Z_WAITOK | Z_ZERO);
+	if (nports != 0) {
+		dt->dt_ports = kalloc_data(nports * sizeof(struct pf_dt_port),
+		    Z_WAITOK | Z_ZERO);
+	}
+	if (dt->dt_rules == NULL || dt->dt_bits == NULL ||
+	    (nports != 0 && dt->dt_ports == NULL)) {
+		/* fall back to the plain skip-step walk */
+		pf_rule_dtree_free(dt);
+		return;
+	}
+
+	i = nports = 0;
+	TAILQ_FOREACH(r, rules, entries) {
+		dt->dt_rules[i] = r;
+
+		if (r->direction != PF_OUT) {
+			pf_dt_setbit(PF_DT_SET(dt, PF_DT_DIR_IN), i);
+		}
+		if (r->direction != PF_IN) {
+			pf_dt_setbit(PF_DT_SET(dt, PF_DT_DIR_OUT), i);
+		}
+
+		if (r->af == 0 || r->af == AF_INET) {
+			pf_dt_setbit(PF_DT_SET(dt, PF_DT_AF_INET), i);
+		}
+		if (r->af == 0 || r->af == AF_INET6) {
+			pf_dt_setbit(PF_DT_SET(dt, PF_DT_AF_INET6), i);
+		}
+		if (r->af == 0) {
+			pf_dt_setbit(PF_DT_SET(dt, PF_DT_AF_OTHER), i);
+		}
+
+		switch (r->proto) {
+		case 0:
+			pf_dt_setbit(PF_DT_SET(dt, PF_DT_PROTO_TCP), i);
+			pf_dt_setbit(PF_DT_SET(dt, PF_DT_PROTO_UDP), i);
+			pf_dt_setbit(PF_DT_SET(dt, PF_DT_PROTO_ICMP), i);
+			pf_dt_setbit(PF_DT_SET(dt, PF_DT_PROTO_ICMP6), i);
+			pf_dt_setbit(PF_DT_SET(dt, PF_DT_PROTO_OTHER), i);
+			break;
+		case IPPROTO_TCP:
+			pf_dt_setbit(PF_DT_SET(dt, PF_DT_PROTO_TCP), i);
+			break;
+		case IPPROTO_UDP:
+			pf_dt_setbit(PF_DT_SET(dt, PF_DT_PROTO_UDP), i);
+			break;
+		case IPPROTO_ICMP:
+			pf_dt_setbit(PF_DT_SET(dt, PF_DT_PROTO_ICMP), i);
+			break;
+		case IPPROTO_ICMPV6:
+			pf_dt_setbit(PF_DT_SET(dt, PF_DT_PROTO_ICMP6), i);
+			break;
+		default:
+			/* the walk still compares the exact protocol */
+			pf_dt_setbit(PF_DT_SET(dt, PF_DT_PROTO_OTHER), i);
+			break;
+		}
+
+		/* dst.xport overlays call_id/spi for GRE and ESP */
+		if ((r->proto == IPPROTO_TCP || r->proto == IPPROTO_UDP) &&
+		    r->dst.xport.range.op == PF_OP_EQ) {
+			dt->dt_ports[nports].port = r->dst.xport.range.port[0];
+			dt->dt_ports[nports].idx = i;
+			nports++;
+		} else {
+			pf_dt_setbit(PF_DT_SET(dt, PF_DT_PORT_ANY), i);
+		}
+		i++;
+	}
+	if (nports > 1) {
+		qsort(dt->dt_ports, nports, sizeof(struct pf_dt_port),
+		    pf_dt_port_cmp);
+	}
+
+	pf_rule_dtree = dt;
+}
+
+/*
+ * Intersect the per-field sets for this packet into the candidate set.
+ * Returns the compiled tree, or NULL if the walk should visit every
+ * rule (no tree, or one that is stale for the active queue).
+ */
+static struct pf_rule_dtree *
+pf_rule_dtree_select(int direction, sa_family_t af, u_int8_t proto,
+    u_int16_t dport)
+{
+	struct pf_rule_dtree *dt = pf_rule_dtree;
+	u_int64_t *cand, *dir, *afs, *prs, *any;
+	u_int32_t w, lo, hi, mid;
+
+	if (dt == NULL || dt->dt_ticket !=
+	    pf_main_ruleset.rules[PF_RULESET_FILTER].active.ticket) {
+		return NULL;
+	}
+
+	cand = PF_DT_SET(dt, PF_DT_CAND);
+	dir = PF_DT_SET(dt, direction == PF_OUT ?
+	    PF_DT_DIR_OUT : PF_DT_DIR_IN);
+	switch (af) {
+	case AF_INET:
+		afs = PF_DT_SET(dt, PF_DT_AF_INET);
+		break;
+	case AF_INET6:
+		afs = PF_DT_SET(dt, PF_DT_AF_INET6);
+		break;
+	default:
+		afs = PF_DT_SET(dt, PF_DT_AF_OTHER);
+		break;
+	}
+	switch (proto) {
+	case IPPROTO_TCP:
+		prs = PF_DT_SET(dt, PF_DT_PROTO_TCP);
+		break;
+	case IPPROTO_UDP:
+		prs = PF_DT_SET(dt, PF_DT_PROTO_UDP);
+		break;
+	case IPPROTO_ICMP:
+		prs = PF_DT_SET(dt, PF_DT_PROTO_ICMP);
+		break;
+	case IPPROTO_ICMPV6:
+		prs = PF_DT_SET(dt, PF_DT_PROTO_ICMP6);
+		break;
+	default:
+		prs = PF_DT_SET(dt, PF_DT_PROTO_OTHER);
+		break;
+	}
+
+	if (proto != IPPROTO_TCP && proto != IPPROTO_UDP) {
+		for (w = 0; w < dt->dt_nwords; w++) {
+			cand[w] = dir[w] & afs[w] & prs[w];
+		}
+		return dt;
+	}
+
+	/* rules with an equality match on this port, plus the rest */
+	any = PF_DT_SET(dt, PF_DT_PORT_ANY);
+	memcpy(cand, any, dt->dt_nwords * sizeof(u_int64_t));
+	lo = 0;
+	hi = dt->dt_nports;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (dt->dt_ports[mid].port < dport) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	for (; lo < dt->dt_nports && dt->dt_ports[lo].port == dport; lo++) {
+		pf_dt_setbit(cand, dt->dt_ports[lo].idx);
+	}
+	for (w = 0; w < dt->dt_nwords; w++) {
+		cand[w] &= dir[w] & afs[w] & prs[w];
+	}
+	return dt;
+}
+
+/*
+ * Return the first candidate rule at or after r in the main filter
+ * ruleset, or NULL if no later rule can match.
+ */
+static struct pf_rule *
+pf_rule_dtree_next(struct pf_rule_dtree *dt, struct pf_rule *r)
+{
+	u_int64_t *cand = PF_DT_SET(dt, PF_DT_CAND);
+	u_int32_t idx = r->nr, w;
+	u_int64_t bits;
+
+	if (idx >= dt->dt_nrules || dt->dt_rules[idx] != r) {
+		return r;
+	}
+	w = idx >> 6;
+	bits = cand[w] & (~0ULL << (idx & 63));
+	while (bits == 0) {
+		if (++w >= dt->dt_nwords) {
+			return NULL;
+		}
+		bits = cand[w];
+	}
+	return dt->dt_rules[(w << 6) + (u_int32_t)__builtin_ctzll(bits)];
+}
+
 u_int32_t
 pf_calc_state_key_flowhash(struct pf_state_key *sk)
 {
@@ -4459,8 +4927,7 @@ pf_detach_state(struct pf_state *s, int flags)
 			pf_remove_state_key_ext_gwy(sk);
 		}
 		if (!(flags & PF_DT_SKIP_LANEXT)) {
-			RB_REMOVE(pf_state_tree_lan_ext,
-			    &pf_statetbl_lan_ext, sk);
+			pf_remove_state_key_lan_ext(sk);
 		}
 		if (sk->app_state) {
 			pool_put(&pf_app_state_pl, sk->app_state);
@@ -4960,6 +5427,7 @@ pf_test_rule(struct pf_rule **rm, struct pf_state **sm, int direction,
 	int                      asd = 0;
 	int                      match = 0;
 	int                      state_icmp = 0;
+	struct pf_rule_dtree    *dt;
 	u_int16_t                mss = tcp_mssdflt;
 	u_int8_t                 icmptype = 0, icmpcode = 0;
 #if SKYWALK
@@ -5283,7 +5751,16 @@ pf_test_rule(struct pf_rule **rm, struct pf_state **sm, int direction,
 		tag = nr->tag;
 	}
 
+	dt = pf_rule_dtree_select(direction, pd->af, pd->proto,
+	    (pd->proto == IPPROTO_TCP || pd->proto == IPPROTO_UDP) ?
+	    th->th_dport : 0);
+
 	while (r != NULL) {
+		/* anchors are not compiled; walk them rule by rule */
+		if (dt != NULL && asd == 0 &&
+		    (r = pf_rule_dtree_next(dt, r)) == NULL) {
+			break;
+		}
 		r->evaluations++;
 		if (pfi_kif_match(r->kif, kif) == r->ifnot) {
 			r = r->skip[PF_SKIP_IFP].ptr;
@@ -8914,12 +9391,10 @@ pf_test_state_esp(struct pf_state **state, int direction, struct pfi_kif *kif,
 			if (s) {
 				struct pf_state_key *sk = s->state_key;
 
-				RB_REMOVE(pf_state_tree_lan_ext,
-				    &pf_statetbl_lan_ext, sk);
+				pf_remove_state_key_lan_ext(sk);
 				sk->ext_lan.xport.spi = esp->spi;
 
-				if (RB_INSERT(pf_state_tree_lan_ext,
-				    &pf_statetbl_lan_ext, sk)) {
+				if (pf_insert_state_key_lan_ext(sk)) {
 					pf_detach_state(s, PF_DT_SKIP_LANEXT);
 				} else {
 					*state = s;
@@ -486,6 +486,7 @@ pfinit(void)
 
 	RB_INIT(&tree_src_tracking);
 	RB_INIT(&pf_anchors);
+	pf_state_hash_init();
 	pf_init_ruleset(&pf_main_ruleset);
 	TAILQ_INIT(&pf_pabuf);
 	TAILQ_INIT(&state_list);
@@ -1170,6 +1171,7 @@ pf_commit_rules(u_int32_t ticket, int rs_num, char *anchor)
 	rs->rules[rs_num].active.ticket =
 	    rs->rules[rs_num].inactive.ticket;
 	pf_calc_skip_steps(rs->rules[rs_num].active.ptr);
+	pf_rule_dtree_update(rs, rs_num);
 
 
 	/* Purge the old rule list. */
@@ -2521,6 +2523,7 @@ pf_ruleset_cleanup(struct pf_ruleset *ruleset, int rs)
 	pf_calc_skip_steps(ruleset->rules[rs].active.ptr);
 	ruleset->rules[rs].active.ticket =
 	    ++ruleset->rules[rs].inactive.ticket;
+	pf_rule_dtree_update(ruleset, rs);
 }
 
 /*
@@ -2606,6 +2609,7 @@ delete_rule:
 		    i, delete_rule);
 		delete_ruleset->rules[i].active.ticket =
 		    ++delete_ruleset->rules[i].inactive.ticket;
+		pf_rule_dtree_update(delete_ruleset, i);
 		goto delete_rule;
 	} else {
 		/*
@@ -3229,6 +3233,7 @@ pfioctl_ioc_rule(u_long cmd, int minordev, struct pfioc_rule *pr, struct proc *p
 		ruleset->rules[rs_num].active.ticket++;
 
 		pf_calc_skip_steps(ruleset->rules[rs_num].active.ptr);
+		pf_rule_dtree_update(ruleset, rs_num);
 #if SKYWALK && defined(XNU_TARGET_OS_OSX)
 		pf_process_compatibilities();
 #endif // SKYWALK && defined(XNU_TARGET_OS_OSX)
@@ -1008,6 +1008,8 @@ struct pf_state_key {
 
 	RB_ENTRY(pf_state_key)   entry_lan_ext;
 	RB_ENTRY(pf_state_key)   entry_ext_gwy;
+	LIST_ENTRY(pf_state_key) hash_lan_ext;
+	LIST_ENTRY(pf_state_key) hash_ext_gwy;
 	struct pf_statelist      states;
 	u_int32_t        refcnt;
 };
@@ -2169,6 +2171,7 @@ __private_extern__ int pf_tbladdr_setup(struct pf_ruleset *,
 __private_extern__ void pf_tbladdr_remove(struct pf_addr_wrap *);
 __private_extern__ void pf_tbladdr_copyout(struct pf_addr_wrap *);
 __private_extern__ void pf_calc_skip_steps(struct pf_rulequeue *);
+__private_extern__ void pf_rule_dtree_update(struct pf_ruleset *, int);
 __private_extern__ u_int32_t pf_calc_state_key_flowhash(struct pf_state_key *);
 
 extern struct pool pf_src_tree_pl, pf_rule_pl;
@@ -2181,6 +2184,7 @@ extern struct thread *pf_purge_thread;
 extern void pf_register_m_tag(void);
 
 __private_extern__ void pfinit(void);
+__private_extern__ void pf_state_hash_init(void);
 __private_extern__ void pf_purge_thread_fn(void *, wait_result_t) __dead2;
 __private_extern__ void pf_purge_expired_src_nodes(void);
 __private_extern__ void pf_purge_expired_states(u_int32_t);
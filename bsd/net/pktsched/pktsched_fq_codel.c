@@ -64,9 +64,13 @@ SYSCTL_INT(_net_classq_fq_codel, OID_AUTO, fq_enable_pacing, CTLFLAG_RW | CTLFLA
     &ifclassq_enable_pacing, 0, "Enable pacing");
 
 static uint64_t fq_empty_purge_delay = FQ_EMPTY_PURGE_DELAY;
+static uint32_t fq_pacing_wheel = 1;
 #if (DEVELOPMENT || DEBUG)
 SYSCTL_QUAD(_net_classq_fq_codel, OID_AUTO, fq_empty_purge_delay, CTLFLAG_RW |
     CTLFLAG_LOCKED, &fq_empty_purge_delay, "Empty flow queue purge delay (ns)");
+SYSCTL_UINT(_net_classq_fq_codel, OID_AUTO, fq_pacing_wheel, CTLFLAG_RW |
+    CTLFLAG_LOCKED, &fq_pacing_wheel, 0,
+    "Park paced flow queues in a timing wheel");
 #endif /* !DEVELOPMENT && !DEBUG */
 
 unsigned int ifclassq_enable_pacing = 1;
@@ -101,6 +105,7 @@ static void fq_if_grp_stat_sc(fq_if_t *fqs, fq_if_group_t *grp,
 static void fq_if_purge_grp(fq_if_t *fqs, fq_if_group_t *grp);
 static inline boolean_t fq_if_is_grp_combined(fq_if_t *fqs, uint8_t grp_idx);
 static void fq_if_destroy_grps(fq_if_t *fqs);
+static void fq_if_pacing_wheel_init(struct fq_pacing_wheel *pw);
 
 uint32_t fq_codel_drr_max_values[FQ_IF_MAX_CLASSES] = {
 	[FQ_IF_CTL_INDEX]       = 8,
@@ -189,7 +194,8 @@ pktsched_fq_init(void)
 
 #define FQ_IF_CLASSQ_IDLE(_fcl_) \
 	(STAILQ_EMPTY(&(_fcl_)->fcl_new_flows) && \
-	STAILQ_EMPTY(&(_fcl_)->fcl_old_flows))
+	STAILQ_EMPTY(&(_fcl_)->fcl_old_flows) && \
+	(_fcl_)->fcl_paced_flows_cnt == 0)
 
 typedef void (* fq_if_append_pkt_t)(classq_pkt_t *, classq_pkt_t *);
 typedef boolean_t (* fq_getq_flow_t)(fq_if_t *, fq_if_classq_t *, fq_t *,
@@ -361,6 +367,7 @@ fq_if_alloc(struct ifclassq *ifq, classq_pkt_type_t ptype)
 	STAILQ_INIT(&fqs->fqs_fclist);
 	TAILQ_INIT(&fqs->fqs_empty_list);
 	TAILQ_INIT(&fqs->fqs_combined_grp_list);
+	fq_if_pacing_wheel_init(&fqs->fqs_pacing_wheel);
 	fqs->fqs_pacemaker_tcall = thread_call_allocate_with_options(fq_if_pacemaker_tcall,
 	    (thread_call_param_t)(ifq->ifcq_ifp), THREAD_CALL_PRIORITY_KERNEL,
 	    THREAD_CALL_OPTIONS_ONCE);
@@ -489,6 +496,7 @@ fq_if_classq_init(fq_if_group_t *fqg, uint32_t pri, uint32_t quantum,
 	fq_cl->fcl_flags = 0;
 	STAILQ_INIT(&fq_cl->fcl_new_flows);
 	STAILQ_INIT(&fq_cl->fcl_old_flows);
+	fq_cl->fcl_paced_flows_cnt = 0;
 }
 
 int
@@ -812,6 +820,321 @@ fq_if_grps_sc_bitmap_move(fq_grp_tailq_t *grp_list, int pri, fq_if_state dst_sta
 	}
 }
 
+static void
+fq_if_pacing_wheel_init(struct fq_pacing_wheel *pw)
+{
+	for (int l = 0; l < FQ_PW_LEVELS; l++) {
+		for (int i = 0; i < FQ_PW_SLOTS; i++) {
+			STAILQ_INIT(&pw->fpw_slots[l][i]);
+		}
+		pw->fpw_bitmap[l] = 0;
+	}
+	STAILQ_INIT(&pw->fpw_overflow);
+	pw->fpw_tick = 0;
+	pw->fpw_last_now = 0;
+	pw->fpw_cnt = 0;
+}
+
+static inline flowq_stailq_t *
+fq_if_pacing_wheel_slot(struct fq_pacing_wheel *pw, uint8_t level,
+    uint8_t slot)
+{
+	if (level == FQ_PW_LEVELS) {
+		return &pw->fpw_overflow;
+	}
+	return &pw->fpw_slots[level][slot];
+}
+
+/*
+ * Put a flow queue in the slot covering tx_time.  A slot at level l is
+ * only used if tx_time falls within the wheel's current level l + 1
+ * period, which guarantees the slot is cascaded before it is due.
+ */
+static void
+fq_if_pacing_wheel_insert(struct fq_pacing_wheel *pw, fq_t *fq,
+    uint64_t tx_time)
+{
+	uint64_t tick = tx_time >> FQ_PW_TICK_SHIFT;
+	uint8_t level, slot = 0;
+
+	if (tx_time == FQ_INVALID_TX_TS || tick < pw->fpw_tick) {
+		tick = pw->fpw_tick;
+	}
+	for (level = 0; level < FQ_PW_LEVELS; level++) {
+		uint32_t shift = FQ_PW_SLOTS_SHIFT * (level + 1);
+		if ((tick >> shift) == (pw->fpw_tick >> shift)) {
+			break;
+		}
+	}
+	if (level < FQ_PW_LEVELS) {
+		slot = (tick >> (FQ_PW_SLOTS_SHIFT * level)) & (FQ_PW_SLOTS - 1);
+		pw->fpw_bitmap[level] |= (1U << slot);
+	}
+	fq->fq_pw_level = level;
+	fq->fq_pw_slot = slot;
+	STAILQ_INSERT_TAIL(fq_if_pacing_wheel_slot(pw, level, slot), fq,
+	    fq_actlink);
+}
+
+/*
+ * Take a flow queue, already removed from its wheel slot, back to the
+ * tail of its class's old flows list.
+ */
+static void
+fq_if_unpark_flow(fq_if_t *fqs, fq_t *fq)
+{
+	fq_if_classq_t *fq_cl = &FQ_CLASSQ(fq);
+
+	ASSERT(fq->fq_in_pacing_wheel);
+	ASSERT(fq->fq_flags & FQF_OLD_FLOW);
+	fq->fq_in_pacing_wheel = false;
+	STAILQ_INSERT_TAIL(&fq_cl->fcl_old_flows, fq, fq_actlink);
+	ASSERT(fq_cl->fcl_paced_flows_cnt > 0);
+	fq_cl->fcl_paced_flows_cnt--;
+	ASSERT(fqs->fqs_pacing_wheel.fpw_cnt > 0);
+	fqs->fqs_pacing_wheel.fpw_cnt--;
+}
+
+/*
+ * Move a flow queue whose head packet is not due until tx_time off the
+ * active lists and into the pacing wheel.  A new flow is accounted as an
+ * old flow from here on, as if it had used up its quantum.
+ */
+static void
+fq_if_park_flow(fq_if_t *fqs, fq_if_classq_t *fq_cl, fq_t *fq,
+    uint64_t tx_time)
+{
+	ASSERT(!fq->fq_in_pacing_wheel);
+	if (fq->fq_flags & FQF_NEW_FLOW) {
+		STAILQ_REMOVE(&fq_cl->fcl_new_flows, fq, flowq, fq_actlink);
+		fq->fq_flags &= ~FQF_NEW_FLOW;
+		fq->fq_flags |= FQF_OLD_FLOW;
+		fq_cl->fcl_stat.fcl_newflows_cnt--;
+		fq_cl->fcl_stat.fcl_oldflows_cnt++;
+	} else {
+		ASSERT(fq->fq_flags & FQF_OLD_FLOW);
+		STAILQ_REMOVE(&fq_cl->fcl_old_flows, fq, flowq, fq_actlink);
+	}
+	fq->fq_in_pacing_wheel = true;
+	fq_cl->fcl_paced_flows_cnt++;
+	fqs->fqs_pacing_wheel.fpw_cnt++;
+	fq_if_pacing_wheel_insert(&fqs->fqs_pacing_wheel, fq, tx_time);
+}
+
+static void
+fq_if_pacing_wheel_remove(fq_if_t *fqs, fq_t *fq)
+{
+	struct fq_pacing_wheel *pw = &fqs->fqs_pacing_wheel;
+	flowq_stailq_t *list;
+
+	ASSERT(fq->fq_in_pacing_wheel);
+	list = fq_if_pacing_wheel_slot(pw, fq->fq_pw_level, fq->fq_pw_slot);
+	STAILQ_REMOVE(list, fq, flowq, fq_actlink);
+	if (fq->fq_pw_level < FQ_PW_LEVELS && STAILQ_EMPTY(list)) {
+		pw->fpw_bitmap[fq->fq_pw_level] &= ~(1U << fq->fq_pw_slot);
+	}
+	fq_if_unpark_flow(fqs, fq);
+}
+
+/*
+ * Unpark all flow queues of fq_cl, or of every class if fq_cl is NULL.
+ */
+static void
+fq_if_pacing_wheel_flush(fq_if_t *fqs, fq_if_classq_t *fq_cl)
+{
+	struct fq_pacing_wheel *pw = &fqs->fqs_pacing_wheel;
+	flowq_stailq_t *list, tmp;
+	fq_t *fq;
+
+	if (pw->fpw_cnt == 0) {
+		return;
+	}
+	for (uint8_t l = 0; l <= FQ_PW_LEVELS; l++) {
+		for (uint8_t i = 0; i < FQ_PW_SLOTS; i++) {
+			if (l == FQ_PW_LEVELS && i > 0) {
+				break;
+			}
+			list = fq_if_pacing_wheel_slot(pw, l, i);
+			STAILQ_INIT(&tmp);
+			STAILQ_CONCAT(&tmp, list);
+			while ((fq = STAILQ_FIRST(&tmp)) != NULL) {
+				STAILQ_REMOVE_HEAD(&tmp, fq_actlink);
+				if (fq_cl == NULL || &FQ_CLASSQ(fq) == fq_cl) {
+					fq_if_unpark_flow(fqs, fq);
+				} else {
+					STAILQ_INSERT_TAIL(list, fq, fq_actlink);
+				}
+			}
+			if (l < FQ_PW_LEVELS && STAILQ_EMPTY(list)) {
+				pw->fpw_bitmap[l] &= ~(1U << i);
+			}
+		}
+	}
+}
+
+/*
+ * Re-insert the flow queues of a slot, now that the wheel has entered the
+ * period the slot covers.  They all land on a finer level.
+ */
+static void
+fq_if_pacing_wheel_cascade(struct fq_pacing_wheel *pw, uint8_t level,
+    uint8_t slot)
+{
+	flowq_stailq_t *list, tmp;
+	fq_t *fq;
+
+	if (level < FQ_PW_LEVELS) {
+		if ((pw->fpw_bitmap[level] & (1U << slot)) == 0) {
+			return;
+		}
+		pw->fpw_bitmap[level] &= ~(1U << slot);
+	}
+	list = fq_if_pacing_wheel_slot(pw, level, slot);
+	STAILQ_INIT(&tmp);
+	STAILQ_CONCAT(&tmp, list);
+	while ((fq = STAILQ_FIRST(&tmp)) != NULL) {
+		STAILQ_REMOVE_HEAD(&tmp, fq_actlink);
+		fq_if_pacing_wheel_insert(pw, fq, fq->fq_next_tx_time);
+	}
+}
+
+/*
+ * Expire the level 0 slot of the current tick.  If the wheel has moved
+ * past that tick, every flow queue in it is due; otherwise only those
+ * whose head packet is ready by now are taken back.
+ */
+static void
+fq_if_pacing_wheel_expire(fq_if_t *fqs, uint8_t slot, bool all, uint64_t now)
+{
+	struct fq_pacing_wheel *pw = &fqs->fqs_pacing_wheel;
+	flowq_stailq_t *list, tmp;
+	fq_t *fq;
+
+	list = &pw->fpw_slots[0][slot];
+	STAILQ_INIT(&tmp);
+	STAILQ_CONCAT(&tmp, list);
+	while ((fq = STAILQ_FIRST(&tmp)) != NULL) {
+		STAILQ_REMOVE_HEAD(&tmp, fq_actlink);
+		if (all || fq_tx_time_ready(fqs, fq, now, NULL)) {
+			fq_if_unpark_flow(fqs, fq);
+		} else {
+			STAILQ_INSERT_TAIL(list, fq, fq_actlink);
+		}
+	}
+	if (STAILQ_EMPTY(list)) {
+		pw->fpw_bitmap[0] &= ~(1U << slot);
+	}
+}
+
+/*
+ * The next tick after tick at which the wheel has work to do: the next
+ * occupied level 0 slot, or the start of the period of the next occupied
+ * slot of a coarser level, or else the next top level period for the
+ * overflow list.
+ */
+static uint64_t
+fq_if_pacing_wheel_next_tick(struct fq_pacing_wheel *pw, uint64_t tick)
+{
+	uint32_t shift, cur, bits;
+
+	for (uint8_t l = 0; l < FQ_PW_LEVELS; l++) {
+		shift = FQ_PW_SLOTS_SHIFT * l;
+		cur = (tick >> shift) & (FQ_PW_SLOTS - 1);
+		bits = pw->fpw_bitmap[l] & ~((2U << cur) - 1);
+		if (bits != 0) {
+			return ((tick >> (shift + FQ_PW_SLOTS_SHIFT)) <<
+			       (shift + FQ_PW_SLOTS_SHIFT)) +
+			       ((uint64_t)__builtin_ctz(bits) << shift);
+		}
+	}
+	shift = FQ_PW_SLOTS_SHIFT * FQ_PW_LEVELS;
+	return ((tick >> shift) + 1) << shift;
+}
+
+/*
+ * Bring the pacing wheel up to now, putting every flow queue that has
+ * become due back on its class's old flows list.  Empty slots are skipped,
+ * so the cost is bounded by the number of occupied slots crossed rather
+ * than by the number of ticks or of paced flows.
+ */
+static void
+fq_if_pacing_wheel_advance(fq_if_t *fqs, uint64_t now)
+{
+	struct fq_pacing_wheel *pw = &fqs->fqs_pacing_wheel;
+	uint64_t now_tick = now >> FQ_PW_TICK_SHIFT;
+	uint64_t tick;
+	uint8_t slot;
+
+	if (pw->fpw_cnt == 0) {
+		goto done;
+	}
+	if (now == pw->fpw_last_now) {
+		return;
+	}
+	if (!ifclassq_enable_pacing || !ifclassq_enable_l4s || !fq_pacing_wheel) {
+		fq_if_pacing_wheel_flush(fqs, NULL);
+		goto done;
+	}
+
+	while (pw->fpw_cnt > 0) {
+		tick = pw->fpw_tick;
+		if ((tick & (FQ_PW_SLOTS - 1)) == 0) {
+			if ((tick & ((1ULL << (2 * FQ_PW_SLOTS_SHIFT)) - 1)) == 0) {
+				if ((tick & ((1ULL << (3 * FQ_PW_SLOTS_SHIFT)) - 1)) == 0) {
+					fq_if_pacing_wheel_cascade(pw, FQ_PW_LEVELS, 0);
+				}
+				fq_if_pacing_wheel_cascade(pw, 2,
+				    (tick >> (2 * FQ_PW_SLOTS_SHIFT)) & (FQ_PW_SLOTS - 1));
+			}
+			fq_if_pacing_wheel_cascade(pw, 1,
+			    (tick >> FQ_PW_SLOTS_SHIFT) & (FQ_PW_SLOTS - 1));
+		}
+		slot = tick & (FQ_PW_SLOTS - 1);
+		if (pw->fpw_bitmap[0] & (1U << slot)) {
+			fq_if_pacing_wheel_expire(fqs, slot, tick < now_tick, now);
+		}
+		if (tick >= now_tick) {
+			break;
+		}
+		pw->fpw_tick = MIN(fq_if_pacing_wheel_next_tick(pw, tick),
+		    now_tick);
+	}
+
+done:
+	if (pw->fpw_cnt == 0 || pw->fpw_tick < now_tick) {
+		pw->fpw_tick = now_tick;
+	}
+	pw->fpw_last_now = now;
+}
+
+/*
+ * Earliest tx time of the parked flow queues, found in the first occupied
+ * slot in time order.
+ */
+static uint64_t
+fq_if_pacing_wheel_next(struct fq_pacing_wheel *pw)
+{
+	uint64_t tx_time = FQ_INVALID_TX_TS;
+	flowq_stailq_t *list = NULL;
+	uint32_t bits, cur;
+	fq_t *fq;
+
+	for (uint8_t l = 0; l < FQ_PW_LEVELS && list == NULL; l++) {
+		cur = (pw->fpw_tick >> (FQ_PW_SLOTS_SHIFT * l)) & (FQ_PW_SLOTS - 1);
+		bits = pw->fpw_bitmap[l] & ~((1U << cur) - 1);
+		if (bits != 0) {
+			list = &pw->fpw_slots[l][__builtin_ctz(bits)];
+		}
+	}
+	if (list == NULL) {
+		list = &pw->fpw_overflow;
+	}
+	STAILQ_FOREACH(fq, list, fq_actlink) {
+		tx_time = MIN(tx_time, fq->fq_next_tx_time);
+	}
+	return tx_time;
+}
+
 /*
  * Pacemaker is only scheduled when no packet can be dequeued from AQM
  * due to pacing. Pacemaker will doorbell the driver when current >= next_tx_time.
@@ -1194,6 +1517,9 @@ fq_if_purge_flow(fq_if_t *fqs, fq_t *fq, uint32_t *pktsp,
 	fq_cl = &FQ_CLASSQ(fq);
 	grp = FQ_GROUP(fq);
 	pkts = bytes = 0;
+	if (fq->fq_in_pacing_wheel) {
+		fq_if_pacing_wheel_remove(fqs, fq);
+	}
 	_PKTSCHED_PKT_INIT(&pkt);
 	for (;;) {
 		fq_getq_flow(fqs, fq, &pkt, now);
@@ -1245,6 +1571,7 @@ fq_if_purge_classq(fq_if_t *fqs, fq_if_classq_t *fq_cl)
 	uint64_t now;
 
 	now = fq_codel_get_time();
+	fq_if_pacing_wheel_flush(fqs, fq_cl);
 	/*
 	 * Take each flow from new/old flow list and flush mbufs
 	 * in that flow
@@ -1285,6 +1612,7 @@ fq_if_purge(fq_if_t *fqs)
 
 	VERIFY(STAILQ_EMPTY(&fqs->fqs_fclist));
 	VERIFY(TAILQ_EMPTY(&fqs->fqs_empty_list));
+	VERIFY(fqs->fqs_pacing_wheel.fpw_cnt == 0);
 
 	fqs->fqs_large_flow = NULL;
 	for (i = 0; i < FQ_IF_HASH_TABLE_SIZE; i++) {
@@ -1931,6 +2259,10 @@ fq_if_drop_packet(fq_if_t *fqs, uint64_t now)
 	VERIFY(!fq_empty(fq, fqs->fqs_ptype));
 
 	fq_cl = &FQ_CLASSQ(fq);
+	/* the new head may be due earlier than the one it was parked for */
+	if (fq->fq_in_pacing_wheel) {
+		fq_if_pacing_wheel_remove(fqs, fq);
+	}
 	_PKTSCHED_PKT_INIT(&pkt);
 	fq_getq_flow_internal(fqs, fq, &pkt);
 	ASSERT(pkt.pktsched_ptype != QP_INVALID);
@@ -2142,6 +2474,8 @@ fq_if_dequeue(fq_if_t *fqs, fq_if_classq_t *fq_cl, uint32_t pktlimit,
 	pktcnt = bytecnt = 0;
 	STAILQ_INIT(&temp_stailq);
 
+	fq_if_pacing_wheel_advance(fqs, now);
+
 	STAILQ_FOREACH_SAFE(fq, &fq_cl->fcl_new_flows, fq_actlink, tfq) {
 		ASSERT((fq->fq_flags & (FQF_NEW_FLOW | FQF_OLD_FLOW)) ==
 		    FQF_NEW_FLOW);
@@ -2151,6 +2485,9 @@ fq_if_dequeue(fq_if_t *fqs, fq_if_classq_t *fq_cl, uint32_t pktlimit,
 			if (fq_tx_time < fq_cl_tx_time) {
 				fq_cl_tx_time = fq_tx_time;
 			}
+			if (fq_pacing_wheel) {
+				fq_if_park_flow(fqs, fq_cl, fq, fq_tx_time);
+			}
 			continue;
 		}
 		all_paced = false;
@@ -2206,6 +2543,9 @@ fq_if_dequeue(fq_if_t *fqs, fq_if_classq_t *fq_cl, uint32_t pktlimit,
 			if (fq_tx_time < fq_cl_tx_time) {
 				fq_cl_tx_time = fq_tx_time;
 			}
+			if (fq_pacing_wheel) {
+				fq_if_park_flow(fqs, fq_cl, fq, fq_tx_time);
+			}
 			continue;
 		}
 		all_paced = false;
@@ -2252,6 +2592,15 @@ fq_if_dequeue(fq_if_t *fqs, fq_if_classq_t *fq_cl, uint32_t pktlimit,
 	}
 
 done:
+	if (fq_cl->fcl_paced_flows_cnt > 0) {
+		/* the wheel's earliest flow may belong to another class */
+		uint64_t wheel_tx_time =
+		    fq_if_pacing_wheel_next(&fqs->fqs_pacing_wheel);
+		ASSERT(wheel_tx_time > now);
+		if (wheel_tx_time < fq_cl_tx_time) {
+			fq_cl_tx_time = wheel_tx_time;
+		}
+	}
 	if (all_paced) {
 		fq_cl->fcl_flags |= FCL_PACED;
 		fq_cl->fcl_next_tx_time = fq_cl_tx_time;
@@ -2587,3 +2936,146 @@ fq_if_set_grp_separated(struct ifclassq *ifcq, uint8_t grp_idx)
 	pktsched_bit_clr(grp_idx, &fqs->fqs_combined_grp_bitmap);
 	TAILQ_REMOVE(&fqs->fqs_combined_grp_list, grp, fqg_grp_link);
 }
+
+#if DEVELOPMENT || DEBUG
+
+#define FQ_PW_TEST_FLOWS        12
+
+/*
+ * Park flow queues of two classes at tx times spread over every level of
+ * the pacing wheel and its overflow list, then advance the wheel through
+ * them: a flow must come back once its tick has passed and not before,
+ * and the wheel must always report the earliest tx time left.
+ */
+static int
+fq_pacing_wheel_test(__unused int64_t in, int64_t *out)
+{
+	static const uint64_t ticks[FQ_PW_TEST_FLOWS] = {
+		3, 3, 31, 40, 700, 1025, 1500, 20000, 32767, 40000, 100000, 200000,
+	};
+	const uint64_t t0 = 1ULL << 40;
+	fq_if_group_t *grp;
+	fq_if_classq_t *fq_cl;
+	fq_if_t *fqs;
+	fq_t *fqp;
+	uint64_t now, next;
+	int error = 0;
+
+	if (!ifclassq_enable_pacing || !ifclassq_enable_l4s || !fq_pacing_wheel) {
+		return ENOTSUP;
+	}
+
+	fqs = kalloc_type(fq_if_t, Z_WAITOK | Z_ZERO | Z_NOFAIL);
+	grp = kalloc_type(fq_if_group_t, Z_WAITOK | Z_ZERO | Z_NOFAIL);
+	fqp = kalloc_type(fq_t, FQ_PW_TEST_FLOWS, Z_WAITOK | Z_ZERO | Z_NOFAIL);
+	fq_if_pacing_wheel_init(&fqs->fqs_pacing_wheel);
+	fq_if_classq_init(grp, FQ_IF_BE_INDEX, 1500, 4, MBUF_SC_BE);
+	fq_if_classq_init(grp, FQ_IF_VI_INDEX, 1500, 4, MBUF_SC_VI);
+
+	/* start the wheel at t0 */
+	fq_if_pacing_wheel_advance(fqs, t0);
+
+	for (int i = 0; i < FQ_PW_TEST_FLOWS; i++) {
+		fq_t *fq = &fqp[i];
+
+		fq->fq_group = grp;
+		fq->fq_sc_index = (i % 2) ? FQ_IF_VI_INDEX : FQ_IF_BE_INDEX;
+		fq->fq_tfc_type = FQ_TFC_L4S;
+		fq->fq_flags = FQF_NEW_FLOW;
+		/* mid-tick, so the flow is never ready within its own tick */
+		fq->fq_next_tx_time = t0 + (ticks[i] << FQ_PW_TICK_SHIFT) +
+		    (1ULL << (FQ_PW_TICK_SHIFT - 1));
+		fq_cl = &FQ_CLASSQ(fq);
+		STAILQ_INSERT_TAIL(&fq_cl->fcl_new_flows, fq, fq_actlink);
+		fq_cl->fcl_stat.fcl_newflows_cnt++;
+		fq_if_park_flow(fqs, fq_cl, fq, fq->fq_next_tx_time);
+	}
+	if (fqs->fqs_pacing_wheel.fpw_cnt != FQ_PW_TEST_FLOWS ||
+	    !STAILQ_EMPTY(&grp->fqg_classq[FQ_IF_BE_INDEX].fcl_new_flows)) {
+		error = EINVAL;
+		goto out;
+	}
+
+	/* a purge takes a parked flow out right away */
+	fq_if_pacing_wheel_remove(fqs, &fqp[FQ_PW_TEST_FLOWS - 1]);
+	if (fqp[FQ_PW_TEST_FLOWS - 1].fq_in_pacing_wheel) {
+		error = EINVAL;
+		goto out;
+	}
+
+	for (int step = 0; step < FQ_PW_TEST_FLOWS - 1; step++) {
+		/* the earliest tx time still parked */
+		next = FQ_INVALID_TX_TS;
+		for (int i = 0; i < FQ_PW_TEST_FLOWS; i++) {
+			if (fqp[i].fq_in_pacing_wheel) {
+				next = MIN(next, fqp[i].fq_next_tx_time);
+			}
+		}
+		if (next == FQ_INVALID_TX_TS) {
+			break;
+		}
+		if (fq_if_pacing_wheel_next(&fqs->fqs_pacing_wheel) != next) {
+			error = EDOM;
+			goto out;
+		}
+
+		/* just before its tick nothing moves, just after it is back */
+		now = ((next >> FQ_PW_TICK_SHIFT) << FQ_PW_TICK_SHIFT) - 1;
+		fq_if_pacing_wheel_advance(fqs, now);
+		for (int i = 0; i < FQ_PW_TEST_FLOWS - 1; i++) {
+			if (fqp[i].fq_in_pacing_wheel !=
+			    (fqp[i].fq_next_tx_time >= next)) {
+				error = ERANGE;
+				goto out;
+			}
+		}
+		now = next + (1ULL << FQ_PW_TICK_SHIFT);
+		fq_if_pacing_wheel_advance(fqs, now);
+		for (int i = 0; i < FQ_PW_TEST_FLOWS - 1; i++) {
+			uint64_t tick = fqp[i].fq_next_tx_time >> FQ_PW_TICK_SHIFT;
+
+			if (fqp[i].fq_in_pacing_wheel !=
+			    (tick > (now >> FQ_PW_TICK_SHIFT))) {
+				error = ERANGE;
+				goto out;
+			}
+		}
+	}
+	if (fqs->fqs_pacing_wheel.fpw_cnt != 0 ||
+	    grp->fqg_classq[FQ_IF_BE_INDEX].fcl_paced_flows_cnt != 0 ||
+	    grp->fqg_classq[FQ_IF_VI_INDEX].fcl_paced_flows_cnt != 0) {
+		error = EINVAL;
+		goto out;
+	}
+
+	/* flushing one class leaves the other's flows parked */
+	for (int i = 0; i < FQ_PW_TEST_FLOWS; i++) {
+		fq_t *fq = &fqp[i];
+
+		fq_cl = &FQ_CLASSQ(fq);
+		fq->fq_next_tx_time = now + (ticks[i] << FQ_PW_TICK_SHIFT);
+		fq_if_park_flow(fqs, fq_cl, fq, fq->fq_next_tx_time);
+	}
+	fq_if_pacing_wheel_flush(fqs, &grp->fqg_classq[FQ_IF_BE_INDEX]);
+	for (int i = 0; i < FQ_PW_TEST_FLOWS; i++) {
+		if (fqp[i].fq_in_pacing_wheel != (fqp[i].fq_sc_index == FQ_IF_VI_INDEX)) {
+			error = EINVAL;
+			goto out;
+		}
+	}
+	fq_if_pacing_wheel_flush(fqs, NULL);
+	if (fqs->fqs_pacing_wheel.fpw_cnt != 0) {
+		error = EINVAL;
+		goto out;
+	}
+
+	*out = 1;
+out:
+	kfree_type(fq_t, FQ_PW_TEST_FLOWS, fqp);
+	kfree_type(fq_if_group_t, grp);
+	kfree_type(fq_if_t, fqs);
+	return error;
+}
+SYSCTL_TEST_REGISTER(fq_pacing_wheel, fq_pacing_wheel_test);
+
+#endif /* DEVELOPMENT || DEBUG */
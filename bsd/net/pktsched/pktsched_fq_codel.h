@@ -148,6 +148,7 @@ typedef struct fq_if_classq {
 	uint64_t fcl_next_tx_time;      /* next time a packet is ready */
 	flowq_stailq_t fcl_new_flows;   /* List of new flows */
 	flowq_stailq_t fcl_old_flows;   /* List of old flows */
+	uint32_t fcl_paced_flows_cnt;   /* old flows parked in pacing wheel */
 	struct fcl_stat fcl_stat;
 #define FCL_PACED               0x1
 	uint8_t fcl_flags;
@@ -203,6 +204,31 @@ typedef struct fq_if_bitmap_ops {
 	fq_if_bitmaps_move      move;
 } bitmap_ops_t;
 
+/*
+ * Hierarchical timing wheel of flow queues whose head packet has a tx time
+ * in the future.  Rather than being skipped over by every dequeue until
+ * the packet is due, such a flow is parked in the slot covering its tx
+ * time and put back on its class's old flows list once that slot expires.
+ *
+ * Level 0 slots are 2^FQ_PW_TICK_SHIFT ns (~131us) wide and each level is
+ * FQ_PW_SLOTS times coarser than the one below, so three levels cover
+ * ~4.3 seconds; anything further out waits on the overflow list.  Slots
+ * of a coarser level are cascaded down when the wheel enters them.
+ */
+#define FQ_PW_LEVELS            3
+#define FQ_PW_SLOTS_SHIFT       5
+#define FQ_PW_SLOTS             (1 << FQ_PW_SLOTS_SHIFT)
+#define FQ_PW_TICK_SHIFT        17
+
+struct fq_pacing_wheel {
+	uint64_t                fpw_tick;       /* current level 0 tick */
+	uint64_t                fpw_last_now;   /* time of the last advance */
+	uint32_t                fpw_cnt;        /* flow queues parked */
+	uint32_t                fpw_bitmap[FQ_PW_LEVELS]; /* non-empty slots */
+	flowq_stailq_t          fpw_slots[FQ_PW_LEVELS][FQ_PW_SLOTS];
+	flowq_stailq_t          fpw_overflow;   /* beyond the top level */
+};
+
 typedef struct fq_codel_sched_data {
 	struct ifclassq         *fqs_ifq;       /* back pointer to ifclassq */
 	flowq_list_t            fqs_flows[FQ_IF_HASH_TABLE_SIZE]; /* flows table */
@@ -220,6 +246,7 @@ typedef struct fq_codel_sched_data {
 	pktsched_bitmap_t       fqs_combined_grp_bitmap;
 	classq_pkt_type_t       fqs_ptype;
 	thread_call_t           fqs_pacemaker_tcall;
+	struct fq_pacing_wheel  fqs_pacing_wheel;
 	bitmap_ops_t            *fqs_bm_ops;
 #define grp_bitmaps_ffs     fqs_bm_ops->ffs
 #define grp_bitmaps_zeros   fqs_bm_ops->zeros
@@ -106,6 +106,23 @@ struct _mbuf {
 extern uint32_t os_cpu_in_cksum(const void *, uint32_t, uint32_t);
 extern uint32_t os_cpu_in_cksum_mbuf(struct _mbuf *, int, int, uint32_t);
 
+#if defined(__x86_64__)
+/* vector kernels for the bulk of a segment, in cpu_in_cksum.s */
+#ifdef KERNEL
+/* legacy SSE only, VEX code would clobber the upper zmm state */
+extern uint64_t os_cpu_in_cksum_sse2(const void *, uint32_t);
+#define CKSUM_VEC_USABLE()      1
+#define CKSUM_VEC(d, l)         os_cpu_in_cksum_sse2(d, l)
+#else /* !KERNEL */
+#include <machine/cpu_capabilities.h>
+
+extern uint64_t os_cpu_in_cksum_avx2(const void *, uint32_t);
+#define CKSUM_VEC_USABLE()      (_get_cpu_capabilities() & kHasAVX2_0)
+#define CKSUM_VEC(d, l)         os_cpu_in_cksum_avx2(d, l)
+#endif /* !KERNEL */
+#define CKSUM_VEC_MIN           256
+#endif /* __x86_64__ */
+
 uint32_t
 os_cpu_in_cksum(const void *data, uint32_t len, uint32_t initial_sum)
 {
@@ -438,6 +455,18 @@ post_initial_offset:
 			data += 2;
 			mlen -= 2;
 		}
+#if defined(__x86_64__)
+		if (mlen >= CKSUM_VEC_MIN && CKSUM_VEC_USABLE()) {
+			int blen = mlen & ~63;
+			uint64_t vsum = CKSUM_VEC(data, blen);
+
+			/* fold both halves in; 2^32 is 1 modulo 0xffff */
+			partial = (partial >> 32) + (partial & 0xffffffff) +
+			    (vsum >> 32) + (vsum & 0xffffffff);
+			data += blen;
+			mlen -= blen;
+		}
+#endif /* __x86_64__ */
 		while (mlen >= 64) {
 			__builtin_prefetch(data + 32);
 			__builtin_prefetch(data + 64);
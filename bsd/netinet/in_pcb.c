@@ -86,6 +86,7 @@
 
 #include <machine/limits.h>
 
+#include <kern/smr.h>
 #include <kern/zalloc.h>
 
 #include <net/if.h>
@@ -141,6 +142,13 @@ static LCK_ATTR_DECLARE(inpcb_lock_attr, 0, 0);
 static LCK_MTX_DECLARE_ATTR(inpcb_lock, &inpcb_lock_grp, &inpcb_lock_attr);
 static LCK_MTX_DECLARE_ATTR(inpcb_timeout_lock, &inpcb_lock_grp, &inpcb_lock_attr);
 
+/*
+ * Exact match lookups on ipi_hashbase walk the chain under inpcb_smr
+ * instead of taking ipi_lock; see in_pcblookup_hash_smr().
+ */
+SMR_DEFINE(inpcb_smr, "inpcb");
+TUNABLE(bool, inpcb_smr_lookup, "inp_smr_lookup", true);
+
 static TAILQ_HEAD(, inpcbinfo) inpcb_head = TAILQ_HEAD_INITIALIZER(inpcb_head);
 
 static u_int16_t inpcb_timeout_run = 0; /* INPCB timer is scheduled to run */
@@ -2074,11 +2082,24 @@ in_pcbdetach(struct inpcb *inp)
 }
 
 
+static void
+in_pcbdispose_free(smr_node_t node)
+{
+	struct inpcb *inp = __container_of(node, struct inpcb, inp_smr_node);
+	struct socket *so = inp->inp_smr_so;
+
+	if ((so->so_flags1 & SOF1_CACHED_IN_SOCK_LAYER) == 0) {
+		zfree(inp->inp_pcbinfo->ipi_zone, inp);
+	}
+	sodealloc(so);
+}
+
 void
 in_pcbdispose(struct inpcb *inp)
 {
 	struct socket *so = inp->inp_socket;
 	struct inpcbinfo *ipi = inp->inp_pcbinfo;
+	bool hashed = (inp->inp_flags2 & INP2_INHASHLIST) != 0;
 
 	if (so != NULL && so->so_usecount != 0) {
 		panic("%s: so %p [%d,%d] usecount %d lockhistory %s",
@@ -2145,10 +2166,21 @@ in_pcbdispose(struct inpcb *inp)
 		 * we deallocate the structure.
 		 */
 		ROUTE_RELEASE(&inp->inp_route);
-		if ((so->so_flags1 & SOF1_CACHED_IN_SOCK_LAYER) == 0) {
-			zfree(ipi->ipi_zone, inp);
+		if (hashed) {
+			/*
+			 * Lockless hash lookups may still hold a pointer to
+			 * this pcb, free it once they are done.  Neither the
+			 * pcb nor its socket can be found by anyone else.
+			 */
+			inp->inp_smr_so = so;
+			smr_call(&inpcb_smr, &inp->inp_smr_node,
+			    sizeof(*inp) + sizeof(*so), in_pcbdispose_free);
+		} else {
+			if ((so->so_flags1 & SOF1_CACHED_IN_SOCK_LAYER) == 0) {
+				zfree(ipi->ipi_zone, inp);
+			}
+			sodealloc(so);
 		}
-		sodealloc(so);
 	}
 }
 
@@ -2349,14 +2381,14 @@ in_pcblookup_local(struct inpcbinfo *pcbinfo, struct in_addr laddr,
 	KERNEL_DEBUG(DBG_FNC_PCB_LOOKUP | DBG_FUNC_START, 0, 0, 0, 0, 0);
 
 	if (!wild_okay) {
-		struct inpcbhead *head;
+		struct smrq_list_head *head;
 		/*
 		 * Look for an unconnected (wildcard foreign addr) PCB that
 		 * matches the local address and port we're looking for.
 		 */
 		head = &pcbinfo->ipi_hashbase[INP_PCBHASH(INADDR_ANY, lport, 0,
 		    pcbinfo->ipi_hashmask)];
-		LIST_FOREACH(inp, head, inp_hash) {
+		smrq_serialized_foreach(inp, head, inp_hash) {
 			if (!(inp->inp_vflag & INP_IPV4)) {
 				continue;
 			}
@@ -2439,7 +2471,7 @@ in_pcblookup_hash_exists(struct inpcbinfo *pcbinfo, struct in_addr faddr,
     u_int fport_arg, struct in_addr laddr, u_int lport_arg, int wildcard,
     uid_t *uid, gid_t *gid, struct ifnet *ifp)
 {
-	struct inpcbhead *head;
+	struct smrq_list_head *head;
 	struct inpcb *inp;
 	u_short fport = (u_short)fport_arg, lport = (u_short)lport_arg;
 	int found = 0;
@@ -2460,7 +2492,7 @@ in_pcblookup_hash_exists(struct inpcbinfo *pcbinfo, struct in_addr faddr,
 	 */
 	head = &pcbinfo->ipi_hashbase[INP_PCBHASH(faddr.s_addr, lport, fport,
 	    pcbinfo->ipi_hashmask)];
-	LIST_FOREACH(inp, head, inp_hash) {
+	smrq_serialized_foreach(inp, head, inp_hash) {
 		if (!(inp->inp_vflag & INP_IPV4)) {
 			continue;
 		}
@@ -2502,7 +2534,7 @@ in_pcblookup_hash_exists(struct inpcbinfo *pcbinfo, struct in_addr faddr,
 
 	head = &pcbinfo->ipi_hashbase[INP_PCBHASH(INADDR_ANY, lport, 0,
 	    pcbinfo->ipi_hashmask)];
-	LIST_FOREACH(inp, head, inp_hash) {
+	smrq_serialized_foreach(inp, head, inp_hash) {
 		if (!(inp->inp_vflag & INP_IPV4)) {
 			continue;
 		}
@@ -2561,6 +2593,91 @@ in_pcblookup_hash_exists(struct inpcbinfo *pcbinfo, struct in_addr faddr,
 	return found;
 }
 
+/*
+ * Enter an inpcb_smr read section for a walk of pcbinfo's hash chains,
+ * and return the rehash sequence to validate the walk against.
+ */
+uint32_t
+in_pcbhash_smr_enter(struct inpcbinfo *pcbinfo)
+{
+	smr_enter(&inpcb_smr);
+	return os_atomic_load(&pcbinfo->ipi_hash_seq, acquire);
+}
+
+/*
+ * Returns true if no pcb moved between hash chains since the sequence
+ * was sampled, i.e. a miss observed during the walk is genuine.
+ * Must be called before leaving the read section.
+ */
+bool
+in_pcbhash_smr_valid(struct inpcbinfo *pcbinfo, uint32_t seq)
+{
+	os_atomic_thread_fence(acquire);
+	return (seq & 1) == 0 &&
+	       os_atomic_load(&pcbinfo->ipi_hash_seq, relaxed) == seq;
+}
+
+/*
+ * Exact match lookup without ipi_lock.  Returns true if the answer
+ * in *inpp is final; false if the caller must repeat the lookup under
+ * the lock (wildcard miss, concurrent rehash, or a match that needs a
+ * NECP check, which may block).
+ */
+static bool
+in_pcblookup_hash_smr(struct inpcbinfo *pcbinfo, struct in_addr faddr,
+    u_short fport, struct in_addr laddr, u_short lport, int wildcard,
+    struct ifnet *ifp, struct inpcb **inpp)
+{
+	struct smrq_list_head *head;
+	struct inpcb *inp, *match = NULL;
+	bool done;
+	uint32_t seq;
+
+	head = &pcbinfo->ipi_hashbase[INP_PCBHASH(faddr.s_addr, lport, fport,
+	    pcbinfo->ipi_hashmask)];
+
+	seq = in_pcbhash_smr_enter(pcbinfo);
+	smrq_entered_foreach(inp, head, inp_hash) {
+		if (!(inp->inp_vflag & INP_IPV4)) {
+			continue;
+		}
+		if (inp->inp_faddr.s_addr != faddr.s_addr ||
+		    inp->inp_laddr.s_addr != laddr.s_addr ||
+		    inp->inp_fport != fport ||
+		    inp->inp_lport != lport) {
+			continue;
+		}
+		if (inp_restricted_recv(inp, ifp)) {
+			continue;
+		}
+#if NECP
+		if ((inp->inp_flags2 & INP2_EXTERNAL_PORT) &&
+		    inp->inp_faddr.s_addr == INADDR_ANY) {
+			smr_leave(&inpcb_smr);
+			return false;
+		}
+#endif /* NECP */
+		match = inp;
+		break;
+	}
+
+	if (!in_pcbhash_smr_valid(pcbinfo, seq)) {
+		done = false;
+	} else if (match == NULL) {
+		done = !wildcard;
+	} else {
+		if (in_pcb_checkstate(match, WNT_ACQUIRE, 0) == WNT_STOPUSING) {
+			/* it's there but dead, say it isn't found */
+			match = NULL;
+		}
+		done = true;
+	}
+	smr_leave(&inpcb_smr);
+
+	*inpp = match;
+	return done;
+}
+
 /*
  * Lookup PCB in hash list.
  */
@@ -2569,15 +2686,17 @@ in_pcblookup_hash(struct inpcbinfo *pcbinfo, struct in_addr faddr,
     u_int fport_arg, struct in_addr laddr, u_int lport_arg, int wildcard,
     struct ifnet *ifp)
 {
-	struct inpcbhead *head;
+	struct smrq_list_head *head;
 	struct inpcb *inp;
 	u_short fport = (u_short)fport_arg, lport = (u_short)lport_arg;
 	struct inpcb *local_wild = NULL;
 	struct inpcb *local_wild_mapped = NULL;
 
-	/*
-	 * We may have found the pcb in the last lookup - check this first.
-	 */
+	if (inpcb_smr_lookup &&
+	    in_pcblookup_hash_smr(pcbinfo, faddr, fport, laddr, lport,
+	    wildcard, ifp, &inp)) {
+		return inp;
+	}
 
 	lck_rw_lock_shared(&pcbinfo->ipi_lock);
 
@@ -2586,7 +2705,7 @@ in_pcblookup_hash(struct inpcbinfo *pcbinfo, struct in_addr faddr,
 	 */
 	head = &pcbinfo->ipi_hashbase[INP_PCBHASH(faddr.s_addr, lport, fport,
 	    pcbinfo->ipi_hashmask)];
-	LIST_FOREACH(inp, head, inp_hash) {
+	smrq_serialized_foreach(inp, head, inp_hash) {
 		if (!(inp->inp_vflag & INP_IPV4)) {
 			continue;
 		}
@@ -2629,7 +2748,7 @@ in_pcblookup_hash(struct inpcbinfo *pcbinfo, struct in_addr faddr,
 
 	head = &pcbinfo->ipi_hashbase[INP_PCBHASH(INADDR_ANY, lport, 0,
 	    pcbinfo->ipi_hashmask)];
-	LIST_FOREACH(inp, head, inp_hash) {
+	smrq_serialized_foreach(inp, head, inp_hash) {
 		if (!(inp->inp_vflag & INP_IPV4)) {
 			continue;
 		}
@@ -2702,7 +2821,7 @@ in_pcblookup_hash(struct inpcbinfo *pcbinfo, struct in_addr faddr,
 int
 in_pcbinshash(struct inpcb *inp, int locked)
 {
-	struct inpcbhead *pcbhash;
+	struct smrq_list_head *pcbhash;
 	struct inpcbporthead *pcbporthash;
 	struct inpcbinfo *pcbinfo = inp->inp_pcbinfo;
 	struct inpcbport *phd;
@@ -2796,7 +2915,7 @@ in_pcbinshash(struct inpcb *inp, int locked)
 
 	inp->inp_phd = phd;
 	LIST_INSERT_HEAD(&phd->phd_pcblist, inp, inp_portlist);
-	LIST_INSERT_HEAD(pcbhash, inp, inp_hash);
+	smrq_serialized_insert_head(pcbhash, &inp->inp_hash);
 	inp->inp_flags2 |= INP2_INHASHLIST;
 
 	if (!locked) {
@@ -2820,7 +2939,8 @@ in_pcbinshash(struct inpcb *inp, int locked)
 void
 in_pcbrehash(struct inpcb *inp)
 {
-	struct inpcbhead *head;
+	struct inpcbinfo *pcbinfo;
+	struct smrq_list_head *head;
 	u_int32_t hashkey_faddr;
 
 #if SKYWALK
@@ -2866,19 +2986,30 @@ in_pcbrehash(struct inpcb *inp)
 		hashkey_faddr = inp->inp_faddr.s_addr;
 	}
 
-	inp->inp_hash_element = INP_PCBHASH(hashkey_faddr, inp->inp_lport,
-	    inp->inp_fport, inp->inp_pcbinfo->ipi_hashmask);
-	head = &inp->inp_pcbinfo->ipi_hashbase[inp->inp_hash_element];
+	/*
+	 * Lockless readers may be walking the old chain through this pcb;
+	 * make the sequence odd while it moves so they know to retry.
+	 */
+	pcbinfo = inp->inp_pcbinfo;
+	os_atomic_inc(&pcbinfo->ipi_hash_seq, relaxed);
+	os_atomic_thread_fence(release);
 
 	if (inp->inp_flags2 & INP2_INHASHLIST) {
-		LIST_REMOVE(inp, inp_hash);
+		smrq_serialized_remove(&pcbinfo->ipi_hashbase[inp->inp_hash_element],
+		    &inp->inp_hash);
 		inp->inp_flags2 &= ~INP2_INHASHLIST;
 	}
 
+	inp->inp_hash_element = INP_PCBHASH(hashkey_faddr, inp->inp_lport,
+	    inp->inp_fport, pcbinfo->ipi_hashmask);
+	head = &pcbinfo->ipi_hashbase[inp->inp_hash_element];
+
 	VERIFY(!(inp->inp_flags2 & INP2_INHASHLIST));
-	LIST_INSERT_HEAD(head, inp, inp_hash);
+	smrq_serialized_insert_head(head, &inp->inp_hash);
 	inp->inp_flags2 |= INP2_INHASHLIST;
 
+	os_atomic_inc(&pcbinfo->ipi_hash_seq, release);
+
 #if NECP
 	// This call catches updates to the remote addresses
 	inp_update_necp_policy(inp, NULL, NULL, 0);
@@ -2904,9 +3035,19 @@ in_pcbremlists(struct inpcb *inp)
 
 		VERIFY(phd != NULL && inp->inp_lport > 0);
 
-		LIST_REMOVE(inp, inp_hash);
-		inp->inp_hash.le_next = NULL;
-		inp->inp_hash.le_prev = NULL;
+		/*
+		 * Leave inp_hash's next pointer intact: a lockless reader
+		 * may still be standing on this pcb, and goes on down the
+		 * rest of the chain from it.  Unlike in_pcbrehash(), this
+		 * doesn't need to bump ipi_hash_seq: the pcb never goes on
+		 * another chain, as it is only removed to be disposed of,
+		 * and in_pcbdispose() defers freeing it past an inpcb_smr
+		 * grace period so it can't be reused meanwhile.  A reader
+		 * that still finds it sees it as WNT_STOPUSING.
+		 */
+		smrq_serialized_remove(
+			&inp->inp_pcbinfo->ipi_hashbase[inp->inp_hash_element],
+			&inp->inp_hash);
 
 		LIST_REMOVE(inp, inp_portlist);
 		inp->inp_portlist.le_next = NULL;
@@ -79,6 +79,7 @@
 #include <sys/bitstring.h>
 #include <sys/tree.h>
 #include <kern/locks.h>
+#include <kern/smr_types.h>
 #include <kern/zalloc.h>
 #include <netinet/in_stat.h>
 #endif /* BSD_KERNEL_PRIVATE */
@@ -154,7 +155,9 @@ struct inp_necp_attributes {
  */
 struct inpcb {
 	decl_lck_mtx_data(, inpcb_mtx); /* inpcb per-socket mutex */
-	LIST_ENTRY(inpcb) inp_hash;     /* hash list */
+	struct smrq_link inp_hash;      /* hash list (inpcb_smr) */
+	struct smr_node inp_smr_node;   /* deferred free, see in_pcbdispose() */
+	struct socket *inp_smr_so;      /* socket freed along with the pcb */
 	LIST_ENTRY(inpcb) inp_list;     /* list for all PCBs of this proto */
 	void    *inp_ppcb;              /* pointer to per-protocol pcb */
 	struct inpcbinfo *inp_pcbinfo;  /* PCB list info */
@@ -615,10 +618,12 @@ struct inpcbinfo {
 
 	/*
 	 * Per-protocol hash of pcbs, hashed by local and foreign
-	 * addresses and port numbers.
+	 * addresses and port numbers.  Readers may walk a chain under
+	 * inpcb_smr; ipi_hash_seq is odd while a pcb moves between chains.
 	 */
-	struct inpcbhead        *ipi_hashbase;
+	struct smrq_list_head   *ipi_hashbase;
 	u_long                  ipi_hashmask;
+	uint32_t                ipi_hash_seq;
 
 	/*
 	 * Per-protocol hash of pcbs, hashed by only local port number.
@@ -791,6 +796,9 @@ extern int allow_udp_port_exhaustion;
 /* release acquired mode, can be garbage collected when wantcnt is null */
 #define WNT_RELEASE             0x2
 
+extern struct smr inpcb_smr;
+extern bool inpcb_smr_lookup;
+
 extern void in_pcbinit(void);
 extern void in_pcbinfo_attach(struct inpcbinfo *);
 extern int in_pcbinfo_detach(struct inpcbinfo *);
@@ -827,6 +835,8 @@ extern int in_pcblookup_hash_exists(struct inpcbinfo *, struct in_addr,
 extern void in_pcbnotifyall(struct inpcbinfo *, struct in_addr, int,
     void (*)(struct inpcb *, int));
 extern void in_pcbrehash(struct inpcb *);
+extern uint32_t in_pcbhash_smr_enter(struct inpcbinfo *);
+extern bool in_pcbhash_smr_valid(struct inpcbinfo *, uint32_t);
 extern int in_getpeeraddr(struct socket *, struct sockaddr **);
 extern int in_getsockaddr(struct socket *, struct sockaddr **);
 extern int in_getsockaddr_s(struct socket *, struct sockaddr_in *);
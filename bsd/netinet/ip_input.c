@@ -99,6 +99,7 @@
 #include <net/if_dl.h>
 #include <net/route.h>
 #include <net/kpi_protocol.h>
+#include <net/flowhash.h>
 #include <net/ntstat.h>
 #include <net/dlil.h>
 #include <net/classq/classq.h>
@@ -145,7 +146,7 @@ extern int ipsec_bypass;
 
 MBUFQ_HEAD(fq_head);
 
-static int frag_timeout_run;            /* frag timer is scheduled to run */
+static u_int32_t frag_timeout_run;      /* frag timer is scheduled to run */
 static void frag_timeout(void *);
 static void frag_sched_timeout(void);
 
@@ -159,17 +160,48 @@ static LCK_GRP_DECLARE(ipqlock_grp, "ipqlock");
 static LCK_MTX_DECLARE(ipqlock, &ipqlock_grp);
 
 
-/* Packet reassembly stuff */
+/*
+ * Packet reassembly stuff
+ *
+ * The reassembly queues are split into shards, each with its own lock
+ * and hash buckets.  A datagram is assigned to a shard by a keyed hash
+ * of its (src, dst, id, proto), so all of its fragments meet in the
+ * same shard no matter which CPU receives them, while fragments of
+ * unrelated datagrams reassemble in parallel.  Each shard also charges
+ * the mbuf memory held by its fragments against an equal share of
+ * ipq_maxbytes.  ipqlock only serializes updates of the parameters.
+ */
+#define IPREASS_NSHARDS_LOG2    4
+#define IPREASS_NSHARDS         (1 << IPREASS_NSHARDS_LOG2)
 #define IPREASS_NHASH_LOG2      6
 #define IPREASS_NHASH           (1 << IPREASS_NHASH_LOG2)
 #define IPREASS_HMASK           (IPREASS_NHASH - 1)
-#define IPREASS_HASH(x, y) \
-	(((((x) & 0xF) | ((((x) >> 8) & 0xF) << 4)) ^ (y)) & IPREASS_HMASK)
+#define IPREASS_SHARD(h)        (&ipq_shards[(h) >> (32 - IPREASS_NSHARDS_LOG2)])
+#define IPREASS_BUCKET(h)       ((h) & IPREASS_HMASK)
+
+TAILQ_HEAD(ipqhead, ipq);
+
+struct ipq_shard {
+	decl_lck_mtx_data(, ipqs_lock);
+	struct ipqhead  ipqs_head[IPREASS_NHASH]; /* ip reassembly queues */
+	u_int32_t       ipqs_bytes;     /* mbuf memory held by this shard */
+} __attribute__((aligned(MAX_CPU_CACHE_LINE_SIZE)));
+
+struct ipq_hash_key {
+	struct in_addr  ipqk_src;
+	struct in_addr  ipqk_dst;
+	u_int16_t       ipqk_id;
+	u_int8_t        ipqk_p;
+	u_int8_t        ipqk_pad;
+};
 
-/* IP fragment reassembly queues (protected by ipqlock) */
-static TAILQ_HEAD(ipqhead, ipq) ipq[IPREASS_NHASH]; /* ip reassembly queues */
+/* IP fragment reassembly queues (each protected by its shard lock) */
+static struct ipq_shard ipq_shards[IPREASS_NSHARDS];
+static u_int32_t ipq_hash_seed;         /* seed for the shard hash */
 static int maxnipq;                     /* max packets in reass queues */
 static u_int32_t maxfragsperpacket;     /* max frags/packet in reass queues */
+static u_int32_t ipq_maxbytes;          /* max mbuf memory in reass queues */
+static u_int32_t ipq_shard_maxbytes;    /* per-shard share of the above */
 static u_int32_t nipq;                  /* # of packets in reass queues */
 static u_int32_t ipq_limit;             /* ipq allocation limit */
 static u_int32_t ipq_count;             /* current # of allocated ipq's */
@@ -177,6 +209,7 @@ static u_int32_t ipq_count;             /* current # of allocated ipq's */
 static int sysctl_ipforwarding SYSCTL_HANDLER_ARGS;
 static int sysctl_maxnipq SYSCTL_HANDLER_ARGS;
 static int sysctl_maxfragsperpacket SYSCTL_HANDLER_ARGS;
+static int sysctl_maxfragbytes SYSCTL_HANDLER_ARGS;
 
 #if (DEBUG || DEVELOPMENT)
 static int sysctl_reset_ip_input_stats SYSCTL_HANDLER_ARGS;
@@ -225,6 +258,11 @@ SYSCTL_PROC(_net_inet_ip, OID_AUTO, maxfragsperpacket,
     sysctl_maxfragsperpacket, "I",
     "Maximum number of IPv4 fragments allowed per packet");
 
+SYSCTL_PROC(_net_inet_ip, OID_AUTO, maxfragbytes,
+    CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_LOCKED, &ipq_maxbytes, 0,
+    sysctl_maxfragbytes, "I",
+    "Maximum mbuf memory held by IPv4 fragment reassembly queues");
+
 static uint32_t ip_adj_clear_hwcksum = 0;
 SYSCTL_UINT(_net_inet_ip, OID_AUTO, adj_clear_hwcksum,
     CTLFLAG_RW | CTLFLAG_LOCKED, &ip_adj_clear_hwcksum, 0,
@@ -390,7 +428,7 @@ static void in_ifaddrhashtbl_init(void);
 static void save_rte(u_char *, struct in_addr);
 static int ip_dooptions(struct mbuf *, int, struct sockaddr_in *);
 static void ip_forward(struct mbuf *, int, struct sockaddr_in *);
-static void frag_freef(struct ipqhead *, struct ipq *);
+static void frag_freef(struct ipq_shard *, struct ipqhead *, struct ipq *);
 static struct mbuf *ip_reass(struct mbuf *);
 static void ip_fwd_route_copyout(struct ifnet *, struct route *);
 static void ip_fwd_route_copyin(struct ifnet *, struct route *);
@@ -522,12 +560,20 @@ ip_init(struct protosw *pp, struct domain *dp)
 
 	lck_mtx_lock(&ipqlock);
 	/* Initialize IP reassembly queue. */
-	for (i = 0; i < IPREASS_NHASH; i++) {
-		TAILQ_INIT(&ipq[i]);
+	for (i = 0; i < IPREASS_NSHARDS; i++) {
+		struct ipq_shard *qs = &ipq_shards[i];
+		int j;
+
+		lck_mtx_init(&qs->ipqs_lock, &ipqlock_grp, LCK_ATTR_NULL);
+		for (j = 0; j < IPREASS_NHASH; j++) {
+			TAILQ_INIT(&qs->ipqs_head[j]);
+		}
 	}
+	ipq_hash_seed = RandomULong();
 
 	maxnipq = nmbclusters / 32;
 	maxfragsperpacket = 128; /* enough for 64k in 512 byte fragments */
+	ipq_maxbytes = (nmbclusters / 8) * MCLBYTES;
 	ipq_updateparams();
 	lck_mtx_unlock(&ipqlock);
 
@@ -2107,6 +2153,11 @@ ipq_updateparams(void)
 	if (maxnipq == 0) {
 		ipq_limit = 1;
 	}
+	/*
+	 * Split the memory budget evenly across the shards; zero means
+	 * fragment memory is bounded only by the limits above.
+	 */
+	ipq_shard_maxbytes = ipq_maxbytes / IPREASS_NSHARDS;
 	/*
 	 * Arm the purge timer if not already and if there's work to do
 	 */
@@ -2156,6 +2207,110 @@ done:
 	return error;
 }
 
+static int
+sysctl_maxfragbytes SYSCTL_HANDLER_ARGS
+{
+#pragma unused(arg1, arg2)
+	int error, i;
+
+	lck_mtx_lock(&ipqlock);
+	i = ipq_maxbytes;
+	error = sysctl_handle_int(oidp, &i, 0, req);
+	if (error || req->newptr == USER_ADDR_NULL) {
+		goto done;
+	}
+	/*
+	 * Impose bounds; every shard must be able to hold at least one
+	 * datagram of the maximum size, unless the budget is disabled.
+	 */
+	if (i < 0 || (i != 0 && i < IPREASS_NSHARDS * IP_MAXPACKET) ||
+	    (uint64_t)i > ((uint64_t)nmbclusters * MCLBYTES) / 2) {
+		error = EINVAL;
+		goto done;
+	}
+	ipq_maxbytes = i;
+	ipq_updateparams();
+done:
+	lck_mtx_unlock(&ipqlock);
+	return error;
+}
+
+/*
+ * Select the shard and hash bucket of a fragment's datagram.
+ */
+static inline struct ipq_shard *
+ipq_lookup_shard(const struct ip *ip, struct ipqhead **head)
+{
+	struct ipq_hash_key key __attribute__((aligned(8)));
+	struct ipq_shard *qs;
+	u_int32_t hash;
+
+	bzero(&key, sizeof(key));
+	key.ipqk_src = ip->ip_src;
+	key.ipqk_dst = ip->ip_dst;
+	key.ipqk_id = ip->ip_id;
+	key.ipqk_p = ip->ip_p;
+	hash = net_flowhash(&key, sizeof(key), ipq_hash_seed);
+
+	qs = IPREASS_SHARD(hash);
+	*head = &qs->ipqs_head[IPREASS_BUCKET(hash)];
+	return qs;
+}
+
+/*
+ * Memory charged to a reassembly queue for holding a fragment.
+ */
+static inline u_int32_t
+ipq_mbuf_bytes(struct mbuf *m)
+{
+	u_int32_t bytes = 0;
+
+	for (; m != NULL; m = m->m_next) {
+		bytes += MSIZE;
+		if (m->m_flags & M_EXT) {
+			bytes += m->m_ext.ext_size;
+		}
+	}
+	return bytes;
+}
+
+/*
+ * Bring a shard back within its memory budget by evicting its oldest
+ * datagrams, other than the one currently being reassembled.  Returns
+ * FALSE if the budget still cannot be met.
+ */
+static boolean_t
+ipq_shard_reclaim(struct ipq_shard *qs, struct ipq *keep)
+{
+	struct ipq *fp, *victim;
+	int i, vi;
+
+	LCK_MTX_ASSERT(&qs->ipqs_lock, LCK_MTX_ASSERT_OWNED);
+
+	while (ipq_shard_maxbytes != 0 &&
+	    qs->ipqs_bytes > ipq_shard_maxbytes) {
+		victim = NULL;
+		vi = 0;
+		for (i = 0; i < IPREASS_NHASH; i++) {
+			fp = TAILQ_LAST(&qs->ipqs_head[i], ipqhead);
+			if (fp == keep) {
+				fp = TAILQ_PREV(fp, ipqhead, ipq_list);
+			}
+			if (fp != NULL &&
+			    (victim == NULL || fp->ipq_ttl < victim->ipq_ttl)) {
+				victim = fp;
+				vi = i;
+			}
+		}
+		if (victim == NULL) {
+			return FALSE;
+		}
+		ipstat.ips_fragdropped += victim->ipq_nfrags;
+		frag_freef(qs, &qs->ipqs_head[vi], victim);
+	}
+	return TRUE;
+}
+
 /*
  * Take incoming datagram fragment and try to reassemble it into
  * whole datagram.  If a chain for reassembly of this datagram already
@@ -2169,11 +2324,11 @@ ip_reass(struct mbuf *m)
 	struct ip *ip;
 	struct mbuf *p, *q, *nq, *t;
 	struct ipq *fp = NULL;
+	struct ipq_shard *qs;
 	struct ipqhead *head;
 	int i, hlen, next;
 	u_int8_t ecn, ecn0;
-	uint32_t csum, csum_flags;
-	uint16_t hash;
+	uint32_t csum, csum_flags, bytes;
 	struct fq_head dfq;
 
 	MBUFQ_INIT(&dfq);       /* for deferred frees */
@@ -2183,21 +2338,15 @@ ip_reass(struct mbuf *m)
 		ipstat.ips_fragments++;
 		ipstat.ips_fragdropped++;
 		m_freem(m);
-		if (nipq > 0) {
-			lck_mtx_lock(&ipqlock);
-			frag_sched_timeout();   /* purge stale fragments */
-			lck_mtx_unlock(&ipqlock);
-		}
+		frag_sched_timeout();   /* purge stale fragments */
 		return NULL;
 	}
 
 	ip = mtod(m, struct ip *);
 	hlen = IP_VHL_HL(ip->ip_vhl) << 2;
 
-	lck_mtx_lock(&ipqlock);
-
-	hash = IPREASS_HASH(ip->ip_src.s_addr, ip->ip_id);
-	head = &ipq[hash];
+	qs = ipq_lookup_shard(ip, &head);
+	lck_mtx_lock(&qs->ipqs_lock);
 
 	/*
 	 * Look for queue of fragments
@@ -2221,21 +2370,23 @@ ip_reass(struct mbuf *m)
 	if ((nipq > (unsigned)maxnipq) && (maxnipq > 0)) {
 		/*
 		 * drop something from the tail of the current queue
-		 * before proceeding further
+		 * before proceeding further; stay within this shard
+		 * so that no other shard lock needs to be taken.
 		 */
 		struct ipq *fq = TAILQ_LAST(head, ipqhead);
 		if (fq == NULL) {   /* gak */
 			for (i = 0; i < IPREASS_NHASH; i++) {
-				struct ipq *r = TAILQ_LAST(&ipq[i], ipqhead);
+				struct ipq *r =
+				    TAILQ_LAST(&qs->ipqs_head[i], ipqhead);
 				if (r) {
 					ipstat.ips_fragtimeout += r->ipq_nfrags;
-					frag_freef(&ipq[i], r);
+					frag_freef(qs, &qs->ipqs_head[i], r);
 					break;
 				}
 			}
 		} else {
 			ipstat.ips_fragtimeout += fq->ipq_nfrags;
-			frag_freef(head, fq);
+			frag_freef(qs, head, fq);
 		}
 	}
 
@@ -2343,6 +2494,8 @@ found:
 	m->m_data += hlen;
 	m->m_len -= hlen;
 
+	bytes = ipq_mbuf_bytes(m);
+
 	/*
 	 * If first fragment to arrive, create a reassembly queue.
 	 */
@@ -2352,7 +2505,7 @@ found:
 			goto dropfrag;
 		}
 		TAILQ_INSERT_HEAD(head, fp, ipq_list);
-		nipq++;
+		os_atomic_inc(&nipq, relaxed);
 		fp->ipq_nfrags = 1;
 		fp->ipq_ttl = IPFRAGTTL;
 		fp->ipq_p = ip->ip_p;
@@ -2360,6 +2513,10 @@ found:
 		fp->ipq_src = ip->ip_src;
 		fp->ipq_dst = ip->ip_dst;
 		fp->ipq_frags = m;
+		fp->ipq_tail = m;
+		fp->ipq_len = ip->ip_len;
+		fp->ipq_bytes = bytes;
+		qs->ipqs_bytes += bytes;
 		m->m_nextpkt = NULL;
 		/*
 		 * If the first fragment has valid checksum offload
@@ -2369,6 +2526,10 @@ found:
 			fp->ipq_csum = csum;
 			fp->ipq_csum_flags = csum_flags;
 		}
+		if (!ipq_shard_reclaim(qs, fp)) {
+			ipstat.ips_fragdropped += fp->ipq_nfrags;
+			frag_freef(qs, head, fp);
+		}
 		m = NULL;       /* nothing to return */
 		goto done;
 	} else {
@@ -2397,11 +2558,20 @@ found:
 	}
 
 	/*
-	 * Find a segment which begins after this one does.
+	 * Find a segment which begins after this one does.  Queued
+	 * segments never overlap, so when this one starts at or beyond
+	 * the last one (fragments arriving in order) it goes at the
+	 * tail and there is nothing to walk.
 	 */
-	for (p = NULL, q = fp->ipq_frags; q; p = q, q = q->m_nextpkt) {
-		if (GETIP(q)->ip_off > ip->ip_off) {
-			break;
+	if (GETIP(fp->ipq_tail)->ip_off <= ip->ip_off) {
+		p = fp->ipq_tail;
+		q = NULL;
+	} else {
+		for (p = NULL, q = fp->ipq_frags; q;
+		    p = q, q = q->m_nextpkt) {
+			if (GETIP(q)->ip_off > ip->ip_off) {
+				break;
+			}
 		}
 	}
 
@@ -2431,6 +2601,9 @@ found:
 		m->m_nextpkt = fp->ipq_frags;
 		fp->ipq_frags = m;
 	}
+	fp->ipq_len += ip->ip_len;
+	fp->ipq_bytes += bytes;
+	qs->ipqs_bytes += bytes;
 
 	/*
 	 * While we overlap succeeding segments trim them or,
@@ -2443,6 +2616,7 @@ found:
 			GETIP(q)->ip_len -= i;
 			GETIP(q)->ip_off += i;
 			m_adj(q, i);
+			fp->ipq_len -= i;
 			fp->ipq_csum_flags = 0;
 			break;
 		}
@@ -2450,9 +2624,16 @@ found:
 		m->m_nextpkt = nq;
 		ipstat.ips_fragdropped++;
 		fp->ipq_nfrags--;
+		fp->ipq_len -= GETIP(q)->ip_len;
+		bytes = ipq_mbuf_bytes(q);
+		fp->ipq_bytes -= bytes;
+		qs->ipqs_bytes -= bytes;
 		/* defer freeing until after lock is dropped */
 		MBUFQ_ENQUEUE(&dfq, q);
 	}
+	if (m->m_nextpkt == NULL) {
+		fp->ipq_tail = m;
+	}
 
 	/*
 	 * If this fragment contains similar checksum offload info
@@ -2475,24 +2656,19 @@ found:
 	 * As a result, n+1 frags are actually allowed per packet, but
 	 * only n will ever be stored. (n = maxfragsperpacket.)
 	 *
+	 * Since queued segments never overlap, the datagram is complete
+	 * exactly when the last segment doesn't have the IP_MF flag and
+	 * the segments add up to the end of the last one.
 	 */
-	next = 0;
-	for (p = NULL, q = fp->ipq_frags; q; p = q, q = q->m_nextpkt) {
-		if (GETIP(q)->ip_off != next) {
-			if (fp->ipq_nfrags > maxfragsperpacket) {
-				ipstat.ips_fragdropped += fp->ipq_nfrags;
-				frag_freef(head, fp);
-			}
-			m = NULL;       /* nothing to return */
-			goto done;
-		}
-		next += GETIP(q)->ip_len;
-	}
-	/* Make sure the last packet didn't have the IP_MF flag */
-	if (p->m_flags & M_FRAG) {
+	q = fp->ipq_tail;
+	next = GETIP(q)->ip_off + GETIP(q)->ip_len;
+	if ((q->m_flags & M_FRAG) || fp->ipq_len != (u_int32_t)next) {
 		if (fp->ipq_nfrags > maxfragsperpacket) {
 			ipstat.ips_fragdropped += fp->ipq_nfrags;
-			frag_freef(head, fp);
+			frag_freef(qs, head, fp);
+		} else if (!ipq_shard_reclaim(qs, fp)) {
+			ipstat.ips_fragdropped += fp->ipq_nfrags;
+			frag_freef(qs, head, fp);
 		}
 		m = NULL;               /* nothing to return */
 		goto done;
@@ -2506,7 +2682,7 @@ found:
 	if (next + (IP_VHL_HL(ip->ip_vhl) << 2) > IP_MAXPACKET) {
 		ipstat.ips_toolong++;
 		ipstat.ips_fragdropped += fp->ipq_nfrags;
-		frag_freef(head, fp);
+		frag_freef(qs, head, fp);
 		m = NULL;               /* nothing to return */
 		goto done;
 	}
@@ -2558,7 +2734,7 @@ found:
 	ip->ip_dst = fp->ipq_dst;
 
 	fp->ipq_frags = NULL;   /* return to caller as 'm' */
-	frag_freef(head, fp);
+	frag_freef(qs, head, fp);
 	fp = NULL;
 
 	m->m_len += (IP_VHL_HL(ip->ip_vhl) << 2);
@@ -2571,7 +2747,7 @@ found:
 
 	/* arm the purge timer if not already and if there's work to do */
 	frag_sched_timeout();
-	lck_mtx_unlock(&ipqlock);
+	lck_mtx_unlock(&qs->ipqs_lock);
 	/* perform deferred free (if needed) now that lock is dropped */
 	if (!MBUFQ_EMPTY(&dfq)) {
 		MBUFQ_DRAIN(&dfq);
@@ -2583,7 +2759,7 @@ done:
 	VERIFY(m == NULL);
 	/* arm the purge timer if not already and if there's work to do */
 	frag_sched_timeout();
-	lck_mtx_unlock(&ipqlock);
+	lck_mtx_unlock(&qs->ipqs_lock);
 	/* perform deferred free (if needed) */
 	if (!MBUFQ_EMPTY(&dfq)) {
 		MBUFQ_DRAIN(&dfq);
@@ -2598,7 +2774,7 @@ dropfrag:
 	}
 	/* arm the purge timer if not already and if there's work to do */
 	frag_sched_timeout();
-	lck_mtx_unlock(&ipqlock);
+	lck_mtx_unlock(&qs->ipqs_lock);
 	m_freem(m);
 	/* perform deferred free (if needed) */
 	if (!MBUFQ_EMPTY(&dfq)) {
@@ -2614,17 +2790,19 @@ dropfrag:
  * associated datagrams.
  */
 static void
-frag_freef(struct ipqhead *fhp, struct ipq *fp)
+frag_freef(struct ipq_shard *qs, struct ipqhead *fhp, struct ipq *fp)
 {
-	LCK_MTX_ASSERT(&ipqlock, LCK_MTX_ASSERT_OWNED);
+	LCK_MTX_ASSERT(&qs->ipqs_lock, LCK_MTX_ASSERT_OWNED);
 
 	fp->ipq_nfrags = 0;
 	if (fp->ipq_frags != NULL) {
 		m_freem_list(fp->ipq_frags);
 		fp->ipq_frags = NULL;
 	}
+	VERIFY(qs->ipqs_bytes >= fp->ipq_bytes);
+	qs->ipqs_bytes -= fp->ipq_bytes;
 	TAILQ_REMOVE(fhp, fp, ipq_list);
-	nipq--;
+	os_atomic_dec(&nipq, relaxed);
 	ipq_free(fp);
 }
 
@@ -2635,8 +2813,9 @@ static void
 frag_timeout(void *arg)
 {
 #pragma unused(arg)
+	struct ipq_shard *qs;
 	struct ipq *fp;
-	int i;
+	int i, j;
 
 	/*
 	 * Update coarse-grained networking timestamp (in sec.); the idea
@@ -2645,47 +2824,53 @@ frag_timeout(void *arg)
 	 */
 	net_update_uptime();
 
-	lck_mtx_lock(&ipqlock);
-	for (i = 0; i < IPREASS_NHASH; i++) {
-		for (fp = TAILQ_FIRST(&ipq[i]); fp;) {
-			struct ipq *fpp;
-
-			fpp = fp;
-			fp = TAILQ_NEXT(fp, ipq_list);
-			if (--fpp->ipq_ttl == 0) {
-				ipstat.ips_fragtimeout += fpp->ipq_nfrags;
-				frag_freef(&ipq[i], fpp);
+	for (j = 0; j < IPREASS_NSHARDS; j++) {
+		qs = &ipq_shards[j];
+		lck_mtx_lock(&qs->ipqs_lock);
+		for (i = 0; i < IPREASS_NHASH; i++) {
+			for (fp = TAILQ_FIRST(&qs->ipqs_head[i]); fp;) {
+				struct ipq *fpp;
+
+				fpp = fp;
+				fp = TAILQ_NEXT(fp, ipq_list);
+				if (--fpp->ipq_ttl == 0) {
+					ipstat.ips_fragtimeout +=
+					    fpp->ipq_nfrags;
+					frag_freef(qs, &qs->ipqs_head[i], fpp);
+				}
 			}
 		}
-	}
-	/*
-	 * If we are over the maximum number of fragments
-	 * (due to the limit being lowered), drain off
-	 * enough to get down to the new limit.
-	 */
-	if (maxnipq >= 0 && nipq > (unsigned)maxnipq) {
+		/*
+		 * If we are over the maximum number of fragments
+		 * (due to the limit being lowered), drain off
+		 * enough to get down to the new limit.
+		 */
 		for (i = 0; i < IPREASS_NHASH; i++) {
-			while (nipq > (unsigned)maxnipq &&
-			    !TAILQ_EMPTY(&ipq[i])) {
+			while (maxnipq >= 0 && nipq > (unsigned)maxnipq &&
+			    !TAILQ_EMPTY(&qs->ipqs_head[i])) {
 				ipstat.ips_fragdropped +=
-				    TAILQ_FIRST(&ipq[i])->ipq_nfrags;
-				frag_freef(&ipq[i], TAILQ_FIRST(&ipq[i]));
+				    TAILQ_FIRST(&qs->ipqs_head[i])->ipq_nfrags;
+				frag_freef(qs, &qs->ipqs_head[i],
+				    TAILQ_FIRST(&qs->ipqs_head[i]));
 			}
 		}
+		/* likewise if the memory budget was lowered */
+		(void) ipq_shard_reclaim(qs, NULL);
+		lck_mtx_unlock(&qs->ipqs_lock);
 	}
 	/* re-arm the purge timer if there's work to do */
-	frag_timeout_run = 0;
+	os_atomic_store(&frag_timeout_run, 0, relaxed);
 	frag_sched_timeout();
-	lck_mtx_unlock(&ipqlock);
 }
 
+/*
+ * May be called with or without a shard lock held.
+ */
 static void
 frag_sched_timeout(void)
 {
-	LCK_MTX_ASSERT(&ipqlock, LCK_MTX_ASSERT_OWNED);
-
-	if (!frag_timeout_run && nipq > 0) {
-		frag_timeout_run = 1;
+	if (nipq > 0 &&
+	    os_atomic_cmpxchg(&frag_timeout_run, 0, 1, relaxed)) {
 		timeout(frag_timeout, NULL, hz);
 	}
 }
@@ -2696,17 +2881,22 @@ frag_sched_timeout(void)
 static void
 frag_drain(void)
 {
-	int i;
+	struct ipq_shard *qs;
+	int i, j;
 
-	lck_mtx_lock(&ipqlock);
-	for (i = 0; i < IPREASS_NHASH; i++) {
-		while (!TAILQ_EMPTY(&ipq[i])) {
-			ipstat.ips_fragdropped +=
-			    TAILQ_FIRST(&ipq[i])->ipq_nfrags;
-			frag_freef(&ipq[i], TAILQ_FIRST(&ipq[i]));
+	for (j = 0; j < IPREASS_NSHARDS; j++) {
+		qs = &ipq_shards[j];
+		lck_mtx_lock(&qs->ipqs_lock);
+		for (i = 0; i < IPREASS_NHASH; i++) {
+			while (!TAILQ_EMPTY(&qs->ipqs_head[i])) {
+				ipstat.ips_fragdropped +=
+				    TAILQ_FIRST(&qs->ipqs_head[i])->ipq_nfrags;
+				frag_freef(qs, &qs->ipqs_head[i],
+				    TAILQ_FIRST(&qs->ipqs_head[i]));
+			}
 		}
+		lck_mtx_unlock(&qs->ipqs_lock);
 	}
-	lck_mtx_unlock(&ipqlock);
 }
 
 static struct ipq *
@@ -102,6 +102,9 @@ struct ipq {
 	u_int32_t       ipq_nfrags;     /* # frags in this packet */
 	uint32_t ipq_csum_flags;        /* checksum flags */
 	uint32_t ipq_csum;              /* partial checksum value */
+	struct mbuf *ipq_tail;          /* fragment with the highest offset */
+	u_int32_t       ipq_len;        /* # data bytes held in fragments */
+	u_int32_t       ipq_bytes;      /* mbuf memory held by fragments */
 };
 
 /*
@@ -119,6 +119,30 @@ SYSCTL_INT(_net_inet_tcp, OID_AUTO, sack_globalholes, CTLFLAG_RD | CTLFLAG_LOCKE
 
 static KALLOC_TYPE_DEFINE(sack_hole_zone, struct sackhole, NET_KT_DEFAULT);
 
+/*
+ * The scoreboard keeps its holes both on the snd_holes list, which gives
+ * ordered neighbours in constant time, and in snd_holes_tree, keyed by
+ * the start of the hole, so that ACK processing can seek straight to the
+ * holes a SACK block covers.  Holes never overlap and are only ever
+ * trimmed from either end, so updating start in place keeps the tree
+ * ordered.
+ */
+static int sackhole_cmp(const struct sackhole *, const struct sackhole *);
+RB_PROTOTYPE(sackhole_tree, sackhole, scbtree, sackhole_cmp);
+RB_GENERATE(sackhole_tree, sackhole, scbtree, sackhole_cmp);
+
+static int
+sackhole_cmp(const struct sackhole *a, const struct sackhole *b)
+{
+	if (SEQ_LT(a->start, b->start)) {
+		return -1;
+	}
+	if (SEQ_GT(a->start, b->start)) {
+		return 1;
+	}
+	return 0;
+}
+
 #define TCP_VALIDATE_SACK_SEQ_NUMBERS(_tp_, _sb_, _ack_) \
     (SEQ_GT((_sb_)->end, (_sb_)->start) && \
     SEQ_GT((_sb_)->start, (_tp_)->snd_una) && \
@@ -260,6 +284,7 @@ tcp_sackhole_alloc(struct tcpcb *tp, tcp_seq start, tcp_seq end)
 	hole->rxmit = start;
 
 	tp->snd_numholes++;
+	tp->snd_holes_bytes += end - start;
 	OSIncrementAtomic(&tcp_sack_globalholes);
 
 	return hole;
@@ -271,6 +296,7 @@ tcp_sackhole_alloc(struct tcpcb *tp, tcp_seq start, tcp_seq end)
 static void
 tcp_sackhole_free(struct tcpcb *tp, struct sackhole *hole)
 {
+	tp->snd_holes_bytes -= hole->end - hole->start;
 	zfree(sack_hole_zone, hole);
 
 	tp->snd_numholes--;
@@ -298,6 +324,7 @@ tcp_sackhole_insert(struct tcpcb *tp, tcp_seq start, tcp_seq end,
 	} else {
 		TAILQ_INSERT_TAIL(&tp->snd_holes, hole, scblink);
 	}
+	VERIFY(RB_INSERT(sackhole_tree, &tp->snd_holes_tree, hole) == NULL);
 
 	/* Update SACK hint. */
 	if (tp->sackhint.nexthole == NULL) {
@@ -320,10 +347,27 @@ tcp_sackhole_remove(struct tcpcb *tp, struct sackhole *hole)
 
 	/* Remove this SACK hole. */
 	TAILQ_REMOVE(&tp->snd_holes, hole, scblink);
+	RB_REMOVE(sackhole_tree, &tp->snd_holes_tree, hole);
 
 	/* Free this SACK hole. */
 	tcp_sackhole_free(tp, hole);
 }
+
+/*
+ * Return the last hole that starts before seq, or NULL if there is none.
+ */
+static struct sackhole *
+tcp_sackhole_find_before(struct tcpcb *tp, tcp_seq seq)
+{
+	struct sackhole key, *hole;
+
+	key.start = seq;
+	hole = RB_NFIND(sackhole_tree, &tp->snd_holes_tree, &key);
+	if (hole == NULL) {
+		return TAILQ_LAST(&tp->snd_holes, sackhole_head);
+	}
+	return TAILQ_PREV(hole, sackhole_head, scblink);
+}
 /*
  * When a new ack with SACK is received, check if it indicates packet
  * reordering. If there is packet reordering, the socket is marked and
@@ -565,9 +609,14 @@ tcp_sack_doack(struct tcpcb *tp, struct tcpopt *to, struct tcphdr *th,
 		if (SEQ_LEQ(sblkp->end, cur->start)) {
 			/*
 			 * SACKs data before the current hole.
-			 * Go to the previous hole.
+			 * Go to the previous hole, or look up the one
+			 * below the block if it is further back than that.
 			 */
-			cur = TAILQ_PREV(cur, sackhole_head, scblink);
+			temp = TAILQ_PREV(cur, sackhole_head, scblink);
+			if (temp != NULL && SEQ_LEQ(sblkp->end, temp->start)) {
+				temp = tcp_sackhole_find_before(tp, sblkp->end);
+			}
+			cur = temp;
 			continue;
 		}
 		tp->sackhint.sack_bytes_rexmit -= (cur->rxmit - cur->start);
@@ -596,6 +645,7 @@ tcp_sack_doack(struct tcpcb *tp, struct tcpopt *to, struct tcphdr *th,
 				tcp_sack_update_byte_counter(tp, cur->start, sblkp->end, newbytes_acked, after_rexmit_acked);
 				tcp_sack_detect_reordering(tp, cur,
 				    sblkp->end, old_snd_fack);
+				tp->snd_holes_bytes -= sblkp->end - cur->start;
 				cur->start = sblkp->end;
 				cur->rxmit = SEQ_MAX(cur->rxmit, cur->start);
 			}
@@ -606,6 +656,7 @@ tcp_sack_doack(struct tcpcb *tp, struct tcpopt *to, struct tcphdr *th,
 				tcp_sack_update_byte_counter(tp, sblkp->start, cur->end, newbytes_acked, after_rexmit_acked);
 				tcp_sack_detect_reordering(tp, cur,
 				    cur->end, old_snd_fack);
+				tp->snd_holes_bytes -= cur->end - sblkp->start;
 				cur->end = sblkp->start;
 				cur->rxmit = SEQ_MIN(cur->rxmit, cur->end);
 			} else {
@@ -625,6 +676,8 @@ tcp_sack_doack(struct tcpcb *tp, struct tcpopt *to, struct tcphdr *th,
 						        += (temp->rxmit
 						    - temp->start);
 					}
+					tp->snd_holes_bytes -=
+					    cur->end - sblkp->start;
 					cur->end = sblkp->start;
 					cur->rxmit = SEQ_MIN(cur->rxmit,
 					    cur->end);
@@ -719,9 +772,10 @@ tcp_sack_partialack(struct tcpcb *tp, struct tcphdr *th)
 	(void) tcp_output(tp);
 }
 
+#if DEBUG
 /*
- * Debug version of tcp_sack_output() that walks the scoreboard. Used for
- * now to sanity check the hint.
+ * Debug version of tcp_sack_output() that walks the scoreboard. Used on
+ * DEBUG kernels to sanity check the hint.
  */
 static struct sackhole *
 tcp_sack_output_debug(struct tcpcb *tp, int *sack_bytes_rexmt)
@@ -741,6 +795,7 @@ tcp_sack_output_debug(struct tcpcb *tp, int *sack_bytes_rexmt)
 	}
 	return p;
 }
+#endif /* DEBUG */
 
 /*
  * Returns the next hole to retransmit and the number of retransmitted bytes
@@ -762,10 +817,13 @@ tcp_sack_output_debug(struct tcpcb *tp, int *sack_bytes_rexmt)
 struct sackhole *
 tcp_sack_output(struct tcpcb *tp, int *sack_bytes_rexmt)
 {
-	struct sackhole *hole = NULL, *dbg_hole = NULL;
+	struct sackhole *hole = NULL;
+#if DEBUG
+	struct sackhole *dbg_hole = NULL;
 	int dbg_bytes_rexmt;
 
 	dbg_hole = tcp_sack_output_debug(tp, &dbg_bytes_rexmt);
+#endif /* DEBUG */
 	*sack_bytes_rexmt = tp->sackhint.sack_bytes_rexmit;
 	hole = tp->sackhint.nexthole;
 	if (hole == NULL || SEQ_LT(hole->rxmit, hole->end)) {
@@ -778,6 +836,7 @@ tcp_sack_output(struct tcpcb *tp, int *sack_bytes_rexmt)
 		}
 	}
 out:
+#if DEBUG
 	if (dbg_hole != hole) {
 		printf("%s: Computed sack hole not the same as cached value\n", __func__);
 		hole = dbg_hole;
@@ -788,6 +847,7 @@ out:
 		    __func__, dbg_bytes_rexmt, *sack_bytes_rexmt);
 		*sack_bytes_rexmt = dbg_bytes_rexmt;
 	}
+#endif /* DEBUG */
 	return hole;
 }
 
@@ -816,33 +876,36 @@ tcp_sack_lost_rexmit(struct tcpcb *tp)
 uint32_t
 tcp_sack_adjust(struct tcpcb *tp)
 {
-	struct sackhole *p, *cur = TAILQ_FIRST(&tp->snd_holes);
+	struct sackhole *p, *cur;
 
-	if (cur == NULL) {
+	if (TAILQ_EMPTY(&tp->snd_holes)) {
 		return 0; /* No holes */
 	}
 	if (SEQ_GEQ(tp->snd_nxt, tp->snd_fack)) {
 		return 0; /* We're already beyond any SACKed blocks */
 	}
 	/*
-	 * Two cases for which we want to advance snd_nxt:
-	 * i) snd_nxt lies between end of one hole and beginning of another
-	 * ii) snd_nxt lies between end of last hole and snd_fack
+	 * Find the hole snd_nxt falls in, or the last one before it.
+	 * If snd_nxt precedes every hole, stay in the first one.
 	 */
-	while ((p = TAILQ_NEXT(cur, scblink)) != NULL) {
-		if (SEQ_LT(tp->snd_nxt, cur->end)) {
-			return cur->end - tp->snd_nxt;
-		}
-		if (SEQ_GEQ(tp->snd_nxt, p->start)) {
-			cur = p;
-		} else {
-			tp->snd_nxt = p->start;
-			return p->end - tp->snd_nxt;
-		}
+	cur = tcp_sackhole_find_before(tp, tp->snd_nxt + 1);
+	if (cur == NULL) {
+		cur = TAILQ_FIRST(&tp->snd_holes);
+		return cur->end - tp->snd_nxt;
 	}
 	if (SEQ_LT(tp->snd_nxt, cur->end)) {
 		return cur->end - tp->snd_nxt;
 	}
+	/*
+	 * Two cases for which we want to advance snd_nxt:
+	 * i) snd_nxt lies between end of one hole and beginning of another
+	 * ii) snd_nxt lies between end of last hole and snd_fack
+	 */
+	p = TAILQ_NEXT(cur, scblink);
+	if (p != NULL) {
+		tp->snd_nxt = p->start;
+		return p->end - tp->snd_nxt;
+	}
 	tp->snd_nxt = tp->snd_fack;
 	return 0;
 }
@@ -854,8 +917,7 @@ tcp_sack_adjust(struct tcpcb *tp)
 boolean_t
 tcp_sack_byte_islost(struct tcpcb *tp)
 {
-	u_int32_t unacked_bytes, sndhole_bytes = 0;
-	struct sackhole *sndhole;
+	u_int32_t unacked_bytes, sndhole_bytes;
 	if (!SACK_ENABLED(tp) || IN_FASTRECOVERY(tp) ||
 	    TAILQ_EMPTY(&tp->snd_holes) ||
 	    (tp->t_flagsext & TF_PKTS_REORDERED)) {
@@ -864,9 +926,7 @@ tcp_sack_byte_islost(struct tcpcb *tp)
 
 	unacked_bytes = tp->snd_max - tp->snd_una;
 
-	TAILQ_FOREACH(sndhole, &tp->snd_holes, scblink) {
-		sndhole_bytes += (sndhole->end - sndhole->start);
-	}
+	sndhole_bytes = tp->snd_holes_bytes;
 
 	VERIFY(unacked_bytes >= sndhole_bytes);
 	return (unacked_bytes - sndhole_bytes) >
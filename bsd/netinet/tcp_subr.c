@@ -1111,6 +1111,7 @@ tcp_newtcpcb(struct inpcb *inp)
 	tp->t_flagsext |= TF_SACK_ENABLE;
 
 	TAILQ_INIT(&tp->snd_holes);
+	RB_INIT(&tp->snd_holes_tree);
 	SLIST_INIT(&tp->t_rxt_segments);
 	SLIST_INIT(&tp->t_notify_ack);
 	tp->t_inpcb = inp;
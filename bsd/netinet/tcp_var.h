@@ -85,6 +85,7 @@ struct name {                           \
 #endif
 
 #ifdef KERNEL_PRIVATE
+#include <sys/tree.h>
 
 #define TCP_RETRANSHZ   1000    /* granularity of TCP timestamps, 1ms */
 /* Minimum time quantum within which the timers are coalesced */
@@ -180,6 +181,7 @@ struct sackhole {
 	tcp_seq rxmit;          /* next seq. no in hole to be retransmitted */
 	u_int32_t rxmit_start;  /* timestamp of first retransmission */
 	TAILQ_ENTRY(sackhole) scblink;  /* scoreboard linkage */
+	RB_ENTRY(sackhole) scbtree;     /* scoreboard lookup by start */
 };
 
 struct sackhint {
@@ -504,6 +506,9 @@ struct tcpcb {
 	                                 *   episode starts at this seq number */
 	TAILQ_HEAD(sackhole_head, sackhole) snd_holes;
 	/* SACK scoreboard (sorted) */
+	RB_HEAD(sackhole_tree, sackhole) snd_holes_tree;
+	/* same holes, indexed by start seq */
+	u_int32_t snd_holes_bytes;      /* bytes covered by the holes */
 	tcp_seq snd_fack;               /* last seq number(+1) sack'd by rcv'r*/
 	int     rcv_numsacks;           /* # distinct sack blks present */
 	struct sackblk sackblks[MAX_SACK_BLKS]; /* seq nos. of sack blocks */
@@ -75,6 +75,7 @@
 
 #include <net/if.h>
 #include <net/route.h>
+#include <net/flowhash.h>
 
 #include <netinet/in.h>
 #include <netinet/in_var.h>
@@ -99,6 +100,7 @@ struct  ip6asfrag {
 	int             ip6af_frglen;   /* fragmentable part length */
 	int             ip6af_off;      /* fragment offset */
 	u_int16_t       ip6af_mff;      /* more fragment bit in frag off */
+	u_int32_t       ip6af_bytes;    /* mbuf memory held by ip6af_m */
 };
 
 #define IP6_REASS_MBUF(ip6af) ((ip6af)->ip6af_m)
@@ -116,10 +118,17 @@ static void frag6_enq(struct ip6asfrag *, struct ip6asfrag *);
 static void frag6_deq(struct ip6asfrag *);
 static void frag6_insque(struct ip6q *, struct ip6q *);
 static void frag6_remque(struct ip6q *);
-static void frag6_purgef(struct ip6q *, struct fq6_head *, struct fq6_head *);
-static void frag6_freef(struct ip6q *, struct fq6_head *, struct fq6_head *);
 
-static int frag6_timeout_run;           /* frag6 timer is scheduled to run */
+struct ip6q_shard;
+static void frag6_purgef(struct ip6q_shard *, struct ip6q *,
+    struct fq6_head *, struct fq6_head *);
+static void frag6_unlinkf(struct ip6q_shard *, struct ip6q *);
+static void frag6_freef(struct ip6q_shard *, struct ip6q *,
+    struct fq6_head *, struct fq6_head *);
+static boolean_t frag6_shard_reclaim(struct ip6q_shard *, struct ip6q *,
+    struct fq6_head *);
+
+static u_int32_t frag6_timeout_run;     /* frag6 timer is scheduled to run */
 static void frag6_timeout(void *);
 static void frag6_sched_timeout(void);
 
@@ -132,12 +141,38 @@ static void ip6af_free(struct ip6asfrag *);
 static LCK_GRP_DECLARE(ip6qlock_grp, "ip6qlock");
 static LCK_MTX_DECLARE(ip6qlock, &ip6qlock_grp);
 
-/* IPv6 fragment reassembly queues (protected by ip6qlock) */
-static struct ip6q ip6q;                /* ip6 reassembly queues */
+/*
+ * As with IPv4, the reassembly queues are split into shards selected by
+ * a keyed hash of the datagram's (src, dst, ident), each with its own
+ * lock, queue and share of the ip6q_maxbytes memory budget.  ip6qlock
+ * only serializes updates of the parameters.
+ */
+#define IP6REASS_NSHARDS_LOG2   4
+#define IP6REASS_NSHARDS        (1 << IP6REASS_NSHARDS_LOG2)
+#define IP6REASS_SHARD(h) \
+	(&ip6q_shards[(h) >> (32 - IP6REASS_NSHARDS_LOG2)])
+
+struct ip6q_shard {
+	decl_lck_mtx_data(, ip6qs_lock);
+	struct ip6q     ip6qs_head;     /* ip6 reassembly queues */
+	u_int32_t       ip6qs_bytes;    /* mbuf memory held by this shard */
+} __attribute__((aligned(MAX_CPU_CACHE_LINE_SIZE)));
+
+struct ip6q_hash_key {
+	struct in6_addr ip6qk_src;
+	struct in6_addr ip6qk_dst;
+	u_int32_t       ip6qk_ident;
+};
+
+/* IPv6 fragment reassembly queues (each protected by its shard lock) */
+static struct ip6q_shard ip6q_shards[IP6REASS_NSHARDS];
+static u_int32_t ip6q_hash_seed;        /* seed for the shard hash */
 static int ip6_maxfragpackets;          /* max packets in reass queues */
 static u_int32_t frag6_nfragpackets;    /* # of packets in reass queues */
 static int ip6_maxfrags;                /* max fragments in reass queues */
 static u_int32_t frag6_nfrags;          /* # of fragments in reass queues */
+static u_int32_t ip6q_maxbytes;         /* max mbuf memory in reass queues */
+static u_int32_t ip6q_shard_maxbytes;   /* per-shard share of the above */
 static u_int32_t ip6q_limit;            /* ip6q allocation limit */
 static u_int32_t ip6q_count;            /* current # of allocated ip6q's */
 static u_int32_t ip6af_limit;           /* ip6asfrag allocation limit */
@@ -145,6 +180,7 @@ static u_int32_t ip6af_count;           /* current # of allocated ip6asfrag's */
 
 static int sysctl_maxfragpackets SYSCTL_HANDLER_ARGS;
 static int sysctl_maxfrags SYSCTL_HANDLER_ARGS;
+static int sysctl_maxfragbytes SYSCTL_HANDLER_ARGS;
 
 SYSCTL_DECL(_net_inet6_ip6);
 
@@ -161,19 +197,34 @@ SYSCTL_PROC(_net_inet6_ip6, IPV6CTL_MAXFRAGS, maxfrags,
     CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_LOCKED, &ip6_maxfrags, 0,
     sysctl_maxfrags, "I", "Maximum number of IPv6 fragments allowed");
 
+SYSCTL_PROC(_net_inet6_ip6, OID_AUTO, maxfragbytes,
+    CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_LOCKED, &ip6q_maxbytes, 0,
+    sysctl_maxfragbytes, "I",
+    "Maximum mbuf memory held by IPv6 fragment reassembly queues");
+
 /*
  * Initialise reassembly queue and fragment identifier.
  */
 void
 frag6_init(void)
 {
+	int i;
+
 	lck_mtx_lock(&ip6qlock);
 	/* Initialize IPv6 reassembly queue. */
-	ip6q.ip6q_next = ip6q.ip6q_prev = &ip6q;
+	for (i = 0; i < IP6REASS_NSHARDS; i++) {
+		struct ip6q_shard *qs = &ip6q_shards[i];
+
+		lck_mtx_init(&qs->ip6qs_lock, &ip6qlock_grp, LCK_ATTR_NULL);
+		qs->ip6qs_head.ip6q_next = qs->ip6qs_head.ip6q_prev =
+		    &qs->ip6qs_head;
+	}
+	ip6q_hash_seed = RandomULong();
 
 	/* same limits as IPv4 */
 	ip6_maxfragpackets = nmbclusters / 32;
 	ip6_maxfrags = ip6_maxfragpackets * 2;
+	ip6q_maxbytes = (nmbclusters / 8) * MCLBYTES;
 	ip6q_updateparams();
 	lck_mtx_unlock(&ip6qlock);
 }
@@ -196,16 +247,49 @@ frag6_restore_context(struct mbuf *m)
 	return (int)m->m_pkthdr.pkt_hdr;
 }
 
+/*
+ * Select the shard of a fragment's datagram.
+ */
+static inline struct ip6q_shard *
+frag6_lookup_shard(const struct ip6_hdr *ip6, const struct ip6_frag *ip6f)
+{
+	struct ip6q_hash_key key __attribute__((aligned(8)));
+	u_int32_t hash;
+
+	bzero(&key, sizeof(key));
+	key.ip6qk_src = ip6->ip6_src;
+	key.ip6qk_dst = ip6->ip6_dst;
+	key.ip6qk_ident = ip6f->ip6f_ident;
+	hash = net_flowhash(&key, sizeof(key), ip6q_hash_seed);
+
+	return IP6REASS_SHARD(hash);
+}
+
+/*
+ * Memory charged to a reassembly queue for holding a fragment.
+ */
+static inline u_int32_t
+frag6_mbuf_bytes(struct mbuf *m)
+{
+	u_int32_t bytes = 0;
+
+	for (; m != NULL; m = m->m_next) {
+		bytes += MSIZE;
+		if (m->m_flags & M_EXT) {
+			bytes += m->m_ext.ext_size;
+		}
+	}
+	return bytes;
+}
+
 /*
  * Send any deferred ICMP param problem error messages; caller must not be
- * holding ip6qlock and is expected to have saved the per-packet parameter
+ * holding a shard lock and is expected to have saved the per-packet parameter
  * value via frag6_save_context().
  */
 static void
 frag6_icmp6_paramprob_error(struct fq6_head *diq6)
 {
-	LCK_MTX_ASSERT(&ip6qlock, LCK_MTX_ASSERT_NOTOWNED);
-
 	if (!MBUFQ_EMPTY(diq6)) {
 		struct mbuf *merr, *merr_tmp;
 		int param;
@@ -222,13 +306,11 @@ frag6_icmp6_paramprob_error(struct fq6_head *diq6)
 
 /*
  * Send any deferred ICMP time exceeded error messages;
- * caller must not be holding ip6qlock.
+ * caller must not be holding a shard lock.
  */
 static void
 frag6_icmp6_timeex_error(struct fq6_head *diq6)
 {
-	LCK_MTX_ASSERT(&ip6qlock, LCK_MTX_ASSERT_NOTOWNED);
-
 	if (!MBUFQ_EMPTY(diq6)) {
 		struct mbuf *m, *m_tmp;
 		MBUFQ_FOREACH_SAFE(m, diq6, m_tmp) {
@@ -279,6 +361,7 @@ frag6_input(struct mbuf **mp, int *offp, int proto)
 	struct mbuf *m = *mp, *t = NULL;
 	struct ip6_hdr *ip6 = NULL;
 	struct ip6_frag *ip6f = NULL;
+	struct ip6q_shard *qs = NULL;
 	struct ip6q *q6 = NULL;
 	struct ip6asfrag *af6 = NULL, *ip6af = NULL, *af6dwn = NULL;
 	int offset = *offp, i = 0, next = 0;
@@ -451,10 +534,12 @@ frag6_input(struct mbuf **mp, int *offp, int proto)
 	ip6stat.ip6s_fragments++;
 	in6_ifstat_inc(dstifp, ifs6_reass_reqd);
 
-	lck_mtx_lock(&ip6qlock);
+	qs = frag6_lookup_shard(ip6, ip6f);
+	lck_mtx_lock(&qs->ip6qs_lock);
 	locked = 1;
 
-	for (q6 = ip6q.ip6q_next; q6 != &ip6q; q6 = q6->ip6q_next) {
+	for (q6 = qs->ip6qs_head.ip6q_next; q6 != &qs->ip6qs_head;
+	    q6 = q6->ip6q_next) {
 		if (ip6f->ip6f_ident == q6->ip6q_ident &&
 		    in6_are_addr_equal_scoped(&ip6->ip6_src, &q6->ip6q_src, ip6_input_getsrcifscope(m), q6->ip6q_src_ifscope) &&
 		    in6_are_addr_equal_scoped(&ip6->ip6_dst, &q6->ip6q_dst, ip6_input_getdstifscope(m), q6->ip6q_dst_ifscope)) {
@@ -462,7 +547,7 @@ frag6_input(struct mbuf **mp, int *offp, int proto)
 		}
 	}
 
-	if (q6 == &ip6q) {
+	if (q6 == &qs->ip6qs_head) {
 		/*
 		 * Create a reassembly queue as this is the first fragment to
 		 * arrive.
@@ -477,8 +562,8 @@ frag6_input(struct mbuf **mp, int *offp, int proto)
 			goto dropfrag;
 		}
 
-		frag6_insque(q6, &ip6q);
-		frag6_nfragpackets++;
+		frag6_insque(q6, &qs->ip6qs_head);
+		os_atomic_inc(&frag6_nfragpackets, relaxed);
 
 		/* ip6q_nxt will be filled afterwards, from 1st fragment */
 		q6->ip6q_down   = q6->ip6q_up = (struct ip6asfrag *)q6;
@@ -497,6 +582,8 @@ frag6_input(struct mbuf **mp, int *offp, int proto)
 
 		q6->ip6q_nfrag = 0;
 		q6->ip6q_flags = 0;
+		q6->ip6q_nbytes = 0;
+		q6->ip6q_bytes = 0;
 
 		/*
 		 * If the first fragment has valid checksum offload
@@ -540,7 +627,7 @@ frag6_input(struct mbuf **mp, int *offp, int proto)
 	if (local_ip6q_unfrglen >= 0) {
 		/* The 1st fragment has already arrived. */
 		if (local_ip6q_unfrglen + fragoff + frgpartlen > IPV6_MAXPACKET) {
-			lck_mtx_unlock(&ip6qlock);
+			lck_mtx_unlock(&qs->ip6qs_lock);
 			locked = 0;
 			icmp6_error(m, ICMP6_PARAM_PROB, ICMP6_PARAMPROB_HEADER,
 			    offset - sizeof(struct ip6_frag) +
@@ -549,7 +636,7 @@ frag6_input(struct mbuf **mp, int *offp, int proto)
 			goto done;
 		}
 	} else if (fragoff + frgpartlen > IPV6_MAXPACKET) {
-		lck_mtx_unlock(&ip6qlock);
+		lck_mtx_unlock(&qs->ip6qs_lock);
 		locked = 0;
 		icmp6_error(m, ICMP6_PARAM_PROB, ICMP6_PARAMPROB_HEADER,
 		    offset - sizeof(struct ip6_frag) +
@@ -570,7 +657,7 @@ frag6_input(struct mbuf **mp, int *offp, int proto)
 		 * the source of the fragment, with the Pointer field set to zero.
 		 */
 		if (!ip6_pkt_has_ulp(m)) {
-			lck_mtx_unlock(&ip6qlock);
+			lck_mtx_unlock(&qs->ip6qs_lock);
 			locked = 0;
 			icmp6_error(m, ICMP6_PARAM_PROB,
 			    ICMP6_PARAMPROB_FIRSTFRAG_INCOMP_HDR, 0);
@@ -589,6 +676,9 @@ frag6_input(struct mbuf **mp, int *offp, int proto)
 
 				/* dequeue the fragment. */
 				frag6_deq(af6);
+				q6->ip6q_nbytes -= af6->ip6af_frglen;
+				q6->ip6q_bytes -= af6->ip6af_bytes;
+				qs->ip6qs_bytes -= af6->ip6af_bytes;
 				ip6af_free(af6);
 
 				/* adjust pointer. */
@@ -620,6 +710,7 @@ frag6_input(struct mbuf **mp, int *offp, int proto)
 	ip6af->ip6af_off = fragoff;
 	ip6af->ip6af_frglen = frgpartlen;
 	ip6af->ip6af_offset = offset;
+	ip6af->ip6af_bytes = frag6_mbuf_bytes(m);
 	IP6_REASS_MBUF(ip6af) = m;
 
 	if (first_frag) {
@@ -649,12 +740,20 @@ frag6_input(struct mbuf **mp, int *offp, int proto)
 	}
 
 	/*
-	 * Find a segment which begins after this one does.
+	 * Find a segment which begins after this one does.  Queued
+	 * segments never overlap, so when this one starts at or beyond
+	 * the last one (fragments arriving in order) it goes at the
+	 * tail and there is nothing to walk.
 	 */
-	for (af6 = q6->ip6q_down; af6 != (struct ip6asfrag *)q6;
-	    af6 = af6->ip6af_down) {
-		if (af6->ip6af_off > ip6af->ip6af_off) {
-			break;
+	if (q6->ip6q_up == (struct ip6asfrag *)q6 ||
+	    q6->ip6q_up->ip6af_off <= ip6af->ip6af_off) {
+		af6 = (struct ip6asfrag *)q6;
+	} else {
+		for (af6 = q6->ip6q_down; af6 != (struct ip6asfrag *)q6;
+		    af6 = af6->ip6af_down) {
+			if (af6->ip6af_off > ip6af->ip6af_off) {
+				break;
+			}
 		}
 	}
 
@@ -721,8 +820,11 @@ insert:
 	 * the most recently active fragmented packet.
 	 */
 	frag6_enq(ip6af, af6->ip6af_up);
-	frag6_nfrags++;
+	os_atomic_inc(&frag6_nfrags, relaxed);
 	q6->ip6q_nfrag++;
+	q6->ip6q_nbytes += ip6af->ip6af_frglen;
+	q6->ip6q_bytes += ip6af->ip6af_bytes;
+	qs->ip6qs_bytes += ip6af->ip6af_bytes;
 
 	/*
 	 * This holds true, when we receive overlapping fragments.
@@ -737,7 +839,7 @@ insert:
 		MBUFQ_INIT(&dfq6);      /* for deferred frees */
 		q6->ip6q_flags |= IP6QF_DIRTY;
 		/* Purge all the fragments but do not free q6 */
-		frag6_purgef(q6, &dfq6, NULL);
+		frag6_purgef(qs, q6, &dfq6, NULL);
 		af6 = NULL;
 
 		/* free fragments that need to be freed */
@@ -767,7 +869,7 @@ insert:
 		 * from here but change the passed mbuf pointer to NULL.
 		 */
 		*mp = NULL;
-		lck_mtx_unlock(&ip6qlock);
+		lck_mtx_unlock(&qs->ip6qs_lock);
 		return IPPROTO_DONE;
 	}
 
@@ -777,20 +879,29 @@ insert:
 	q6->ip6q_unfrglen = local_ip6q_unfrglen;
 	q6->ip6q_nxt = local_ip6q_nxt;
 
-	next = 0;
-	for (af6 = q6->ip6q_down; af6 != (struct ip6asfrag *)q6;
-	    af6 = af6->ip6af_down) {
-		if (af6->ip6af_off != next) {
-			lck_mtx_unlock(&ip6qlock);
-			locked = 0;
-			m = NULL;
-			goto done;
+	/*
+	 * Since an overlap purges the queue above, queued segments never
+	 * overlap; reassembly is complete exactly when the last segment
+	 * doesn't have the more fragments bit and the segments add up to
+	 * the end of the last one.  Otherwise keep the shard within its
+	 * memory budget before waiting for more.
+	 */
+	af6 = q6->ip6q_up;
+	next = af6->ip6af_off + af6->ip6af_frglen;
+	if (af6->ip6af_mff || q6->ip6q_nbytes != (u_int32_t)next) {
+		struct fq6_head dfq6 = {0};
+
+		MBUFQ_INIT(&dfq6);      /* for deferred frees */
+		if (!frag6_shard_reclaim(qs, q6, &dfq6)) {
+			ip6stat.ip6s_fragoverflow++;
+			frag6_freef(qs, q6, &dfq6, NULL);
 		}
-		next += af6->ip6af_frglen;
-	}
-	if (af6->ip6af_up->ip6af_mff) {
-		lck_mtx_unlock(&ip6qlock);
+		lck_mtx_unlock(&qs->ip6qs_lock);
 		locked = 0;
+		if (!MBUFQ_EMPTY(&dfq6)) {
+			MBUFQ_DRAIN(&dfq6);
+		}
+		VERIFY(MBUFQ_EMPTY(&dfq6));
 		m = NULL;
 		goto done;
 	}
@@ -862,10 +973,7 @@ insert:
 	} else {
 		/* this comes with no copy if the boundary is on cluster */
 		if ((t = m_split(m, offset, M_DONTWAIT)) == NULL) {
-			frag6_remque(q6);
-			frag6_nfragpackets--;
-			frag6_nfrags -= q6->ip6q_nfrag;
-			ip6q_free(q6);
+			frag6_unlinkf(qs, q6);
 			goto dropfrag;
 		}
 		m_adj(t, sizeof(struct ip6_frag));
@@ -880,10 +988,7 @@ insert:
 		*prvnxtp = nxt;
 	}
 
-	frag6_remque(q6);
-	frag6_nfragpackets--;
-	frag6_nfrags -= q6->ip6q_nfrag;
-	ip6q_free(q6);
+	frag6_unlinkf(qs, q6);
 
 	if (m->m_flags & M_PKTHDR) {    /* Isn't it always true? */
 		m_fixhdr(m);
@@ -907,7 +1012,7 @@ insert:
 
 	/* arm the purge timer if not already and if there's work to do */
 	frag6_sched_timeout();
-	lck_mtx_unlock(&ip6qlock);
+	lck_mtx_unlock(&qs->ip6qs_lock);
 	in6_ifstat_inc(dstifp, ifs6_reass_ok);
 	frag6_icmp6_paramprob_error(&diq6);
 	VERIFY(MBUFQ_EMPTY(&diq6));
@@ -916,17 +1021,11 @@ insert:
 done:
 	VERIFY(m == NULL);
 	*mp = m;
-	if (!locked) {
-		if (frag6_nfragpackets == 0) {
-			frag6_icmp6_paramprob_error(&diq6);
-			VERIFY(MBUFQ_EMPTY(&diq6));
-			return IPPROTO_DONE;
-		}
-		lck_mtx_lock(&ip6qlock);
+	if (locked) {
+		lck_mtx_unlock(&qs->ip6qs_lock);
 	}
 	/* arm the purge timer if not already and if there's work to do */
 	frag6_sched_timeout();
-	lck_mtx_unlock(&ip6qlock);
 	frag6_icmp6_paramprob_error(&diq6);
 	VERIFY(MBUFQ_EMPTY(&diq6));
 	return IPPROTO_DONE;
@@ -935,7 +1034,7 @@ dropfrag:
 	ip6stat.ip6s_fragdropped++;
 	/* arm the purge timer if not already and if there's work to do */
 	frag6_sched_timeout();
-	lck_mtx_unlock(&ip6qlock);
+	lck_mtx_unlock(&qs->ip6qs_lock);
 	in6_ifstat_inc(dstifp, ifs6_reass_fail);
 	m_freem(m);
 	*mp = NULL;
@@ -955,12 +1054,13 @@ dropfrag:
  * It leaves the fragment header object (q6) intact.
  */
 static void
-frag6_purgef(struct ip6q *q6, struct fq6_head *dfq6, struct fq6_head *diq6)
+frag6_purgef(struct ip6q_shard *qs, struct ip6q *q6, struct fq6_head *dfq6,
+    struct fq6_head *diq6)
 {
 	struct ip6asfrag *af6 = NULL;
 	struct ip6asfrag *down6 = NULL;
 
-	LCK_MTX_ASSERT(&ip6qlock, LCK_MTX_ASSERT_OWNED);
+	LCK_MTX_ASSERT(&qs->ip6qs_lock, LCK_MTX_ASSERT_OWNED);
 
 	for (af6 = q6->ip6q_down; af6 != (struct ip6asfrag *)q6;
 	    af6 = down6) {
@@ -992,6 +1092,27 @@ frag6_purgef(struct ip6q *q6, struct fq6_head *dfq6, struct fq6_head *diq6)
 		}
 		ip6af_free(af6);
 	}
+	VERIFY(qs->ip6qs_bytes >= q6->ip6q_bytes);
+	qs->ip6qs_bytes -= q6->ip6q_bytes;
+	q6->ip6q_bytes = 0;
+	q6->ip6q_nbytes = 0;
+}
+
+/*
+ * Remove a fragment header object, whose fragments have already been
+ * dequeued, from its shard and free it.
+ */
+static void
+frag6_unlinkf(struct ip6q_shard *qs, struct ip6q *q6)
+{
+	LCK_MTX_ASSERT(&qs->ip6qs_lock, LCK_MTX_ASSERT_OWNED);
+
+	VERIFY(qs->ip6qs_bytes >= q6->ip6q_bytes);
+	qs->ip6qs_bytes -= q6->ip6q_bytes;
+	frag6_remque(q6);
+	os_atomic_dec(&frag6_nfragpackets, relaxed);
+	os_atomic_sub(&frag6_nfrags, q6->ip6q_nfrag, relaxed);
+	ip6q_free(q6);
 }
 
 /*
@@ -1005,24 +1126,50 @@ frag6_purgef(struct ip6q *q6, struct fq6_head *dfq6, struct fq6_head *diq6)
  * It also remove the fragment header object from the queue and frees it.
  */
 static void
-frag6_freef(struct ip6q *q6, struct fq6_head *dfq6, struct fq6_head *diq6)
+frag6_freef(struct ip6q_shard *qs, struct ip6q *q6, struct fq6_head *dfq6,
+    struct fq6_head *diq6)
 {
-	frag6_purgef(q6, dfq6, diq6);
-	frag6_remque(q6);
-	frag6_nfragpackets--;
-	frag6_nfrags -= q6->ip6q_nfrag;
-	ip6q_free(q6);
+	frag6_purgef(qs, q6, dfq6, diq6);
+	frag6_unlinkf(qs, q6);
+}
+
+/*
+ * Bring a shard back within its memory budget by evicting its oldest
+ * datagrams, other than the one currently being reassembled.  Returns
+ * FALSE if the budget still cannot be met.
+ */
+static boolean_t
+frag6_shard_reclaim(struct ip6q_shard *qs, struct ip6q *keep,
+    struct fq6_head *dfq6)
+{
+	struct ip6q *q6;
+
+	LCK_MTX_ASSERT(&qs->ip6qs_lock, LCK_MTX_ASSERT_OWNED);
+
+	while (ip6q_shard_maxbytes != 0 &&
+	    qs->ip6qs_bytes > ip6q_shard_maxbytes) {
+		/* new reassembly queues are inserted at the head */
+		q6 = qs->ip6qs_head.ip6q_prev;
+		if (q6 == keep) {
+			q6 = q6->ip6q_prev;
+		}
+		if (q6 == &qs->ip6qs_head) {
+			return FALSE;
+		}
+		ip6stat.ip6s_fragoverflow++;
+		frag6_freef(qs, q6, dfq6, NULL);
+	}
+	return TRUE;
 }
 
 /*
  * Put an ip fragment on a reassembly chain.
  * Like insque, but pointers in middle of structure.
+ * The list primitives below are called with the shard lock held.
  */
 void
 frag6_enq(struct ip6asfrag *af6, struct ip6asfrag *up6)
 {
-	LCK_MTX_ASSERT(&ip6qlock, LCK_MTX_ASSERT_OWNED);
-
 	af6->ip6af_up = up6;
 	af6->ip6af_down = up6->ip6af_down;
 	up6->ip6af_down->ip6af_up = af6;
@@ -1035,8 +1182,6 @@ frag6_enq(struct ip6asfrag *af6, struct ip6asfrag *up6)
 void
 frag6_deq(struct ip6asfrag *af6)
 {
-	LCK_MTX_ASSERT(&ip6qlock, LCK_MTX_ASSERT_OWNED);
-
 	af6->ip6af_up->ip6af_down = af6->ip6af_down;
 	af6->ip6af_down->ip6af_up = af6->ip6af_up;
 }
@@ -1044,8 +1189,6 @@ frag6_deq(struct ip6asfrag *af6)
 void
 frag6_insque(struct ip6q *new, struct ip6q *old)
 {
-	LCK_MTX_ASSERT(&ip6qlock, LCK_MTX_ASSERT_OWNED);
-
 	new->ip6q_prev = old;
 	new->ip6q_next = old->ip6q_next;
 	old->ip6q_next->ip6q_prev = new;
@@ -1055,8 +1198,6 @@ frag6_insque(struct ip6q *new, struct ip6q *old)
 void
 frag6_remque(struct ip6q *p6)
 {
-	LCK_MTX_ASSERT(&ip6qlock, LCK_MTX_ASSERT_OWNED);
-
 	p6->ip6q_prev->ip6q_next = p6->ip6q_next;
 	p6->ip6q_next->ip6q_prev = p6->ip6q_prev;
 }
@@ -1072,7 +1213,9 @@ frag6_timeout(void *arg)
 #pragma unused(arg)
 	struct fq6_head dfq6, diq6;
 	struct fq6_head *diq6_tmp = NULL;
-	struct ip6q *q6;
+	struct ip6q_shard *qs;
+	struct ip6q *q6, *head;
+	int i;
 
 	MBUFQ_INIT(&dfq6);      /* for deferred frees */
 	MBUFQ_INIT(&diq6);      /* for deferred ICMP time exceeded errors */
@@ -1084,10 +1227,12 @@ frag6_timeout(void *arg)
 	 */
 	net_update_uptime();
 
-	lck_mtx_lock(&ip6qlock);
-	q6 = ip6q.ip6q_next;
-	if (q6) {
-		while (q6 != &ip6q) {
+	for (i = 0; i < IP6REASS_NSHARDS; i++) {
+		qs = &ip6q_shards[i];
+		head = &qs->ip6qs_head;
+		lck_mtx_lock(&qs->ip6qs_lock);
+		q6 = head->ip6q_next;
+		while (q6 != head) {
 			--q6->ip6q_ttl;
 			q6 = q6->ip6q_next;
 			if (q6->ip6q_prev->ip6q_ttl == 0) {
@@ -1099,33 +1244,34 @@ frag6_timeout(void *arg)
 				 */
 				diq6_tmp = (q6->ip6q_prev->ip6q_flags & IP6QF_DIRTY) ?
 				    NULL : &diq6;
-				frag6_freef(q6->ip6q_prev, &dfq6, diq6_tmp);
+				frag6_freef(qs, q6->ip6q_prev, &dfq6, diq6_tmp);
 			}
 		}
-	}
-	/*
-	 * If we are over the maximum number of fragments
-	 * (due to the limit being lowered), drain off
-	 * enough to get down to the new limit.
-	 */
-	if (ip6_maxfragpackets >= 0) {
-		while (frag6_nfragpackets > (unsigned)ip6_maxfragpackets &&
-		    ip6q.ip6q_prev) {
+		/*
+		 * If we are over the maximum number of fragments
+		 * (due to the limit being lowered), drain off
+		 * enough to get down to the new limit.
+		 */
+		while (ip6_maxfragpackets >= 0 &&
+		    frag6_nfragpackets > (unsigned)ip6_maxfragpackets &&
+		    head->ip6q_prev != head) {
 			ip6stat.ip6s_fragoverflow++;
 			/* XXX in6_ifstat_inc(ifp, ifs6_reass_fail) */
 			/*
 			 * Avoid sending ICMPv6 Time Exceeded for fragment headers
 			 * that are marked dirty.
 			 */
-			diq6_tmp = (ip6q.ip6q_prev->ip6q_flags & IP6QF_DIRTY) ?
+			diq6_tmp = (head->ip6q_prev->ip6q_flags & IP6QF_DIRTY) ?
 			    NULL : &diq6;
-			frag6_freef(ip6q.ip6q_prev, &dfq6, diq6_tmp);
+			frag6_freef(qs, head->ip6q_prev, &dfq6, diq6_tmp);
 		}
+		/* likewise if the memory budget was lowered */
+		(void) frag6_shard_reclaim(qs, NULL, &dfq6);
+		lck_mtx_unlock(&qs->ip6qs_lock);
 	}
 	/* re-arm the purge timer if there's work to do */
-	frag6_timeout_run = 0;
+	os_atomic_store(&frag6_timeout_run, 0, relaxed);
 	frag6_sched_timeout();
-	lck_mtx_unlock(&ip6qlock);
 
 	/* free fragments that need to be freed */
 	if (!MBUFQ_EMPTY(&dfq6)) {
@@ -1138,13 +1284,14 @@ frag6_timeout(void *arg)
 	VERIFY(MBUFQ_EMPTY(&diq6));
 }
 
+/*
+ * May be called with or without a shard lock held.
+ */
 static void
 frag6_sched_timeout(void)
 {
-	LCK_MTX_ASSERT(&ip6qlock, LCK_MTX_ASSERT_OWNED);
-
-	if (!frag6_timeout_run && frag6_nfragpackets > 0) {
-		frag6_timeout_run = 1;
+	if (frag6_nfragpackets > 0 &&
+	    os_atomic_cmpxchg(&frag6_timeout_run, 0, 1, relaxed)) {
 		timeout(frag6_timeout, NULL, hz);
 	}
 }
@@ -1157,23 +1304,30 @@ frag6_drain(void)
 {
 	struct fq6_head dfq6, diq6;
 	struct fq6_head *diq6_tmp = NULL;
+	struct ip6q_shard *qs;
+	struct ip6q *head;
+	int i;
 
 	MBUFQ_INIT(&dfq6);      /* for deferred frees */
 	MBUFQ_INIT(&diq6);      /* for deferred ICMP time exceeded errors */
 
-	lck_mtx_lock(&ip6qlock);
-	while (ip6q.ip6q_next != &ip6q) {
-		ip6stat.ip6s_fragdropped++;
-		/* XXX in6_ifstat_inc(ifp, ifs6_reass_fail) */
-		/*
-		 * Avoid sending ICMPv6 Time Exceeded for fragment headers
-		 * that are marked dirty.
-		 */
-		diq6_tmp = (ip6q.ip6q_next->ip6q_flags & IP6QF_DIRTY) ?
-		    NULL : &diq6;
-		frag6_freef(ip6q.ip6q_next, &dfq6, diq6_tmp);
+	for (i = 0; i < IP6REASS_NSHARDS; i++) {
+		qs = &ip6q_shards[i];
+		head = &qs->ip6qs_head;
+		lck_mtx_lock(&qs->ip6qs_lock);
+		while (head->ip6q_next != head) {
+			ip6stat.ip6s_fragdropped++;
+			/* XXX in6_ifstat_inc(ifp, ifs6_reass_fail) */
+			/*
+			 * Avoid sending ICMPv6 Time Exceeded for fragment headers
+			 * that are marked dirty.
+			 */
+			diq6_tmp = (head->ip6q_next->ip6q_flags & IP6QF_DIRTY) ?
+			    NULL : &diq6;
+			frag6_freef(qs, head->ip6q_next, &dfq6, diq6_tmp);
+		}
+		lck_mtx_unlock(&qs->ip6qs_lock);
 	}
-	lck_mtx_unlock(&ip6qlock);
 
 	/* free fragments that need to be freed */
 	if (!MBUFQ_EMPTY(&dfq6)) {
@@ -1275,6 +1429,11 @@ ip6q_updateparams(void)
 	if (ip6_maxfrags == 0) {
 		ip6af_limit = 1;
 	}
+	/*
+	 * Split the memory budget evenly across the shards; zero means
+	 * fragment memory is bounded only by the limits above.
+	 */
+	ip6q_shard_maxbytes = ip6q_maxbytes / IP6REASS_NSHARDS;
 	/*
 	 * Arm the purge timer if not already and if there's work to do
 	 */
@@ -1328,3 +1487,31 @@ done:
 	lck_mtx_unlock(&ip6qlock);
 	return error;
 }
+
+static int
+sysctl_maxfragbytes SYSCTL_HANDLER_ARGS
+{
+#pragma unused(arg1, arg2)
+	int error, i;
+
+	lck_mtx_lock(&ip6qlock);
+	i = ip6q_maxbytes;
+	error = sysctl_handle_int(oidp, &i, 0, req);
+	if (error || req->newptr == USER_ADDR_NULL) {
+		goto done;
+	}
+	/*
+	 * Impose bounds; every shard must be able to hold at least one
+	 * datagram of the maximum size, unless the budget is disabled.
+	 */
+	if (i < 0 || (i != 0 && i < IP6REASS_NSHARDS * IPV6_MAXPACKET) ||
+	    (uint64_t)i > ((uint64_t)nmbclusters * MCLBYTES) / 2) {
+		error = EINVAL;
+		goto done;
+	}
+	ip6q_maxbytes = i;
+	ip6q_updateparams();
+done:
+	lck_mtx_unlock(&ip6qlock);
+	return error;
+}
@@ -126,6 +126,7 @@
 #include <net/if_var.h>
 
 #include <kern/kern_types.h>
+#include <kern/smr.h>
 #include <kern/zalloc.h>
 
 #if IPSEC
@@ -1241,14 +1242,14 @@ in6_pcblookup_local(struct inpcbinfo *pcbinfo, struct in6_addr *laddr,
 	struct inpcbport *phd;
 
 	if (!wild_okay) {
-		struct inpcbhead *head;
+		struct smrq_list_head *head;
 		/*
 		 * Look for an unconnected (wildcard foreign addr) PCB that
 		 * matches the local address and port we're looking for.
 		 */
 		head = &pcbinfo->ipi_hashbase[INP_PCBHASH(INADDR_ANY, lport, 0,
 		    pcbinfo->ipi_hashmask)];
-		LIST_FOREACH(inp, head, inp_hash) {
+		smrq_serialized_foreach(inp, head, inp_hash) {
 			if (!(inp->inp_vflag & INP_IPV6)) {
 				continue;
 			}
@@ -1373,7 +1374,7 @@ in6_pcblookup_hash_exists(struct inpcbinfo *pcbinfo, struct in6_addr *faddr,
     u_int fport_arg, uint32_t fifscope, struct in6_addr *laddr, u_int lport_arg, uint32_t lifscope, int wildcard,
     uid_t *uid, gid_t *gid, struct ifnet *ifp, bool relaxed)
 {
-	struct inpcbhead *head;
+	struct smrq_list_head *head;
 	struct inpcb *inp;
 	uint16_t fport = (uint16_t)fport_arg, lport = (uint16_t)lport_arg;
 	int found;
@@ -1388,7 +1389,7 @@ in6_pcblookup_hash_exists(struct inpcbinfo *pcbinfo, struct in6_addr *faddr,
 	 */
 	head = &pcbinfo->ipi_hashbase[INP_PCBHASH(faddr->s6_addr32[3] /* XXX */,
 	    lport, fport, pcbinfo->ipi_hashmask)];
-	LIST_FOREACH(inp, head, inp_hash) {
+	smrq_serialized_foreach(inp, head, inp_hash) {
 		if (!(inp->inp_vflag & INP_IPV6)) {
 			continue;
 		}
@@ -1428,7 +1429,7 @@ in6_pcblookup_hash_exists(struct inpcbinfo *pcbinfo, struct in6_addr *faddr,
 
 		head = &pcbinfo->ipi_hashbase[INP_PCBHASH(INADDR_ANY, lport, 0,
 		    pcbinfo->ipi_hashmask)];
-		LIST_FOREACH(inp, head, inp_hash) {
+		smrq_serialized_foreach(inp, head, inp_hash) {
 			if (!(inp->inp_vflag & INP_IPV6)) {
 				continue;
 			}
@@ -1482,6 +1483,65 @@ in6_pcblookup_hash_exists(struct inpcbinfo *pcbinfo, struct in6_addr *faddr,
 	return 0;
 }
 
+/*
+ * Exact match lookup without ipi_lock; the IPv6 counterpart of
+ * in_pcblookup_hash_smr().  Returns false if the caller must repeat
+ * the lookup under the lock.
+ */
+static bool
+in6_pcblookup_hash_smr(struct inpcbinfo *pcbinfo, struct in6_addr *faddr,
+    uint16_t fport, uint32_t fifscope, struct in6_addr *laddr, uint16_t lport,
+    uint32_t lifscope, int wildcard, struct ifnet *ifp, struct inpcb **inpp)
+{
+	struct smrq_list_head *head;
+	struct inpcb *inp, *match = NULL;
+	bool done;
+	uint32_t seq;
+
+	head = &pcbinfo->ipi_hashbase[INP_PCBHASH(faddr->s6_addr32[3] /* XXX */,
+	    lport, fport, pcbinfo->ipi_hashmask)];
+
+	seq = in_pcbhash_smr_enter(pcbinfo);
+	smrq_entered_foreach(inp, head, inp_hash) {
+		if (!(inp->inp_vflag & INP_IPV6)) {
+			continue;
+		}
+		if (inp->inp_fport != fport || inp->inp_lport != lport ||
+		    !in6_are_addr_equal_scoped(&inp->in6p_faddr, faddr, inp->inp_fifscope, fifscope) ||
+		    !in6_are_addr_equal_scoped(&inp->in6p_laddr, laddr, inp->inp_lifscope, lifscope)) {
+			continue;
+		}
+		if (inp_restricted_recv(inp, ifp)) {
+			continue;
+		}
+#if NECP
+		if ((inp->inp_flags2 & INP2_EXTERNAL_PORT) &&
+		    IN6_IS_ADDR_UNSPECIFIED(&inp->in6p_faddr)) {
+			smr_leave(&inpcb_smr);
+			return false;
+		}
+#endif /* NECP */
+		match = inp;
+		break;
+	}
+
+	if (!in_pcbhash_smr_valid(pcbinfo, seq)) {
+		done = false;
+	} else if (match == NULL) {
+		done = !wildcard;
+	} else {
+		if (in_pcb_checkstate(match, WNT_ACQUIRE, 0) == WNT_STOPUSING) {
+			/* it's there but dead, say it isn't found */
+			match = NULL;
+		}
+		done = true;
+	}
+	smr_leave(&inpcb_smr);
+
+	*inpp = match;
+	return done;
+}
+
 /*
  * Lookup PCB in hash list.
  */
@@ -1490,10 +1550,16 @@ in6_pcblookup_hash(struct inpcbinfo *pcbinfo, struct in6_addr *faddr,
     u_int fport_arg, uint32_t fifscope, struct in6_addr *laddr, u_int lport_arg, uint32_t lifscope, int wildcard,
     struct ifnet *ifp)
 {
-	struct inpcbhead *head;
+	struct smrq_list_head *head;
 	struct inpcb *inp;
 	uint16_t fport = (uint16_t)fport_arg, lport = (uint16_t)lport_arg;
 
+	if (inpcb_smr_lookup &&
+	    in6_pcblookup_hash_smr(pcbinfo, faddr, fport, fifscope, laddr,
+	    lport, lifscope, wildcard, ifp, &inp)) {
+		return inp;
+	}
+
 	lck_rw_lock_shared(&pcbinfo->ipi_lock);
 
 	/*
@@ -1501,7 +1567,7 @@ in6_pcblookup_hash(struct inpcbinfo *pcbinfo, struct in6_addr *faddr,
 	 */
 	head = &pcbinfo->ipi_hashbase[INP_PCBHASH(faddr->s6_addr32[3] /* XXX */,
 	    lport, fport, pcbinfo->ipi_hashmask)];
-	LIST_FOREACH(inp, head, inp_hash) {
+	smrq_serialized_foreach(inp, head, inp_hash) {
 		if (!(inp->inp_vflag & INP_IPV6)) {
 			continue;
 		}
@@ -1539,7 +1605,7 @@ in6_pcblookup_hash(struct inpcbinfo *pcbinfo, struct in6_addr *faddr,
 
 		head = &pcbinfo->ipi_hashbase[INP_PCBHASH(INADDR_ANY, lport, 0,
 		    pcbinfo->ipi_hashmask)];
-		LIST_FOREACH(inp, head, inp_hash) {
+		smrq_serialized_foreach(inp, head, inp_hash) {
 			if (!(inp->inp_vflag & INP_IPV6)) {
 				continue;
 			}
@@ -119,6 +119,8 @@ struct  ip6q {
 	uint32_t        ip6q_csum;      /* partial checksum value */
 	uint32_t        ip6q_flags;
 	uint32_t        ip6q_dst_ifscope, ip6q_src_ifscope;
+	uint32_t        ip6q_nbytes;    /* # payload bytes held in fragments */
+	uint32_t        ip6q_bytes;     /* mbuf memory held by fragments */
 #define IP6QF_DIRTY    0x00000001
 };
 
@@ -172,12 +172,6 @@ enum cuckoo_resize_ops {
  *
  */
 
-/* hash might be zero, so always use _node == NULL to test empty slot */
-struct _slot {
-	uint32_t                _hash;
-	struct cuckoo_node      *_node;
-};
-
 /*
  * Cuckoo hashtable cache line awareness:
  *   - ARM platform has 128B CPU cache line.
@@ -186,15 +180,22 @@ struct _slot {
  *
  * Thus cuckoo_hashtable use 128B as bucket size to make best use CPU cache
  * resource.
+ *
+ * Slot hashes and nodes are kept in separate arrays, so that the hashes of
+ * all slots can be compared against a key's hash a 64-bit word at a time
+ * (see __bucket_match()).  Hash might be zero, so always use a NULL node to
+ * test for an empty slot.
  */
 #define _CHT_CACHELINE_CHUNK 128
 #define _CHT_SLOT_INVAL UINT8_MAX
-static const uint8_t _CHT_BUCKET_SLOTS =
-    ((_CHT_CACHELINE_CHUNK - sizeof(lck_mtx_t) - sizeof(uint8_t)) /
-    sizeof(struct _slot));
+#define _CHT_BUCKET_SLOTS 8
 
 struct _bucket {
-	struct _slot            _slots[_CHT_BUCKET_SLOTS];
+	union {
+		uint32_t        _hashes[_CHT_BUCKET_SLOTS];
+		uint64_t        _hash_words[_CHT_BUCKET_SLOTS / 2];
+	};
+	struct cuckoo_node      *_nodes[_CHT_BUCKET_SLOTS];
 	decl_lck_mtx_data(, _lock);
 	uint8_t                 _inuse;
 } __attribute__((aligned(_CHT_CACHELINE_CHUNK)));
@@ -220,19 +221,23 @@ struct cuckoo_hashtable {
 } __attribute__((aligned(_CHT_CACHELINE_CHUNK)));
 
 static_assert(sizeof(struct _bucket) <= _CHT_CACHELINE_CHUNK);
+static_assert(_CHT_BUCKET_SLOTS % 2 == 0 && _CHT_BUCKET_SLOTS <= 32);
+/* __bucket_match() maps the low half of each hash word to the even slot */
+static_assert(BYTE_ORDER == LITTLE_ENDIAN);
 
 static inline void
-__slot_set(struct _slot *slt, uint32_t hash, struct cuckoo_node *node)
+__slot_set(struct _bucket *b, uint32_t slot_idx, uint32_t hash,
+    struct cuckoo_node *node)
 {
-	slt->_hash = hash;
-	slt->_node = node;
+	b->_hashes[slot_idx] = hash;
+	b->_nodes[slot_idx] = node;
 }
 
 static inline void
-__slot_reset(struct _slot *slt)
+__slot_reset(struct _bucket *b, uint32_t slot_idx)
 {
-	slt->_hash = 0;
-	slt->_node = NULL;
+	b->_hashes[slot_idx] = 0;
+	b->_nodes[slot_idx] = NULL;
 }
 
 static inline uint32_t
@@ -270,16 +275,34 @@ __bucket_idx(struct cuckoo_hashtable *h, struct _bucket *b)
 }
 #endif /* SK_LOG */
 
-static inline struct _slot *
-__bucket_slot(struct _bucket *b, uint32_t slot_idx)
+static inline bool
+__slot_empty(struct _bucket *b, uint32_t slot_idx)
 {
-	return &b->_slots[slot_idx];
+	return b->_nodes[slot_idx] == NULL;
 }
 
-static inline bool
-__slot_empty(struct _slot *s)
+/*
+ * Compare the hashes of all slots in a bucket against hash, two slots per
+ * 64-bit word, and return a bitmask of the slots that match.  A 32-bit lane
+ * is zero iff adding 0x7fffffff to its low 31 bits leaves the top bit clear
+ * and the top bit was clear to begin with; the add can't carry into the
+ * next lane, so there are no false positives.  Empty slots (hash 0) may
+ * match; callers skip them by their NULL node.
+ */
+static inline uint32_t
+__bucket_match(struct _bucket *b, uint32_t hash)
 {
-	return s->_node == NULL;
+	const uint64_t low31 = 0x7fffffff7fffffffULL;
+	const uint64_t pattern = hash * 0x0000000100000001ULL;
+	uint32_t mask = 0;
+	uint64_t x, t;
+
+	for (uint32_t i = 0; i < _CHT_BUCKET_SLOTS / 2; i++) {
+		x = b->_hash_words[i] ^ pattern;
+		t = ~(((x & low31) + low31) | x | low31);
+		mask |= (uint32_t)(((t >> 31) & 1) | ((t >> 62) & 2)) << (2 * i);
+	}
+	return mask;
 }
 
 static inline uint32_t
@@ -478,23 +501,24 @@ static inline struct cuckoo_node *
 __find_in_bucket(struct cuckoo_hashtable *h, struct _bucket *b, void *key,
     uint32_t hash)
 {
-	uint32_t i;
+	uint32_t i, match;
 	struct cuckoo_node *node = NULL;
 
 	__lock_bucket(b);
 	if (b->_inuse == 0) {
 		goto done;
 	}
-	for (i = 0; i < _CHT_BUCKET_SLOTS; i++) {
-		if (b->_slots[i]._hash == hash) {
-			node = b->_slots[i]._node;
-			while (node != NULL) {
-				if (h->_obj_cmp(node, key) == 0) {
-					h->_obj_retain(node);
-					goto done;
-				}
-				node = cuckoo_node_next(node);
+	match = __bucket_match(b, hash);
+	while (match != 0) {
+		i = __builtin_ctz(match);
+		match &= match - 1;
+		node = b->_nodes[i];
+		while (node != NULL) {
+			if (h->_obj_cmp(node, key) == 0) {
+				h->_obj_retain(node);
+				goto done;
 			}
+			node = cuckoo_node_next(node);
 		}
 	}
 
@@ -528,6 +552,53 @@ done:
 	return node;
 }
 
+static inline void
+__prefetch_bucket(struct _bucket *b)
+{
+	__builtin_prefetch(b);
+	__builtin_prefetch((uint8_t *)b + _CHT_CACHELINE_CHUNK / 2);
+}
+
+/*
+ * Look up a burst of keys.  The primary and alternate buckets of a group
+ * of keys are prefetched before any of them is probed, so that the cache
+ * misses of the group overlap instead of being taken one key at a time.
+ */
+#define _CHT_FIND_BATCH 16
+
+/* will return nodes retained */
+uint32_t
+cuckoo_hashtable_find_batch(struct cuckoo_hashtable *h, void **keys,
+    const uint32_t *hashes, struct cuckoo_node **nodes, uint32_t n)
+{
+	uint32_t i, j, end, found = 0;
+
+	__rlock_table(h);
+
+	for (i = 0; i < n; i = end) {
+		end = MIN(n, i + _CHT_FIND_BATCH);
+		for (j = i; j < end; j++) {
+			__prefetch_bucket(__prim_bucket(h, hashes[j]));
+			__prefetch_bucket(__alt_bucket(h, hashes[j]));
+		}
+		for (j = i; j < end; j++) {
+			nodes[j] = __find_in_bucket(h,
+			    __prim_bucket(h, hashes[j]), keys[j], hashes[j]);
+			if (nodes[j] == NULL) {
+				nodes[j] = __find_in_bucket(h,
+				    __alt_bucket(h, hashes[j]), keys[j],
+				    hashes[j]);
+			}
+			if (nodes[j] != NULL) {
+				found++;
+			}
+		}
+	}
+
+	__unrlock_table(h);
+	return found;
+}
+
 /*
  * To add a key into cuckoo_hashtable:
  *   1. First it searches the key's two candidate buckets b1, b2
@@ -551,16 +622,15 @@ __add_to_bucket(struct cuckoo_hashtable *h, struct _bucket *b,
 		goto done;
 	}
 	for (uint8_t i = 0; i < _CHT_BUCKET_SLOTS; i++) {
-		struct _slot *s = __bucket_slot(b, i);
-		if (__slot_empty(s)) {
+		if (__slot_empty(b, i)) {
 			if (avail_i == _CHT_SLOT_INVAL) {
 				avail_i = i;
 			}
 		} else {
 			/* chain to existing slot with same hash */
-			if (__improbable(s->_hash == hash)) {
-				ASSERT(s->_node != NULL);
-				ret = cuckoo_node_chain(s->_node, node);
+			if (__improbable(b->_hashes[i] == hash)) {
+				ASSERT(b->_nodes[i] != NULL);
+				ret = cuckoo_node_chain(b->_nodes[i], node);
 				if (ret != 0) {
 					goto done;
 				}
@@ -574,8 +644,7 @@ __add_to_bucket(struct cuckoo_hashtable *h, struct _bucket *b,
 	}
 	if (avail_i != _CHT_SLOT_INVAL) {
 		h->_obj_retain(node);
-		b->_slots[avail_i]._hash = hash;
-		b->_slots[avail_i]._node = node;
+		__slot_set(b, avail_i, hash, node);
 		b->_inuse++;
 		cht_debug("hash %x node %p inserted [%zu][%d]", hash, node,
 		    __bucket_idx(h, b), avail_i);
@@ -640,14 +709,13 @@ cuckoo_move(struct cuckoo_hashtable *h, struct cuckoo_node *node,
 		 * 1. from_bkt[from_slot]'s alternative bucket is still to_bkt
 		 * 3. to_bkt[to_slot] is still vacant
 		 */
-		alt_bkt = __alt_bucket(h, from_bkt->_slots[from_slot]._hash);
-		if (alt_bkt != to_bkt ||
-		    !__slot_empty(__bucket_slot(to_bkt, to_slot))) {
+		alt_bkt = __alt_bucket(h, from_bkt->_hashes[from_slot]);
+		if (alt_bkt != to_bkt || !__slot_empty(to_bkt, to_slot)) {
 			__unlock_bucket(from_bkt);
 			__unlock_bucket(to_bkt);
 			cht_warn("cuckoo move path invalid: %s %s",
 			    alt_bkt != to_bkt ? "alt_bkt != to_bkt" : "",
-			    !__slot_empty(__bucket_slot(to_bkt, to_slot)) ?
+			    !__slot_empty(to_bkt, to_slot) ?
 			    "!slot_empty(to_bkt, to_slot)" : "");
 			return EINVAL;
 		}
@@ -656,13 +724,14 @@ cuckoo_move(struct cuckoo_hashtable *h, struct cuckoo_node *node,
 		    from_bkt - h->_buckets, from_slot, to_bkt - h->_buckets,
 		    to_slot);
 
-		ASSERT(to_bkt->_slots[to_slot]._node == NULL);
-		ASSERT(to_bkt->_slots[to_slot]._hash == 0);
+		ASSERT(to_bkt->_nodes[to_slot] == NULL);
+		ASSERT(to_bkt->_hashes[to_slot] == 0);
 
 		/* move entry backward */
-		to_bkt->_slots[to_slot] = from_bkt->_slots[from_slot];
+		__slot_set(to_bkt, to_slot, from_bkt->_hashes[from_slot],
+		    from_bkt->_nodes[from_slot]);
 		to_bkt->_inuse++;
-		__slot_reset(&from_bkt->_slots[from_slot]);
+		__slot_reset(from_bkt, from_slot);
 		from_bkt->_inuse--;
 
 		__unlock_bucket(to_bkt);
@@ -676,13 +745,13 @@ cuckoo_move(struct cuckoo_hashtable *h, struct cuckoo_node *node,
 	ASSERT(curr_node->prev_slot_idx == _CHT_SLOT_INVAL);
 
 	/* if root slot is no longer valid */
-	if (to_bkt->_slots[to_slot]._node != NULL) {
+	if (!__slot_empty(to_bkt, to_slot)) {
 		__unlock_bucket(to_bkt);
 		return EINVAL;
 	}
 
 	to_bkt->_inuse++;
-	__slot_set(&to_bkt->_slots[to_slot], hash, node);
+	__slot_set(to_bkt, to_slot, hash, node);
 	h->_obj_retain(node);
 	__unlock_bucket(to_bkt);
 
@@ -716,8 +785,7 @@ cuckoo_probe(struct cuckoo_hashtable *h, struct cuckoo_node *node,
 		b = __get_bucket(h, queue[head].bkt_idx);
 		avail_i = _CHT_SLOT_INVAL;
 		for (uint8_t i = 0; i < _CHT_BUCKET_SLOTS; i++) {
-			struct _slot *s = __bucket_slot(b, i);
-			if (__slot_empty(s)) {
+			if (__slot_empty(b, i)) {
 				if (avail_i == _CHT_SLOT_INVAL) {
 					avail_i = i;
 				}
@@ -728,9 +796,9 @@ cuckoo_probe(struct cuckoo_hashtable *h, struct cuckoo_node *node,
 			 * Another node with same hash could have been probed
 			 * into this bucket, chain to it.
 			 */
-			if (__improbable(s->_hash == hash)) {
-				ASSERT(s->_node != NULL);
-				ret = cuckoo_node_chain(s->_node, node);
+			if (__improbable(b->_hashes[i] == hash)) {
+				ASSERT(b->_nodes[i] != NULL);
+				ret = cuckoo_node_chain(b->_nodes[i], node);
 				if (ret != 0) {
 					goto done;
 				}
@@ -741,7 +809,8 @@ cuckoo_probe(struct cuckoo_hashtable *h, struct cuckoo_node *node,
 				goto done;
 			}
 
-			queue[tail].bkt_idx = __alt_hash(s->_hash) & h->_bitmask;
+			queue[tail].bkt_idx = __alt_hash(b->_hashes[i]) &
+			    h->_bitmask;
 			queue[tail].prev_node_idx = head;
 			queue[tail].prev_slot_idx = i;
 			tail++;
@@ -795,12 +864,11 @@ __foreach_node(struct cuckoo_hashtable *h, bool wlocked,
 			__lock_bucket(b);
 		}
 		for (uint32_t j = 0; j < _CHT_BUCKET_SLOTS; j++) {
-			struct _slot *s = __bucket_slot(b, j);
 			struct cuckoo_node *node = NULL, *next_node = NULL;
-			node = s->_node;
+			node = b->_nodes[j];
 			while (node != NULL) {
 				next_node = cuckoo_node_next(node);
-				node_handler(node, s->_hash);
+				node_handler(node, b->_hashes[j]);
 				node = next_node;
 			}
 		}
@@ -970,21 +1038,22 @@ static inline int
 __del_from_bucket(struct cuckoo_hashtable *h, struct _bucket *b,
     struct cuckoo_node *node, uint32_t hash)
 {
-	uint32_t i;
+	uint32_t i, match;
 
 	__lock_bucket(b);
-	for (i = 0; i < _CHT_BUCKET_SLOTS; i++) {
-		if (b->_slots[i]._hash == hash) {
-			if (cuckoo_node_del(&b->_slots[i]._node, node)) {
-				h->_obj_release(node);
-				OSAddAtomic(-1, &h->_n_entries);
-				if (__slot_empty(__bucket_slot(b, i))) {
-					b->_slots[i]._hash = 0;
-					b->_inuse--;
-				}
-				__unlock_bucket(b);
-				return 0;
+	match = __bucket_match(b, hash);
+	while (match != 0) {
+		i = __builtin_ctz(match);
+		match &= match - 1;
+		if (cuckoo_node_del(&b->_nodes[i], node)) {
+			h->_obj_release(node);
+			OSAddAtomic(-1, &h->_n_entries);
+			if (__slot_empty(b, i)) {
+				b->_hashes[i] = 0;
+				b->_inuse--;
 			}
+			__unlock_bucket(b);
+			return 0;
 		}
 	}
 	__unlock_bucket(b);
@@ -1062,8 +1131,8 @@ cuckoo_hashtable_health_check(struct cuckoo_hashtable *h)
 		b = &h->_buckets[i];
 		uint8_t inuse = 0;
 		for (j = 0; j < _CHT_BUCKET_SLOTS; j++) {
-			hash = b->_slots[j]._hash;
-			node = b->_slots[j]._node;
+			hash = b->_hashes[j];
+			node = b->_nodes[j];
 			if (node != NULL) {
 				inuse++;
 			}
@@ -1115,8 +1184,8 @@ cuckoo_hashtable_dump(struct cuckoo_hashtable *h)
 		printf("%d\t", i);
 		b = &h->_buckets[i];
 		for (j = 0; j < _CHT_BUCKET_SLOTS; j++) {
-			hash = b->_slots[j]._hash;
-			node = b->_slots[j]._node;
+			hash = b->_hashes[j];
+			node = b->_nodes[j];
 			printf("0x%08x(%p) ", hash, node);
 		}
 		printf("\n");
@@ -92,6 +92,8 @@ int cuckoo_hashtable_del(struct cuckoo_hashtable *h, struct cuckoo_node *node,
     uint32_t key);
 struct cuckoo_node *cuckoo_hashtable_find_with_hash(struct cuckoo_hashtable *h,
     void *key, uint32_t hv);
+uint32_t cuckoo_hashtable_find_batch(struct cuckoo_hashtable *h, void **keys,
+    const uint32_t *hashes, struct cuckoo_node **nodes, uint32_t n);
 
 /*
  * There is no guarantee that keys concurrently operated would be returned by
@@ -188,6 +188,87 @@ cht_obj_fini()
 	sk_free_type_array(struct cht_obj, CHT_OBJ_MAX, cht_objs);
 }
 
+#define CHT_BATCH_MAX   64
+
+static void
+cht_batch_find_check(void)
+{
+	void *keys[CHT_BATCH_MAX];
+	uint32_t hashes[CHT_BATCH_MAX];
+	struct cuckoo_node *nodes[CHT_BATCH_MAX];
+	int64_t missing_key = -1;
+	struct cht_obj *co;
+	uint32_t i, j, n, found;
+
+	for (i = 0; i < CHT_OBJ_MAX; i += n) {
+		n = MIN(CHT_BATCH_MAX, CHT_OBJ_MAX - i);
+		for (j = 0; j < n; j++) {
+			co = &cht_objs[i + j];
+			keys[j] = &co->co_key;
+			hashes[j] = co->co_hash;
+		}
+		// mix a missing key into every batch
+		keys[n / 2] = &missing_key;
+
+		found = cuckoo_hashtable_find_batch(h, keys, hashes, nodes, n);
+		ASSERT(found == n - 1);
+		for (j = 0; j < n; j++) {
+			co = &cht_objs[i + j];
+			if (j == n / 2) {
+				ASSERT(nodes[j] == NULL);
+				continue;
+			}
+			ASSERT(nodes[j] == &co->co_cnode);
+			ASSERT(nodes[j] == cuckoo_hashtable_find_with_hash(h,
+			    keys[j], hashes[j]));
+			ASSERT(cht_obj_refcnt(co) == 4);
+			cht_obj_release(co);
+			cht_obj_release(co);
+		}
+	}
+}
+
+static void
+cht_lookup_bench(void)
+{
+	void *keys[CHT_BATCH_MAX];
+	uint32_t hashes[CHT_BATCH_MAX];
+	struct cuckoo_node *nodes[CHT_BATCH_MAX];
+	struct cuckoo_node *node;
+	struct cht_obj *co;
+	uint64_t start, single_ns, batch_ns;
+	uint32_t i, j, n, found;
+
+	start = mach_absolute_time();
+	for (i = 0; i < CHT_OBJ_MAX; i++) {
+		co = &cht_objs[i];
+		node = cuckoo_hashtable_find_with_hash(h, &co->co_key, co->co_hash);
+		ASSERT(node == &co->co_cnode);
+		cht_obj_release(co);
+	}
+	absolutetime_to_nanoseconds(mach_absolute_time() - start, &single_ns);
+
+	start = mach_absolute_time();
+	for (i = 0; i < CHT_OBJ_MAX; i += n) {
+		n = MIN(CHT_BATCH_MAX, CHT_OBJ_MAX - i);
+		for (j = 0; j < n; j++) {
+			co = &cht_objs[i + j];
+			keys[j] = &co->co_key;
+			hashes[j] = co->co_hash;
+		}
+		found = cuckoo_hashtable_find_batch(h, keys, hashes, nodes, n);
+		ASSERT(found == n);
+		for (j = 0; j < n; j++) {
+			cht_obj_release(&cht_objs[i + j]);
+		}
+	}
+	absolutetime_to_nanoseconds(mach_absolute_time() - start, &batch_ns);
+
+	SK_ERR("%u lookups: single %llu ns (%llu ns/op), batch %llu ns "
+	    "(%llu ns/op)", CHT_OBJ_MAX, single_ns, single_ns / CHT_OBJ_MAX,
+	    batch_ns, batch_ns / CHT_OBJ_MAX);
+}
+
 static void
 cht_basic_tests(void)
 {
@@ -270,6 +351,12 @@ cht_basic_tests(void)
 		cht_obj_release(co);
 	}
 
+	// batch find all objs
+	cht_batch_find_check();
+
+	// single vs. batch lookup cost
+	cht_lookup_bench();
+
 	// walk all objs
 	cuckoo_hashtable_foreach(h, ^(struct cuckoo_node *curr_node, uint32_t curr_hash) {
 		co = container_of(curr_node, struct cht_obj, co_cnode);
@@ -390,6 +477,12 @@ cht_concurrent_add_check(void)
 		cht_obj_release(co);
 	}
 
+	// batch find all objs
+	cht_batch_find_check();
+
+	// single vs. batch lookup cost
+	cht_lookup_bench();
+
 	// walk all objs
 	cuckoo_hashtable_foreach(h, ^(struct cuckoo_node *curr_node, uint32_t curr_hash) {
 		co = container_of(curr_node, struct cht_obj, co_cnode);
@@ -234,6 +234,7 @@ struct  namecache {
 	vnode_t                 nc_dvp;         /* vnode of parent of name */
 	vnode_t                 nc_vp;          /* vnode the name refers to */
 	unsigned int            nc_hashval;     /* hashval of stringname */
+	uint16_t                nc_lru;         /* LRU shard the entry is on */
 	const char              *nc_name;       /* pointer to segment name in string cache */
 };
 
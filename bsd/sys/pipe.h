@@ -112,16 +112,16 @@ struct pipebuf {
 };
 
 
-#ifdef PIPE_DIRECT
+#ifdef KERNEL
 /*
  * Information to support direct transfers between processes for pipes.
+ * The writer's buffer is mapped copy-on-write into the kernel at kva,
+ * and the reader copies out of it directly.
  */
 struct pipemapping {
 	vm_offset_t     kva;            /* kernel virtual address */
 	vm_size_t       cnt;            /* number of chars in buffer */
 	vm_size_t       pos;            /* current position of transfer */
-	int             npages;         /* number of pages */
-	vm_page_t       ms[PIPENPAGES]; /* pages in source process */
 };
 #endif
 
@@ -154,9 +154,7 @@ struct label;
  */
 struct pipe {
 	struct  pipebuf pipe_buffer;    /* data storage */
-#ifdef PIPE_DIRECT
 	struct  pipemapping pipe_map;   /* pipe mapping for direct I/O */
-#endif
 	struct  selinfo pipe_sel;       /* for compat with select */
 	pid_t   pipe_pgid;              /* information for async I/O */
 	struct  pipe *pipe_peer;        /* link with other direction */
@@ -379,6 +379,12 @@
 
 #define SIOCSIFDIRECTLINK _IOWR('i', 218, struct ifreq) /* set DIRECTLINK */
 
+#define SIOCGIFRSSQUEUES _IOWR('i', 220, struct ifreq) /* get # of RSS input queues in use */
+#define SIOCSIFRSSQUEUES _IOWR('i', 221, struct ifreq) /* set # of RSS input queues in use */
+
+#define SIOCSIFNOGRO    _IOWR('i', 222, struct ifreq) /* skip software receive aggregation */
+#define SIOCGIFNOGRO    _IOWR('i', 223, struct ifreq) /* get software receive aggregation state */
+
 #endif /* PRIVATE */
 
 #define SIOCGIFDIRECTLINK _IOWR('i', 219, struct ifreq) /* get DIRECTLINK */
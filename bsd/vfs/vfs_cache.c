@@ -83,6 +83,8 @@
 #include <sys/user.h>
 #include <sys/paths.h>
 #include <os/overflow.h>
+#include <kern/counter.h>
+#include <kern/cpu_number.h>
 
 #if CONFIG_MACF
 #include <security/mac_framework.h>
@@ -111,9 +113,17 @@
 
 ZONE_DEFINE_TYPE(namecache_zone, "namecache", struct namecache, ZC_NONE);
 
-struct smrq_list_head *nchashtbl;       /* Hash Table */
-u_long  nchashmask;
-u_long  nchash;                         /* size of hash table - 1 */
+/*
+ * The hash table is published as a single SMR pointer so that it can be
+ * resized while lockless lookups are in flight: readers always see a
+ * consistent heads/mask pair, and a replaced table is only freed once
+ * every reader that could have loaded it has left its read section.
+ */
+struct nchashtbl {
+	u_long                  nht_mask;       /* size of hash table - 1 */
+	struct smrq_list_head  *nht_heads;
+};
+static SMR_POINTER(struct nchashtbl *) nchashtbl; /* Hash Table */
 long    numcache;                       /* number of cache entries allocated */
 int     desiredNodes;
 int     desiredNegNodes;
@@ -124,28 +134,53 @@ __options_decl(nc_smr_level_t, uint32_t, {
 	NC_SMR_LOOKUP = 1
 });
 TUNABLE(nc_smr_level_t, nc_smr_enabled, "ncsmr", NC_SMR_LOOKUP);
-TAILQ_HEAD(, namecache) nchead;         /* chain of all name cache entries */
-TAILQ_HEAD(, namecache) neghead;        /* chain of only negative cache entries */
+
+/*
+ * The LRU lists are split into shards, each with its own lock, so that
+ * keeping them doesn't depend on the name cache lock.  An entry goes on the
+ * shard of the CPU that entered it and stays there until it is freed or
+ * reused.  Reuse and negative entry eviction take the oldest entry of the
+ * current CPU's shard, or of the next shard that has one.
+ */
+#define NC_LRU_SHARDS   16
+
+struct nc_lru {
+	lck_spin_t              ncl_lock;
+	TAILQ_HEAD(, namecache) ncl_head;       /* chain of all name cache entries */
+	TAILQ_HEAD(, namecache) ncl_neghead;    /* chain of only negative cache entries */
+};
+static struct nc_lru nc_lru[NC_LRU_SHARDS];
 
 
 #if COLLECT_STATS
 
-struct  nchstats nchstats;              /* cache effectiveness statistics */
+/*
+ * Cache effectiveness statistics.
+ *
+ * These are bumped from lookups that only hold the name cache lock
+ * shared (or no lock at all), so they are kept in per-cpu counters
+ * rather than in a shared struct nchstats.
+ */
+SCALABLE_COUNTER_DEFINE(ncs_goodhits);  /* hits that we can really use */
+SCALABLE_COUNTER_DEFINE(ncs_neghits);   /* negative hits that we can use */
+SCALABLE_COUNTER_DEFINE(ncs_badhits);   /* hits we must drop */
+SCALABLE_COUNTER_DEFINE(ncs_miss);      /* misses */
+SCALABLE_COUNTER_DEFINE(ncs_stolen);    /* entries recycled by cache_enter */
+SCALABLE_COUNTER_DEFINE(ncs_enters);
+SCALABLE_COUNTER_DEFINE(ncs_deletes);
+SCALABLE_COUNTER_DEFINE(ncs_badvid);
 
-#define NCHSTAT(v) {            \
-	nchstats.v++;           \
-}
-#define NAME_CACHE_LOCK_SHARED()        name_cache_lock()
-#define NAME_CACHE_LOCK_SHARED_TO_EXCLUSIVE() TRUE
+#define NCHSTAT(v)      counter_inc(&(v))
 
 #else
 
 #define NCHSTAT(v)
+
+#endif /* COLLECT_STATS */
+
 #define NAME_CACHE_LOCK_SHARED()        name_cache_lock_shared()
 #define NAME_CACHE_LOCK_SHARED_TO_EXCLUSIVE()             name_cache_lock_shared_to_exclusive()
 
-#endif
-
 #define NAME_CACHE_LOCK()               name_cache_lock()
 #define NAME_CACHE_UNLOCK()             name_cache_unlock()
 
@@ -179,57 +214,47 @@ SYSCTL_COMPAT_INT(_vfs_ncstats, OID_AUTO, nc_smr_enabled,
     CTLFLAG_RD | CTLFLAG_LOCKED,
     &nc_smr_enabled, 0, "");
 
-#if COLLECT_NC_SMR_STATS
-struct ncstats {
-	uint64_t cl_smr_hits;
-	uint64_t cl_smr_miss;
-	uint64_t cl_smr_negative_hits;
-	uint64_t cl_smr_fallback;
-	uint64_t cl_lock_hits;
-	uint64_t clp_next;
-	uint64_t clp_next_fail;
-	uint64_t clp_smr_next;
-	uint64_t clp_smr_next_fail;
-	uint64_t clp_smr_fallback;
-	uint64_t nc_lock_shared;
-	uint64_t nc_lock;
-} ncstats = {0};
-
-SYSCTL_LONG(_vfs_ncstats, OID_AUTO, cl_smr_hits,
-    CTLFLAG_RD | CTLFLAG_LOCKED,
-    &ncstats.cl_smr_hits, "");
-SYSCTL_LONG(_vfs_ncstats, OID_AUTO, cl_smr_misses,
-    CTLFLAG_RD | CTLFLAG_LOCKED,
-    &ncstats.cl_smr_miss, "");
-SYSCTL_LONG(_vfs_ncstats, OID_AUTO, cl_smr_negative_hits,
-    CTLFLAG_RD | CTLFLAG_LOCKED,
-    &ncstats.cl_smr_negative_hits, "");
-SYSCTL_LONG(_vfs_ncstats, OID_AUTO, cl_smr_fallback,
-    CTLFLAG_RD | CTLFLAG_LOCKED,
-    &ncstats.cl_smr_fallback, "");
-SYSCTL_LONG(_vfs_ncstats, OID_AUTO, cl_lock_hits,
-    CTLFLAG_RD | CTLFLAG_LOCKED,
-    &ncstats.cl_lock_hits, "");
-SYSCTL_LONG(_vfs_ncstats, OID_AUTO, clp_next,
-    CTLFLAG_RD | CTLFLAG_LOCKED,
-    &ncstats.clp_next, "");
-SYSCTL_LONG(_vfs_ncstats, OID_AUTO, clp_next_fail,
-    CTLFLAG_RD | CTLFLAG_LOCKED,
-    &ncstats.clp_next_fail, "");
-SYSCTL_LONG(_vfs_ncstats, OID_AUTO, clp_smr_next,
-    CTLFLAG_RD | CTLFLAG_LOCKED,
-    &ncstats.clp_smr_next, "");
-SYSCTL_LONG(_vfs_ncstats, OID_AUTO, clp_smr_next_fail,
-    CTLFLAG_RD | CTLFLAG_LOCKED,
-    &ncstats.clp_smr_next_fail, "");
-SYSCTL_LONG(_vfs_ncstats, OID_AUTO, nc_lock_shared,
-    CTLFLAG_RD | CTLFLAG_LOCKED,
-    &ncstats.nc_lock_shared, "");
-SYSCTL_LONG(_vfs_ncstats, OID_AUTO, nc_lock,
+#if COLLECT_STATS
+SYSCTL_SCALABLE_COUNTER(_vfs_ncstats, ncs_goodhits, ncs_goodhits, "");
+SYSCTL_SCALABLE_COUNTER(_vfs_ncstats, ncs_neghits, ncs_neghits, "");
+SYSCTL_SCALABLE_COUNTER(_vfs_ncstats, ncs_badhits, ncs_badhits, "");
+SYSCTL_SCALABLE_COUNTER(_vfs_ncstats, ncs_miss, ncs_miss, "");
+SYSCTL_SCALABLE_COUNTER(_vfs_ncstats, ncs_stolen, ncs_stolen, "");
+SYSCTL_SCALABLE_COUNTER(_vfs_ncstats, ncs_enters, ncs_enters, "");
+SYSCTL_SCALABLE_COUNTER(_vfs_ncstats, ncs_deletes, ncs_deletes, "");
+SYSCTL_SCALABLE_COUNTER(_vfs_ncstats, ncs_badvid, ncs_badvid, "");
+SYSCTL_INT(_vfs_ncstats, OID_AUTO, ncs_negtotal,
     CTLFLAG_RD | CTLFLAG_LOCKED,
-    &ncstats.nc_lock, "");
+    &ncs_negtotal, 0, "");
+#endif /* COLLECT_STATS */
 
-#define NC_SMR_STATS(v)  os_atomic_inc(&ncstats.v, relaxed)
+#if COLLECT_NC_SMR_STATS
+SCALABLE_COUNTER_DEFINE(ncstats_cl_smr_hits);
+SCALABLE_COUNTER_DEFINE(ncstats_cl_smr_miss);
+SCALABLE_COUNTER_DEFINE(ncstats_cl_smr_negative_hits);
+SCALABLE_COUNTER_DEFINE(ncstats_cl_smr_fallback);
+SCALABLE_COUNTER_DEFINE(ncstats_cl_lock_hits);
+SCALABLE_COUNTER_DEFINE(ncstats_clp_next);
+SCALABLE_COUNTER_DEFINE(ncstats_clp_next_fail);
+SCALABLE_COUNTER_DEFINE(ncstats_clp_smr_next);
+SCALABLE_COUNTER_DEFINE(ncstats_clp_smr_next_fail);
+SCALABLE_COUNTER_DEFINE(ncstats_clp_smr_fallback);
+SCALABLE_COUNTER_DEFINE(ncstats_nc_lock_shared);
+SCALABLE_COUNTER_DEFINE(ncstats_nc_lock);
+
+SYSCTL_SCALABLE_COUNTER(_vfs_ncstats, cl_smr_hits, ncstats_cl_smr_hits, "");
+SYSCTL_SCALABLE_COUNTER(_vfs_ncstats, cl_smr_misses, ncstats_cl_smr_miss, "");
+SYSCTL_SCALABLE_COUNTER(_vfs_ncstats, cl_smr_negative_hits, ncstats_cl_smr_negative_hits, "");
+SYSCTL_SCALABLE_COUNTER(_vfs_ncstats, cl_smr_fallback, ncstats_cl_smr_fallback, "");
+SYSCTL_SCALABLE_COUNTER(_vfs_ncstats, cl_lock_hits, ncstats_cl_lock_hits, "");
+SYSCTL_SCALABLE_COUNTER(_vfs_ncstats, clp_next, ncstats_clp_next, "");
+SYSCTL_SCALABLE_COUNTER(_vfs_ncstats, clp_next_fail, ncstats_clp_next_fail, "");
+SYSCTL_SCALABLE_COUNTER(_vfs_ncstats, clp_smr_next, ncstats_clp_smr_next, "");
+SYSCTL_SCALABLE_COUNTER(_vfs_ncstats, clp_smr_next_fail, ncstats_clp_smr_next_fail, "");
+SYSCTL_SCALABLE_COUNTER(_vfs_ncstats, nc_lock_shared, ncstats_nc_lock_shared, "");
+SYSCTL_SCALABLE_COUNTER(_vfs_ncstats, nc_lock, ncstats_nc_lock, "");
+
+#define NC_SMR_STATS(v)  counter_inc(&ncstats_##v)
 #else
 #define NC_SMR_STATS(v)
 #endif /* COLLECT_NC_SMR_STATS */
@@ -242,6 +267,7 @@ static void cache_delete(struct namecache *, int);
 static void cache_enter_locked(vnode_t dvp, vnode_t vp, struct componentname *cnp, const char *strname);
 static void cache_purge_locked(vnode_t vp, kauth_cred_t *credp);
 static void namecache_smr_free(void *, size_t);
+static struct nchashtbl *nchashtbl_alloc(int elements);
 static void string_smr_free(void *, size_t);
 
 
@@ -256,8 +282,16 @@ static void init_crc32(void);
 static unsigned int crc32tab[256];
 
 
+#define NCHHASH_TBL(tbl, dvp, hash_val) \
+	(&(tbl)->nht_heads[((dvp)->v_id ^ (hash_val)) & (tbl)->nht_mask])
+
+/* lookups holding the name cache lock */
 #define NCHHASH(dvp, hash_val) \
-	(&nchashtbl[(dvp->v_id ^ (hash_val)) & nchashmask])
+	NCHHASH_TBL(smr_serialized_load(&nchashtbl), dvp, hash_val)
+
+/* lookups inside a vfs_smr read section */
+#define NCHHASH_SMR(dvp, hash_val) \
+	NCHHASH_TBL(smr_entered_load_acquire(&nchashtbl), dvp, hash_val)
 
 /*
  * This function tries to check if a directory vp is a subdirectory of dvp
@@ -2397,7 +2431,7 @@ cache_lookup_smr(vnode_t dvp, struct componentname *cnp, uint32_t *vidp)
 		return NULL;
 	}
 
-	smrq_entered_foreach(ncp, NCHHASH(dvp, cnp->cn_hash), nc_hash) {
+	smrq_entered_foreach(ncp, NCHHASH_SMR(dvp, cnp->cn_hash), nc_hash) {
 		counter = os_atomic_load(&ncp->nc_counter, acquire);
 		if (!(counter & NC_VALID)) {
 			ncp = NULL;
@@ -2547,11 +2581,7 @@ relook:
 
 		if (vnode_getwithvid(vp, vid)) {
 			vnode_drop(vp);
-#if COLLECT_STATS
-			NAME_CACHE_LOCK();
 			NCHSTAT(ncs_badvid);
-			NAME_CACHE_UNLOCK();
-#endif
 			return 0;
 		}
 		vnode_drop(vp);
@@ -2628,7 +2658,7 @@ cache_lookup(struct vnode *dvp, struct vnode **vpp, struct componentname *cnp)
 
 	vfs_smr_enter();
 
-	smrq_entered_foreach(ncp, NCHHASH(dvp, cnp->cn_hash), nc_hash) {
+	smrq_entered_foreach(ncp, NCHHASH_SMR(dvp, cnp->cn_hash), nc_hash) {
 		counter = os_atomic_load(&ncp->nc_counter, acquire);
 		if (!(counter & NC_VALID)) {
 			vfs_smr_leave();
@@ -2788,6 +2818,104 @@ cache_enter(struct vnode *dvp, struct vnode *vp, struct componentname *cnp)
 }
 
 
+static void
+nc_lru_insert(struct namecache *ncp)
+{
+	struct nc_lru *lru;
+
+	ncp->nc_lru = (uint16_t)(cpu_number() % NC_LRU_SHARDS);
+	lru = &nc_lru[ncp->nc_lru];
+
+	lck_spin_lock(&lru->ncl_lock);
+	TAILQ_INSERT_TAIL(&lru->ncl_head, ncp, nc_entry);
+	if (ncp->nc_vp == NULLVP) {
+		TAILQ_INSERT_TAIL(&lru->ncl_neghead, ncp, nc_un.nc_negentry);
+	}
+	lck_spin_unlock(&lru->ncl_lock);
+
+	if (ncp->nc_vp == NULLVP) {
+		os_atomic_inc(&ncs_negtotal, relaxed);
+	}
+}
+
+static void
+nc_lru_remove(struct namecache *ncp)
+{
+	struct nc_lru *lru = &nc_lru[ncp->nc_lru];
+
+	lck_spin_lock(&lru->ncl_lock);
+	TAILQ_REMOVE(&lru->ncl_head, ncp, nc_entry);
+	lck_spin_unlock(&lru->ncl_lock);
+}
+
+static void
+nc_lru_remove_negative(struct namecache *ncp)
+{
+	struct nc_lru *lru = &nc_lru[ncp->nc_lru];
+
+	lck_spin_lock(&lru->ncl_lock);
+	TAILQ_REMOVE(&lru->ncl_neghead, ncp, nc_un.nc_negentry);
+	lck_spin_unlock(&lru->ncl_lock);
+
+	os_atomic_dec(&ncs_negtotal, relaxed);
+}
+
+/*
+ * Take the oldest entry off the LRU to reuse it.  Unless @any, only an
+ * entry that is no longer valid is taken, and only from the current CPU's
+ * shard.
+ */
+static struct namecache *
+nc_lru_reuse(bool any)
+{
+	uint16_t first = (uint16_t)(cpu_number() % NC_LRU_SHARDS);
+	struct namecache *ncp;
+	struct nc_lru *lru;
+
+	for (int i = 0; i < NC_LRU_SHARDS; i++) {
+		lru = &nc_lru[(first + i) % NC_LRU_SHARDS];
+
+		lck_spin_lock(&lru->ncl_lock);
+		ncp = TAILQ_FIRST(&lru->ncl_head);
+		if (ncp != NULL && (any || !(ncp->nc_counter & NC_VALID))) {
+			TAILQ_REMOVE(&lru->ncl_head, ncp, nc_entry);
+			lck_spin_unlock(&lru->ncl_lock);
+			return ncp;
+		}
+		lck_spin_unlock(&lru->ncl_lock);
+
+		if (!any) {
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * The oldest negative entry, for cache_delete() to evict.
+ */
+static struct namecache *
+nc_lru_oldest_negative(void)
+{
+	uint16_t first = (uint16_t)(cpu_number() % NC_LRU_SHARDS);
+	struct namecache *ncp;
+	struct nc_lru *lru;
+
+	for (int i = 0; i < NC_LRU_SHARDS; i++) {
+		lru = &nc_lru[(first + i) % NC_LRU_SHARDS];
+
+		lck_spin_lock(&lru->ncl_lock);
+		ncp = TAILQ_FIRST(&lru->ncl_neghead);
+		lck_spin_unlock(&lru->ncl_lock);
+		if (ncp != NULL) {
+			return ncp;
+		}
+	}
+
+	return NULL;
+}
+
 static void
 cache_enter_locked(struct vnode *dvp, struct vnode *vp, struct componentname *cnp, const char *strname)
 {
@@ -2813,12 +2941,11 @@ cache_enter_locked(struct vnode *dvp, struct vnode *vp, struct componentname *cn
 	}
 	/*
 	 * We allocate a new entry if we are less than the maximum
-	 * allowed and the one at the front of the list is in use.
-	 * Otherwise we use the one at the front of the list.
+	 * allowed and the one at the front of this CPU's LRU is in use.
+	 * Otherwise we use the oldest one.
 	 */
-	if (numcache < desiredNodes &&
-	    ((ncp = nchead.tqh_first) == NULL ||
-	    (ncp->nc_counter & NC_VALID))) {
+	ncp = nc_lru_reuse(numcache >= desiredNodes);
+	if (ncp == NULL) {
 		/*
 		 * Allocate one more entry
 		 */
@@ -2829,21 +2956,13 @@ cache_enter_locked(struct vnode *dvp, struct vnode *vp, struct componentname *cn
 		}
 		ncp->nc_counter = 0;
 		numcache++;
-	} else {
+	} else if (ncp->nc_counter & NC_VALID) {
 		/*
-		 * reuse an old entry
+		 * still in use... we need to
+		 * delete it before re-using it
 		 */
-		ncp = TAILQ_FIRST(&nchead);
-		TAILQ_REMOVE(&nchead, ncp, nc_entry);
-
-		if (ncp->nc_counter & NC_VALID) {
-			/*
-			 * still in use... we need to
-			 * delete it before re-using it
-			 */
-			NCHSTAT(ncs_stolen);
-			cache_delete(ncp, 0);
-		}
+		NCHSTAT(ncs_stolen);
+		cache_delete(ncp, 0);
 	}
 	NCHSTAT(ncs_enters);
 
@@ -2882,12 +3001,6 @@ cache_enter_locked(struct vnode *dvp, struct vnode *vp, struct componentname *cn
 		ncp->nc_hashval = hash;
 	}
 
-	/*
-	 * make us the newest entry in the cache
-	 * i.e. we'll be the last to be stolen
-	 */
-	TAILQ_INSERT_TAIL(&nchead, ncp, nc_entry);
-
 	ncpp = NCHHASH(dvp, cnp->cn_hash);
 #if DIAGNOSTIC
 	{
@@ -2911,22 +3024,24 @@ cache_enter_locked(struct vnode *dvp, struct vnode *vp, struct componentname *cn
 		 * that point at vp
 		 */
 		LIST_INSERT_HEAD(&vp->v_nclinks, ncp, nc_un.nc_link);
-	} else {
-		/*
-		 * this is a negative cache entry (vp == NULL)
-		 * stick it on the negative cache list.
-		 */
-		TAILQ_INSERT_TAIL(&neghead, ncp, nc_un.nc_negentry);
+	}
 
-		ncs_negtotal++;
+	/*
+	 * make us the newest entry in the cache
+	 * i.e. we'll be the last to be stolen,
+	 * and if this is a negative cache entry
+	 * (vp == NULL) the newest negative one
+	 */
+	nc_lru_insert(ncp);
 
-		if (ncs_negtotal > desiredNegNodes) {
-			/*
-			 * if we've reached our desired limit
-			 * of negative cache entries, delete
-			 * the oldest
-			 */
-			negp = TAILQ_FIRST(&neghead);
+	if (vp == NULLVP && os_atomic_load(&ncs_negtotal, relaxed) > desiredNegNodes) {
+		/*
+		 * if we've reached our desired limit
+		 * of negative cache entries, delete
+		 * the oldest
+		 */
+		negp = nc_lru_oldest_negative();
+		if (negp != NULL) {
 			cache_delete(negp, 1);
 		}
 	}
@@ -3003,14 +3118,15 @@ nchinit(void)
 		zone_enable_smr(namecache_zone, VFS_SMR(), &namecache_smr_free);
 		zone_enable_smr(stringcache_zone, VFS_SMR(), &string_smr_free);
 	}
-	TAILQ_INIT(&nchead);
-	TAILQ_INIT(&neghead);
+	for (int i = 0; i < NC_LRU_SHARDS; i++) {
+		lck_spin_init(&nc_lru[i].ncl_lock, &namecache_lck_grp, LCK_ATTR_NULL);
+		TAILQ_INIT(&nc_lru[i].ncl_head);
+		TAILQ_INIT(&nc_lru[i].ncl_neghead);
+	}
 
 	init_crc32();
 
-	nchashtbl = hashinit(MAX(CONFIG_NC_HASH, (2 * desiredNodes)), M_CACHE, &nchash);
-	nchashmask = nchash;
-	nchash++;
+	smr_init_store(&nchashtbl, nchashtbl_alloc(MAX(CONFIG_NC_HASH, (2 * desiredNodes))));
 
 	init_string_table();
 
@@ -3046,59 +3162,88 @@ name_cache_unlock(void)
 }
 
 
+static struct nchashtbl *
+nchashtbl_alloc(int elements)
+{
+	struct nchashtbl *tbl;
+
+	tbl = kalloc_type(struct nchashtbl, Z_WAITOK | Z_NOFAIL);
+	tbl->nht_heads = hashinit(elements, M_CACHE, &tbl->nht_mask);
+	if (tbl->nht_heads == NULL) {
+		kfree_type(struct nchashtbl, tbl);
+		return NULL;
+	}
+	return tbl;
+}
+
+static void
+nchashtbl_free(struct nchashtbl *tbl)
+{
+	hashdestroy(tbl->nht_heads, M_CACHE, tbl->nht_mask);
+	kfree_type(struct nchashtbl, tbl);
+}
+
+/*
+ * Resize the name cache (and its hash table) for newsize vnodes.
+ *
+ * Entries are moved to the new table under the exclusive name cache lock
+ * while lockless lookups may still be walking the old one.  Every entry
+ * is pushed at the head of a chain that only ever contains already moved
+ * entries, so a concurrent walker always reaches the end of a list; at
+ * worst it misses and falls back to the locked path.
+ */
 int
 resize_namecache(int newsize)
 {
-	struct smrq_list_head   *new_table;
-	struct smrq_list_head   *old_table;
+	struct nchashtbl        *new_table;
+	struct nchashtbl        *old_table;
 	struct smrq_list_head   *old_head;
 	struct namecache    *entry;
-	uint32_t            i, hashval;
+	uint32_t            hashval;
 	int                 dNodes, dNegNodes, nelements;
-	u_long              new_size, old_size;
 
 	if (newsize < 0) {
 		return EINVAL;
 	}
 
 	dNegNodes = (newsize / 10);
-	dNodes = newsize + dNegNodes;
-	// we don't support shrinking yet
-	if (dNodes <= desiredNodes) {
-		return 0;
-	}
-
-	if (os_mul_overflow(dNodes, 2, &nelements)) {
+	if (os_add_overflow(newsize, dNegNodes, &dNodes) ||
+	    os_mul_overflow(dNodes, 2, &nelements)) {
 		return EINVAL;
 	}
+	if (dNodes == desiredNodes) {
+		return 0;
+	}
 
-	new_table = hashinit(nelements, M_CACHE, &nchashmask);
-	new_size  = nchashmask + 1;
-
+	new_table = nchashtbl_alloc(MAX(CONFIG_NC_HASH, nelements));
 	if (new_table == NULL) {
 		return ENOMEM;
 	}
 
 	NAME_CACHE_LOCK();
 
+	old_table = smr_serialized_load(&nchashtbl);
+
+	/*
+	 * When shrinking, entries beyond the new desiredNodes are reclaimed
+	 * lazily: cache_enter_locked() recycles the oldest entry rather than
+	 * allocating while numcache is over the limit.
+	 */
+	desiredNodes = dNodes;
+	desiredNegNodes = dNegNodes;
+
 	/* No need to switch if the hash table size hasn't changed. */
-	if (new_size == nchash) {
+	if (new_table->nht_mask == old_table->nht_mask) {
 		NAME_CACHE_UNLOCK();
-		hashdestroy(new_table, M_CACHE, new_size - 1);
+		nchashtbl_free(new_table);
 		return 0;
 	}
 
-	// do the switch!
-	old_table = nchashtbl;
-	nchashtbl = new_table;
-	old_size  = nchash;
-	nchash    = new_size;
-
 	// walk the old table and insert all the entries into
 	// the new table
 	//
-	for (i = 0; i < old_size; i++) {
-		old_head = &old_table[i];
+	for (u_long i = 0; i <= old_table->nht_mask; i++) {
+		old_head = &old_table->nht_heads[i];
 		smrq_serialized_foreach_safe(entry, old_head, nc_hash) {
 			//
 			// XXXdbg - Beware: this assumes that hash_string() does
@@ -3107,18 +3252,75 @@ resize_namecache(int newsize)
 			hashval = hash_string(entry->nc_name, 0);
 			entry->nc_hashval = hashval;
 
-			smrq_serialized_insert_head(NCHHASH(entry->nc_dvp, hashval), &entry->nc_hash);
+			smrq_serialized_insert_head(NCHHASH_TBL(new_table, entry->nc_dvp, hashval), &entry->nc_hash);
 		}
 	}
-	desiredNodes = dNodes;
-	desiredNegNodes = dNegNodes;
+
+	/* do the switch! */
+	smr_serialized_store(&nchashtbl, new_table);
 
 	NAME_CACHE_UNLOCK();
-	hashdestroy(old_table, M_CACHE, old_size - 1);
+
+	if (nc_smr_enabled) {
+		vfs_smr_synchronize();
+	}
+	nchashtbl_free(old_table);
 
 	return 0;
 }
 
+/*
+ * Chain length distribution of the name cache hash table, exported
+ * as vfs.ncstats.nc_hash_chains.
+ */
+#define NC_CHAIN_HIST_BUCKETS   8
+
+struct nc_chain_stats {
+	uint64_t ncc_buckets;           /* size of the hash table */
+	uint64_t ncc_entries;           /* entries hashed */
+	uint64_t ncc_max_chain;         /* longest chain */
+	/* number of chains of length i, last slot for anything longer */
+	uint64_t ncc_hist[NC_CHAIN_HIST_BUCKETS + 1];
+};
+
+static int
+sysctl_nc_hash_chains SYSCTL_HANDLER_ARGS
+{
+#pragma unused(oidp, arg1, arg2)
+	struct nc_chain_stats stats = {};
+	struct nchashtbl *tbl;
+	struct namecache *ncp;
+
+	if (req->newptr != USER_ADDR_NULL) {
+		return EPERM;
+	}
+	if (req->oldptr == USER_ADDR_NULL) {
+		return SYSCTL_OUT(req, NULL, sizeof(stats));
+	}
+
+	NAME_CACHE_LOCK_SHARED();
+	tbl = smr_serialized_load(&nchashtbl);
+	stats.ncc_buckets = tbl->nht_mask + 1;
+	for (u_long i = 0; i <= tbl->nht_mask; i++) {
+		uint64_t len = 0;
+
+		smrq_serialized_foreach(ncp, &tbl->nht_heads[i], nc_hash) {
+			len++;
+		}
+		stats.ncc_entries += len;
+		stats.ncc_max_chain = MAX(stats.ncc_max_chain, len);
+		stats.ncc_hist[MIN(len, NC_CHAIN_HIST_BUCKETS)]++;
+	}
+	NAME_CACHE_UNLOCK();
+
+	return SYSCTL_OUT(req, &stats, sizeof(stats));
+}
+
+SYSCTL_PROC(_vfs_ncstats, OID_AUTO, nc_hash_chains,
+    CTLTYPE_OPAQUE | CTLFLAG_RD | CTLFLAG_LOCKED,
+    0, 0, sysctl_nc_hash_chains, "S,nc_chain_stats",
+    "name cache hash chain length distribution");
+
 static void
 namecache_smr_free(void *_ncp, __unused size_t _size)
 {
@@ -3145,8 +3347,7 @@ cache_delete(struct namecache *ncp, int free_entry)
 	if (ncp->nc_vp) {
 		LIST_REMOVE(ncp, nc_un.nc_link);
 	} else {
-		TAILQ_REMOVE(&neghead, ncp, nc_un.nc_negentry);
-		ncs_negtotal--;
+		nc_lru_remove_negative(ncp);
 	}
 	TAILQ_REMOVE(&(ncp->nc_dvp->v_ncchildren), ncp, nc_child);
 
@@ -3163,7 +3364,7 @@ cache_delete(struct namecache *ncp, int free_entry)
 	}
 
 	if (free_entry) {
-		TAILQ_REMOVE(&nchead, ncp, nc_entry);
+		nc_lru_remove(ncp);
 		if (nc_smr_enabled) {
 			zfree_smr(namecache_zone, ncp);
 		} else {
@@ -3269,11 +3470,13 @@ void
 cache_purgevfs(struct mount *mp)
 {
 	struct smrq_list_head *ncpp;
+	struct nchashtbl *tbl;
 	struct namecache *ncp;
 
 	NAME_CACHE_LOCK();
+	tbl = smr_serialized_load(&nchashtbl);
 	/* Scan hash tables for applicable entries */
-	for (ncpp = &nchashtbl[nchash - 1]; ncpp >= nchashtbl; ncpp--) {
+	for (ncpp = &tbl->nht_heads[tbl->nht_mask]; ncpp >= tbl->nht_heads; ncpp--) {
 restart:
 		smrq_serialized_foreach(ncp, ncpp, nc_hash) {
 			if (ncp->nc_dvp->v_mount == mp) {
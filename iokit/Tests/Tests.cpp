@@ -904,6 +904,34 @@ OSCollectionTest(int newValue)
 	OSNumber * nnum = OSDynamicCast(OSNumber, dict->getObject("test"));
 	assert(12345678 == (int)(10000 * nnum->doubleValue()));
 
+	// large enough to be looked up through the hash index
+	dict = OSDictionary::withCapacity(4);
+	for (unsigned int i = 0; i < 100; i++) {
+		char key[16];
+		snprintf(key, sizeof(key), "key%u", i);
+		dict->setObject(key, OSNumber::withNumber(i, 32));
+	}
+	assert(100 == dict->getCount());
+	for (unsigned int i = 0; i < 100; i += 2) {
+		char key[16];
+		snprintf(key, sizeof(key), "key%u", i);
+		dict->removeObject(key);
+	}
+	assert(50 == dict->getCount());
+	index = 1;
+	dict->iterateObjects(^bool (const OSSymbol * sym, OSObject * obj) {
+		OSNumber * n = OSDynamicCast(OSNumber, obj);
+		assert(n && n->unsigned32BitValue() == index);
+		assert(obj == dict->getObject(sym));
+		index += 2;
+		return false;
+	});
+	for (unsigned int i = 0; i < 100; i++) {
+		char key[16];
+		snprintf(key, sizeof(key), "key%u", i);
+		assert((i & 1) == (dict->getObject(key) != NULL));
+	}
+
 	return 0;
 }
 
@@ -322,6 +322,206 @@ parseKCDataContainer(kcdata_iter_t *iter_p, NSError **error)
 	return retval;
 }
 
+/* kcd_c_type of LZ4 compressed buffers, see kcd_compression_type_t in kern_cdata.h */
+#define KCDCT_LZ4 0x02
+
+/*
+ * Decode the LZ4 sequences of one block into [dst, dst_end). Matches may reach
+ * back to dst_begin, into the output of earlier blocks.
+ */
+static BOOL
+decodeLZ4Sequences(const uint8_t * src, const uint8_t * src_end, uint8_t * dst_begin, uint8_t * dst, uint8_t * dst_end)
+{
+	while (src < src_end) {
+		uint8_t token = *src++;
+		size_t length = token >> 4;
+		uint8_t b;
+
+		if (length == 15) {
+			do {
+				if (src >= src_end)
+					return NO;
+				b = *src++;
+				length += b;
+			} while (b == 255);
+		}
+		if (length > (size_t)(src_end - src) || length > (size_t)(dst_end - dst))
+			return NO;
+		memcpy(dst, src, length);
+		src += length;
+		dst += length;
+
+		/* the last sequence of a block has no match */
+		if (src == src_end)
+			break;
+		if (src_end - src < 2)
+			return NO;
+		size_t distance = (size_t)src[0] | ((size_t)src[1] << 8);
+		src += 2;
+
+		length = (token & 15) + 4;
+		if (length == 19) {
+			do {
+				if (src >= src_end)
+					return NO;
+				b = *src++;
+				length += b;
+			} while (b == 255);
+		}
+		if (distance == 0 || distance > (size_t)(dst - dst_begin) || length > (size_t)(dst_end - dst))
+			return NO;
+		/* matches may overlap their own output */
+		for (size_t i = 0; i < length; i++)
+			dst[i] = dst[i - distance];
+		dst += length;
+	}
+
+	return dst == dst_end;
+}
+
+/*
+ * Decode an LZ4 compressed kcdata stream (kcd_c_type KCDCT_LZ4) of srcSize
+ * bytes into exactly dstSize bytes at dst.
+ */
+static BOOL
+decodeLZ4Blocks(const uint8_t * src, size_t srcSize, uint8_t * dst, size_t dstSize, NSError ** error)
+{
+	const uint8_t * src_end = src + srcSize;
+	uint8_t * dst_begin     = dst;
+	uint8_t * dst_end       = dst + dstSize;
+	uint32_t header[3];
+
+	for (;;) {
+		if (src_end - src < (ptrdiff_t)sizeof(uint32_t))
+			goto truncated;
+		memcpy(&header[0], src, sizeof(uint32_t));
+
+		switch (header[0]) {
+		case KCDATA_LZ4_END_MAGIC:
+			if (dst != dst_end) {
+				if (error)
+					*error = GEN_ERRORF(KERN_INVALID_OBJECT, "LZ4 stream decoded to %zu bytes, expected %zu",
+					    (size_t)(dst - dst_begin), dstSize);
+				return NO;
+			}
+			return YES;
+
+		case KCDATA_LZ4_RAW_BLOCK_MAGIC:
+			if (src_end - src < (ptrdiff_t)(2 * sizeof(uint32_t)))
+				goto truncated;
+			memcpy(header, src, 2 * sizeof(uint32_t));
+			src += 2 * sizeof(uint32_t);
+			if (header[1] > (size_t)(src_end - src) || header[1] > (size_t)(dst_end - dst))
+				goto truncated;
+			memcpy(dst, src, header[1]);
+			src += header[1];
+			dst += header[1];
+			break;
+
+		case KCDATA_LZ4_BLOCK_MAGIC:
+			if (src_end - src < (ptrdiff_t)sizeof(header))
+				goto truncated;
+			memcpy(header, src, sizeof(header));
+			src += sizeof(header);
+			if (header[2] > (size_t)(src_end - src) || header[1] > (size_t)(dst_end - dst))
+				goto truncated;
+			if (!decodeLZ4Sequences(src, src + header[2], dst_begin, dst, dst + header[1])) {
+				if (error)
+					*error = GEN_ERRORF(KERN_INVALID_OBJECT, "corrupt LZ4 block at offset %zu",
+					    (size_t)(dst - dst_begin));
+				return NO;
+			}
+			src += header[2];
+			dst += header[1];
+			break;
+
+		default:
+			if (error)
+				*error = GEN_ERRORF(KERN_INVALID_OBJECT, "bad LZ4 block magic 0x%x", header[0]);
+			return NO;
+		}
+	}
+
+truncated:
+	if (error)
+		*error = GEN_ERROR(KERN_INVALID_OBJECT, "LZ4 stream is truncated");
+	return NO;
+}
+
+NSData *
+decompressKCDataBuffer(void * dataBuffer, uint32_t size, NSError ** error)
+{
+	uint64_t compressionType = UINT64_MAX, totalout = 0, totalin = 0;
+	kcdata_iter_t iter;
+
+	if (dataBuffer == NULL) {
+		if (error)
+			*error = GEN_ERROR(KERN_INVALID_ARGUMENT, "buffer is null");
+		return nil;
+	}
+
+	iter = kcdata_iter(dataBuffer, size);
+	if (!kcdata_iter_valid(iter) || kcdata_iter_type(iter) != KCDATA_BUFFER_BEGIN_COMPRESSED) {
+		if (error)
+			*error = GEN_ERROR(KERN_INVALID_VALUE, "not a compressed kcdata buffer");
+		return nil;
+	}
+
+	/* kcd_c_type, kcd_c_totalout and kcd_c_totalin, then the inner buffer's header */
+	for (iter = kcdata_iter_next(iter); kcdata_iter_valid(iter) && kcdata_iter_type(iter) == KCDATA_TYPE_UINT64_DESC;
+	    iter = kcdata_iter_next(iter)) {
+		char * desc;
+		uint64_t value;
+		void * datap;
+
+		if (kcdata_iter_size(iter) < KCDATA_DESC_MAXLEN + sizeof(uint64_t))
+			break;
+		kcdata_iter_get_data_with_desc(iter, &desc, &datap, NULL);
+		memcpy(&value, datap, sizeof(value));
+		if (strncmp(desc, "kcd_c_type", KCDATA_DESC_MAXLEN) == 0) {
+			compressionType = value;
+		} else if (strncmp(desc, "kcd_c_totalout", KCDATA_DESC_MAXLEN) == 0) {
+			totalout = value;
+		} else if (strncmp(desc, "kcd_c_totalin", KCDATA_DESC_MAXLEN) == 0) {
+			totalin = value;
+		}
+	}
+	if (!kcdata_iter_valid(iter) || compressionType == UINT64_MAX) {
+		if (error)
+			*error = GEN_ERROR(KERN_INVALID_OBJECT, "missing compression header");
+		return nil;
+	}
+	if (compressionType != KCDCT_LZ4) {
+		/* zlib streams are inflated by the callers, which already link zlib */
+		if (error)
+			*error = GEN_ERRORF(KERN_NOT_SUPPORTED, "unsupported compression type %llu", compressionType);
+		return nil;
+	}
+
+	uint32_t innerType     = kcdata_iter_type(iter);
+	const uint8_t * stream = kcdata_iter_payload(iter);
+	size_t available       = (size_t)((uint8_t *)dataBuffer + size - stream);
+	size_t paddedSize      = (size_t)((totalin + 15) & ~15ULL);
+	if (totalout > available || totalin > UINT32_MAX - 2 * sizeof(struct kcdata_item) - 15) {
+		if (error)
+			*error = GEN_ERROR(KERN_INVALID_OBJECT, "compressed stream doesn't fit the buffer");
+		return nil;
+	}
+
+	/* the inner buffer's header, the decoded items, padding and the end marker */
+	NSMutableData * result = [NSMutableData dataWithLength:paddedSize + 2 * sizeof(struct kcdata_item)];
+	struct kcdata_item * item = result.mutableBytes;
+	item->type = innerType;
+
+	if (!decodeLZ4Blocks(stream, (size_t)totalout, (uint8_t *)(item + 1), (size_t)totalin, error))
+		return nil;
+
+	item = (struct kcdata_item *)((uint8_t *)(item + 1) + paddedSize);
+	item->type = KCDATA_TYPE_BUFFER_END;
+
+	return result;
+}
+
 NSDictionary *
 parseKCDataBuffer(void * dataBuffer, uint32_t size, NSError ** error)
 {
@@ -357,6 +557,12 @@ parseKCDataBuffer(void * dataBuffer, uint32_t size, NSError ** error)
 	case KCDATA_BUFFER_BEGIN_XNUPOST_CONFIG:
 		rootKey = @"xnupost_testconfig";
 		break;
+	case KCDATA_BUFFER_BEGIN_COMPRESSED: {
+		NSData * decompressed = decompressKCDataBuffer(dataBuffer, size, error);
+		if (!decompressed)
+			return NULL;
+		return parseKCDataBuffer((void *)decompressed.bytes, (uint32_t)decompressed.length, error);
+	}
 	default: {
 		if (error)
 			*error = GEN_ERROR(KERN_INVALID_VALUE, "invalid magic number");
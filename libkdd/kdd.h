@@ -153,5 +153,28 @@ NSMutableDictionary * _Nullable parseKCDataContainer(kcdata_iter_t * _Nonnull it
  */
 NSDictionary * _Nullable parseKCDataBuffer(void * _Nonnull dataBuffer, uint32_t size, NSError * _Nullable * _Nullable error) NS_RETURNS_RETAINED;
 
+/*!
+ * @function decompressKCDataBuffer
+ *
+ * @abstract
+ * Decompress a KCDATA_BUFFER_BEGIN_COMPRESSED buffer into a plain KCDATA buffer.
+ *
+ * @param dataBuffer
+ * A pointer in memory where the compressed KCDATA is allocated.
+ *
+ * @param size
+ * Size of the buffer as provided by kernel api.
+ *
+ * @return NSData *
+ * The inner buffer, starting with its KCDATA_BUFFER_BEGIN_* header and ending with
+ * KCDATA_TYPE_BUFFER_END, ready for parseKCDataBuffer().
+ *
+ * @discussion
+ * Only LZ4 compressed buffers are decoded here. zlib compressed buffers fail with
+ * KERN_NOT_SUPPORTED and should be inflated by the caller.
+ *
+ */
+NSData * _Nullable decompressKCDataBuffer(void * _Nonnull dataBuffer, uint32_t size, NSError * _Nullable * _Nullable error) NS_RETURNS_RETAINED;
+
 
 #endif /* _KDD_H_ */
@@ -78,27 +78,143 @@ OSDictionary::sortBySymbol(void)
 {
 	qsort(dictionary, count, sizeof(OSDictionary::dictEntry),
 	    &OSDictionary::dictEntry::compare);
+	hashRebuild();
+}
+
+/*
+ * Dictionaries with a capacity of at least kHashThreshold also keep an open
+ * addressing index keyed on the OSSymbol pointer.  Each slot holds the
+ * position of an entry in dictionary[] plus one, zero meaning empty, so
+ * the entry array keeps its order for iteration and serialization.
+ *
+ * The index is stored in the same allocation as the entries, right after
+ * the first capacity of them, and its size only depends on the capacity.
+ * This adds no state to the class, so both container layouts get it.  It
+ * has twice as many slots as the capacity, so an append always fits, and
+ * it is rebuilt whenever entries move.
+ */
+#define kHashThreshold  32
+#define kHashMaxCapacity (UINT_MAX / (4 * sizeof(dictEntry)))
+
+static inline unsigned int
+OSDictionaryHashKey(const OSSymbol *aKey, unsigned int mask)
+{
+	uint64_t hash = (uint64_t)(uintptr_t)aKey * 0x9E3779B97F4A7C15ULL;
+
+	return (unsigned int)(hash >> 32) & mask;
+}
+
+unsigned int
+OSDictionary::hashSlots(unsigned int capacity)
+{
+	if (capacity < kHashThreshold) {
+		return 0;
+	}
+
+	// capacity is bounded by kHashMaxCapacity, so this can't overflow
+	return 1U << (32 - __builtin_clz(2 * capacity - 1));
+}
+
+// number of dictEntry sized elements holding capacity entries and their index
+unsigned int
+OSDictionary::allocCount(unsigned int capacity)
+{
+	size_t indexSize = hashSlots(capacity) * sizeof(unsigned int);
+
+	return capacity +
+	       (unsigned int)((indexSize + sizeof(dictEntry) - 1) / sizeof(dictEntry));
+}
+
+// largest capacity, at least capacity, whose entries and index fit in allocated
+unsigned int
+OSDictionary::capacityForAlloc(unsigned int allocated, unsigned int capacity)
+{
+	while (capacity < allocated && allocCount(capacity + 1) <= allocated) {
+		capacity++;
+	}
+
+	return capacity;
+}
+
+bool
+OSDictionary::hasHashIndex(void) const
+{
+	return capacity >= kHashThreshold;
+}
+
+unsigned int *
+OSDictionary::hashIndex(void) const
+{
+	return (unsigned int *)(void *)&dictionary[capacity];
+}
+
+unsigned int
+OSDictionary::hashFind(const OSSymbol *aKey) const
+{
+	unsigned int *slots = hashIndex();
+	unsigned int mask = hashSlots(capacity) - 1;
+	unsigned int slot = OSDictionaryHashKey(aKey, mask);
+	unsigned int entry;
+
+	while ((entry = slots[slot])) {
+		if (aKey == dictionary[entry - 1].key) {
+			return entry - 1;
+		}
+		slot = (slot + 1) & mask;
+	}
+
+	return count;
+}
+
+void
+OSDictionary::hashInsert(unsigned int entry)
+{
+	unsigned int *slots = hashIndex();
+	unsigned int mask = hashSlots(capacity) - 1;
+	unsigned int slot = OSDictionaryHashKey(dictionary[entry].key.get(), mask);
+
+	while (slots[slot]) {
+		slot = (slot + 1) & mask;
+	}
+	slots[slot] = entry + 1;
+}
+
+void
+OSDictionary::hashRebuild(void)
+{
+	if (!hasHashIndex()) {
+		return;
+	}
+
+	bzero(hashIndex(), hashSlots(capacity) * sizeof(unsigned int));
+	for (unsigned int i = 0; i < count; i++) {
+		hashInsert(i);
+	}
 }
 
 bool
 OSDictionary::initWithCapacity(unsigned int inCapacity)
 {
+	unsigned int allocated;
+
 	if (!super::init()) {
 		return false;
 	}
 
-	if (inCapacity > (UINT_MAX / sizeof(dictEntry))) {
+	if (inCapacity > kHashMaxCapacity) {
 		return false;
 	}
 
 //fOptions |= kSort;
 
-	dictionary = kallocp_type_container(dictEntry, &inCapacity, Z_WAITOK_ZERO);
+	allocated = allocCount(inCapacity);
+	dictionary = kallocp_type_container(dictEntry, &allocated, Z_WAITOK_ZERO);
 	if (!dictionary) {
 		return false;
 	}
 
-	OSCONTAINER_ACCUMSIZE(inCapacity * sizeof(dictEntry));
+	inCapacity = capacityForAlloc(allocated, inCapacity);
+	OSCONTAINER_ACCUMSIZE(allocCount(inCapacity) * sizeof(dictEntry));
 
 	count = 0;
 	capacity = inCapacity;
@@ -214,6 +330,8 @@ OSDictionary::initWithDictionary(const OSDictionary *dict,
 
 	if ((kSort & fOptions) && !(kSort & dict->fOptions)) {
 		sortBySymbol();
+	} else {
+		hashRebuild();
 	}
 
 	return true;
@@ -280,8 +398,8 @@ OSDictionary::free()
 	(void) super::setOptions(0, kImmutable);
 	flushCollection();
 	if (dictionary) {
-		kfree_type(dictEntry, capacity, dictionary);
-		OSCONTAINER_ACCUMSIZE( -(capacity * sizeof(dictEntry)));
+		kfree_type(dictEntry, allocCount(capacity), dictionary);
+		OSCONTAINER_ACCUMSIZE( -(allocCount(capacity) * sizeof(dictEntry)));
 	}
 
 	super::free();
@@ -316,7 +434,7 @@ unsigned int
 OSDictionary::ensureCapacity(unsigned int newCapacity)
 {
 	dictEntry *newDict;
-	unsigned int finalCapacity;
+	unsigned int finalCapacity, allocated;
 
 	if (newCapacity <= capacity) {
 		return capacity;
@@ -327,16 +445,22 @@ OSDictionary::ensureCapacity(unsigned int newCapacity)
 	    * capacityIncrement;
 
 	// integer overflow check
-	if (finalCapacity < newCapacity) {
+	if (finalCapacity < newCapacity || finalCapacity > kHashMaxCapacity) {
 		return capacity;
 	}
 
+	allocated = allocCount(finalCapacity);
 	newDict = kreallocp_type_container(dictEntry, dictionary,
-	    capacity, &finalCapacity, Z_WAITOK_ZERO);
+	    allocCount(capacity), &allocated, Z_WAITOK_ZERO);
 	if (newDict) {
-		OSCONTAINER_ACCUMSIZE(sizeof(dictEntry) * (finalCapacity - capacity));
+		finalCapacity = capacityForAlloc(allocated, finalCapacity);
+		OSCONTAINER_ACCUMSIZE(sizeof(dictEntry) *
+		    (allocCount(finalCapacity) - allocCount(capacity)));
+		// the old index was copied to where the new entries go
+		bzero(&newDict[capacity], (allocCount(capacity) - capacity) * sizeof(dictEntry));
 		dictionary = newDict;
 		capacity = finalCapacity;
+		hashRebuild();
 	}
 
 	return capacity;
@@ -352,6 +476,7 @@ OSDictionary::flushCollection()
 		dictionary[i].value.reset();
 	}
 	count = 0;
+	hashRebuild();
 }
 
 bool
@@ -370,6 +495,9 @@ setObject(const OSSymbol *aKey, const OSMetaClassBase *anObject, bool onlyAdd)
 	if (fOptions & kSort) {
 		i = OSSymbol::bsearch(aKey, &dictionary[0], count, sizeof(dictionary[0]));
 		exists = (i < count) && (aKey == dictionary[i].key);
+	} else if (hasHashIndex()) {
+		i = hashFind(aKey);
+		exists = (i < count);
 	} else {
 		for (exists = false, i = 0; i < count; i++) {
 			if ((exists = (aKey == dictionary[i].key))) {
@@ -405,6 +533,12 @@ setObject(const OSSymbol *aKey, const OSMetaClassBase *anObject, bool onlyAdd)
 	dictionary[i].value.reset(anObject, OSRetain);
 	count++;
 
+	if (hasHashIndex() && i == count - 1) {
+		hashInsert(i);
+	} else {
+		hashRebuild();
+	}
+
 	return true;
 }
 
@@ -448,6 +582,9 @@ OSDictionary::removeObject(const OSSymbol *aKey)
 	if (fOptions & kSort) {
 		i = OSSymbol::bsearch(aKey, &dictionary[0], count, sizeof(dictionary[0]));
 		exists = (i < count) && (aKey == dictionary[i].key);
+	} else if (hasHashIndex()) {
+		i = hashFind(aKey);
+		exists = (i < count);
 	} else {
 		for (exists = false, i = 0; i < count; i++) {
 			if ((exists = (aKey == dictionary[i].key))) {
@@ -463,6 +600,7 @@ OSDictionary::removeObject(const OSSymbol *aKey)
 
 		count--;
 		bcopy(&dictionary[i + 1], &dictionary[i], (count - i) * sizeof(dictionary[0]));
+		hashRebuild();
 
 		oldEntry.key->taggedRelease(OSTypeID(OSCollection));
 		oldEntry.value->taggedRelease(OSTypeID(OSCollection));
@@ -515,7 +653,12 @@ OSDictionary::getObject(const OSSymbol *aKey) const
 	// of OSSymbol::bsearch
 	//
 	// If we have less than 4 objects, scanning is faster.
-	if (count > 4 && (fOptions & kSort)) {
+	if (hasHashIndex()) {
+		i = hashFind(aKey);
+		if (i < count) {
+			return const_cast<OSObject *> ((const OSObject *)dictionary[i].value.get());
+		}
+	} else if (count > 4 && (fOptions & kSort)) {
 		while (l < r) {
 			i = (l + r) / 2;
 			if (aKey == dictionary[i].key) {
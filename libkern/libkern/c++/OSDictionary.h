@@ -159,6 +159,18 @@ protected:
 
 #endif /* APPLE_KEXT_ALIGN_CONTAINERS */
 
+#if XNU_KERNEL_PRIVATE
+// Open addressing index stored after the entries of dictionary[], see OSDictionary.cpp.
+	static unsigned int hashSlots(unsigned int capacity);
+	static unsigned int allocCount(unsigned int capacity);
+	static unsigned int capacityForAlloc(unsigned int allocated, unsigned int capacity);
+	bool hasHashIndex(void) const;
+	unsigned int * hashIndex(void) const;
+	unsigned int hashFind(const OSSymbol * aKey) const;
+	void hashInsert(unsigned int entry);
+	void hashRebuild(void);
+#endif
+
 // Member functions used by the OSCollectionIterator class.
 	virtual unsigned int iteratorSize() const APPLE_KEXT_OVERRIDE;
 	virtual bool initIterator(void * iterator) const APPLE_KEXT_OVERRIDE;
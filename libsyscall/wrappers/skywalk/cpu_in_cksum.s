@@ -46,7 +46,10 @@
 #include "../../../bsd/dev/arm64/cpu_in_cksum.s"
 #elif defined(__arm__)
 #include "../../../bsd/dev/arm/cpu_in_cksum.s"
-#elif defined(__i386__) || defined(__x86_64__)
+#elif defined(__x86_64__)
+/* The reference C code calls the AVX2 kernel for long buffers */
+#include "../../../bsd/dev/i386/cpu_in_cksum.s"
+#elif defined(__i386__)
 /* This is dealt with by the reference C code */
 #else
 #error "Unsupported architecture"
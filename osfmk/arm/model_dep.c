@@ -53,6 +53,7 @@
 #endif
 #include <machine/atomic.h>
 #include <machine/trap.h>
+#include <machine/machine_cpu.h>
 #include <kern/spl.h>
 #include <pexpert/pexpert.h>
 #include <kdp/kdp_callout.h>
@@ -1253,6 +1254,12 @@ DebuggerXCall(
 
 	os_atomic_dec(&debugger_sync, relaxed);
 
+	/* help with a parallel stackshot while held */
+	if (stackshot_active()) {
+		while (os_atomic_load(&mp_kdp_trap, relaxed) != 0 && stackshot_cpu_poll()) {
+			cpu_pause();
+		}
+	}
 
 	wait_while_mp_kdp_trap(false);
 
@@ -1882,6 +1882,10 @@ mp_kdp_wait(boolean_t flush, boolean_t isNMI)
 		}
 
 		kdp_x86_xcpu_poll();
+		if (stackshot_active()) {
+			/* help with a parallel stackshot */
+			(void)stackshot_cpu_poll();
+		}
 		cpu_pause();
 	}
 
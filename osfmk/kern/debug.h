@@ -280,6 +280,10 @@ __options_decl(stackshot_flags_t, uint64_t, {
 	STACKSHOT_DISABLE_LATENCY_INFO             = 0x40000000,
 	STACKSHOT_SAVE_DYLD_COMPACTINFO            = 0x80000000,
 	STACKSHOT_INCLUDE_DRIVER_THREADS_IN_KERNEL = 0x100000000,
+	/* With STACKSHOT_DO_COMPRESS, compress with LZ4 rather than zlib */
+	STACKSHOT_DO_COMPRESS_LZ4                  = 0x200000000,
+	/* Spread the task walk across the CPUs held while the stackshot is taken */
+	STACKSHOT_PARALLEL                         = 0x400000000,
 }); // Note: Add any new flags to kcdata.py (stackshot_in_flags)
 
 __options_decl(microstackshot_flags_t, uint32_t, {
@@ -651,6 +655,7 @@ extern struct additional_panic_data_buffer *panic_data_buffers;
 boolean_t oslog_is_safe(void);
 boolean_t debug_mode_active(void);
 boolean_t stackshot_active(void);
+bool stackshot_cpu_poll(void);
 void panic_stackshot_reset_state(void);
 
 /*
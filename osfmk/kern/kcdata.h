@@ -195,7 +195,7 @@
  * In order to avoid keeping large amounts of memory reserved for a panic stackshot, kcdata has support
  * for compressing the buffer in a streaming fashion. New data pushed to the kcdata buffer will be
  * automatically compressed using an algorithm selected by the API user (currently, we only support
- * pass-through and zlib, in the future we plan to add WKDM support, see: 57913859).
+ * pass-through, zlib and LZ4, in the future we plan to add WKDM support, see: 57913859).
  *
  * To start using compression, call:
  *   kcdata_init_compress(kcdata_p, hdr_tag, memcpy_f, comp_type);
@@ -233,6 +233,19 @@
  *   This function will also add some statistics about the compression to the buffer which helps with
  *   decompressing later.
  *
+ * A compressed buffer starts with a KCDATA_BUFFER_BEGIN_COMPRESSED header, followed by the
+ * "kcd_c_type", "kcd_c_totalout" and "kcd_c_totalin" uint64 items and the header of the inner buffer.
+ * The next kcd_c_totalout bytes are the compressed stream, which inflates to kcd_c_totalin bytes of
+ * items. The KCDATA_TYPE_BUFFER_END item follows the stream uncompressed.
+ *
+ * For zlib (kcd_c_type 1) the stream is a zlib stream. For LZ4 (kcd_c_type 2) it is a series of
+ * blocks, each starting with a uint32_t magic:
+ *   KCDATA_LZ4_BLOCK_MAGIC, uint32_t decoded size, uint32_t encoded size, LZ4 sequences
+ *   KCDATA_LZ4_RAW_BLOCK_MAGIC, uint32_t size, raw bytes
+ *   KCDATA_LZ4_END_MAGIC
+ * The matches in a block may reach back into the output of earlier blocks, so the blocks have to
+ * be decoded in order into a single buffer.
+ *
  */
 
 
@@ -469,6 +482,11 @@ struct kcdata_type_definition {
 #define KCDATA_BUFFER_BEGIN_XNUPOST_CONFIG 0x1e21c09fu       /* owner: osfmk/tests/kernel_tests.c */
                                                              /* type-range: 0x1040-0x105f */
 
+/* Block magic numbers of LZ4 compressed kcdata, see "Feature description: Compression" above */
+#define KCDATA_LZ4_BLOCK_MAGIC          0x31347662u          /* 'bv41' */
+#define KCDATA_LZ4_RAW_BLOCK_MAGIC      0x2d347662u          /* 'bv4-' */
+#define KCDATA_LZ4_END_MAGIC            0x24347662u          /* 'bv4$' */
+
 /* next type range number available 0x1060 */
 /**************** definitions for XNUPOST *********************/
 #define XNUPOST_KCTYPE_TESTCONFIG               0x1040
@@ -38,6 +38,7 @@
 #include <kern/kalloc.h>
 #include <kern/ipc_kobject.h>
 #include <mach/mach_vm.h>
+#include <vm/lz4.h>
 
 static kern_return_t kcdata_get_memory_addr_with_flavor(kcdata_descriptor_t data, uint32_t type, uint32_t size, uint64_t flags, mach_vm_address_t *user_addr);
 static size_t kcdata_get_memory_size_for_data(uint32_t size);
@@ -57,6 +58,25 @@ static void kcdata_object_no_senders(ipc_port_t port, mach_port_mscount_t mscoun
  */
 #define ZLIB_METADATA_SIZE 1440
 
+/*
+ * LZ4 encodes the input in blocks of KCDATA_LZ4_BLOCK_SIZE, and its matches
+ * can reach back KCDATA_LZ4_HISTORY_SIZE bytes into earlier blocks. The stage
+ * holds the history followed by a few blocks of input so that the history
+ * only has to be slid down every few blocks. Together with the hash table
+ * this is about as much metadata as zlib needs.
+ */
+#define KCDATA_LZ4_BLOCK_SIZE           (8 * 1024)
+#define KCDATA_LZ4_HISTORY_SIZE         (16 * 1024)
+#define KCDATA_LZ4_STAGE_SIZE           (KCDATA_LZ4_HISTORY_SIZE + 4 * KCDATA_LZ4_BLOCK_SIZE)
+/* lz4_encode_2gb() may read this far past the end of its input */
+#define KCDATA_LZ4_STAGE_SLACK          16
+#define KCDATA_LZ4_METADATA_SIZE        (lz4_hash_table_size + KCDATA_LZ4_STAGE_SIZE + KCDATA_LZ4_STAGE_SLACK)
+
+/* magic, decoded size, encoded size; see KCDATA_LZ4_BLOCK_MAGIC */
+#define KCDATA_LZ4_BLOCK_HEADER_SIZE    (3 * sizeof(uint32_t))
+/* magic, size; see KCDATA_LZ4_RAW_BLOCK_MAGIC */
+#define KCDATA_LZ4_RAW_HEADER_SIZE      (2 * sizeof(uint32_t))
+
 /* #define kcdata_debug_printf printf */
 #define kcdata_debug_printf(...) ;
 
@@ -465,6 +485,44 @@ kcdata_compress_zfree(void *opaque, void *ptr)
 	 */
 }
 
+static void
+kcdata_lz4_reset_hash(lz4_hash_entry_t *hash_table)
+{
+	const lz4_hash_entry_t HASH_FILL = { .offset = 0x80000000, .word = 0x0 };
+
+	for (int i = 0; i < LZ4_COMPRESS_HASH_ENTRIES; i++) {
+		hash_table[i] = HASH_FILL;
+	}
+}
+
+/* Called by kcdata_init_compress_state() when the configured compression algorithm is LZ4 */
+static kern_return_t
+kcdata_init_compress_state_lz4(kcdata_descriptor_t data)
+{
+	struct kcdata_compress_descriptor *cd = &data->kcd_comp_d;
+	size_t size = round_page(KCDATA_LZ4_METADATA_SIZE);
+	void *buf;
+
+	/* the hash table, followed by the stage */
+	buf = kcdata_endalloc(data, size);
+	if (buf == NULL) {
+		return KERN_INSUFFICIENT_BUFFER_SIZE;
+	}
+
+	cd->kcd_cd_base = buf;
+	cd->kcd_cd_offset = 0;
+	cd->kcd_cd_maxoffset = size;
+	cd->kcd_cd_flags = 0;
+	cd->kcd_cd_lz4 = (struct kcdata_lz4_stream){
+		.kcd_lz4_stage = (uint8_t *)buf + lz4_hash_table_size,
+	};
+	kcdata_lz4_reset_hash(buf);
+
+	kcdata_debug_printf("%s: buffer [%p - %p]\n", __func__, buf, (uint8_t *)buf + size);
+
+	return KERN_SUCCESS;
+}
+
 /* Used to initialize the selected compression algorithm's internal state (if any) */
 static kern_return_t
 kcdata_init_compress_state(kcdata_descriptor_t data, void (*memcpy_f)(void *, const void *, size_t), uint64_t type, mach_vm_address_t totalout_addr, mach_vm_address_t totalin_addr)
@@ -510,6 +568,9 @@ kcdata_init_compress_state(kcdata_descriptor_t data, void (*memcpy_f)(void *, co
 			ret = KERN_INVALID_ARGUMENT;
 		}
 		break;
+	case KCDCT_LZ4:
+		ret = kcdata_init_compress_state_lz4(data);
+		break;
 	default:
 		panic("kcdata_init_compress_state: invalid compression type: %d", (int) type);
 	}
@@ -631,6 +692,164 @@ kcdata_do_compress_zlib(kcdata_descriptor_t data, void *inbuffer,
 	return KERN_SUCCESS;
 }
 
+/*
+ * Keep the last KCDATA_LZ4_HISTORY_SIZE bytes of history at the start of the
+ * stage, and rebase the hash table so its entries still point at the same
+ * bytes. Entries that would point before the stage are dropped.
+ */
+static void
+kcdata_lz4_slide(struct kcdata_compress_descriptor *cd)
+{
+	struct kcdata_lz4_stream *ls = &cd->kcd_cd_lz4;
+	lz4_hash_entry_t *hash_table = cd->kcd_cd_base;
+	uint32_t shift;
+
+	assert(ls->kcd_lz4_pending == 0);
+	if (ls->kcd_lz4_history <= KCDATA_LZ4_HISTORY_SIZE) {
+		return;
+	}
+
+	shift = (uint32_t)(ls->kcd_lz4_history - KCDATA_LZ4_HISTORY_SIZE);
+	memmove(ls->kcd_lz4_stage, ls->kcd_lz4_stage + shift, KCDATA_LZ4_HISTORY_SIZE);
+	ls->kcd_lz4_history = KCDATA_LZ4_HISTORY_SIZE;
+
+	for (int i = 0; i < LZ4_COMPRESS_HASH_ENTRIES; i++) {
+		if (hash_table[i].offset >= shift && hash_table[i].offset < KCDATA_LZ4_STAGE_SIZE) {
+			hash_table[i].offset -= shift;
+		} else {
+			hash_table[i].offset = 0x80000000;
+		}
+	}
+}
+
+/*
+ * Encode the pending input into one block at @outbuffer: an LZ4 block when
+ * that is smaller, a raw block otherwise. Returns the number of bytes written,
+ * or 0 when @outsize can't hold the worst case.
+ */
+static size_t
+kcdata_lz4_emit_block(struct kcdata_compress_descriptor *cd, uint8_t *outbuffer, size_t outsize)
+{
+	struct kcdata_lz4_stream *ls = &cd->kcd_cd_lz4;
+	size_t insize = ls->kcd_lz4_pending;
+	const uint8_t *src_begin = ls->kcd_lz4_stage + ls->kcd_lz4_history;
+	const uint8_t *src = src_begin;
+	uint8_t *payload = outbuffer + KCDATA_LZ4_BLOCK_HEADER_SIZE;
+	uint8_t *dst = payload;
+	uint32_t header[3];
+	size_t encoded, wrote;
+
+	if (outsize < KCDATA_LZ4_BLOCK_HEADER_SIZE + insize + LZ4_GOFAST_SAFETY_MARGIN) {
+		return 0;
+	}
+
+	/*
+	 * The encoder gives up once its output would outgrow the input, and
+	 * starts its matches from the stage so they can reach into the history.
+	 */
+	lz4_encode_2gb(&dst, insize + LZ4_GOFAST_SAFETY_MARGIN, &src,
+	    ls->kcd_lz4_stage, insize, cd->kcd_cd_base, 0);
+	encoded = (size_t)(dst - payload);
+
+	if (src == src_begin + insize && encoded + sizeof(uint32_t) < insize) {
+		header[0] = KCDATA_LZ4_BLOCK_MAGIC;
+		header[1] = (uint32_t)insize;
+		header[2] = (uint32_t)encoded;
+		memcpy(outbuffer, header, KCDATA_LZ4_BLOCK_HEADER_SIZE);
+		wrote = KCDATA_LZ4_BLOCK_HEADER_SIZE + encoded;
+	} else {
+		header[0] = KCDATA_LZ4_RAW_BLOCK_MAGIC;
+		header[1] = (uint32_t)insize;
+		memcpy(outbuffer, header, KCDATA_LZ4_RAW_HEADER_SIZE);
+		memcpy(outbuffer + KCDATA_LZ4_RAW_HEADER_SIZE, src_begin, insize);
+		wrote = KCDATA_LZ4_RAW_HEADER_SIZE + insize;
+	}
+
+	ls->kcd_lz4_history += insize;
+	ls->kcd_lz4_pending = 0;
+	ls->kcd_lz4_total_out += wrote;
+	if (ls->kcd_lz4_history + KCDATA_LZ4_BLOCK_SIZE > KCDATA_LZ4_STAGE_SIZE) {
+		kcdata_lz4_slide(cd);
+	}
+
+	return wrote;
+}
+
+/* Called by kcdata_do_compress() when the configured compression algorithm is LZ4 */
+static kern_return_t
+kcdata_do_compress_lz4(kcdata_descriptor_t data, void *inbuffer,
+    size_t insize, void *outbuffer, size_t outsize, size_t *wrote,
+    enum kcdata_compression_flush flush)
+{
+	struct kcdata_compress_descriptor *cd = &data->kcd_comp_d;
+	struct kcdata_lz4_stream *ls = &cd->kcd_cd_lz4;
+	const uint8_t *src = inbuffer;
+	uint8_t *dst = outbuffer;
+	uint8_t *dst_end = dst + outsize;
+	size_t len;
+
+	assert(cd->kcd_cd_memcpy_f);
+
+	/*
+	 * Most kcdata items are much smaller than the span the encoder needs to
+	 * find any match in, so unlike zlib, a sync flush doesn't force a block
+	 * out: input is staged until a whole block is pending or the stream is
+	 * finished.
+	 */
+	while (insize > 0) {
+		len = MIN(insize, KCDATA_LZ4_BLOCK_SIZE - ls->kcd_lz4_pending);
+		cd->kcd_cd_memcpy_f(ls->kcd_lz4_stage + ls->kcd_lz4_history + ls->kcd_lz4_pending, src, len);
+		ls->kcd_lz4_pending += len;
+		ls->kcd_lz4_total_in += len;
+		src += len;
+		insize -= len;
+
+		if (ls->kcd_lz4_pending == KCDATA_LZ4_BLOCK_SIZE) {
+			len = kcdata_lz4_emit_block(cd, dst, (size_t)(dst_end - dst));
+			if (len == 0) {
+				return KERN_INSUFFICIENT_BUFFER_SIZE;
+			}
+			dst += len;
+		}
+	}
+
+	if (flush == KCDCF_FINISH) {
+		const uint32_t end_magic = KCDATA_LZ4_END_MAGIC;
+
+		if (ls->kcd_lz4_pending) {
+			len = kcdata_lz4_emit_block(cd, dst, (size_t)(dst_end - dst));
+			if (len == 0) {
+				return KERN_INSUFFICIENT_BUFFER_SIZE;
+			}
+			dst += len;
+		}
+		if ((size_t)(dst_end - dst) < sizeof(end_magic)) {
+			return KERN_INSUFFICIENT_BUFFER_SIZE;
+		}
+		memcpy(dst, &end_magic, sizeof(end_magic));
+		dst += sizeof(end_magic);
+		ls->kcd_lz4_total_out += sizeof(end_magic);
+	}
+
+	kcdata_debug_printf("%s: %p (%zu) <- %p (%zu); flush: %d; wrote = %ld\n",
+	    __func__, outbuffer, outsize, inbuffer, insize, flush, dst - (uint8_t *)outbuffer);
+	if (wrote) {
+		*wrote = (size_t)(dst - (uint8_t *)outbuffer);
+	}
+	return KERN_SUCCESS;
+}
+
+/*
+ * zlib writes at least a sync marker on every KCDCF_SYNC_FLUSH, so writing
+ * nothing means its stream is broken. LZ4 stages input across sync flushes
+ * and legitimately writes nothing for most of them.
+ */
+static inline bool
+kcdata_compression_sync_flush_writes(kcdata_descriptor_t data)
+{
+	return data->kcd_comp_d.kcd_cd_compression_type != KCDCT_LZ4;
+}
+
 /*
  * Compress the buffer at @inbuffer (of size @insize) into the kcdata buffer
  * @outbuffer (of size @outsize). Flush based on the @flush parameter.
@@ -667,6 +886,8 @@ kcdata_do_compress(kcdata_descriptor_t data, void *inbuffer, size_t insize,
 	switch (data->kcd_comp_d.kcd_cd_compression_type) {
 	case KCDCT_ZLIB:
 		return kcdata_do_compress_zlib(data, inbuffer, insize, outbuffer, outsize, wrote, flush);
+	case KCDCT_LZ4:
+		return kcdata_do_compress_lz4(data, inbuffer, insize, outbuffer, outsize, wrote, flush);
 	default:
 		panic("invalid compression type 0x%llx in kcdata_do_compress", data->kcd_comp_d.kcd_cd_compression_type);
 	}
@@ -681,6 +902,20 @@ kcdata_compression_bound_zlib(kcdata_descriptor_t data, size_t size)
 	return (size_t) deflateBound(zs, (unsigned long) size);
 }
 
+static size_t
+kcdata_compression_bound_lz4(kcdata_descriptor_t data, size_t size)
+{
+	size_t staged = data->kcd_comp_d.kcd_cd_lz4.kcd_lz4_pending + size;
+
+	/*
+	 * Input staged by earlier calls may come out now too. Blocks are never
+	 * larger than their raw form, but the encoder needs some slack past the
+	 * end of its output, and the stream may end here.
+	 */
+	return staged + (staged / KCDATA_LZ4_BLOCK_SIZE + 1) * KCDATA_LZ4_BLOCK_HEADER_SIZE +
+	       LZ4_GOFAST_SAFETY_MARGIN + sizeof(uint32_t);
+}
+
 
 /*
  * returns the worst-case, maximum length of the compressed data when
@@ -692,6 +927,8 @@ kcdata_compression_bound(kcdata_descriptor_t data, size_t size)
 	switch (data->kcd_comp_d.kcd_cd_compression_type) {
 	case KCDCT_ZLIB:
 		return kcdata_compression_bound_zlib(data, size);
+	case KCDCT_LZ4:
+		return kcdata_compression_bound_lz4(data, size);
 	case KCDCT_NONE:
 		return size;
 	default:
@@ -791,7 +1028,7 @@ kcdata_compress_chunk_with_flags(kcdata_descriptor_t data, uint32_t type, const
 			return kr;
 		}
 		kcdata_debug_printf("%s: 3rd wrote = %zu\n", __func__, wrote);
-		if (wrote == 0) {
+		if (wrote == 0 && kcdata_compression_sync_flush_writes(data)) {
 			return KERN_FAILURE;
 		}
 		space_ptr = (void *)((uintptr_t)space_ptr + wrote);
@@ -862,6 +1099,72 @@ kcdata_push_array(kcdata_descriptor_t data, uint32_t type_of_element, uint32_t s
 	}
 }
 
+/*
+ * kcdata_append_items:
+ *		Append @size bytes of complete, 16-byte aligned kcdata items at @items
+ *		(the contents of another kcdata buffer between its BEGIN and END
+ *		markers) to the kcdata buffer described by @data, compressing them if
+ *		@data is compressed.
+ *
+ * Returns KERN_INSUFFICIENT_BUFFER_SIZE if the items don't fit.
+ */
+kern_return_t
+kcdata_append_items(kcdata_descriptor_t data, const void *items, uint32_t size)
+{
+	struct kcdata_compress_descriptor *cd = &data->kcd_comp_d;
+	size_t max_size, wrote = 0;
+	kern_return_t kr;
+
+	if (items == NULL || (size % KCDATA_ALIGNMENT_SIZE) != 0) {
+		return KERN_INVALID_ARGUMENT;
+	}
+	if (size == 0) {
+		return KERN_SUCCESS;
+	}
+
+	if ((data->kcd_flags & KCFLAG_USE_COMPRESSION) == 0 || (cd->kcd_cd_flags & KCD_CD_FLAG_IN_MARK)) {
+		/* check available memory, including trailer size for KCDATA_TYPE_BUFFER_END */
+		if (size + sizeof(struct kcdata_item) > data->kcd_length ||
+		    data->kcd_length - (size + sizeof(struct kcdata_item)) < data->kcd_addr_end - data->kcd_addr_begin) {
+			return KERN_INSUFFICIENT_BUFFER_SIZE;
+		}
+
+		kr = kcdata_memcpy(data, data->kcd_addr_end, items, size);
+		if (kr) {
+			return kr;
+		}
+		data->kcd_addr_end += size;
+
+		if (!(data->kcd_flags & KCFLAG_NO_AUTO_ENDBUFFER)) {
+			return kcdata_write_buffer_end(data);
+		}
+		return KERN_SUCCESS;
+	}
+
+	max_size = kcdata_compression_bound(data, size);
+	if (max_size > data->kcd_length ||
+	    data->kcd_length - max_size < data->kcd_addr_end - data->kcd_addr_begin) {
+		kcdata_debug_printf("%s: insufficient buffer size: kcd_length => %d e-b=> %lld our size: %zu\n",
+		    __func__, data->kcd_length, data->kcd_addr_end - data->kcd_addr_begin, max_size);
+		return KERN_INSUFFICIENT_BUFFER_SIZE;
+	}
+
+	kr = kcdata_do_compress(data, (void *)(uintptr_t)items, size, (void *)data->kcd_addr_end, max_size, &wrote,
+	    cd->kcd_cd_flags & KCD_CD_FLAG_FINALIZE ? KCDCF_FINISH : KCDCF_SYNC_FLUSH);
+	if (kr != KERN_SUCCESS) {
+		return kr;
+	}
+	if (wrote == 0 && kcdata_compression_sync_flush_writes(data)) {
+		return KERN_FAILURE;
+	}
+	assert(wrote <= max_size);
+
+	/* move the end marker forward */
+	data->kcd_addr_end += wrote;
+
+	return KERN_SUCCESS;
+}
+
 /* A few words on how window compression works:
  *
  * This is how the buffer looks when the window is opened:
@@ -966,7 +1269,7 @@ kcdata_compression_window_close(kcdata_descriptor_t data)
 		return kr;
 	}
 	kcdata_debug_printf("%s: first wrote = %zu\n", __func__, wrote);
-	if (wrote == 0) {
+	if (wrote == 0 && kcdata_compression_sync_flush_writes(data)) {
 		return KERN_FAILURE;
 	}
 	space_ptr = (void *)((uintptr_t)space_ptr + wrote);
@@ -974,8 +1277,11 @@ kcdata_compression_window_close(kcdata_descriptor_t data)
 
 	assert((size_t)((uintptr_t)space_ptr - (uintptr_t)space_start) <= max_size);
 
-	/* copy to the original location */
-	kcdata_memcpy(data, cd->kcd_cd_mark_begin, space_start, (uint32_t) (max_size - total_uncompressed_space_remaining));
+	/*
+	 * copy to the original location. This may overlap: LZ4 output can include
+	 * input staged before the window was opened, and outgrow the window.
+	 */
+	memmove((void *)cd->kcd_cd_mark_begin, space_start, (size_t) (max_size - total_uncompressed_space_remaining));
 
 	/* rewind the end marker */
 	data->kcd_addr_end = cd->kcd_cd_mark_begin + (max_size - total_uncompressed_space_remaining);
@@ -997,6 +1303,19 @@ kcdata_get_compression_stats_zlib(kcdata_descriptor_t data, uint64_t *totalout,
 	return KERN_SUCCESS;
 }
 
+static kern_return_t
+kcdata_get_compression_stats_lz4(kcdata_descriptor_t data, uint64_t *totalout, uint64_t *totalin)
+{
+	struct kcdata_compress_descriptor *cd = &data->kcd_comp_d;
+
+	assert((cd->kcd_cd_flags & KCD_CD_FLAG_IN_MARK) == 0);
+
+	*totalout = cd->kcd_cd_lz4.kcd_lz4_total_out;
+	*totalin = cd->kcd_cd_lz4.kcd_lz4_total_in;
+
+	return KERN_SUCCESS;
+}
+
 static kern_return_t
 kcdata_get_compression_stats(kcdata_descriptor_t data, uint64_t *totalout, uint64_t *totalin)
 {
@@ -1006,6 +1325,9 @@ kcdata_get_compression_stats(kcdata_descriptor_t data, uint64_t *totalout, uint6
 	case KCDCT_ZLIB:
 		kr = kcdata_get_compression_stats_zlib(data, totalout, totalin);
 		break;
+	case KCDCT_LZ4:
+		kr = kcdata_get_compression_stats_lz4(data, totalout, totalin);
+		break;
 	case KCDCT_NONE:
 		*totalout = *totalin = kcdata_memory_get_used_bytes(data);
 		kr = KERN_SUCCESS;
@@ -1034,12 +1356,9 @@ kcdata_write_compression_stats(kcdata_descriptor_t data)
 	return kr;
 }
 
-static kern_return_t
-kcdata_finish_compression_zlib(kcdata_descriptor_t data)
+static void
+kcdata_finish_compression_clear_tail(kcdata_descriptor_t data)
 {
-	struct kcdata_compress_descriptor *cd = &data->kcd_comp_d;
-	z_stream *zs = &cd->kcd_cd_zs;
-
 	/*
 	 * macOS on x86 w/ coprocessor ver. 2 and later context: Stackshot compression leaves artifacts
 	 * in the panic buffer which interferes with CRC checks. The CRC is calculated here over the full
@@ -1057,6 +1376,15 @@ kcdata_finish_compression_zlib(kcdata_descriptor_t data)
 	void* stackshot_end = (char*)data->kcd_addr_begin + kcdata_memory_get_used_bytes(data);
 	uint32_t zero_fill_size = data->kcd_length - kcdata_memory_get_used_bytes(data);
 	bzero(stackshot_end, zero_fill_size);
+}
+
+static kern_return_t
+kcdata_finish_compression_zlib(kcdata_descriptor_t data)
+{
+	struct kcdata_compress_descriptor *cd = &data->kcd_comp_d;
+	z_stream *zs = &cd->kcd_cd_zs;
+
+	kcdata_finish_compression_clear_tail(data);
 
 	if (deflateEnd(zs) == Z_OK) {
 		return KERN_SUCCESS;
@@ -1073,6 +1401,10 @@ kcdata_finish_compression(kcdata_descriptor_t data)
 	switch (data->kcd_comp_d.kcd_cd_compression_type) {
 	case KCDCT_ZLIB:
 		return kcdata_finish_compression_zlib(data);
+	case KCDCT_LZ4:
+		/* the stream was ended by the last KCDCF_FINISH */
+		kcdata_finish_compression_clear_tail(data);
+		return KERN_SUCCESS;
 	case KCDCT_NONE:
 		return KERN_SUCCESS;
 	default:
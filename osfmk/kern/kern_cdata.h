@@ -61,6 +61,7 @@
 __options_decl(kcd_compression_type_t, uint64_t, {
 	KCDCT_NONE = 0x00,
 	KCDCT_ZLIB = 0x01,
+	KCDCT_LZ4  = 0x02,
 });
 
 #ifdef KERNEL
@@ -71,9 +72,24 @@ __options_decl(kcd_cd_flag_t, uint64_t, {
 	KCD_CD_FLAG_FINALIZE = 0x02,
 });
 
+/*
+ * LZ4 stream state. The hash table and the staging buffer live in the
+ * metadata area at kcd_cd_base, see kcdata_do_compress_lz4().
+ */
+struct kcdata_lz4_stream {
+	uint8_t *kcd_lz4_stage;     /* encoded history, then pending input */
+	size_t kcd_lz4_history;     /* bytes of history at the start of the stage */
+	size_t kcd_lz4_pending;     /* bytes staged but not encoded yet */
+	uint64_t kcd_lz4_total_in;
+	uint64_t kcd_lz4_total_out;
+};
+
 /* Structure to save zstream and other compression metadata */
 struct kcdata_compress_descriptor {
-	z_stream kcd_cd_zs;
+	union {
+		z_stream kcd_cd_zs;
+		struct kcdata_lz4_stream kcd_cd_lz4;
+	};
 	void *kcd_cd_base;
 	uint64_t kcd_cd_offset;
 	size_t kcd_cd_maxoffset;
@@ -160,6 +176,7 @@ void *kcdata_memory_get_begin_addr(kcdata_descriptor_t data);
 kern_return_t kcdata_init_compress(kcdata_descriptor_t, int hdr_tag, void (*memcpy_f)(void *, const void *, size_t), uint64_t type);
 kern_return_t kcdata_push_data(kcdata_descriptor_t data, uint32_t type, uint32_t size, const void *input_data);
 kern_return_t kcdata_push_array(kcdata_descriptor_t data, uint32_t type_of_element, uint32_t size_of_element, uint32_t count, const void *input_data);
+kern_return_t kcdata_append_items(kcdata_descriptor_t data, const void *items, uint32_t size);
 kern_return_t kcdata_compress_memory_addr(kcdata_descriptor_t data, void *ptr);
 void *kcdata_endalloc(kcdata_descriptor_t data, size_t length);
 kern_return_t kcdata_finish(kcdata_descriptor_t data);
@@ -53,9 +53,11 @@
 #include <string.h> /* bcopy */
 
 #include <kern/backtrace.h>
+#include <kern/bits.h>
 #include <kern/coalition.h>
 #include <kern/exclaves_stackshot.h>
 #include <kern/exclaves_inspection.h>
+#include <kern/percpu.h>
 #include <kern/processor.h>
 #include <kern/host_statistics.h>
 #include <kern/counter.h>
@@ -72,6 +74,7 @@
 #include <vm/vm_fault.h>
 #include <vm/vm_shared_region.h>
 #include <vm/vm_compressor.h>
+#include <machine/machine_cpu.h>
 #include <libkern/OSKextLibPrivate.h>
 #include <os/log.h>
 
@@ -158,6 +161,41 @@ static size_t stackshot_exclave_inspect_ctid_capacity = 0;
 static kern_return_t stackshot_exclave_kr = KERN_SUCCESS;
 #endif /* CONFIG_EXCLAVES */
 
+/*
+ * Parallel stackshots (STACKSHOT_PARALLEL): the CPUs held by the debugger
+ * while the stackshot is taken take tasks off a shared cursor and record them
+ * into their own slice of stackshot_parallel_buf, see stackshot_cpu_poll().
+ * The CPU taking the stackshot records tasks straight into the stackshot
+ * buffer, and appends each slice to it once every task has been handed out.
+ */
+__enum_decl(stackshot_parallel_state_t, uint32_t, {
+	STACKSHOT_PARALLEL_NONE,        /* no work will be handed out */
+	STACKSHOT_PARALLEL_PENDING,     /* the stackshot CPU may start handing out tasks */
+	STACKSHOT_PARALLEL_RUNNING,     /* tasks are being handed out */
+});
+
+#define STACKSHOT_PARALLEL_MIN_SLICE (64 * 1024)
+
+struct stackshot_cpu_context {
+	struct kcdata_descriptor scc_kcdata;         /* this CPU's slice of stackshot_parallel_buf */
+	task_t                   scc_deferred_task;  /* task that didn't fit in the slice */
+	kern_return_t            scc_error;
+	bool                     scc_used;           /* recorded into its slice this stackshot */
+};
+
+static void *stackshot_parallel_buf;
+static uint32_t stackshot_parallel_bufsize;
+static stackshot_parallel_state_t stackshot_parallel_state;
+static struct stackshot_context *stackshot_parallel_ctx;
+static task_t stackshot_parallel_cursor;        /* next task to hand out */
+static uint32_t stackshot_parallel_slices;      /* number of slices in stackshot_parallel_buf */
+static uint32_t stackshot_parallel_next_slice;
+static uint32_t stackshot_parallel_helpers;     /* CPUs currently recording tasks */
+static struct stackshot_cpu_context PERCPU_DATA(stackshot_cpu_context);
+
+/* Serializes port label hash lookups and inserts across CPUs, see stackshot_plh_lookup() */
+static uint32_t stackshot_plh_lock_word;
+
 __private_extern__ void stackshot_init( void );
 static boolean_t memory_iszero(void *addr, size_t size);
 uint32_t                get_stackshot_estsize(uint32_t prev_size_hint, uint32_t adj);
@@ -1174,11 +1212,12 @@ kern_stack_snapshot_internal(int stackshot_config_version, void *stackshot_confi
 
 		stackshot_duration_outer = NULL;
 
-		/* if compression was requested, allocate the extra zlib scratch area */
+		/* if compression was requested, allocate the extra zlib or LZ4 scratch area */
 		if (flags & STACKSHOT_DO_COMPRESS) {
 			hdr_tag = (flags & STACKSHOT_COLLECT_DELTA_SNAPSHOT) ? KCDATA_BUFFER_BEGIN_DELTA_STACKSHOT
 			    : KCDATA_BUFFER_BEGIN_STACKSHOT;
-			error = kcdata_init_compress(kcdata_p, hdr_tag, kdp_memcpy, KCDCT_ZLIB);
+			error = kcdata_init_compress(kcdata_p, hdr_tag, kdp_memcpy,
+			    (flags & STACKSHOT_DO_COMPRESS_LZ4) ? KCDCT_LZ4 : KCDCT_ZLIB);
 			if (error != KERN_SUCCESS) {
 				os_log(OS_LOG_DEFAULT, "failed to initialize compression: %d!\n",
 				    (int) error);
@@ -1186,6 +1225,16 @@ kern_stack_snapshot_internal(int stackshot_config_version, void *stackshot_confi
 			}
 		}
 
+		/*
+		 * The other CPUs record into slices of a second buffer of the same
+		 * size, if this fails the stackshot is simply taken on one CPU.
+		 */
+		if ((flags & STACKSHOT_PARALLEL) &&
+		    kmem_alloc(kernel_map, (vm_offset_t *)&stackshot_parallel_buf, stackshotbuf_size,
+		    KMA_DATA, VM_KERN_MEMORY_DIAG) == KERN_SUCCESS) {
+			stackshot_parallel_bufsize = stackshotbuf_size;
+		}
+
 		/*
 		 * Disable interrupts and save the current interrupt state.
 		 */
@@ -1210,6 +1259,12 @@ kern_stack_snapshot_internal(int stackshot_config_version, void *stackshot_confi
 		SOCD_TRACE_XNU_END(STACKSHOT);
 		ml_set_interrupts_enabled(prev_interrupt_state);
 
+		if (stackshot_parallel_buf != NULL) {
+			kmem_free(kernel_map, (vm_offset_t)stackshot_parallel_buf, stackshot_parallel_bufsize);
+			stackshot_parallel_buf = NULL;
+			stackshot_parallel_bufsize = 0;
+		}
+
 #if CONFIG_EXCLAVES
 		/* trigger Exclave thread collection if any are queued */
 		assert(error == KERN_SUCCESS || stackshot_exclave_inspect_ctids == NULL);
@@ -1338,6 +1393,11 @@ kdp_snapshot_preflight(int pid, void * tracebuf, uint32_t tracebuf_size, uint64_
 
 	panic_stackshot = ((flags & STACKSHOT_FROM_PANIC) != 0);
 
+	/* let the other CPUs know to wait for tasks as they enter the debugger */
+	os_atomic_store(&stackshot_parallel_state,
+	    ((flags & STACKSHOT_PARALLEL) && !panic_stackshot) ? STACKSHOT_PARALLEL_PENDING : STACKSHOT_PARALLEL_NONE,
+	    release);
+
 	assert(data_p != NULL);
 	assert(stackshot_kcdata_p == NULL);
 	stackshot_kcdata_p = data_p;
@@ -1387,30 +1447,35 @@ memory_iszero(void *addr, size_t size)
  * to avoid the expensive software KVA-to-phys translation in the VM.
  */
 
+/* per-CPU, as several CPUs validate addresses during a parallel stackshot */
 struct _stackshot_validation_state {
 	vm_offset_t last_valid_page_kva;
 	size_t last_valid_size;
-} g_validation_state;
+};
+static struct _stackshot_validation_state PERCPU_DATA(stackshot_validation_state);
 
 static void
 _stackshot_validation_reset(void)
 {
-	g_validation_state.last_valid_page_kva = -1;
-	g_validation_state.last_valid_size = 0;
+	struct _stackshot_validation_state *vs = PERCPU_GET(stackshot_validation_state);
+
+	vs->last_valid_page_kva = -1;
+	vs->last_valid_size = 0;
 }
 
 static bool
 _stackshot_validate_kva(vm_offset_t addr, size_t size)
 {
+	struct _stackshot_validation_state *vs = PERCPU_GET(stackshot_validation_state);
 	vm_offset_t page_addr = atop_kernel(addr);
-	if (g_validation_state.last_valid_page_kva == page_addr &&
-	    g_validation_state.last_valid_size <= size) {
+	if (vs->last_valid_page_kva == page_addr &&
+	    vs->last_valid_size <= size) {
 		return true;
 	}
 
 	if (ml_validate_nofault(addr, size)) {
-		g_validation_state.last_valid_page_kva = page_addr;
-		g_validation_state.last_valid_size = size;
+		vs->last_valid_page_kva = page_addr;
+		vs->last_valid_size = size;
 		return true;
 	}
 	return false;
@@ -1445,11 +1510,11 @@ _stackshot_strlen(const char *s, size_t maxlen)
  * The parallel arrays contain:
  *      - plh_array[idx]	the pointer entered
  *      - plh_chains[idx]	the hash chain
- *      - plh_gen[idx]		the last 'generation #' seen
  *
- * Generation IDs are used to track entries looked up in the current
- * task; 0 is never used, and the plh_gen array is cleared to 0 on
- * rollover.
+ * The hash is shared by all the CPUs recording tasks in a parallel
+ * stackshot, so lookups and inserts are done under stackshot_plh_lock().
+ * The entries looked up in the task being recorded are tracked per-CPU,
+ * in struct stackshot_plh_refs.
  *
  * The portlabel_ids we report externally are just the index in the array,
  * plus 1 to avoid 0 as a value.  0 is NONE, -1 is UNKNOWN (e.g. there is
@@ -1460,11 +1525,7 @@ struct port_label_hash {
 	uint16_t                plh_count;      /* count of used entries in plh_array */
 	struct ipc_service_port_label **plh_array; /* _size allocated, _count used */
 	int16_t                *plh_chains;    /* _size allocated */
-	uint8_t                *plh_gen;       /* last 'gen #' seen in */
 	int16_t                *plh_hash;      /* (1 << STACKSHOT_PLH_SHIFT) entry hash table: hash(ptr) -> array index */
-	int16_t                 plh_curgen_min; /* min idx seen for this gen */
-	int16_t                 plh_curgen_max; /* max idx seen for this gen */
-	uint8_t                 plh_curgen;     /* current gen */
 #if DEVELOPMENT || DEBUG
 	/* statistics */
 	uint32_t                plh_lookups;    /* # lookups or inserts */
@@ -1483,10 +1544,23 @@ struct port_label_hash {
 } port_label_hash;
 
 #define STACKSHOT_PLH_SHIFT    7
-#define STACKSHOT_PLH_SIZE_MAX ((kdp_ipc_have_splabel)? 1024 : 0)
+#define STACKSHOT_PLH_SIZE_LIMIT 1024
+#define STACKSHOT_PLH_SIZE_MAX ((kdp_ipc_have_splabel)? STACKSHOT_PLH_SIZE_LIMIT : 0)
 size_t stackshot_port_label_size = (2 * (1u << STACKSHOT_PLH_SHIFT));
 #define STASKSHOT_PLH_SIZE(x) MIN((x), STACKSHOT_PLH_SIZE_MAX)
 
+/*
+ * Entries referenced by the task being recorded on this CPU.  Every bit set
+ * lies within [spr_min, spr_max], which is all stackshot_plh_resetrefs()
+ * has to clear.
+ */
+struct stackshot_plh_refs {
+	bitmap_t                spr_bits[BITMAP_LEN(STACKSHOT_PLH_SIZE_LIMIT)];
+	int16_t                 spr_min;        /* min idx referenced */
+	int16_t                 spr_max;        /* max idx referenced */
+};
+static struct stackshot_plh_refs PERCPU_DATA(stackshot_plh_refs);
+
 static size_t
 stackshot_plh_est_size(void)
 {
@@ -1499,7 +1573,6 @@ stackshot_plh_est_size(void)
 #define SIZE_EST(x) ROUNDUP((x), sizeof (uintptr_t))
 	return SIZE_EST(size * sizeof(*plh->plh_array)) +
 	       SIZE_EST(size * sizeof(*plh->plh_chains)) +
-	       SIZE_EST(size * sizeof(*plh->plh_gen)) +
 	       SIZE_EST((1ul << STACKSHOT_PLH_SHIFT) * sizeof(*plh->plh_hash));
 #undef SIZE_EST
 }
@@ -1516,9 +1589,6 @@ stackshot_plh_setup(kcdata_descriptor_t data)
 	struct port_label_hash plh = {
 		.plh_size = STASKSHOT_PLH_SIZE(stackshot_port_label_size),
 		.plh_count = 0,
-		.plh_curgen = 1,
-		.plh_curgen_min = STACKSHOT_PLH_SIZE_MAX,
-		.plh_curgen_max = 0,
 	};
 	stackshot_plh_reset();
 	size_t size = plh.plh_size;
@@ -1527,16 +1597,14 @@ stackshot_plh_setup(kcdata_descriptor_t data)
 	}
 	plh.plh_array = kcdata_endalloc(data, size * sizeof(*plh.plh_array));
 	plh.plh_chains = kcdata_endalloc(data, size * sizeof(*plh.plh_chains));
-	plh.plh_gen = kcdata_endalloc(data, size * sizeof(*plh.plh_gen));
 	plh.plh_hash = kcdata_endalloc(data, (1ul << STACKSHOT_PLH_SHIFT) * sizeof(*plh.plh_hash));
-	if (plh.plh_array == NULL || plh.plh_chains == NULL || plh.plh_gen == NULL || plh.plh_hash == NULL) {
+	if (plh.plh_array == NULL || plh.plh_chains == NULL || plh.plh_hash == NULL) {
 		PLH_STAT_OP(port_label_hash.plh_bad++);
 		return;
 	}
 	for (int x = 0; x < size; x++) {
 		plh.plh_array[x] = NULL;
 		plh.plh_chains[x] = -1;
-		plh.plh_gen[x] = 0;
 	}
 	for (int x = 0; x < (1ul << STACKSHOT_PLH_SHIFT); x++) {
 		plh.plh_hash[x] = -1;
@@ -1567,46 +1635,36 @@ enum stackshot_plh_lookup_type {
 };
 
 static void
-stackshot_plh_resetgen(void)
+stackshot_plh_lock(void)
 {
-	struct port_label_hash *plh = &port_label_hash;
-	if (plh->plh_curgen_min == STACKSHOT_PLH_SIZE_MAX && plh->plh_curgen_max == 0) {
-		return;  // no lookups, nothing using the current generation
-	}
-	plh->plh_curgen++;
-	plh->plh_curgen_min = STACKSHOT_PLH_SIZE_MAX;
-	plh->plh_curgen_max = 0;
-	if (plh->plh_curgen == 0) { // wrapped, zero the array and increment the generation
-		for (int x = 0; x < plh->plh_size; x++) {
-			plh->plh_gen[x] = 0;
-		}
-		plh->plh_curgen = 1;
+	while (!os_atomic_cmpxchg(&stackshot_plh_lock_word, 0, 1, acquire)) {
+		cpu_pause();
 	}
 }
 
+static void
+stackshot_plh_unlock(void)
+{
+	os_atomic_store(&stackshot_plh_lock_word, 0, release);
+}
+
+static void
+stackshot_plh_resetrefs(void)
+{
+	struct stackshot_plh_refs *refs = PERCPU_GET(stackshot_plh_refs);
+
+	for (int idx = refs->spr_min; idx <= refs->spr_max; idx++) {
+		bitmap_clear(refs->spr_bits, idx);
+	}
+	refs->spr_min = STACKSHOT_PLH_SIZE_LIMIT;
+	refs->spr_max = -1;
+}
+
 static int16_t
-stackshot_plh_lookup(struct ipc_service_port_label *ispl, enum stackshot_plh_lookup_type type)
+stackshot_plh_lookup_locked(struct port_label_hash *plh, struct ipc_service_port_label *ispl)
 {
-	struct port_label_hash *plh = &port_label_hash;
 	int depth;
 	int16_t cur;
-	if (ispl == NULL) {
-		return STACKSHOT_PORTLABELID_NONE;
-	}
-	switch (type) {
-	case STACKSHOT_PLH_LOOKUP_SEND:
-		PLH_STAT_OP(plh->plh_lookup_send++);
-		break;
-	case STACKSHOT_PLH_LOOKUP_RECEIVE:
-		PLH_STAT_OP(plh->plh_lookup_receive++);
-		break;
-	default:
-		break;
-	}
-	PLH_STAT_OP(plh->plh_lookups++);
-	if (plh->plh_size == 0) {
-		return STACKSHOT_PORTLABELID_MISSING;
-	}
 	int16_t hash = stackshot_plh_hash(ispl);
 	assert(hash >= 0 && hash < (1ul << STACKSHOT_PLH_SHIFT));
 	depth = 0;
@@ -1614,77 +1672,110 @@ stackshot_plh_lookup(struct ipc_service_port_label *ispl, enum stackshot_plh_loo
 		/* cur must be in-range, and chain depth can never be above our # allocated */
 		if (cur >= plh->plh_count || depth > plh->plh_count || depth > plh->plh_size) {
 			PLH_STAT_OP((plh->plh_bad++), (plh->plh_bad_depth += depth));
-			return STACKSHOT_PORTLABELID_MISSING;
+			return -1;
 		}
 		assert(cur < plh->plh_count);
 		if (plh->plh_array[cur] == ispl) {
 			PLH_STAT_OP((plh->plh_found++), (plh->plh_found_depth += depth));
-			goto found;
+			return cur;
 		}
 		depth++;
 	}
 	/* not found in hash table, so alloc and insert it */
 	if (cur != -1) {
 		PLH_STAT_OP((plh->plh_bad++), (plh->plh_bad_depth += depth));
-		return STACKSHOT_PORTLABELID_MISSING; /* bad end of chain */
+		return -1; /* bad end of chain */
 	}
 	PLH_STAT_OP((plh->plh_insert++), (plh->plh_insert_depth += depth));
 	if (plh->plh_count >= plh->plh_size) {
-		return STACKSHOT_PORTLABELID_MISSING; /* no space */
+		return -1; /* no space */
 	}
 	cur = plh->plh_count;
-	plh->plh_count++;
 	plh->plh_array[cur] = ispl;
 	plh->plh_chains[cur] = plh->plh_hash[hash];
 	plh->plh_hash[hash] = cur;
-found:
-	plh->plh_gen[cur] = plh->plh_curgen;
-	if (plh->plh_curgen_min > cur) {
-		plh->plh_curgen_min = cur;
+	plh->plh_count++;
+	return cur;
+}
+
+static int16_t
+stackshot_plh_lookup(struct ipc_service_port_label *ispl, enum stackshot_plh_lookup_type type)
+{
+	struct port_label_hash *plh = &port_label_hash;
+	struct stackshot_plh_refs *refs;
+	int16_t cur;
+	if (ispl == NULL) {
+		return STACKSHOT_PORTLABELID_NONE;
+	}
+	if (plh->plh_size == 0) {
+		return STACKSHOT_PORTLABELID_MISSING;
+	}
+	stackshot_plh_lock();
+	switch (type) {
+	case STACKSHOT_PLH_LOOKUP_SEND:
+		PLH_STAT_OP(plh->plh_lookup_send++);
+		break;
+	case STACKSHOT_PLH_LOOKUP_RECEIVE:
+		PLH_STAT_OP(plh->plh_lookup_receive++);
+		break;
+	default:
+		break;
+	}
+	PLH_STAT_OP(plh->plh_lookups++);
+	cur = stackshot_plh_lookup_locked(plh, ispl);
+	stackshot_plh_unlock();
+	if (cur < 0) {
+		return STACKSHOT_PORTLABELID_MISSING;
+	}
+
+	refs = PERCPU_GET(stackshot_plh_refs);
+	bitmap_set(refs->spr_bits, cur);
+	if (refs->spr_min > cur) {
+		refs->spr_min = cur;
 	}
-	if (plh->plh_curgen_max < cur) {
-		plh->plh_curgen_max = cur;
+	if (refs->spr_max < cur) {
+		refs->spr_max = cur;
 	}
 	return cur + 1;   /* offset to avoid 0 */
 }
 
-// record any PLH referenced since the last stackshot_plh_resetgen() call
+// record any PLH referenced on this CPU since the last stackshot_plh_resetrefs() call
 static kern_return_t
-kdp_stackshot_plh_record(void)
+kdp_stackshot_plh_record(kcdata_descriptor_t kcd)
 {
 	kern_return_t error = KERN_SUCCESS;
 	struct port_label_hash *plh = &port_label_hash;
-	uint16_t count = plh->plh_count;
-	uint8_t curgen = plh->plh_curgen;
-	int16_t curgen_min = plh->plh_curgen_min;
-	int16_t curgen_max = plh->plh_curgen_max;
-	if (curgen_min <= curgen_max && curgen_max < count &&
+	struct stackshot_plh_refs *refs = PERCPU_GET(stackshot_plh_refs);
+	uint16_t count = os_atomic_load(&plh->plh_count, relaxed);
+	int16_t refs_min = refs->spr_min;
+	int16_t refs_max = refs->spr_max;
+	if (refs_min <= refs_max && refs_max < count &&
 	    count <= plh->plh_size && plh->plh_size <= STACKSHOT_PLH_SIZE_MAX) {
 		struct ipc_service_port_label **arr = plh->plh_array;
 		size_t ispl_size, max_namelen;
 		kdp_ipc_splabel_size(&ispl_size, &max_namelen);
-		for (int idx = curgen_min; idx <= curgen_max; idx++) {
+		for (int idx = refs_min; idx <= refs_max; idx++) {
 			struct ipc_service_port_label *ispl = arr[idx];
 			struct portlabel_info spl = {
 				.portlabel_id = (idx + 1),
 			};
 			const char *name = NULL;
 			long name_sz = 0;
-			if (plh->plh_gen[idx] != curgen) {
+			if (!bitmap_test(refs->spr_bits, idx)) {
 				continue;
 			}
 			if (_stackshot_validate_kva((vm_offset_t)ispl, ispl_size)) {
 				kdp_ipc_fill_splabel(ispl, &spl, &name);
 			}
-			kcd_exit_on_error(kcdata_add_container_marker(stackshot_kcdata_p, KCDATA_TYPE_CONTAINER_BEGIN,
+			kcd_exit_on_error(kcdata_add_container_marker(kcd, KCDATA_TYPE_CONTAINER_BEGIN,
 			    STACKSHOT_KCCONTAINER_PORTLABEL, idx + 1));
 			if (name != NULL && (name_sz = _stackshot_strlen(name, max_namelen)) > 0) {   /* validates the kva */
-				kcd_exit_on_error(kcdata_push_data(stackshot_kcdata_p, STACKSHOT_KCTYPE_PORTLABEL_NAME, name_sz + 1, name));
+				kcd_exit_on_error(kcdata_push_data(kcd, STACKSHOT_KCTYPE_PORTLABEL_NAME, name_sz + 1, name));
 			} else {
 				spl.portlabel_flags |= STACKSHOT_PORTLABEL_READFAILED;
 			}
-			kcd_exit_on_error(kcdata_push_data(stackshot_kcdata_p, STACKSHOT_KCTYPE_PORTLABEL, sizeof(spl), &spl));
-			kcd_exit_on_error(kcdata_add_container_marker(stackshot_kcdata_p, KCDATA_TYPE_CONTAINER_END,
+			kcd_exit_on_error(kcdata_push_data(kcd, STACKSHOT_KCTYPE_PORTLABEL, sizeof(spl), &spl));
+			kcd_exit_on_error(kcdata_add_container_marker(kcd, KCDATA_TYPE_CONTAINER_END,
 			    STACKSHOT_KCCONTAINER_PORTLABEL, idx + 1));
 		}
 	}
@@ -2775,11 +2866,18 @@ kcdata_record_thread_snapshot(
 #if CONFIG_EXCLAVES
 	if ((thread->th_exclaves_state & TH_EXCLAVES_RPC) && stackshot_exclave_inspect_ctids && !panic_stackshot) {
 		/* save exclave thread for later collection */
-		if (stackshot_exclave_inspect_ctid_count < stackshot_exclave_inspect_ctid_capacity) {
-			/* certain threads, like the collector, must never be inspected */
-			if ((os_atomic_load(&thread->th_exclaves_inspection_state, relaxed) & TH_EXCLAVES_INSPECTION_NOINSPECT) == 0) {
-				stackshot_exclave_inspect_ctids[stackshot_exclave_inspect_ctid_count] = thread_get_ctid(thread);
-				stackshot_exclave_inspect_ctid_count += 1;
+		/* certain threads, like the collector, must never be inspected */
+		if ((os_atomic_load(&thread->th_exclaves_inspection_state, relaxed) & TH_EXCLAVES_INSPECTION_NOINSPECT) == 0) {
+			size_t ctid_index, ctid_next;
+
+			/* other CPUs may be queueing threads too during a parallel stackshot */
+			if (os_atomic_rmw_loop(&stackshot_exclave_inspect_ctid_count, ctid_index, ctid_next, relaxed, {
+				if (ctid_index >= stackshot_exclave_inspect_ctid_capacity) {
+					os_atomic_rmw_loop_give_up(break);
+				}
+				ctid_next = ctid_index + 1;
+			})) {
+				stackshot_exclave_inspect_ctids[ctid_index] = thread_get_ctid(thread);
 				if ((os_atomic_load(&thread->th_exclaves_inspection_state, relaxed) & TH_EXCLAVES_INSPECTION_STACKSHOT) != 0) {
 					panic("stackshot: trying to inspect already-queued thread");
 				}
@@ -3152,6 +3250,7 @@ struct stackshot_context {
 	int pid;
 	uint64_t trace_flags;
 	bool include_drivers;
+	kcdata_descriptor_t kcd;        /* where this CPU records tasks */
 };
 
 static kern_return_t
@@ -3162,6 +3261,7 @@ kdp_stackshot_record_task(struct stackshot_context *ctx, task_t task)
 	boolean_t collect_delta_stackshot = ((ctx->trace_flags & STACKSHOT_COLLECT_DELTA_SNAPSHOT) != 0);
 	boolean_t save_owner_info         = ((ctx->trace_flags & STACKSHOT_THREAD_WAITINFO) != 0);
 
+	kcdata_descriptor_t kcd = ctx->kcd;
 	kern_return_t error = KERN_SUCCESS;
 	mach_vm_address_t out_addr = 0;
 	int saved_count = 0;
@@ -3230,7 +3330,7 @@ kdp_stackshot_record_task(struct stackshot_context *ctx, task_t task)
 	/* Trace everything, unless a process was specified. Add in driver tasks if requested. */
 	if ((ctx->pid == -1) || (ctx->pid == task_pid) || (ctx->include_drivers && task_is_driver(task))) {
 		/* add task snapshot marker */
-		kcd_exit_on_error(kcdata_add_container_marker(stackshot_kcdata_p, KCDATA_TYPE_CONTAINER_BEGIN,
+		kcd_exit_on_error(kcdata_add_container_marker(kcd, KCDATA_TYPE_CONTAINER_BEGIN,
 		    container_type, task_uniqueid));
 
 		if (collect_delta_stackshot) {
@@ -3284,23 +3384,23 @@ kdp_stackshot_record_task(struct stackshot_context *ctx, task_t task)
 			 * because the task may have exec'ed, changing its name, architecture, load info, etc
 			 */
 
-			kcd_exit_on_error(kcdata_record_shared_cache_info(stackshot_kcdata_p, task, &task_snap_ss_flags));
-			kcd_exit_on_error(kcdata_record_uuid_info(stackshot_kcdata_p, task, ctx->trace_flags, have_pmap, &task_snap_ss_flags));
+			kcd_exit_on_error(kcdata_record_shared_cache_info(kcd, task, &task_snap_ss_flags));
+			kcd_exit_on_error(kcdata_record_uuid_info(kcd, task, ctx->trace_flags, have_pmap, &task_snap_ss_flags));
 #if STACKSHOT_COLLECTS_LATENCY_INFO
 			if (!task_in_transition) {
-				kcd_exit_on_error(kcdata_record_task_snapshot(stackshot_kcdata_p, task, ctx->trace_flags, have_pmap, task_snap_ss_flags, &latency_info));
+				kcd_exit_on_error(kcdata_record_task_snapshot(kcd, task, ctx->trace_flags, have_pmap, task_snap_ss_flags, &latency_info));
 			} else {
-				kcd_exit_on_error(kcdata_record_transitioning_task_snapshot(stackshot_kcdata_p, task, task_snap_ss_flags, transition_type));
+				kcd_exit_on_error(kcdata_record_transitioning_task_snapshot(kcd, task, task_snap_ss_flags, transition_type));
 			}
 #else
 			if (!task_in_transition) {
-				kcd_exit_on_error(kcdata_record_task_snapshot(stackshot_kcdata_p, task, ctx->trace_flags, have_pmap, task_snap_ss_flags));
+				kcd_exit_on_error(kcdata_record_task_snapshot(kcd, task, ctx->trace_flags, have_pmap, task_snap_ss_flags));
 			} else {
-				kcd_exit_on_error(kcdata_record_transitioning_task_snapshot(stackshot_kcdata_p, task, task_snap_ss_flags, transition_type));
+				kcd_exit_on_error(kcdata_record_transitioning_task_snapshot(kcd, task, task_snap_ss_flags, transition_type));
 			}
 #endif /* STACKSHOT_COLLECTS_LATENCY_INFO */
 		} else {
-			kcd_exit_on_error(kcdata_record_task_delta_snapshot(stackshot_kcdata_p, task, ctx->trace_flags, have_pmap, task_snap_ss_flags));
+			kcd_exit_on_error(kcdata_record_task_delta_snapshot(kcd, task, ctx->trace_flags, have_pmap, task_snap_ss_flags));
 		}
 
 #if STACKSHOT_COLLECTS_LATENCY_INFO
@@ -3310,7 +3410,7 @@ kdp_stackshot_record_task(struct stackshot_context *ctx, task_t task)
 		struct thread_delta_snapshot_v3 * delta_snapshots = NULL;
 		int current_delta_snapshot_index                  = 0;
 		if (num_delta_thread_snapshots > 0) {
-			kcd_exit_on_error(kcdata_get_memory_addr_for_array(stackshot_kcdata_p, STACKSHOT_KCTYPE_THREAD_DELTA_SNAPSHOT,
+			kcd_exit_on_error(kcdata_get_memory_addr_for_array(kcd, STACKSHOT_KCTYPE_THREAD_DELTA_SNAPSHOT,
 			    sizeof(struct thread_delta_snapshot_v3),
 			    num_delta_thread_snapshots, &out_addr));
 			delta_snapshots = (struct thread_delta_snapshot_v3 *)out_addr;
@@ -3343,18 +3443,18 @@ kdp_stackshot_record_task(struct stackshot_context *ctx, task_t task)
 			switch (thread_classification) {
 			case tc_full_snapshot:
 				/* add thread marker */
-				kcd_exit_on_error(kcdata_add_container_marker(stackshot_kcdata_p, KCDATA_TYPE_CONTAINER_BEGIN,
+				kcd_exit_on_error(kcdata_add_container_marker(kcd, KCDATA_TYPE_CONTAINER_BEGIN,
 				    STACKSHOT_KCCONTAINER_THREAD, thread_uniqueid));
 
 				/* thread snapshot can be large, including strings, avoid overflowing the stack. */
-				kcdata_compression_window_open(stackshot_kcdata_p);
+				kcdata_compression_window_open(kcd);
 
-				kcd_exit_on_error(kcdata_record_thread_snapshot(stackshot_kcdata_p, thread, task, ctx->trace_flags, have_pmap, thread_on_core));
+				kcd_exit_on_error(kcdata_record_thread_snapshot(kcd, thread, task, ctx->trace_flags, have_pmap, thread_on_core));
 
-				kcd_exit_on_error(kcdata_compression_window_close(stackshot_kcdata_p));
+				kcd_exit_on_error(kcdata_compression_window_close(kcd));
 
 				/* mark end of thread snapshot data */
-				kcd_exit_on_error(kcdata_add_container_marker(stackshot_kcdata_p, KCDATA_TYPE_CONTAINER_END,
+				kcd_exit_on_error(kcdata_add_container_marker(kcd, KCDATA_TYPE_CONTAINER_END,
 				    STACKSHOT_KCCONTAINER_THREAD, thread_uniqueid));
 				break;
 			case tc_delta_snapshot:
@@ -3389,22 +3489,22 @@ kdp_stackshot_record_task(struct stackshot_context *ctx, task_t task)
 		/* allocate space for the wait and turnstil info */
 		if (num_waitinfo_threads > 0 || num_turnstileinfo_threads > 0) {
 			/* thread waitinfo and turnstileinfo can be quite large, avoid overflowing the stack */
-			kcdata_compression_window_open(stackshot_kcdata_p);
+			kcdata_compression_window_open(kcd);
 
 			if (num_waitinfo_threads > 0) {
-				kcd_exit_on_error(kcdata_get_memory_addr_for_array(stackshot_kcdata_p, STACKSHOT_KCTYPE_THREAD_WAITINFO,
+				kcd_exit_on_error(kcdata_get_memory_addr_for_array(kcd, STACKSHOT_KCTYPE_THREAD_WAITINFO,
 				    sizeof(thread_waitinfo_v2_t), num_waitinfo_threads, &out_addr));
 				thread_waitinfo = (thread_waitinfo_v2_t *)out_addr;
 			}
 
 			if (num_turnstileinfo_threads > 0) {
 				/* get space for the turnstile info */
-				kcd_exit_on_error(kcdata_get_memory_addr_for_array(stackshot_kcdata_p, STACKSHOT_KCTYPE_THREAD_TURNSTILEINFO,
+				kcd_exit_on_error(kcdata_get_memory_addr_for_array(kcd, STACKSHOT_KCTYPE_THREAD_TURNSTILEINFO,
 				    sizeof(thread_turnstileinfo_v2_t), num_turnstileinfo_threads, &out_addr));
 				thread_turnstileinfo = (thread_turnstileinfo_v2_t *)out_addr;
 			}
 
-			stackshot_plh_resetgen();  // so we know which portlabel_ids are referenced
+			stackshot_plh_resetrefs();  // so we know which portlabel_ids are referenced
 		}
 
 #if STACKSHOT_COLLECTS_LATENCY_INFO
@@ -3456,33 +3556,33 @@ kdp_stackshot_record_task(struct stackshot_context *ctx, task_t task)
 #endif
 
 		if (num_waitinfo_threads > 0 || num_turnstileinfo_threads > 0) {
-			kcd_exit_on_error(kcdata_compression_window_close(stackshot_kcdata_p));
+			kcd_exit_on_error(kcdata_compression_window_close(kcd));
 			// now, record the portlabel hashes.
-			kcd_exit_on_error(kdp_stackshot_plh_record());
+			kcd_exit_on_error(kdp_stackshot_plh_record(kcd));
 		}
 
 #if IMPORTANCE_INHERITANCE
 		if (save_donating_pids_p) {
 			kcd_exit_on_error(
-				((((mach_vm_address_t)kcd_end_address(stackshot_kcdata_p) + (TASK_IMP_WALK_LIMIT * sizeof(int32_t))) <
-				(mach_vm_address_t)kcd_max_address(stackshot_kcdata_p))
+				((((mach_vm_address_t)kcd_end_address(kcd) + (TASK_IMP_WALK_LIMIT * sizeof(int32_t))) <
+				(mach_vm_address_t)kcd_max_address(kcd))
 				? KERN_SUCCESS
 				: KERN_RESOURCE_SHORTAGE));
 			saved_count = task_importance_list_pids(task, TASK_IMP_LIST_DONATING_PIDS,
-			    (void *)kcd_end_address(stackshot_kcdata_p), TASK_IMP_WALK_LIMIT);
+			    (void *)kcd_end_address(kcd), TASK_IMP_WALK_LIMIT);
 			if (saved_count > 0) {
 				/* Variable size array - better not have it on the stack. */
-				kcdata_compression_window_open(stackshot_kcdata_p);
-				kcd_exit_on_error(kcdata_get_memory_addr_for_array(stackshot_kcdata_p, STACKSHOT_KCTYPE_DONATING_PIDS,
+				kcdata_compression_window_open(kcd);
+				kcd_exit_on_error(kcdata_get_memory_addr_for_array(kcd, STACKSHOT_KCTYPE_DONATING_PIDS,
 				    sizeof(int32_t), saved_count, &out_addr));
-				kcd_exit_on_error(kcdata_compression_window_close(stackshot_kcdata_p));
+				kcd_exit_on_error(kcdata_compression_window_close(kcd));
 			}
 		}
 #endif
 
 #if SCHED_HYGIENE_DEBUG && CONFIG_PERVASIVE_CPI
 		if (!panic_stackshot) {
-			kcd_exit_on_error(kcdata_add_uint64_with_description(stackshot_kcdata_p, (mt_cur_cpu_cycles() - task_begin_cpu_cycle_count),
+			kcd_exit_on_error(kcdata_add_uint64_with_description(kcd, (mt_cur_cpu_cycles() - task_begin_cpu_cycle_count),
 			    "task_cpu_cycle_count"));
 		}
 #endif
@@ -3490,12 +3590,12 @@ kdp_stackshot_record_task(struct stackshot_context *ctx, task_t task)
 #if STACKSHOT_COLLECTS_LATENCY_INFO
 		latency_info.misc2_latency = mach_absolute_time() - latency_info.misc2_latency;
 		if (collect_latency_info) {
-			kcd_exit_on_error(kcdata_push_data(stackshot_kcdata_p, STACKSHOT_KCTYPE_LATENCY_INFO_TASK, sizeof(latency_info), &latency_info));
+			kcd_exit_on_error(kcdata_push_data(kcd, STACKSHOT_KCTYPE_LATENCY_INFO_TASK, sizeof(latency_info), &latency_info));
 		}
 #endif /* STACKSHOT_COLLECTS_LATENCY_INFO */
 
 		/* mark end of task snapshot data */
-		kcd_exit_on_error(kcdata_add_container_marker(stackshot_kcdata_p, KCDATA_TYPE_CONTAINER_END, container_type,
+		kcd_exit_on_error(kcdata_add_container_marker(kcd, KCDATA_TYPE_CONTAINER_END, container_type,
 		    task_uniqueid));
 	}
 
@@ -3504,6 +3604,210 @@ error_exit:
 	return error;
 }
 
+/* The task after @task on the tasks list and then the terminated tasks list, or the first task */
+static task_t
+stackshot_parallel_task_after(task_t task)
+{
+	queue_entry_t next = (task == TASK_NULL) ? queue_first(&tasks) : queue_next(&task->tasks);
+
+	if (queue_end(&tasks, next)) {
+		next = queue_first(&terminated_tasks);
+	}
+	if (queue_end(&terminated_tasks, next)) {
+		return TASK_NULL;
+	}
+	return (task_t)(void *)next;
+}
+
+/* Hand out the next task to record in a parallel stackshot, or TASK_NULL once they all have been */
+static task_t
+stackshot_parallel_next_task(void)
+{
+	task_t task, next;
+
+	os_atomic_rmw_loop(&stackshot_parallel_cursor, task, next, relaxed, {
+		if (task == TASK_NULL) {
+			os_atomic_rmw_loop_give_up(return TASK_NULL);
+		}
+		next = stackshot_parallel_task_after(task);
+	});
+	return task;
+}
+
+static bool
+stackshot_parallel_available(void)
+{
+	return os_atomic_load(&stackshot_parallel_state, relaxed) == STACKSHOT_PARALLEL_PENDING &&
+	       stackshot_parallel_buf != NULL && processor_count > 1 &&
+	       stackshot_parallel_bufsize >= STACKSHOT_PARALLEL_MIN_SLICE;
+}
+
+#if CONFIG_EXCLAVES
+/*
+ * A task that didn't fit in a helper's slice is recorded again by the
+ * stackshot CPU, queueing its exclave threads a second time.
+ */
+static void
+stackshot_exclave_remove_duplicate_ctids(void)
+{
+	size_t count = 0;
+
+	for (size_t i = 0; i < stackshot_exclave_inspect_ctid_count; i++) {
+		ctid_t ctid = stackshot_exclave_inspect_ctids[i];
+		size_t j;
+
+		for (j = 0; j < count && stackshot_exclave_inspect_ctids[j] != ctid; j++) {
+			;
+		}
+		if (j == count) {
+			stackshot_exclave_inspect_ctids[count++] = ctid;
+		}
+	}
+	stackshot_exclave_inspect_ctid_count = count;
+}
+#endif /* CONFIG_EXCLAVES */
+
+/*
+ * Record every task, and every terminated task, with the help of the other
+ * CPUs held in the debugger. This CPU records into the stackshot buffer as
+ * usual, then appends what the others recorded in their slices, then records
+ * any task that didn't fit in a slice.
+ */
+static kern_return_t
+kdp_stackshot_record_tasks_parallel(struct stackshot_context *ctx)
+{
+	kern_return_t error = KERN_SUCCESS;
+	uint32_t helpers = 0;
+	bool deferred = false;
+	task_t task;
+
+	percpu_foreach(scc, stackshot_cpu_context) {
+		scc->scc_used = false;
+	}
+	stackshot_parallel_ctx = ctx;
+	stackshot_parallel_cursor = stackshot_parallel_task_after(TASK_NULL);
+	stackshot_parallel_slices = MIN(processor_count - 1, stackshot_parallel_bufsize / STACKSHOT_PARALLEL_MIN_SLICE);
+	stackshot_parallel_next_slice = 0;
+	os_atomic_store(&stackshot_parallel_state, STACKSHOT_PARALLEL_RUNNING, release);
+
+	while ((task = stackshot_parallel_next_task()) != TASK_NULL) {
+		error = kdp_stackshot_record_task(ctx, task);
+		if (error) {
+			/* stop handing out tasks */
+			os_atomic_store(&stackshot_parallel_cursor, TASK_NULL, relaxed);
+			break;
+		}
+	}
+
+	/* pairs with stackshot_cpu_poll(): after this, no CPU joins in */
+	os_atomic_store(&stackshot_parallel_state, STACKSHOT_PARALLEL_NONE, seq_cst);
+	while (os_atomic_load(&stackshot_parallel_helpers, seq_cst) != 0) {
+		cpu_pause();
+	}
+	if (error) {
+		goto error_exit;
+	}
+
+	percpu_foreach(scc, stackshot_cpu_context) {
+		kcdata_descriptor_t kcd = &scc->scc_kcdata;
+
+		if (!scc->scc_used) {
+			continue;
+		}
+		kcd_exit_on_error(scc->scc_error);
+		kcd_exit_on_error(kcdata_append_items(ctx->kcd, (void *)(kcd->kcd_addr_begin + sizeof(struct kcdata_item)),
+		    (uint32_t)(kcd->kcd_addr_end - kcd->kcd_addr_begin - sizeof(struct kcdata_item))));
+		if (scc->scc_deferred_task != TASK_NULL) {
+			kcd_exit_on_error(kdp_stackshot_record_task(ctx, scc->scc_deferred_task));
+			deferred = true;
+		}
+		helpers++;
+	}
+
+#if CONFIG_EXCLAVES
+	if (deferred && stackshot_exclave_inspect_ctids) {
+		stackshot_exclave_remove_duplicate_ctids();
+	}
+#else
+#pragma unused(deferred)
+#endif /* CONFIG_EXCLAVES */
+
+	kcd_exit_on_error(kcdata_add_uint32_with_description(ctx->kcd, helpers, "stackshot_parallel_cpus"));
+
+error_exit:
+	return error;
+}
+
+/*
+ * Called by the CPUs held in the debugger while another CPU takes a
+ * stackshot. If it is a parallel stackshot, record tasks into this CPU's
+ * slice until they have all been handed out or the slice is full.
+ *
+ * Returns false once this CPU has nothing (left) to do for this stackshot.
+ */
+bool
+stackshot_cpu_poll(void)
+{
+	struct stackshot_cpu_context *scc = PERCPU_GET(stackshot_cpu_context);
+	struct stackshot_context ctx;
+	uint32_t slice, slice_size;
+	task_t task;
+
+	switch (os_atomic_load(&stackshot_parallel_state, acquire)) {
+	case STACKSHOT_PARALLEL_NONE:
+		return false;
+	case STACKSHOT_PARALLEL_PENDING:
+		return true;
+	case STACKSHOT_PARALLEL_RUNNING:
+		if (scc->scc_used) {
+			return false;
+		}
+		break;
+	}
+
+	/* pairs with kdp_stackshot_record_tasks_parallel() waiting for helpers */
+	os_atomic_inc(&stackshot_parallel_helpers, seq_cst);
+	if (os_atomic_load(&stackshot_parallel_state, seq_cst) != STACKSHOT_PARALLEL_RUNNING) {
+		goto out;
+	}
+	slice = os_atomic_inc_orig(&stackshot_parallel_next_slice, relaxed);
+	if (slice >= stackshot_parallel_slices) {
+		goto out;
+	}
+
+	slice_size = (stackshot_parallel_bufsize / stackshot_parallel_slices) & ~(KCDATA_ALIGNMENT_SIZE - 1);
+	scc->scc_used = true;
+	scc->scc_deferred_task = TASK_NULL;
+	scc->scc_error = kcdata_memory_static_init(&scc->scc_kcdata,
+	    (mach_vm_address_t)stackshot_parallel_buf + slice * slice_size, KCDATA_BUFFER_BEGIN_STACKSHOT,
+	    slice_size, KCFLAG_USE_MEMCOPY | KCFLAG_NO_AUTO_ENDBUFFER);
+
+	ctx = *stackshot_parallel_ctx;
+	ctx.kcd = &scc->scc_kcdata;
+	_stackshot_validation_reset();
+
+	while (scc->scc_error == KERN_SUCCESS && (task = stackshot_parallel_next_task()) != TASK_NULL) {
+		mach_vm_address_t task_begin = ctx.kcd->kcd_addr_end;
+
+		scc->scc_error = kdp_stackshot_record_task(&ctx, task);
+		if (scc->scc_error == KERN_INSUFFICIENT_BUFFER_SIZE) {
+			/* drop what fit, and leave the task to the stackshot CPU */
+			ctx.kcd->kcd_addr_end = task_begin;
+			scc->scc_deferred_task = task;
+			scc->scc_error = KERN_SUCCESS;
+			break;
+		}
+	}
+	if (scc->scc_error) {
+		/* the stackshot will fail, stop handing out tasks */
+		os_atomic_store(&stackshot_parallel_cursor, TASK_NULL, relaxed);
+	}
+
+out:
+	os_atomic_dec(&stackshot_parallel_helpers, release);
+	return false;
+}
+
 /* Record global shared regions */
 static kern_return_t
 kdp_stackshot_shared_regions(uint64_t trace_flags)
@@ -3644,6 +3948,7 @@ kdp_stackshot_kcdata_format(int pid, uint64_t * trace_flags_p)
 	ctx.trace_flags = trace_flags;
 	ctx.pid = pid;
 	ctx.include_drivers = (pid == 0 && (trace_flags & STACKSHOT_INCLUDE_DRIVER_THREADS_IN_KERNEL) != 0);
+	ctx.kcd = stackshot_kcdata_p;
 
 	if (use_fault_path) {
 		fault_stats.sfs_pages_faulted_in = 0;
@@ -3778,6 +4083,17 @@ kdp_stackshot_kcdata_format(int pid, uint64_t * trace_flags_p)
 
 	bool const process_scoped = (ctx.pid != -1) && !ctx.include_drivers;
 
+	/*
+	 * Faulting stackshots share a single time budget, and single process
+	 * stackshots have nothing to spread, so both stay on this CPU.
+	 */
+	bool const parallel = !process_scoped && !use_fault_path && stackshot_parallel_available();
+	if (parallel) {
+		kcd_exit_on_error(kdp_stackshot_record_tasks_parallel(&ctx));
+	} else {
+		os_atomic_store(&stackshot_parallel_state, STACKSHOT_PARALLEL_NONE, release);
+	}
+
 	/* Iterate over tasks */
 	queue_iterate(&tasks, task, task_t, tasks)
 	{
@@ -3790,6 +4106,11 @@ kdp_stackshot_kcdata_format(int pid, uint64_t * trace_flags_p)
 			}
 		}
 
+		if (parallel) {
+			/* already recorded */
+			continue;
+		}
+
 		if (process_scoped && (pid_from_task(task) != ctx.pid)) {
 			continue;
 		}
@@ -3866,11 +4187,13 @@ kdp_stackshot_kcdata_format(int pid, uint64_t * trace_flags_p)
 	 * transitioning_task_snapshot struct is collected via
 	 * kcdata_record_transitioning_task_snapshot()
 	 */
-	queue_iterate(&terminated_tasks, task, task_t, tasks)
-	{
-		error = kdp_stackshot_record_task(&ctx, task);
-		if (error) {
-			goto error_exit;
+	if (!parallel) {
+		queue_iterate(&terminated_tasks, task, task_t, tasks)
+		{
+			error = kdp_stackshot_record_task(&ctx, task);
+			if (error) {
+				goto error_exit;
+			}
 		}
 	}
 #if DEVELOPMENT || DEBUG
@@ -4102,6 +4425,7 @@ do_stackshot(void *context)
 	stackshot_out_flags = stack_snapshot_flags;
 
 	stack_snapshot_ret = kdp_stackshot_kcdata_format(stack_snapshot_pid, &stackshot_out_flags);
+	os_atomic_store(&stackshot_parallel_state, STACKSHOT_PARALLEL_NONE, release);
 
 	kdp_snapshot--;
 	return stack_snapshot_ret;
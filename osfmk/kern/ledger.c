@@ -65,6 +65,21 @@
 #define LF_TRACK_CREDIT_ONLY    0x10000 /* only update "credit" */
 #define LF_DIAG_WARNED          0x20000 /* callback was called for balance diag */
 #define LF_DIAG_DISABLED        0x40000 /* diagnostics threshold are disabled at the moment */
+#define LF_PERCPU               0x80000 /* updates may be batched in per-cpu deltas */
+#define LF_PERCPU_DIRTY         0x100000 /* per-cpu deltas may be non-zero */
+#define LF_PERCPU_SLOT_SHIFT    24      /* index in struct ledger_percpu */
+#define LF_PERCPU_SLOT_MASK     (0x3 << LF_PERCPU_SLOT_SHIFT)
+#define LF_PERCPU_SLOT(flags)   (((flags) & LF_PERCPU_SLOT_MASK) >> LF_PERCPU_SLOT_SHIFT)
+_Static_assert(LEDGER_PERCPU_SLOTS <= (LF_PERCPU_SLOT_MASK >> LF_PERCPU_SLOT_SHIFT) + 1,
+    "LF_PERCPU_SLOT_MASK too small for LEDGER_PERCPU_SLOTS");
+
+/*
+ * Per-cpu batching is bypassed while any of these is set, as they all
+ * need to see each update of the balance as it happens.
+ */
+#define LF_PERCPU_BYPASS        (LF_WAKE_NEEDED | LF_REFILL_SCHEDULED | \
+	LF_CALLED_BACK | LF_WARNED | LF_PANIC_ON_NEGATIVE | LF_DIAG_WARNED | \
+	LEDGER_ACTION_BLOCK)
 
 
 /*
@@ -214,6 +229,9 @@ struct ledger_template {
 	struct entry_template   *lt_entries;
 	/* Lookup table to go from entry_offset to index in the lt_entries table. */
 	uint16_t                *lt_entries_lut;
+	/* Per-cpu batched entries, immutable once the template is complete. */
+	uint16_t                lt_percpu_cnt;
+	ledger_amount_t         lt_percpu_threshold[LEDGER_PERCPU_SLOTS];
 };
 
 static inline uint16_t
@@ -247,6 +265,9 @@ ledger_template_entries_lut_size(uint16_t lt_table_size)
 	splx(s);                                                \
 }
 
+static ZONE_DEFINE_TYPE(ledger_percpu_zone, "ledger.percpu",
+    struct ledger_percpu, ZC_PERCPU | ZC_ALIGNMENT_REQUIRED | ZC_KASAN_NOREDZONE);
+
 static int ledger_cnt = 0;
 /* ledger ast helper functions */
 static uint32_t ledger_check_needblock(ledger_t l, uint64_t now);
@@ -388,6 +409,9 @@ ledger_template_copy(ledger_template_t template, const char *name)
 	new_template->lt_cnt = template->lt_cnt;
 	new_template->lt_next_offset = template->lt_next_offset;
 	new_template->lt_entries_lut = new_entries_lut;
+	new_template->lt_percpu_cnt = template->lt_percpu_cnt;
+	bcopy(template->lt_percpu_threshold, new_template->lt_percpu_threshold,
+	    sizeof(template->lt_percpu_threshold));
 
 out:
 	template_unlock(template);
@@ -626,6 +650,18 @@ ledger_template_complete_secure_alloc(ledger_template_t template)
 	 * ledger is large enough.
 	 */
 	pmap_ledger_verify_size(ledger_size);
+
+	/*
+	 * The pmap updates these ledgers from its own context and validates
+	 * them as a whole, keep every entry exact.
+	 */
+	template_lock(template);
+	for (uint16_t i = 0; i < template->lt_cnt; i++) {
+		template->lt_entries[i].et_flags &= ~(LF_PERCPU | LF_PERCPU_SLOT_MASK);
+	}
+	template->lt_percpu_cnt = 0;
+	template_unlock(template);
+
 	template->lt_initialized = true;
 }
 
@@ -669,6 +705,11 @@ ledger_instantiate(ledger_template_t template, int entry_type)
 	}
 
 	ledger->l_template = template;
+	ledger->l_percpu = NULL;
+	if (template->lt_percpu_cnt != 0) {
+		ledger->l_percpu = zalloc_percpu(ledger_percpu_zone,
+		    Z_WAITOK | Z_ZERO | Z_NOFAIL);
+	}
 	ledger->l_id = ledger_cnt++;
 	os_ref_init(&ledger->l_refs, &ledger_refgrp);
 	assert(entries_size > 0);
@@ -754,6 +795,10 @@ ledger_dereference(ledger_t ledger)
 
 	if (os_ref_release(&ledger->l_refs) == 0) {
 		ledger_template_t template = ledger->l_template;
+		if (ledger->l_percpu != NULL) {
+			zfree_percpu(ledger_percpu_zone, ledger->l_percpu);
+			ledger->l_percpu = NULL;
+		}
 		if (template->lt_zone) {
 			zfree(template->lt_zone, ledger);
 		} else {
@@ -1127,6 +1172,177 @@ ledger_check_new_balance(thread_t thread, ledger_t ledger, int entry)
 	ledger_entry_check_new_balance(thread, ledger, entry);
 }
 
+/*
+ * Per-cpu batching.
+ *
+ * Entries opted in with ledger_entry_batch_percpu() account updates in a
+ * per-cpu delta of the ledger's l_percpu and only touch the shared entry
+ * once that delta reaches the entry's threshold.  At rest every cpu's delta
+ * stays below the threshold, so the true balance is never more than
+ * threshold * ncpus away from the entry's.
+ *
+ * Updates are only batched while that slack can't carry the balance across
+ * the entry's limit or warning level.  Otherwise they fold all the deltas
+ * first and go to the entry directly, so limits, warnings and callbacks
+ * see every crossing as they do for unbatched entries.  Readers add the
+ * deltas in; only the max tracking can lag the true peak by the slack.
+ */
+
+/*
+ * Add credit and debit to the entry itself.  Small and credit-only entries
+ * only ever have a credit, which debits make go down.
+ */
+static void
+ledger_entry_add_delta(ledger_t ledger, int entry, ledger_amount_t credit,
+    ledger_amount_t debit)
+{
+	struct ledger_entry_small *les = &ledger->l_entries[ENTRY_ID_OFFSET(entry)];
+
+	if (ENTRY_ID_SIZE(entry) == sizeof(struct ledger_entry_small)) {
+		assert(debit == 0);
+		OSAddAtomic64(credit, &les->les_credit);
+	} else {
+		struct ledger_entry *le = (struct ledger_entry *)les;
+
+		if (credit != 0) {
+			OSAddAtomic64(credit, &le->le_credit);
+		}
+		if (debit != 0) {
+			OSAddAtomic64(debit, &le->le_debit);
+		}
+	}
+}
+
+/*
+ * Move every cpu's delta for this entry into the entry itself.
+ */
+static void
+ledger_percpu_fold(ledger_t ledger, int entry)
+{
+	volatile uint32_t *flags = get_entry_flags(ledger, entry);
+	ledger_amount_t credit = 0, debit = 0;
+	uint32_t slot;
+
+	if ((*flags & LF_PERCPU_DIRTY) == 0) {
+		return;
+	}
+
+	slot = LF_PERCPU_SLOT(*flags);
+	flag_clear(flags, LF_PERCPU_DIRTY);
+	zpercpu_foreach(lp, ledger->l_percpu) {
+		if (os_atomic_load_wide(&lp->lp_deltas[slot].lpd_credit, relaxed)) {
+			credit += os_atomic_xchg(&lp->lp_deltas[slot].lpd_credit, 0, relaxed);
+		}
+		if (os_atomic_load_wide(&lp->lp_deltas[slot].lpd_debit, relaxed)) {
+			debit += os_atomic_xchg(&lp->lp_deltas[slot].lpd_debit, 0, relaxed);
+		}
+	}
+	ledger_entry_add_delta(ledger, entry, credit, debit);
+}
+
+/*
+ * Add every cpu's delta for this entry to a credit/debit read from it.
+ */
+static void
+ledger_percpu_sum(ledger_t ledger, uint32_t flags, ledger_amount_t *credit,
+    ledger_amount_t *debit)
+{
+	uint32_t slot = LF_PERCPU_SLOT(flags);
+
+	if ((flags & LF_PERCPU_DIRTY) == 0) {
+		return;
+	}
+
+	zpercpu_foreach(lp, ledger->l_percpu) {
+		*credit += os_atomic_load_wide(&lp->lp_deltas[slot].lpd_credit, relaxed);
+		*debit += os_atomic_load_wide(&lp->lp_deltas[slot].lpd_debit, relaxed);
+	}
+}
+
+/*
+ * Try to account an update in the current cpu's delta for this entry.
+ * Returns false if it must be applied to the entry directly, in which case
+ * any outstanding deltas have been folded into the entry first.
+ */
+static bool
+ledger_percpu_defer(thread_t thread, ledger_t ledger, int entry,
+    ledger_amount_t credit, ledger_amount_t debit)
+{
+	volatile uint32_t *flags = get_entry_flags(ledger, entry);
+	uint32_t f = *flags;
+	struct ledger_percpu *lp;
+	ledger_amount_t threshold, c, d;
+	uint32_t slot;
+
+	if ((f & LF_PERCPU) == 0) {
+		return false;
+	}
+
+	slot = LF_PERCPU_SLOT(f);
+	threshold = ledger->l_template->lt_percpu_threshold[slot];
+
+	if ((f & LF_PERCPU_BYPASS) || (credit < 0 ? -credit : credit) + debit >= threshold) {
+		goto direct;
+	}
+
+	if (ENTRY_ID_SIZE(entry) == sizeof(struct ledger_entry)) {
+		struct ledger_entry *le = ledger_entry_identifier_to_entry(ledger, entry);
+
+		if (le->le_limit != LEDGER_LIMIT_INFINITY) {
+			ledger_amount_t level = le->le_limit;
+
+			/* Negative limits trip on the way down, don't bother. */
+			if (level <= 0) {
+				goto direct;
+			}
+			if ((f & LEDGER_ACTION_CALLBACK) &&
+			    le->le_warn_percent != LEDGER_PERCENT_NONE) {
+				level = (level * le->le_warn_percent) >> 16;
+			}
+			if (le->le_credit - le->le_debit >= level - threshold * (ledger_amount_t)zpercpu_count()) {
+				goto direct;
+			}
+		}
+#if DEBUG || DEVELOPMENT
+		if (le->le_diag_threshold_scaled != LEDGER_DIAG_MEM_THRESHOLD_INFINITY &&
+		    ledger_is_diag_threshold_enabled_internal(le)) {
+			goto direct;
+		}
+#endif
+	}
+
+	lp = zpercpu_get(ledger->l_percpu);
+	if (credit != 0) {
+		c = os_atomic_add(&lp->lp_deltas[slot].lpd_credit, credit, seq_cst);
+		d = os_atomic_load_wide(&lp->lp_deltas[slot].lpd_debit, relaxed);
+	} else {
+		c = os_atomic_load_wide(&lp->lp_deltas[slot].lpd_credit, relaxed);
+		d = os_atomic_add(&lp->lp_deltas[slot].lpd_debit, debit, seq_cst);
+	}
+
+	/*
+	 * Publish the delta after adding it: ledger_percpu_fold() clears the
+	 * flag before draining, so it either sees our delta or we set it again.
+	 */
+	if ((os_atomic_load(flags, seq_cst) & LF_PERCPU_DIRTY) == 0) {
+		flag_set(flags, LF_PERCPU_DIRTY);
+	}
+
+	if ((c < 0 ? -c : c) + d >= threshold) {
+		credit = os_atomic_xchg(&lp->lp_deltas[slot].lpd_credit, 0, relaxed);
+		debit = os_atomic_xchg(&lp->lp_deltas[slot].lpd_debit, 0, relaxed);
+		ledger_entry_add_delta(ledger, entry, credit, debit);
+		if (thread) {
+			ledger_entry_check_new_balance(thread, ledger, entry);
+		}
+	}
+	return true;
+
+direct:
+	ledger_percpu_fold(ledger, entry);
+	return false;
+}
+
 /*
  * Add value to an entry in a ledger for a specific thread.
  */
@@ -1145,6 +1361,10 @@ ledger_credit_thread(thread_t thread, ledger_t ledger, int entry, ledger_amount_
 		return KERN_SUCCESS;
 	}
 
+	if (ledger_percpu_defer(thread, ledger, entry, amount, 0)) {
+		return KERN_SUCCESS;
+	}
+
 	if (entry_size == sizeof(struct ledger_entry_small)) {
 		struct ledger_entry_small *les = &ledger->l_entries[ENTRY_ID_OFFSET(entry)];
 		old = OSAddAtomic64(amount, &les->les_credit);
@@ -1228,6 +1448,7 @@ ledger_rollup_entry(ledger_t to_ledger, ledger_t from_ledger, int entry)
 
 	assert(to_ledger->l_template->lt_cnt == from_ledger->l_template->lt_cnt);
 	if (is_entry_valid(from_ledger, entry) && is_entry_valid(to_ledger, entry)) {
+		ledger_percpu_fold(from_ledger, entry);
 		from_les = &from_ledger->l_entries[entry_offset];
 		to_les = &to_ledger->l_entries[entry_offset];
 		if (entry_size == sizeof(struct ledger_entry)) {
@@ -1264,6 +1485,7 @@ ledger_zero_balance(ledger_t ledger, int entry)
 		return KERN_INVALID_VALUE;
 	}
 
+	ledger_percpu_fold(ledger, entry);
 	les = &ledger->l_entries[entry_offset];
 	if (entry_size == sizeof(struct ledger_entry_small)) {
 		while (true) {
@@ -1349,6 +1571,7 @@ ledger_set_limit(ledger_t ledger, int entry, ledger_amount_t limit,
 
 	lprintf(("ledger_set_limit: %lld\n", limit));
 	le = ledger_entry_identifier_to_entry(ledger, entry);
+	ledger_percpu_fold(ledger, entry);
 
 	if (limit == LEDGER_LIMIT_INFINITY) {
 		/*
@@ -1547,6 +1770,61 @@ out:
 	return kr;
 }
 
+/*
+ * Batch updates to this entry in per-cpu deltas of less than threshold,
+ * see ledger_percpu_defer().
+ */
+kern_return_t
+ledger_entry_batch_percpu(ledger_template_t template, int entry,
+    ledger_amount_t threshold)
+{
+	const uint16_t *idx_p;
+	uint16_t idx;
+	struct entry_template *et = NULL;
+	kern_return_t kr = KERN_INVALID_VALUE;
+
+	if (threshold <= 0) {
+		return KERN_INVALID_ARGUMENT;
+	}
+
+	template_lock(template);
+
+	/* Ledgers already allocated have no room for the deltas. */
+	if (template->lt_initialized) {
+		kr = KERN_INVALID_VALUE;
+		goto out;
+	}
+
+	idx_p = ledger_entry_to_template_idx(template, entry);
+	if (idx_p == NULL) {
+		kr = KERN_INVALID_VALUE;
+		goto out;
+	}
+	idx = *idx_p;
+	if (idx >= template->lt_cnt) {
+		kr = KERN_INVALID_VALUE;
+		goto out;
+	}
+	et = &template->lt_entries[idx];
+
+	if ((et->et_flags & LF_PERCPU) == 0) {
+		if (template->lt_percpu_cnt == LEDGER_PERCPU_SLOTS) {
+			kr = KERN_RESOURCE_SHORTAGE;
+			goto out;
+		}
+		et->et_flags |= LF_PERCPU |
+		    ((uint32_t)template->lt_percpu_cnt << LF_PERCPU_SLOT_SHIFT);
+		template->lt_percpu_cnt++;
+	}
+	template->lt_percpu_threshold[LF_PERCPU_SLOT(et->et_flags)] = threshold;
+	kr = KERN_SUCCESS;
+
+out:
+	template_unlock(template);
+
+	return kr;
+}
+
 /*
  * Add a callback to be executed when the resource goes into deficit.
  */
@@ -1808,6 +2086,7 @@ ledger_debit_thread(thread_t thread, ledger_t ledger, int entry, ledger_amount_t
 	struct ledger_entry *le;
 	ledger_amount_t old, new;
 	uint16_t entry_size = ENTRY_ID_SIZE(entry);
+	bool credit_only = false;
 
 	if (!is_entry_valid_and_active(ledger, entry) || (amount < 0)) {
 		return KERN_INVALID_ARGUMENT;
@@ -1817,6 +2096,15 @@ ledger_debit_thread(thread_t thread, ledger_t ledger, int entry, ledger_amount_t
 		return KERN_SUCCESS;
 	}
 
+	/* Small entries are always credit-only. */
+	if (*get_entry_flags(ledger, entry) & LF_TRACK_CREDIT_ONLY) {
+		credit_only = true;
+	}
+	if (ledger_percpu_defer(thread, ledger, entry,
+	    credit_only ? -amount : 0, credit_only ? 0 : amount)) {
+		return KERN_SUCCESS;
+	}
+
 	if (entry_size == sizeof(struct ledger_entry_small)) {
 		struct ledger_entry_small *les = &ledger->l_entries[ENTRY_ID_OFFSET(entry)];
 		old = OSAddAtomic64(-amount, &les->les_credit);
@@ -2198,9 +2486,11 @@ ledger_get_entries(ledger_t ledger, int entry, ledger_amount_t *credit,
 		le = (struct ledger_entry *)les;
 		*credit = le->le_credit;
 		*debit = le->le_debit;
+		ledger_percpu_sum(ledger, le->le_flags, credit, debit);
 	} else if (entry_size == sizeof(struct ledger_entry_small)) {
 		*credit = les->les_credit;
 		*debit = 0;
+		ledger_percpu_sum(ledger, les->les_flags, credit, debit);
 	} else {
 		panic("Unknown ledger entry size! ledger=%p, entry=0x%x, entry_size=%d\n", ledger, entry, entry_size);
 	}
@@ -2348,6 +2638,7 @@ ledger_fill_entry_info(ledger_t ledger,
 		lei->lei_limit = LEDGER_LIMIT_INFINITY;
 		lei->lei_credit = les->les_credit;
 		lei->lei_debit = 0;
+		ledger_percpu_sum(ledger, les->les_flags, &lei->lei_credit, &lei->lei_debit);
 		lei->lei_refill_period = 0;
 		lei->lei_last_refill = abstime_to_nsecs(now);
 	} else if (entry_size == sizeof(struct ledger_entry)) {
@@ -2355,6 +2646,7 @@ ledger_fill_entry_info(ledger_t ledger,
 		lei->lei_limit         = le->le_limit;
 		lei->lei_credit        = le->le_credit;
 		lei->lei_debit         = le->le_debit;
+		ledger_percpu_sum(ledger, le->le_flags, &lei->lei_credit, &lei->lei_debit);
 		lei->lei_refill_period = (le->le_flags & LF_REFILL_SCHEDULED) ?
 		    abstime_to_nsecs(le->_le.le_refill.le_refill_period) : 0;
 		lei->lei_last_refill   = abstime_to_nsecs(now - le->_le.le_refill.le_last_refill);
@@ -2714,3 +3006,129 @@ ledger_is_diag_threshold_enabled(ledger_t ledger, int entry, bool *status)
 	return KERN_SUCCESS;
 }
 #endif // DEBUG || DEVELOPMENT
+
+#if DEVELOPMENT || DEBUG
+
+#define LEDGER_PERCPU_TEST_THRESHOLD    4096
+
+#define LEDGER_PERCPU_TEST_CHECK(expr)                                  \
+	do {                                                            \
+	        if (!(expr)) {                                          \
+	                printf("ledger_percpu_test: line %d: %s\n",     \
+	                    __LINE__, #expr);                           \
+	                error = EINVAL;                                 \
+	                goto out;                                       \
+	        }                                                       \
+	} while (0)
+
+/* Balance of the entry itself, without the outstanding per-cpu deltas. */
+static ledger_amount_t
+ledger_percpu_test_raw(ledger_t ledger, int entry)
+{
+	struct ledger_entry *le = ledger_entry_identifier_to_entry(ledger, entry);
+
+	return le->le_credit - le->le_debit;
+}
+
+static ledger_amount_t
+ledger_percpu_test_balance(ledger_t ledger, int entry)
+{
+	ledger_amount_t balance = -1;
+
+	(void)ledger_get_balance(ledger, entry, &balance);
+	return balance;
+}
+
+static int
+ledger_percpu_test(__unused int64_t in, int64_t *out)
+{
+	ledger_amount_t slack, limit, raw;
+	ledger_template_t template;
+	int batched, blocking, negative;
+	ledger_t ledger = NULL;
+	int error = 0;
+
+	template = ledger_template_create("percpu_test");
+	if (template == NULL) {
+		return ENOMEM;
+	}
+	batched = ledger_entry_add(template, "batched", "test", "bytes");
+	blocking = ledger_entry_add(template, "blocking", "test", "bytes");
+	negative = ledger_entry_add(template, "negative", "test", "bytes");
+	LEDGER_PERCPU_TEST_CHECK(batched >= 0 && blocking >= 0 && negative >= 0);
+	LEDGER_PERCPU_TEST_CHECK(ledger_entry_batch_percpu(template, batched,
+	    LEDGER_PERCPU_TEST_THRESHOLD) == KERN_SUCCESS);
+	LEDGER_PERCPU_TEST_CHECK(ledger_entry_batch_percpu(template, blocking,
+	    LEDGER_PERCPU_TEST_THRESHOLD) == KERN_SUCCESS);
+	LEDGER_PERCPU_TEST_CHECK(ledger_entry_batch_percpu(template, negative,
+	    LEDGER_PERCPU_TEST_THRESHOLD) == KERN_SUCCESS);
+	LEDGER_PERCPU_TEST_CHECK(ledger_panic_on_negative(template, negative) == KERN_SUCCESS);
+	ledger_template_complete(template);
+
+	/* Too late once ledgers may have been allocated. */
+	LEDGER_PERCPU_TEST_CHECK(ledger_entry_batch_percpu(template, batched,
+	    LEDGER_PERCPU_TEST_THRESHOLD) != KERN_SUCCESS);
+
+	ledger = ledger_instantiate(template, LEDGER_CREATE_ACTIVE_ENTRIES);
+	LEDGER_PERCPU_TEST_CHECK(ledger != NULL && ledger->l_percpu != NULL);
+	slack = LEDGER_PERCPU_TEST_THRESHOLD * (ledger_amount_t)zpercpu_count();
+
+	/*
+	 * Small updates stay in the per-cpu deltas, whichever cpu they ran
+	 * on, and reads add them in.
+	 */
+	LEDGER_PERCPU_TEST_CHECK(ledger_credit(ledger, batched, 100) == KERN_SUCCESS);
+	LEDGER_PERCPU_TEST_CHECK(ledger_debit(ledger, batched, 40) == KERN_SUCCESS);
+	LEDGER_PERCPU_TEST_CHECK(ledger_percpu_test_raw(ledger, batched) == 0);
+	LEDGER_PERCPU_TEST_CHECK(ledger_percpu_test_balance(ledger, batched) == 60);
+
+	/* An update of at least the threshold folds the deltas and goes direct. */
+	LEDGER_PERCPU_TEST_CHECK(ledger_credit(ledger, batched,
+	    2 * LEDGER_PERCPU_TEST_THRESHOLD) == KERN_SUCCESS);
+	raw = ledger_percpu_test_raw(ledger, batched);
+	LEDGER_PERCPU_TEST_CHECK(raw == 60 + 2 * LEDGER_PERCPU_TEST_THRESHOLD);
+	LEDGER_PERCPU_TEST_CHECK(ledger_percpu_test_balance(ledger, batched) == raw);
+
+	/* Well under the limit, the slack can't reach it: keep batching. */
+	limit = raw + slack + LEDGER_PERCPU_TEST_THRESHOLD;
+	LEDGER_PERCPU_TEST_CHECK(ledger_set_limit(ledger, batched, limit, 0) == KERN_SUCCESS);
+	LEDGER_PERCPU_TEST_CHECK(ledger_credit(ledger, batched, 10) == KERN_SUCCESS);
+	LEDGER_PERCPU_TEST_CHECK(ledger_percpu_test_raw(ledger, batched) == raw);
+	LEDGER_PERCPU_TEST_CHECK(ledger_percpu_test_balance(ledger, batched) == raw + 10);
+
+	/* Setting the limit folds, and within the slack updates go direct. */
+	limit = raw + 10 + slack - 1;
+	LEDGER_PERCPU_TEST_CHECK(ledger_set_limit(ledger, batched, limit, 0) == KERN_SUCCESS);
+	LEDGER_PERCPU_TEST_CHECK(ledger_percpu_test_raw(ledger, batched) == raw + 10);
+	LEDGER_PERCPU_TEST_CHECK(ledger_credit(ledger, batched, 10) == KERN_SUCCESS);
+	LEDGER_PERCPU_TEST_CHECK(ledger_percpu_test_raw(ledger, batched) == raw + 20);
+	LEDGER_PERCPU_TEST_CHECK(ledger_set_limit(ledger, batched,
+	    LEDGER_LIMIT_INFINITY, 0) == KERN_SUCCESS);
+
+	/* Zeroing the balance accounts for the deltas too. */
+	LEDGER_PERCPU_TEST_CHECK(ledger_credit(ledger, batched, 10) == KERN_SUCCESS);
+	LEDGER_PERCPU_TEST_CHECK(ledger_zero_balance(ledger, batched) == KERN_SUCCESS);
+	LEDGER_PERCPU_TEST_CHECK(ledger_percpu_test_balance(ledger, batched) == 0);
+
+	/* Blocking and panic-on-negative entries see every update. */
+	LEDGER_PERCPU_TEST_CHECK(ledger_set_action(ledger, blocking,
+	    LEDGER_ACTION_BLOCK) == KERN_SUCCESS);
+	LEDGER_PERCPU_TEST_CHECK(ledger_credit(ledger, blocking, 10) == KERN_SUCCESS);
+	LEDGER_PERCPU_TEST_CHECK(ledger_percpu_test_raw(ledger, blocking) == 10);
+	LEDGER_PERCPU_TEST_CHECK(ledger_credit(ledger, negative, 10) == KERN_SUCCESS);
+	LEDGER_PERCPU_TEST_CHECK(ledger_debit(ledger, negative, 5) == KERN_SUCCESS);
+	LEDGER_PERCPU_TEST_CHECK(ledger_percpu_test_raw(ledger, negative) == 5);
+
+	*out = 1;
+out:
+	if (ledger != NULL) {
+		ledger_dereference(ledger);
+	}
+	ledger_template_dereference(template);
+	return error;
+}
+SYSCTL_TEST_REGISTER(ledger_percpu, ledger_percpu_test);
+
+#undef LEDGER_PERCPU_TEST_CHECK
+
+#endif /* DEVELOPMENT || DEBUG */
@@ -102,11 +102,26 @@ struct ledger_entry_small {
 	volatile ledger_amount_t les_credit __attribute__((aligned(8)));
 } __attribute__((aligned(8)));
 
+/*
+ * Per-cpu credit/debit deltas for entries opted into
+ * ledger_entry_batch_percpu(), folded into the entry when they
+ * reach the entry's threshold or when the balance must be exact.
+ */
+#define LEDGER_PERCPU_SLOTS     4
+
+struct ledger_percpu {
+	struct {
+		ledger_amount_t lpd_credit;
+		ledger_amount_t lpd_debit;
+	} lp_deltas[LEDGER_PERCPU_SLOTS];
+};
+
 struct ledger {
 	uint64_t                  l_id;
 	os_refcnt_t               l_refs;
 	int32_t                   l_size;
 	struct ledger_template *  l_template;
+	struct ledger_percpu *    l_percpu;     /* per-cpu pointer, see zalloc_percpu() */
 	struct ledger_entry_small l_entries[] __attribute__((aligned(8)));
 };
 #endif /* MACH_KERNEL_PRIVATE */
@@ -163,6 +178,14 @@ extern kern_return_t ledger_panic_on_negative(ledger_template_t template,
     int entry);
 extern kern_return_t ledger_track_credit_only(ledger_template_t template,
     int entry);
+/*
+ * Accumulate updates to this entry in per-cpu deltas of at most
+ * threshold before touching the shared entry.  Must be called before
+ * the template is completed; ignored for templates completed with
+ * ledger_template_complete_secure_alloc().
+ */
+extern kern_return_t ledger_entry_batch_percpu(ledger_template_t template,
+    int entry, ledger_amount_t threshold);
 extern int ledger_key_lookup(ledger_template_t template, const char *key);
 
 /*
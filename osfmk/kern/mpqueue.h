@@ -12,9 +12,28 @@ __BEGIN_DECLS
 /*
  *	Define macros for queues with locks.
  */
+/*
+ * Hashed hierarchical timing wheel, used by the timer call queues for
+ * coalescable timers (see timer_call.c).  Level 0 slots are one tick wide
+ * and each level is MPQ_WHEEL_SLOTS times coarser than the one below;
+ * anything beyond the top level waits on the overflow list.
+ */
+#define MPQ_WHEEL_LEVELS        4
+#define MPQ_WHEEL_SLOTS_SHIFT   5
+#define MPQ_WHEEL_SLOTS         (1 << MPQ_WHEEL_SLOTS_SHIFT)
+
+struct mpqueue_wheel {
+	uint64_t                mpw_tick;       /* current level 0 tick */
+	uint64_t                mpw_count;      /* entries on the wheel */
+	uint32_t                mpw_bitmap[MPQ_WHEEL_LEVELS]; /* non-empty slots */
+	struct queue_entry      mpw_slots[MPQ_WHEEL_LEVELS][MPQ_WHEEL_SLOTS];
+	struct queue_entry      mpw_overflow;   /* beyond the top level */
+};
+
 struct mpqueue_head {
 	struct queue_entry      head;           /* header for queue */
 	struct priority_queue_deadline_min mpq_pqhead;
+	struct mpqueue_wheel    mpq_wheel;
 	uint64_t                earliest_soft_deadline;
 	uint64_t                count;
 	lck_ticket_t            lock_data;
@@ -42,6 +42,7 @@
 #include <kern/task.h>
 #include <kern/thread.h>
 #include <kern/sched_clutch.h>
+#include <kern/sched_clutch_policy.h>
 #include <machine/atomic.h>
 #include <kern/sched_clutch.h>
 #include <sys/kdebug.h>
@@ -138,11 +139,9 @@ static inline void sched_clutch_hierarchy_locked_assert(sched_clutch_root_t);
 
 extern processor_set_t pset_array[MAX_PSETS];
 
-/*
- * Special markers for buckets that have invalid WCELs/quantums etc.
- */
-#define SCHED_CLUTCH_INVALID_TIME_32 ((uint32_t)~0)
-#define SCHED_CLUTCH_INVALID_TIME_64 ((uint64_t)~0)
+_Static_assert(SCHED_CLUTCH_POLICY_BUCKETS == TH_BUCKET_SCHED_MAX, "sched_clutch_policy.h bucket count mismatch");
+_Static_assert(SCHED_CLUTCH_POLICY_BUCKET_FIXPRI == TH_BUCKET_FIXPRI, "sched_clutch_policy.h bucket mismatch");
+_Static_assert(SCHED_CLUTCH_POLICY_BUCKET_SHARE_FG == TH_BUCKET_SHARE_FG, "sched_clutch_policy.h bucket mismatch");
 
 /*
  * Root level bucket WCELs
@@ -153,14 +152,7 @@ extern processor_set_t pset_array[MAX_PSETS];
  * for the bucket.
  *
  */
-static uint32_t sched_clutch_root_bucket_wcel_us[TH_BUCKET_SCHED_MAX] = {
-	SCHED_CLUTCH_INVALID_TIME_32,                   /* FIXPRI */
-	0,                                              /* FG */
-	37500,                                          /* IN (37.5ms) */
-	75000,                                          /* DF (75ms) */
-	150000,                                         /* UT (150ms) */
-	250000                                          /* BG (250ms) */
-};
+static uint32_t sched_clutch_root_bucket_wcel_us[TH_BUCKET_SCHED_MAX] = SCHED_CLUTCH_ROOT_BUCKET_WCEL_US_DEFAULT;
 static uint64_t sched_clutch_root_bucket_wcel[TH_BUCKET_SCHED_MAX] = {0};
 
 /*
@@ -173,18 +165,8 @@ static uint64_t sched_clutch_root_bucket_wcel[TH_BUCKET_SCHED_MAX] = {0};
  * opportunity for high priority buckets to remain responsive.
  */
 
-/* Special warp deadline value to indicate that the bucket has not used any warp yet */
-#define SCHED_CLUTCH_ROOT_BUCKET_WARP_UNUSED    (SCHED_CLUTCH_INVALID_TIME_64)
-
 /* Warp window durations for various tiers */
-static uint32_t sched_clutch_root_bucket_warp_us[TH_BUCKET_SCHED_MAX] = {
-	SCHED_CLUTCH_INVALID_TIME_32,                   /* FIXPRI */
-	8000,                                           /* FG (8ms)*/
-	4000,                                           /* IN (4ms) */
-	2000,                                           /* DF (2ms) */
-	1000,                                           /* UT (1ms) */
-	0                                               /* BG (0ms) */
-};
+static uint32_t sched_clutch_root_bucket_warp_us[TH_BUCKET_SCHED_MAX] = SCHED_CLUTCH_ROOT_BUCKET_WARP_US_DEFAULT;
 static uint64_t sched_clutch_root_bucket_warp[TH_BUCKET_SCHED_MAX] = {0};
 
 /*
@@ -196,23 +178,9 @@ static uint64_t sched_clutch_root_bucket_warp[TH_BUCKET_SCHED_MAX] = {0};
  */
 
 #if XNU_TARGET_OS_OSX
-static uint32_t sched_clutch_thread_quantum_us[TH_BUCKET_SCHED_MAX] = {
-	10000,                                          /* FIXPRI (10ms) */
-	10000,                                          /* FG (10ms) */
-	10000,                                          /* IN (10ms) */
-	10000,                                          /* DF (10ms) */
-	4000,                                           /* UT (4ms) */
-	2000                                            /* BG (2ms) */
-};
+static uint32_t sched_clutch_thread_quantum_us[TH_BUCKET_SCHED_MAX] = SCHED_CLUTCH_THREAD_QUANTUM_US_OSX;
 #else /* XNU_TARGET_OS_OSX */
-static uint32_t sched_clutch_thread_quantum_us[TH_BUCKET_SCHED_MAX] = {
-	10000,                                          /* FIXPRI (10ms) */
-	10000,                                          /* FG (10ms) */
-	8000,                                           /* IN (8ms) */
-	6000,                                           /* DF (6ms) */
-	4000,                                           /* UT (4ms) */
-	2000                                            /* BG (2ms) */
-};
+static uint32_t sched_clutch_thread_quantum_us[TH_BUCKET_SCHED_MAX] = SCHED_CLUTCH_THREAD_QUANTUM_US_EMBEDDED;
 #endif /* XNU_TARGET_OS_OSX */
 
 static uint64_t sched_clutch_thread_quantum[TH_BUCKET_SCHED_MAX] = {0};
@@ -708,77 +676,78 @@ evaluate_root_buckets:
 	 */
 	bitmap_t *warp_available_bitmap = (edf_bucket->scrb_bound) ? (root_clutch->scr_bound_warp_available) : (root_clutch->scr_unbound_warp_available);
 	warp_bucket_index = bitmap_lsb_first(warp_available_bitmap, TH_BUCKET_SCHED_MAX);
+	warp_bucket = NULL;
+	if ((warp_bucket_index != -1) && (warp_bucket_index < edf_bucket->scrb_bucket)) {
+		warp_bucket = (edf_bucket->scrb_bound) ? &root_clutch->scr_bound_buckets[warp_bucket_index] : &root_clutch->scr_unbound_buckets[warp_bucket_index];
+	}
 
-	if ((warp_bucket_index == -1) || (warp_bucket_index >= edf_bucket->scrb_bucket)) {
-		/* No higher buckets have warp left; best choice is the EDF based bucket */
-		if (edf_bucket->scrb_starvation_avoidance) {
-			/*
-			 * Indicates that the earliest deadline bucket is in starvation avoidance mode. Check to see if the
-			 * starvation avoidance window is still open and return this bucket if it is.
-			 *
-			 * The starvation avoidance window is calculated based on the quantum of threads at that bucket and
-			 * the number of CPUs in the cluster. The idea is to basically provide one quantum worth of starvation
-			 * avoidance across all CPUs.
-			 */
-			uint64_t starvation_window = sched_clutch_thread_quantum[edf_bucket->scrb_bucket] / pset_available_cpu_count(root_clutch->scr_pset);
-			if (timestamp < (edf_bucket->scrb_starvation_ts + starvation_window)) {
-				return edf_bucket;
-			} else {
-				/* Starvation avoidance window is over; update deadline and re-evaluate EDF */
-				edf_bucket->scrb_starvation_avoidance = false;
-				edf_bucket->scrb_starvation_ts = 0;
-				sched_clutch_root_bucket_deadline_update(edf_bucket, root_clutch, timestamp);
-			}
-			goto evaluate_root_buckets;
-		}
+	/*
+	 * If the EDF bucket is in starvation avoidance mode, its window provides one
+	 * quantum worth of starvation avoidance across all CPUs of the cluster.
+	 */
+	uint64_t starvation_window = 0;
+	if (edf_bucket->scrb_starvation_avoidance) {
+		starvation_window = sched_clutch_policy_starvation_window(sched_clutch_thread_quantum[edf_bucket->scrb_bucket],
+		    pset_available_cpu_count(root_clutch->scr_pset));
+	}
 
-		/* Looks like the EDF bucket is not in starvation avoidance mode; check if it should be */
-		if (highest_runnable_bucket < edf_bucket->scrb_bucket) {
-			/* Since a higher bucket is runnable, it indicates that the EDF bucket should be in starvation avoidance */
-			edf_bucket->scrb_starvation_avoidance = true;
-			edf_bucket->scrb_starvation_ts = timestamp;
+	switch (sched_clutch_policy_root_select(highest_runnable_bucket, edf_bucket->scrb_bucket,
+	    edf_bucket->scrb_starvation_avoidance, edf_bucket->scrb_starvation_ts, starvation_window,
+	    warp_bucket_index, warp_bucket ? warp_bucket->scrb_warped_deadline : 0, timestamp)) {
+	case SCHED_CLUTCH_ROOT_SELECT_EDF_STARVATION:
+		return edf_bucket;
+
+	case SCHED_CLUTCH_ROOT_SELECT_STARVATION_EXPIRED:
+		/* Starvation avoidance window is over; update deadline and re-evaluate EDF */
+		edf_bucket->scrb_starvation_avoidance = false;
+		edf_bucket->scrb_starvation_ts = 0;
+		sched_clutch_root_bucket_deadline_update(edf_bucket, root_clutch, timestamp);
+		goto evaluate_root_buckets;
+
+	case SCHED_CLUTCH_ROOT_SELECT_EDF_STARVATION_START:
+		/* Since a higher bucket is runnable, the EDF bucket is selected in starvation avoidance mode */
+		edf_bucket->scrb_starvation_avoidance = true;
+		edf_bucket->scrb_starvation_ts = timestamp;
+		return edf_bucket;
+
+	case SCHED_CLUTCH_ROOT_SELECT_EDF:
+		/* EDF bucket is being selected in the natural order; update deadline and reset warp */
+		sched_clutch_root_bucket_deadline_update(edf_bucket, root_clutch, timestamp);
+		edf_bucket->scrb_warp_remaining = sched_clutch_root_bucket_warp[edf_bucket->scrb_bucket];
+		edf_bucket->scrb_warped_deadline = SCHED_CLUTCH_ROOT_BUCKET_WARP_UNUSED;
+		if (edf_bucket->scrb_bound) {
+			bitmap_set(root_clutch->scr_bound_warp_available, edf_bucket->scrb_bucket);
 		} else {
-			/* EDF bucket is being selected in the natural order; update deadline and reset warp */
-			sched_clutch_root_bucket_deadline_update(edf_bucket, root_clutch, timestamp);
-			edf_bucket->scrb_warp_remaining = sched_clutch_root_bucket_warp[edf_bucket->scrb_bucket];
-			edf_bucket->scrb_warped_deadline = SCHED_CLUTCH_ROOT_BUCKET_WARP_UNUSED;
-			if (edf_bucket->scrb_bound) {
-				bitmap_set(root_clutch->scr_bound_warp_available, edf_bucket->scrb_bucket);
-			} else {
-				bitmap_set(root_clutch->scr_unbound_warp_available, edf_bucket->scrb_bucket);
-			}
+			bitmap_set(root_clutch->scr_unbound_warp_available, edf_bucket->scrb_bucket);
 		}
 		return edf_bucket;
-	}
 
-	/*
-	 * Looks like there is a root bucket which is higher in the natural priority
-	 * order than edf_bucket and might have some warp remaining.
-	 */
-	warp_bucket = (edf_bucket->scrb_bound) ? &root_clutch->scr_bound_buckets[warp_bucket_index] : &root_clutch->scr_unbound_buckets[warp_bucket_index];
-	if (warp_bucket->scrb_warped_deadline == SCHED_CLUTCH_ROOT_BUCKET_WARP_UNUSED) {
+	case SCHED_CLUTCH_ROOT_SELECT_WARP_START:
 		/* Root bucket has not used any of its warp; set a deadline to expire its warp and return it */
 		warp_bucket->scrb_warped_deadline = timestamp + warp_bucket->scrb_warp_remaining;
 		sched_clutch_root_bucket_deadline_update(warp_bucket, root_clutch, timestamp);
 		return warp_bucket;
-	}
-	if (warp_bucket->scrb_warped_deadline > timestamp) {
+
+	case SCHED_CLUTCH_ROOT_SELECT_WARP:
 		/* Root bucket already has a warp window open with some warp remaining */
 		sched_clutch_root_bucket_deadline_update(warp_bucket, root_clutch, timestamp);
 		return warp_bucket;
-	}
 
-	/* For this bucket, warp window was opened sometime in the past but has now
-	 * expired. Mark the bucket as not avilable for warp anymore and re-run the
-	 * warp bucket selection logic.
-	 */
-	warp_bucket->scrb_warp_remaining = 0;
-	if (warp_bucket->scrb_bound) {
-		bitmap_clear(root_clutch->scr_bound_warp_available, warp_bucket->scrb_bucket);
-	} else {
-		bitmap_clear(root_clutch->scr_unbound_warp_available, warp_bucket->scrb_bucket);
+	case SCHED_CLUTCH_ROOT_SELECT_WARP_EXPIRED:
+		/*
+		 * For this bucket, warp window was opened sometime in the past but has now
+		 * expired. Mark the bucket as not avilable for warp anymore and re-run the
+		 * warp bucket selection logic.
+		 */
+		warp_bucket->scrb_warp_remaining = 0;
+		if (warp_bucket->scrb_bound) {
+			bitmap_clear(root_clutch->scr_bound_warp_available, warp_bucket->scrb_bucket);
+		} else {
+			bitmap_clear(root_clutch->scr_unbound_warp_available, warp_bucket->scrb_bucket);
+		}
+		goto evaluate_root_buckets;
 	}
-	goto evaluate_root_buckets;
+	panic("sched_clutch_root_highest_root_bucket: unexpected selection for root_clutch %p", root_clutch);
 }
 
 /*
@@ -791,13 +760,12 @@ sched_clutch_root_bucket_deadline_calculate(
 	sched_clutch_root_bucket_t root_bucket,
 	uint64_t timestamp)
 {
-	/* For fixpri AboveUI bucket always return it as the earliest deadline */
-	if (root_bucket->scrb_bucket < TH_BUCKET_SHARE_FG) {
-		return 0;
-	}
-
-	/* For all timeshare buckets set the deadline as current time + worst-case-execution-latency */
-	return timestamp + sched_clutch_root_bucket_wcel[root_bucket->scrb_bucket];
+	/*
+	 * The fixpri AboveUI bucket always has the earliest deadline; for all timeshare
+	 * buckets the deadline is current time + worst-case-execution-latency.
+	 */
+	return sched_clutch_policy_root_bucket_deadline(root_bucket->scrb_bucket, timestamp,
+	           sched_clutch_root_bucket_wcel[root_bucket->scrb_bucket]);
 }
 
 /*
@@ -894,24 +862,14 @@ sched_clutch_root_bucket_empty(
 	bitmap_t *warp_bitmap = (root_bucket->scrb_bound) ? root_clutch->scr_bound_warp_available : root_clutch->scr_unbound_warp_available;
 	bitmap_clear(warp_bitmap, root_bucket->scrb_bucket);
 
-	if (root_bucket->scrb_warped_deadline != SCHED_CLUTCH_ROOT_BUCKET_WARP_UNUSED) {
-		if (root_bucket->scrb_warped_deadline > timestamp) {
-			/*
-			 * For root buckets that were using the warp, check if the warp
-			 * deadline is in the future. If yes, remove the wall time the
-			 * warp was active and update the warp remaining. This allows
-			 * the root bucket to use the remaining warp the next time it
-			 * becomes runnable.
-			 */
-			root_bucket->scrb_warp_remaining = root_bucket->scrb_warped_deadline - timestamp;
-		} else {
-			/*
-			 * If the root bucket's warped deadline is in the past, it has used up
-			 * all the warp it was assigned. Empty out its warp remaining.
-			 */
-			root_bucket->scrb_warp_remaining = 0;
-		}
-	}
+	/*
+	 * For root buckets that were using the warp, remove the wall time the warp
+	 * was active from the warp remaining. This allows the root bucket to use the
+	 * remaining warp the next time it becomes runnable. If the warped deadline
+	 * is in the past, it has used up all the warp it was assigned.
+	 */
+	root_bucket->scrb_warp_remaining = sched_clutch_policy_warp_remaining(root_bucket->scrb_warp_remaining,
+	    root_bucket->scrb_warped_deadline, timestamp);
 }
 
 static int
@@ -1048,22 +1006,14 @@ sched_clutch_root_urgency_dec(
  */
 
 /* Priority boost range for interactivity */
-#define SCHED_CLUTCH_BUCKET_GROUP_INTERACTIVE_PRI_DEFAULT     (8)
 uint8_t sched_clutch_bucket_group_interactive_pri = SCHED_CLUTCH_BUCKET_GROUP_INTERACTIVE_PRI_DEFAULT;
 
 /* window to scale the cpu usage and blocked values (currently 500ms). Its the threshold of used+blocked */
 uint64_t sched_clutch_bucket_group_adjust_threshold = 0;
-#define SCHED_CLUTCH_BUCKET_GROUP_ADJUST_THRESHOLD_USECS      (500000)
-
-/* The ratio to scale the cpu/blocked time per window */
-#define SCHED_CLUTCH_BUCKET_GROUP_ADJUST_RATIO                (10)
 
 /* Initial value for voluntary blocking time for the clutch_bucket */
 #define SCHED_CLUTCH_BUCKET_GROUP_BLOCKED_TS_INVALID          (uint64_t)(~0)
 
-/* Value indicating the clutch bucket is not pending execution */
-#define SCHED_CLUTCH_BUCKET_GROUP_PENDING_INVALID             ((uint64_t)(~0))
-
 /*
  * Thread group CPU starvation avoidance
  *
@@ -1077,14 +1027,7 @@ uint64_t sched_clutch_bucket_group_adjust_threshold = 0;
  * These values are multiplied by the load average of the relevant root bucket to
  * provide an estimate of the actual clutch bucket load.
  */
-static uint32_t sched_clutch_bucket_group_pending_delta_us[TH_BUCKET_SCHED_MAX] = {
-	SCHED_CLUTCH_INVALID_TIME_32,           /* FIXPRI */
-	10000,                                  /* FG */
-	37500,                                  /* IN */
-	75000,                                  /* DF */
-	150000,                                 /* UT */
-	250000,                                 /* BG */
-};
+static uint32_t sched_clutch_bucket_group_pending_delta_us[TH_BUCKET_SCHED_MAX] = SCHED_CLUTCH_BUCKET_GROUP_PENDING_DELTA_US_DEFAULT;
 static uint64_t sched_clutch_bucket_group_pending_delta[TH_BUCKET_SCHED_MAX] = {0};
 
 /*
@@ -1423,7 +1366,6 @@ sched_clutch_interactivity_from_cpu_data(sched_clutch_bucket_group_t clutch_buck
 	scb_cpu_data.scbcd_cpu_data_packed = os_atomic_load_wide(&clutch_bucket_group->scbg_cpu_data.scbcd_cpu_data_packed, relaxed);
 	clutch_cpu_data_t cpu_used = scb_cpu_data.cpu_data.scbcd_cpu_used;
 	clutch_cpu_data_t cpu_blocked = scb_cpu_data.cpu_data.scbcd_cpu_blocked;
-	uint8_t interactive_score = 0;
 
 	if ((cpu_blocked == 0) && (cpu_used == 0)) {
 		return (uint8_t)clutch_bucket_group->scbg_interactivity_data.scct_count;
@@ -1432,15 +1374,7 @@ sched_clutch_interactivity_from_cpu_data(sched_clutch_bucket_group_t clutch_buck
 	 * For all timeshare buckets, calculate the interactivity score of the bucket
 	 * and add it to the base priority
 	 */
-	if (cpu_blocked > cpu_used) {
-		/* Interactive clutch_bucket case */
-		interactive_score = sched_clutch_bucket_group_interactive_pri +
-		    ((sched_clutch_bucket_group_interactive_pri * (cpu_blocked - cpu_used)) / cpu_blocked);
-	} else {
-		/* Non-interactive clutch_bucket case */
-		interactive_score = ((sched_clutch_bucket_group_interactive_pri * cpu_blocked) / cpu_used);
-	}
-	return interactive_score;
+	return sched_clutch_policy_interactivity_score(cpu_used, cpu_blocked, sched_clutch_bucket_group_interactive_pri);
 }
 
 /*
@@ -1621,29 +1555,6 @@ sched_clutch_bucket_group_cpu_usage_update(
 	os_atomic_add(&(clutch_bucket_group->scbg_cpu_data.cpu_data.scbcd_cpu_used), (clutch_cpu_data_t)delta, relaxed);
 }
 
-/*
- * sched_clutch_bucket_group_cpu_pending_adjust()
- *
- * Routine to calculate the adjusted CPU usage value based on the pending intervals. The calculation is done
- * such that one "pending interval" provides one point improvement in interactivity score.
- */
-static inline uint64_t
-sched_clutch_bucket_group_cpu_pending_adjust(
-	uint64_t cpu_used,
-	uint64_t cpu_blocked,
-	uint8_t pending_intervals)
-{
-	uint64_t cpu_used_adjusted = 0;
-	if (cpu_blocked < cpu_used) {
-		cpu_used_adjusted = (sched_clutch_bucket_group_interactive_pri * cpu_blocked * cpu_used);
-		cpu_used_adjusted = cpu_used_adjusted / ((sched_clutch_bucket_group_interactive_pri * cpu_blocked) + (cpu_used * pending_intervals));
-	} else {
-		uint64_t adjust_factor = (cpu_blocked * pending_intervals) / sched_clutch_bucket_group_interactive_pri;
-		cpu_used_adjusted = (adjust_factor > cpu_used) ? 0 : (cpu_used - adjust_factor);
-	}
-	return cpu_used_adjusted;
-}
-
 /*
  * sched_clutch_bucket_group_cpu_adjust()
  *
@@ -1665,17 +1576,12 @@ sched_clutch_bucket_group_cpu_adjust(
 		clutch_cpu_data_t cpu_used = old_cpu_data.cpu_data.scbcd_cpu_used;
 		clutch_cpu_data_t cpu_blocked = old_cpu_data.cpu_data.scbcd_cpu_blocked;
 
-		if ((pending_intervals == 0) && (cpu_used + cpu_blocked) < sched_clutch_bucket_group_adjust_threshold) {
+		/* Scale down to the recent CPU history and use the shift passed in to ageout the CPU usage */
+		if (!sched_clutch_policy_cpu_adjust(&cpu_used, &cpu_blocked, pending_intervals,
+		    sched_clutch_bucket_group_adjust_threshold, sched_clutch_bucket_group_interactive_pri)) {
 		        /* No changes to the CPU used and blocked values */
 		        os_atomic_rmw_loop_give_up();
 		}
-		if ((cpu_used + cpu_blocked) >= sched_clutch_bucket_group_adjust_threshold) {
-		        /* Only keep the recent CPU history to better indicate how this TG has been behaving */
-		        cpu_used = cpu_used / SCHED_CLUTCH_BUCKET_GROUP_ADJUST_RATIO;
-		        cpu_blocked = cpu_blocked / SCHED_CLUTCH_BUCKET_GROUP_ADJUST_RATIO;
-		}
-		/* Use the shift passed in to ageout the CPU usage */
-		cpu_used = (clutch_cpu_data_t)sched_clutch_bucket_group_cpu_pending_adjust(cpu_used, cpu_blocked, pending_intervals);
 		new_cpu_data.cpu_data.scbcd_cpu_used = cpu_used;
 		new_cpu_data.cpu_data.scbcd_cpu_blocked = cpu_blocked;
 	});
@@ -2129,23 +2035,13 @@ sched_clutch_bucket_group_pending_ageout(
 	uint8_t cpu_usage_shift = 0;
 
 	os_atomic_rmw_loop(&clutch_bucket_group->scbg_pending_data.scct_packed, old_pending_data.scct_packed, new_pending_data.scct_packed, relaxed, {
-		cpu_usage_shift = 0;
-		uint64_t old_pending_ts = old_pending_data.scct_timestamp;
-		bool old_update = (old_pending_ts >= timestamp);
-		bool no_pending_time = (old_pending_ts == SCHED_CLUTCH_BUCKET_GROUP_PENDING_INVALID);
-		bool no_bucket_load = (bucket_load == 0);
-		if (old_update || no_pending_time || no_bucket_load) {
-		        os_atomic_rmw_loop_give_up();
-		}
-
-		/* Calculate the time the clutch bucket group has been pending */
-		uint64_t pending_delta = timestamp - old_pending_ts;
-		uint64_t interactivity_delta = sched_clutch_bucket_group_pending_delta[clutch_bucket_group->scbg_bucket] * bucket_load;
-		if (pending_delta < interactivity_delta) {
+		uint64_t pending_ts = old_pending_data.scct_timestamp;
+		cpu_usage_shift = sched_clutch_policy_pending_ageout(&pending_ts, timestamp,
+		    sched_clutch_bucket_group_pending_delta[clutch_bucket_group->scbg_bucket], (uint32_t)bucket_load);
+		if (cpu_usage_shift == 0) {
 		        os_atomic_rmw_loop_give_up();
 		}
-		cpu_usage_shift = (pending_delta / interactivity_delta);
-		new_pending_data.scct_timestamp = old_pending_ts + (cpu_usage_shift * interactivity_delta);
+		new_pending_data.scct_timestamp = pending_ts;
 		new_pending_data.scct_count = old_pending_data.scct_count;
 	});
 	return cpu_usage_shift;
@@ -2227,21 +2123,8 @@ sched_clutch_bucket_group_pending_ageout(
 {
 	sched_clutch_hierarchy_locked_assert(&pset0.pset_clutch_root);
 	int bucket_load = sched_clutch_global_bucket_load_get(clutch_bucket_group->scbg_bucket);
-	uint64_t old_pending_ts = clutch_bucket_group->scbg_pending_data.scct_timestamp;
-	bool old_update = (old_pending_ts >= timestamp);
-	bool no_pending_time = (old_pending_ts == SCHED_CLUTCH_BUCKET_GROUP_PENDING_INVALID);
-	bool no_bucket_load = (bucket_load == 0);
-	if (old_update || no_pending_time || no_bucket_load) {
-		return 0;
-	}
-	uint64_t pending_delta = timestamp - old_pending_ts;
-	uint64_t interactivity_delta = sched_clutch_bucket_group_pending_delta[clutch_bucket_group->scbg_bucket] * bucket_load;
-	if (pending_delta < interactivity_delta) {
-		return 0;
-	}
-	uint8_t cpu_usage_shift = (pending_delta / interactivity_delta);
-	clutch_bucket_group->scbg_pending_data.scct_timestamp = old_pending_ts + (cpu_usage_shift * interactivity_delta);
-	return cpu_usage_shift;
+	return sched_clutch_policy_pending_ageout(&clutch_bucket_group->scbg_pending_data.scct_timestamp, timestamp,
+	           sched_clutch_bucket_group_pending_delta[clutch_bucket_group->scbg_bucket], (uint32_t)bucket_load);
 }
 
 static uint8_t
@@ -4175,41 +4058,23 @@ sched_edge_migration_check(uint32_t cluster_id, processor_set_t preferred_pset,
 		return false;
 	}
 	uint32_t dst_load = shared_rsrc_thread ? (uint32_t)sched_pset_cluster_shared_rsrc_load(dst_pset, shared_rsrc_type) : sched_edge_cluster_load_metric(dst_pset, thread->th_sched_bucket);
-	if (dst_load == 0) {
+	bool selected_homogeneous = (pset_type_for_id((*selected_pset)->pset_cluster_id) == preferred_cluster_type);
+	bool candidate_homogeneous = (pset_type_for_id(dst_pset->pset_cluster_id) == preferred_cluster_type);
+
+	switch (sched_edge_policy_migration_check(preferred_cluster_load, dst_load, edge[cluster_id].sce_migration_weight,
+	    shared_rsrc_thread, selected_homogeneous, candidate_homogeneous, max_edge_delta)) {
+	case SCHED_EDGE_MIGRATE_IDLE:
 		/* The candidate cluster is idle; select it immediately for execution */
 		*selected_pset = dst_pset;
-		*max_edge_delta = preferred_cluster_load;
 		return true;
-	}
-
-	uint32_t edge_delta = 0;
-	if (dst_load > preferred_cluster_load) {
-		return false;
-	}
-	edge_delta = preferred_cluster_load - dst_load;
-	if (!shared_rsrc_thread && (edge_delta < edge[cluster_id].sce_migration_weight)) {
-		/*
-		 * For non shared resource threads, use the edge migration weight to decide if
-		 * this cluster is over-committed at the QoS level of this thread.
-		 */
+	case SCHED_EDGE_MIGRATE_CANDIDATE:
+		/* dst_pset seems to be the best candidate for migration; however other candidates should still be evaluated */
+		*selected_pset = dst_pset;
 		return false;
-	}
-
-	if (edge_delta < *max_edge_delta) {
+	case SCHED_EDGE_MIGRATE_SKIP:
+	default:
 		return false;
 	}
-	if (edge_delta == *max_edge_delta) {
-		/* If the edge delta is the same as the max delta, make sure a homogeneous cluster is picked */
-		boolean_t selected_homogeneous = (pset_type_for_id((*selected_pset)->pset_cluster_id) == preferred_cluster_type);
-		boolean_t candidate_homogeneous = (pset_type_for_id(dst_pset->pset_cluster_id) == preferred_cluster_type);
-		if (selected_homogeneous || !candidate_homogeneous) {
-			return false;
-		}
-	}
-	/* dst_pset seems to be the best candidate for migration; however other candidates should still be evaluated */
-	*max_edge_delta = edge_delta;
-	*selected_pset = dst_pset;
-	return false;
 }
 
 /*
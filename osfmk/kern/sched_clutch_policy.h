@@ -0,0 +1,445 @@
+/*
+ * Copyright (c) 2024 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+#ifndef _KERN_SCHED_CLUTCH_POLICY_H_
+#define _KERN_SCHED_CLUTCH_POLICY_H_
+
+/*
+ * Clutch/Edge scheduling policy
+ *
+ * The decisions taken by the Clutch and Edge schedulers (root bucket
+ * EDF/warp/starvation avoidance selection, clutch bucket group interactivity
+ * scoring and CPU usage ageout, migration across cluster edges) are kept here
+ * as pure functions of the few values they depend on, together with the
+ * default tunables. sched_clutch.c applies the results to the hierarchy.
+ *
+ * This header must not depend on anything else in the kernel: it is also
+ * built into the user space scheduler simulator (tools/sched_sim), which has
+ * to take exactly the decisions the kernel takes. Durations are in mach
+ * absolute time units in the kernel and in nanoseconds in the simulator; none
+ * of the routines depend on the unit.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Number of schedulable buckets, i.e. TH_BUCKET_SCHED_MAX */
+#define SCHED_CLUTCH_POLICY_BUCKETS             (6)
+#define SCHED_CLUTCH_POLICY_BUCKET_FIXPRI       (0)
+#define SCHED_CLUTCH_POLICY_BUCKET_SHARE_FG     (1)
+
+/*
+ * Special markers for buckets that have invalid WCELs/quantums etc.
+ */
+#define SCHED_CLUTCH_INVALID_TIME_32 ((uint32_t)~0)
+#define SCHED_CLUTCH_INVALID_TIME_64 ((uint64_t)~0)
+
+/* Special warp deadline value to indicate that the bucket has not used any warp yet */
+#define SCHED_CLUTCH_ROOT_BUCKET_WARP_UNUSED    (SCHED_CLUTCH_INVALID_TIME_64)
+
+/*
+ * Default tunables, in usecs and indexed by bucket. See sched_clutch.c for
+ * what each of them controls.
+ */
+#define SCHED_CLUTCH_ROOT_BUCKET_WCEL_US_DEFAULT {                              \
+	SCHED_CLUTCH_INVALID_TIME_32,                   /* FIXPRI */            \
+	0,                                              /* FG */                \
+	37500,                                          /* IN (37.5ms) */       \
+	75000,                                          /* DF (75ms) */         \
+	150000,                                         /* UT (150ms) */        \
+	250000                                          /* BG (250ms) */        \
+}
+
+#define SCHED_CLUTCH_ROOT_BUCKET_WARP_US_DEFAULT {                              \
+	SCHED_CLUTCH_INVALID_TIME_32,                   /* FIXPRI */            \
+	8000,                                           /* FG (8ms)*/           \
+	4000,                                           /* IN (4ms) */          \
+	2000,                                           /* DF (2ms) */          \
+	1000,                                           /* UT (1ms) */          \
+	0                                               /* BG (0ms) */          \
+}
+
+#define SCHED_CLUTCH_THREAD_QUANTUM_US_OSX {                                    \
+	10000,                                          /* FIXPRI (10ms) */     \
+	10000,                                          /* FG (10ms) */         \
+	10000,                                          /* IN (10ms) */         \
+	10000,                                          /* DF (10ms) */         \
+	4000,                                           /* UT (4ms) */          \
+	2000                                            /* BG (2ms) */          \
+}
+
+#define SCHED_CLUTCH_THREAD_QUANTUM_US_EMBEDDED {                               \
+	10000,                                          /* FIXPRI (10ms) */     \
+	10000,                                          /* FG (10ms) */         \
+	8000,                                           /* IN (8ms) */          \
+	6000,                                           /* DF (6ms) */          \
+	4000,                                           /* UT (4ms) */          \
+	2000                                            /* BG (2ms) */          \
+}
+
+#define SCHED_CLUTCH_BUCKET_GROUP_PENDING_DELTA_US_DEFAULT {                    \
+	SCHED_CLUTCH_INVALID_TIME_32,                   /* FIXPRI */            \
+	10000,                                          /* FG */                \
+	37500,                                          /* IN */                \
+	75000,                                          /* DF */                \
+	150000,                                         /* UT */                \
+	250000,                                         /* BG */                \
+}
+
+/* Priority boost range for interactivity */
+#define SCHED_CLUTCH_BUCKET_GROUP_INTERACTIVE_PRI_DEFAULT     (8)
+
+/* window to scale the cpu usage and blocked values (currently 500ms). Its the threshold of used+blocked */
+#define SCHED_CLUTCH_BUCKET_GROUP_ADJUST_THRESHOLD_USECS      (500000)
+
+/* The ratio to scale the cpu/blocked time per window */
+#define SCHED_CLUTCH_BUCKET_GROUP_ADJUST_RATIO                (10)
+
+/* Value indicating the clutch bucket is not pending execution */
+#define SCHED_CLUTCH_BUCKET_GROUP_PENDING_INVALID             ((uint64_t)(~0))
+
+/*
+ * Root bucket selection
+ */
+
+/*
+ * sched_clutch_policy_root_bucket_deadline()
+ *
+ * Deadline of a root bucket made runnable or selected at timestamp. The
+ * AboveUI bucket is never scheduled by deadline and always has the earliest.
+ */
+static inline uint64_t
+sched_clutch_policy_root_bucket_deadline(
+	int bucket,
+	uint64_t timestamp,
+	uint64_t wcel)
+{
+	if (bucket < SCHED_CLUTCH_POLICY_BUCKET_SHARE_FG) {
+		return 0;
+	}
+	return timestamp + wcel;
+}
+
+/*
+ * sched_clutch_policy_starvation_window()
+ *
+ * The starvation avoidance window is calculated based on the quantum of
+ * threads at the bucket and the number of CPUs in the cluster. The idea is
+ * to basically provide one quantum worth of starvation avoidance across all
+ * CPUs.
+ */
+static inline uint64_t
+sched_clutch_policy_starvation_window(
+	uint64_t thread_quantum,
+	uint32_t cpu_count)
+{
+	return thread_quantum / (cpu_count ? cpu_count : 1);
+}
+
+/*
+ * sched_clutch_policy_warp_remaining()
+ *
+ * Warp left to a root bucket when it becomes empty. A bucket that was using
+ * its warp keeps the part of the window that is still in the future, so that
+ * it can use it the next time it becomes runnable.
+ */
+static inline uint64_t
+sched_clutch_policy_warp_remaining(
+	uint64_t warp_remaining,
+	uint64_t warped_deadline,
+	uint64_t timestamp)
+{
+	if (warped_deadline == SCHED_CLUTCH_ROOT_BUCKET_WARP_UNUSED) {
+		return warp_remaining;
+	}
+	return (warped_deadline > timestamp) ? (warped_deadline - timestamp) : 0;
+}
+
+/*
+ * Outcome of one round of the timeshare root bucket selection. The caller
+ * applies the action to the hierarchy and either returns the chosen bucket
+ * or, for the *_EXPIRED actions, evaluates the root buckets again.
+ */
+typedef enum {
+	/* Select the EDF bucket; its starvation avoidance window is still open */
+	SCHED_CLUTCH_ROOT_SELECT_EDF_STARVATION,
+	/* Close the starvation avoidance window of the EDF bucket, update its deadline and re-evaluate */
+	SCHED_CLUTCH_ROOT_SELECT_STARVATION_EXPIRED,
+	/* Select the EDF bucket ahead of a higher runnable bucket and open its starvation avoidance window */
+	SCHED_CLUTCH_ROOT_SELECT_EDF_STARVATION_START,
+	/* Select the EDF bucket in the natural order; update its deadline and reset its warp */
+	SCHED_CLUTCH_ROOT_SELECT_EDF,
+	/* Select the warp bucket and open its warp window */
+	SCHED_CLUTCH_ROOT_SELECT_WARP_START,
+	/* Select the warp bucket; its warp window is still open */
+	SCHED_CLUTCH_ROOT_SELECT_WARP,
+	/* Mark the warp bucket as out of warp and re-evaluate */
+	SCHED_CLUTCH_ROOT_SELECT_WARP_EXPIRED,
+} sched_clutch_root_select_t;
+
+/*
+ * sched_clutch_policy_root_select()
+ *
+ * Decide between the earliest deadline root bucket and the highest root bucket
+ * with warp available, once the AboveUI special cases have been handled.
+ *
+ * highest_runnable: highest (i.e. lowest numbered) runnable bucket
+ * edf_bucket: bucket with the earliest deadline
+ * edf_starvation_avoidance/edf_starvation_ts: its starvation avoidance state
+ * starvation_window: see sched_clutch_policy_starvation_window(); only used
+ *     when edf_starvation_avoidance is set
+ * warp_bucket: highest bucket with warp available, or -1
+ * warped_deadline: the warp deadline of warp_bucket
+ */
+static inline sched_clutch_root_select_t
+sched_clutch_policy_root_select(
+	int highest_runnable,
+	int edf_bucket,
+	bool edf_starvation_avoidance,
+	uint64_t edf_starvation_ts,
+	uint64_t starvation_window,
+	int warp_bucket,
+	uint64_t warped_deadline,
+	uint64_t timestamp)
+{
+	if ((warp_bucket == -1) || (warp_bucket >= edf_bucket)) {
+		/* No higher buckets have warp left; best choice is the EDF based bucket */
+		if (edf_starvation_avoidance) {
+			if (timestamp < (edf_starvation_ts + starvation_window)) {
+				return SCHED_CLUTCH_ROOT_SELECT_EDF_STARVATION;
+			}
+			return SCHED_CLUTCH_ROOT_SELECT_STARVATION_EXPIRED;
+		}
+		if (highest_runnable < edf_bucket) {
+			/* Since a higher bucket is runnable, it indicates that the EDF bucket should be in starvation avoidance */
+			return SCHED_CLUTCH_ROOT_SELECT_EDF_STARVATION_START;
+		}
+		return SCHED_CLUTCH_ROOT_SELECT_EDF;
+	}
+
+	/*
+	 * There is a root bucket which is higher in the natural priority order
+	 * than the EDF bucket and might have some warp remaining.
+	 */
+	if (warped_deadline == SCHED_CLUTCH_ROOT_BUCKET_WARP_UNUSED) {
+		return SCHED_CLUTCH_ROOT_SELECT_WARP_START;
+	}
+	if (warped_deadline > timestamp) {
+		return SCHED_CLUTCH_ROOT_SELECT_WARP;
+	}
+	return SCHED_CLUTCH_ROOT_SELECT_WARP_EXPIRED;
+}
+
+/*
+ * Clutch bucket group interactivity
+ */
+
+/*
+ * sched_clutch_policy_interactivity_score()
+ *
+ * Interactivity score in [0:interactive_pri * 2] of a clutch bucket group
+ * which has used cpu_used and been blocked for cpu_blocked; at least one of
+ * them must be non-zero.
+ */
+static inline uint8_t
+sched_clutch_policy_interactivity_score(
+	uint64_t cpu_used,
+	uint64_t cpu_blocked,
+	uint8_t interactive_pri)
+{
+	if (cpu_blocked > cpu_used) {
+		/* Interactive clutch_bucket case */
+		return (uint8_t)(interactive_pri + ((interactive_pri * (cpu_blocked - cpu_used)) / cpu_blocked));
+	}
+	/* Non-interactive clutch_bucket case */
+	return (uint8_t)((interactive_pri * cpu_blocked) / cpu_used);
+}
+
+/*
+ * sched_clutch_policy_pending_ageout()
+ *
+ * Number of "pending intervals" a clutch bucket group pending since
+ * pending_ts has waited by timestamp, given the pending delta of its bucket
+ * and the number of runnable clutch buckets at that bucket. Moves pending_ts
+ * forward by the intervals accounted for.
+ */
+static inline uint8_t
+sched_clutch_policy_pending_ageout(
+	uint64_t *pending_ts,
+	uint64_t timestamp,
+	uint64_t pending_delta,
+	uint32_t bucket_load)
+{
+	uint64_t old_pending_ts = *pending_ts;
+	if ((old_pending_ts >= timestamp) || (old_pending_ts == SCHED_CLUTCH_BUCKET_GROUP_PENDING_INVALID) || (bucket_load == 0)) {
+		return 0;
+	}
+
+	/* Calculate the time the clutch bucket group has been pending */
+	uint64_t delta = timestamp - old_pending_ts;
+	uint64_t interactivity_delta = pending_delta * bucket_load;
+	if (delta < interactivity_delta) {
+		return 0;
+	}
+	uint8_t cpu_usage_shift = (uint8_t)(delta / interactivity_delta);
+	*pending_ts = old_pending_ts + (cpu_usage_shift * interactivity_delta);
+	return cpu_usage_shift;
+}
+
+/*
+ * sched_clutch_policy_cpu_pending_adjust()
+ *
+ * Adjusted CPU usage value based on the pending intervals. The calculation is
+ * done such that one "pending interval" provides one point improvement in
+ * interactivity score.
+ */
+static inline uint64_t
+sched_clutch_policy_cpu_pending_adjust(
+	uint64_t cpu_used,
+	uint64_t cpu_blocked,
+	uint8_t pending_intervals,
+	uint8_t interactive_pri)
+{
+	uint64_t cpu_used_adjusted = 0;
+	if (cpu_blocked == 0) {
+		/*
+		 * A group that has not blocked in the recent history (its blocked time
+		 * decays to 0 once scaled down often enough) keeps no CPU usage; this is
+		 * what the division below yields on arm64, but 0/0 traps on x86.
+		 */
+		return 0;
+	}
+	if (cpu_blocked < cpu_used) {
+		cpu_used_adjusted = (interactive_pri * cpu_blocked * cpu_used);
+		cpu_used_adjusted = cpu_used_adjusted / ((interactive_pri * cpu_blocked) + (cpu_used * pending_intervals));
+	} else {
+		uint64_t adjust_factor = (cpu_blocked * pending_intervals) / interactive_pri;
+		cpu_used_adjusted = (adjust_factor > cpu_used) ? 0 : (cpu_used - adjust_factor);
+	}
+	return cpu_used_adjusted;
+}
+
+/*
+ * sched_clutch_policy_cpu_adjust()
+ *
+ * Scale the cpu usage and blocked time once their sum gets bigger than
+ * adjust_threshold, and age out the CPU usage by pending_intervals. Returns
+ * false if neither value needs to change.
+ */
+static inline bool
+sched_clutch_policy_cpu_adjust(
+	uint64_t *cpu_used,
+	uint64_t *cpu_blocked,
+	uint8_t pending_intervals,
+	uint64_t adjust_threshold,
+	uint8_t interactive_pri)
+{
+	uint64_t used = *cpu_used;
+	uint64_t blocked = *cpu_blocked;
+
+	if ((pending_intervals == 0) && (used + blocked) < adjust_threshold) {
+		/* No changes to the CPU used and blocked values */
+		return false;
+	}
+	if ((used + blocked) >= adjust_threshold) {
+		/* Only keep the recent CPU history to better indicate how this TG has been behaving */
+		used = used / SCHED_CLUTCH_BUCKET_GROUP_ADJUST_RATIO;
+		blocked = blocked / SCHED_CLUTCH_BUCKET_GROUP_ADJUST_RATIO;
+	}
+	/* Use the shift passed in to ageout the CPU usage */
+	*cpu_used = sched_clutch_policy_cpu_pending_adjust(used, blocked, pending_intervals, interactive_pri);
+	*cpu_blocked = blocked;
+	return true;
+}
+
+/*
+ * Edge migration
+ */
+
+typedef enum {
+	/* The candidate cluster is not a better choice */
+	SCHED_EDGE_MIGRATE_SKIP,
+	/* The candidate cluster is the best choice so far; keep looking */
+	SCHED_EDGE_MIGRATE_CANDIDATE,
+	/* The candidate cluster is idle; select it immediately */
+	SCHED_EDGE_MIGRATE_IDLE,
+} sched_edge_migrate_t;
+
+/*
+ * sched_edge_policy_migration_check()
+ *
+ * Evaluate migrating a thread from its preferred cluster, with load
+ * preferred_load, to a cluster with load dst_load across an edge that allows
+ * migration with migration_weight. max_edge_delta is the load delta of the
+ * best candidate so far; it is updated when a better candidate is found.
+ * selected_homogeneous/candidate_homogeneous tell whether the best candidate
+ * so far and this candidate have the same type as the preferred cluster, and
+ * break ties in favor of homogeneous clusters.
+ */
+static inline sched_edge_migrate_t
+sched_edge_policy_migration_check(
+	uint32_t preferred_load,
+	uint32_t dst_load,
+	uint32_t migration_weight,
+	bool shared_rsrc_thread,
+	bool selected_homogeneous,
+	bool candidate_homogeneous,
+	uint32_t *max_edge_delta)
+{
+	if (dst_load == 0) {
+		/* The candidate cluster is idle; select it immediately for execution */
+		*max_edge_delta = preferred_load;
+		return SCHED_EDGE_MIGRATE_IDLE;
+	}
+
+	if (dst_load > preferred_load) {
+		return SCHED_EDGE_MIGRATE_SKIP;
+	}
+	uint32_t edge_delta = preferred_load - dst_load;
+	if (!shared_rsrc_thread && (edge_delta < migration_weight)) {
+		/*
+		 * For non shared resource threads, use the edge migration weight to decide if
+		 * this cluster is over-committed at the QoS level of this thread.
+		 */
+		return SCHED_EDGE_MIGRATE_SKIP;
+	}
+
+	if (edge_delta < *max_edge_delta) {
+		return SCHED_EDGE_MIGRATE_SKIP;
+	}
+	if (edge_delta == *max_edge_delta) {
+		/* If the edge delta is the same as the max delta, make sure a homogeneous cluster is picked */
+		if (selected_homogeneous || !candidate_homogeneous) {
+			return SCHED_EDGE_MIGRATE_SKIP;
+		}
+	}
+	*max_edge_delta = edge_delta;
+	return SCHED_EDGE_MIGRATE_CANDIDATE;
+}
+
+#endif /* _KERN_SCHED_CLUTCH_POLICY_H_ */
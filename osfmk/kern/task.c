@@ -426,6 +426,9 @@ extern int exit_with_port_space_exception(void *proc, mach_exception_code_t code
 // Warn tasks when they hit 80% of their memory limit.
 #define PHYS_FOOTPRINT_WARNING_LEVEL 80
 
+// Per-cpu batch for the hottest memory ledger entries, see init_task_ledgers().
+#define TASK_LEDGER_PERCPU_BATCH (128 * 1024)
+
 #define TASK_WAKEUPS_MONITOR_DEFAULT_LIMIT              150 /* wakeups per second */
 #define TASK_WAKEUPS_MONITOR_DEFAULT_INTERVAL   300 /* in seconds. */
 
@@ -1404,6 +1407,16 @@ init_task_ledgers(void)
 	ledger_track_maximum(t, task_ledgers.internal_compressed, 60);
 	ledger_track_maximum(t, task_ledgers.reusable, 60);
 	ledger_track_maximum(t, task_ledgers.external, 60);
+
+	/*
+	 * Every fault and wiring change of every thread in a task lands on
+	 * these: batch them per-cpu, a few pages at a time, so threads of
+	 * the same task don't all serialize on the shared entries.
+	 */
+	ledger_entry_batch_percpu(t, task_ledgers.phys_footprint, TASK_LEDGER_PERCPU_BATCH);
+	ledger_entry_batch_percpu(t, task_ledgers.phys_mem, TASK_LEDGER_PERCPU_BATCH);
+	ledger_entry_batch_percpu(t, task_ledgers.internal, TASK_LEDGER_PERCPU_BATCH);
+	ledger_entry_batch_percpu(t, task_ledgers.wired_mem, TASK_LEDGER_PERCPU_BATCH);
 #if MACH_ASSERT
 	if (pmap_ledgers_panic) {
 		ledger_panic_on_negative(t, task_ledgers.phys_footprint);
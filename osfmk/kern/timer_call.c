@@ -123,6 +123,27 @@ SCALABLE_COUNTER_DEFINE(timer_scan_pauses_cnt);
  */
 SCALABLE_COUNTER_DEFINE(timer_scan_postpones_cnt);
 
+/*
+ * Timers with enough leeway can be kept on a per-queue hierarchical timing
+ * wheel instead of the priority queue, which makes arming and cancelling
+ * them O(1) and expires everything due in a tick as one batch.  The wheel
+ * is on by default in server performance mode and can be turned on or off
+ * with the "timer_wheel" boot-arg.  A timer only goes on the wheel if its
+ * leeway is at least a tick, so that the start of the tick of its hard
+ * deadline, where its slot expires, is never before its soft deadline.
+ * Rate-limited timers, whose soft deadline does not count, stay on the
+ * priority queue.
+ */
+#define TIMER_WHEEL_TICK_NS     (256ULL * NSEC_PER_USEC)        /* 256 us */
+#define TIMER_WHEEL_DEADLINE_MAX (UINT64_MAX >> 1)
+extern int serverperfmode;
+static boolean_t timer_wheel_enabled = FALSE;
+static uint32_t timer_wheel_tick_shift;
+
+/* Count of timers queued on, and expired from, a timer wheel. */
+SCALABLE_COUNTER_DEFINE(timer_wheel_enqueues_cnt);
+SCALABLE_COUNTER_DEFINE(timer_wheel_expires_cnt);
+
 #define MAX_TIMER_SCAN_LIMIT    (30000ULL * NSEC_PER_USEC)  /* 30 ms */
 #define MIN_TIMER_SCAN_LIMIT    (   50ULL * NSEC_PER_USEC)  /* 50 us */
 #define MAX_TIMER_SCAN_INTERVAL ( 2000ULL * NSEC_PER_USEC)  /*  2 ms */
@@ -257,14 +278,38 @@ timer_call_init_abstime(void)
 
 	nanoseconds_to_absolutetime(timer_scan_limit_us * NSEC_PER_USEC, &timer_scan_limit_abs);
 	nanoseconds_to_absolutetime(timer_scan_interval_us * NSEC_PER_USEC, &timer_scan_interval_abs);
+
+	/* round the wheel tick down to a power of two */
+	nanoseconds_to_absolutetime(TIMER_WHEEL_TICK_NS, &result);
+	timer_wheel_tick_shift = 63 - __builtin_clzll(result | 1);
 }
 
+static void
+timer_wheel_init(struct mpqueue_wheel *wheel)
+{
+	for (int l = 0; l < MPQ_WHEEL_LEVELS; l++) {
+		for (int i = 0; i < MPQ_WHEEL_SLOTS; i++) {
+			queue_init(&wheel->mpw_slots[l][i]);
+		}
+		wheel->mpw_bitmap[l] = 0;
+	}
+	queue_init(&wheel->mpw_overflow);
+	wheel->mpw_tick = 0;
+	wheel->mpw_count = 0;
+}
 
 void
 timer_call_init(void)
 {
+	uint32_t wheel;
+
 	timer_longterm_init();
 	timer_call_init_abstime();
+
+	timer_wheel_enabled = serverperfmode ? TRUE : FALSE;
+	if (PE_parse_boot_argn("timer_wheel", &wheel, sizeof(wheel))) {
+		timer_wheel_enabled = (wheel != 0);
+	}
 }
 
 
@@ -273,6 +318,7 @@ timer_call_queue_init(mpqueue_head_t *queue)
 {
 	DBG("timer_call_queue_init(%p)\n", queue);
 	mpqueue_init(queue, &timer_call_lck_grp, LCK_ATTR_NULL);
+	timer_wheel_init(&queue->mpq_wheel);
 }
 
 
@@ -288,6 +334,7 @@ timer_call_setup(
 		.tc_func = func,
 		.tc_param0 = param0,
 		.tc_async_dequeue = false,
+		.tc_on_wheel = false,
 	};
 
 	simple_lock_init(&(call)->tc_lock, 0);
@@ -320,6 +367,241 @@ mpqueue_for_timer_call(timer_call_t entry)
 	return __container_of(queue_entry_is_on, struct mpqueue_head, head);
 }
 
+/*
+ * Timer wheel
+ * ===========
+ *
+ * A timer on the wheel sits in the slot covering the tick of its hard
+ * deadline.  A slot of level l is only used while the wheel's current tick
+ * is in the same level l + 1 period as the timer, which guarantees that
+ * the slot is cascaded down to a finer level before it is due.  Once the
+ * wheel reaches a level 0 slot, every timer in it is due.
+ *
+ * Like the priority queue, the wheel is protected by the queue lock.
+ */
+static inline queue_t
+timer_wheel_slot(struct mpqueue_wheel *wheel, uint8_t level, uint8_t slot)
+{
+	if (level == MPQ_WHEEL_LEVELS) {
+		return &wheel->mpw_overflow;
+	}
+	return &wheel->mpw_slots[level][slot];
+}
+
+static inline boolean_t
+timer_wheel_eligible(timer_call_t call, uint64_t deadline)
+{
+	return timer_wheel_enabled &&
+	       (call->tc_flags & TIMER_CALL_RATELIMITED) == 0 &&
+	       deadline <= TIMER_WHEEL_DEADLINE_MAX &&
+	       deadline >= call->tc_soft_deadline &&
+	       (deadline - call->tc_soft_deadline) >> timer_wheel_tick_shift != 0;
+}
+
+static void
+timer_wheel_place(struct mpqueue_wheel *wheel, timer_call_t call, uint64_t tick)
+{
+	uint8_t level, slot = 0;
+
+	/* timers already due expire with the current slot */
+	if (tick < wheel->mpw_tick) {
+		tick = wheel->mpw_tick;
+	}
+	for (level = 0; level < MPQ_WHEEL_LEVELS; level++) {
+		uint32_t shift = MPQ_WHEEL_SLOTS_SHIFT * (level + 1);
+		if ((tick >> shift) == (wheel->mpw_tick >> shift)) {
+			break;
+		}
+	}
+	if (level < MPQ_WHEEL_LEVELS) {
+		slot = (tick >> (MPQ_WHEEL_SLOTS_SHIFT * level)) & (MPQ_WHEEL_SLOTS - 1);
+		wheel->mpw_bitmap[level] |= (1U << slot);
+	}
+	call->tc_wheel_level = level;
+	call->tc_wheel_slot = slot;
+	enqueue_tail(timer_wheel_slot(wheel, level, slot), &call->tc_wlink);
+}
+
+static void
+timer_wheel_insert(struct mpqueue_wheel *wheel, timer_call_t call, uint64_t deadline)
+{
+	if (wheel->mpw_count++ == 0) {
+		/* an empty wheel is not advanced, catch it up with the time */
+		wheel->mpw_tick = mach_absolute_time() >> timer_wheel_tick_shift;
+	}
+	call->tc_on_wheel = true;
+	timer_wheel_place(wheel, call, deadline >> timer_wheel_tick_shift);
+	counter_inc(&timer_wheel_enqueues_cnt);
+}
+
+static void
+timer_wheel_remove(struct mpqueue_wheel *wheel, timer_call_t call)
+{
+	uint8_t level = call->tc_wheel_level;
+	uint8_t slot = call->tc_wheel_slot;
+
+	assert(call->tc_on_wheel);
+	remqueue(&call->tc_wlink);
+	if (level < MPQ_WHEEL_LEVELS && queue_empty(&wheel->mpw_slots[level][slot])) {
+		wheel->mpw_bitmap[level] &= ~(1U << slot);
+	}
+	call->tc_on_wheel = false;
+	wheel->mpw_count--;
+}
+
+/*
+ * Re-place the timers of a slot, now that the wheel has entered the period
+ * the slot covers.  They all land on a finer level.
+ */
+static void
+timer_wheel_cascade(struct mpqueue_wheel *wheel, uint8_t level, uint8_t slot)
+{
+	queue_head_t    tmp;
+	timer_call_t    call;
+
+	if (level < MPQ_WHEEL_LEVELS) {
+		if ((wheel->mpw_bitmap[level] & (1U << slot)) == 0) {
+			return;
+		}
+		wheel->mpw_bitmap[level] &= ~(1U << slot);
+	}
+	movqueue(timer_wheel_slot(wheel, level, slot), &tmp);
+	while ((call = qe_dequeue_head(&tmp, struct timer_call, tc_wlink)) != NULL) {
+		timer_wheel_place(wheel, call,
+		    call->tc_pqlink.deadline >> timer_wheel_tick_shift);
+	}
+}
+
+/*
+ * The first tick after tick at which the wheel has work to do: the next
+ * occupied level 0 slot, or the start of the period of the next occupied
+ * slot of a coarser level, or else the next top level period for the
+ * overflow list.
+ */
+static uint64_t
+timer_wheel_next_tick(struct mpqueue_wheel *wheel, uint64_t tick)
+{
+	uint32_t shift, cur, bits;
+
+	for (uint8_t l = 0; l < MPQ_WHEEL_LEVELS; l++) {
+		shift = MPQ_WHEEL_SLOTS_SHIFT * l;
+		cur = (tick >> shift) & (MPQ_WHEEL_SLOTS - 1);
+		bits = wheel->mpw_bitmap[l] & ~((2U << cur) - 1);
+		if (bits != 0) {
+			return ((tick >> (shift + MPQ_WHEEL_SLOTS_SHIFT)) <<
+			       (shift + MPQ_WHEEL_SLOTS_SHIFT)) +
+			       ((uint64_t)__builtin_ctz(bits) << shift);
+		}
+	}
+	if (queue_empty(&wheel->mpw_overflow)) {
+		return UINT64_MAX;
+	}
+	shift = MPQ_WHEEL_SLOTS_SHIFT * MPQ_WHEEL_LEVELS;
+	return ((tick >> shift) + 1) << shift;
+}
+
+/*
+ * Deadline at which the wheel next has work to do, which is either
+ * expiring a level 0 slot or cascading a coarser one.
+ */
+static uint64_t
+timer_wheel_next_deadline(struct mpqueue_wheel *wheel)
+{
+	uint64_t tick = wheel->mpw_tick;
+
+	if (wheel->mpw_count == 0) {
+		return UINT64_MAX;
+	}
+	if (queue_empty(&wheel->mpw_slots[0][tick & (MPQ_WHEEL_SLOTS - 1)])) {
+		tick = timer_wheel_next_tick(wheel, tick);
+		if (tick == UINT64_MAX) {
+			return UINT64_MAX;
+		}
+	}
+	return tick << timer_wheel_tick_shift;
+}
+
+/*
+ * Bring the wheel up to now, cascading the coarser slots it enters on the
+ * way, and return the first timer of the current level 0 slot if any.
+ * Empty slots are skipped, so the cost is bounded by the number of occupied
+ * slots crossed rather than by the number of ticks.  The wheel does not
+ * move past a slot until all of its timers are expired or cancelled.
+ */
+static timer_call_t
+timer_wheel_first_due(struct mpqueue_wheel *wheel, uint64_t now)
+{
+	uint64_t now_tick = now >> timer_wheel_tick_shift;
+	uint64_t tick;
+	queue_t slot;
+
+	if (wheel->mpw_count == 0) {
+		wheel->mpw_tick = MAX(wheel->mpw_tick, now_tick);
+		return NULL;
+	}
+
+	for (;;) {
+		tick = wheel->mpw_tick;
+		slot = &wheel->mpw_slots[0][tick & (MPQ_WHEEL_SLOTS - 1)];
+		if (!queue_empty(slot)) {
+			return qe_queue_first(slot, struct timer_call, tc_wlink);
+		}
+		if (tick >= now_tick) {
+			return NULL;
+		}
+
+		tick = MIN(timer_wheel_next_tick(wheel, tick), now_tick);
+		wheel->mpw_tick = tick;
+		for (uint8_t l = MPQ_WHEEL_LEVELS; l > 0; l--) {
+			uint32_t shift = MPQ_WHEEL_SLOTS_SHIFT * l;
+			if ((tick & ((1ULL << shift) - 1)) == 0) {
+				timer_wheel_cascade(wheel, l, l == MPQ_WHEEL_LEVELS ? 0 :
+				    (tick >> shift) & (MPQ_WHEEL_SLOTS - 1));
+			}
+		}
+	}
+}
+
+/*
+ * Next deadline of a queue, over both the priority queue and the wheel.
+ * Also returns the earliest soft deadline, for the opportunistic expiry of
+ * coalesced timers, if requested.
+ */
+static uint64_t
+timer_queue_next_deadline(mpqueue_head_t *queue, uint64_t *soft_deadline)
+{
+	timer_call_t    head;
+	uint64_t        deadline, soft;
+
+	head = priority_queue_min(&queue->mpq_pqhead, struct timer_call, tc_pqlink);
+	deadline = soft = timer_wheel_next_deadline(&queue->mpq_wheel);
+	if (head) {
+		deadline = MIN(deadline, head->tc_pqlink.deadline);
+		soft = MIN(soft, head->tc_flags & TIMER_CALL_RATELIMITED ?
+		    head->tc_pqlink.deadline : head->tc_soft_deadline);
+	}
+	if (soft_deadline) {
+		*soft_deadline = soft;
+	}
+	return deadline;
+}
+
+/*
+ * Take an entry off the priority queue or the wheel of its queue, leaving
+ * it on the queue's list.
+ */
+static __inline__ void
+timer_call_entry_unlink(
+	timer_call_t            entry,
+	mpqueue_head_t          *mpqueue)
+{
+	if (entry->tc_on_wheel) {
+		timer_wheel_remove(&mpqueue->mpq_wheel, entry);
+	} else if (mpqueue != timer_longterm_queue) {
+		priority_queue_remove(&mpqueue->mpq_pqhead, &entry->tc_pqlink);
+	}
+}
+
 
 static __inline__ mpqueue_head_t *
 timer_call_entry_dequeue(
@@ -347,10 +629,7 @@ timer_call_entry_dequeue(
 	}
 #endif /* TIMER_ASSERT */
 
-	if (old_mpqueue != timer_longterm_queue) {
-		priority_queue_remove(&old_mpqueue->mpq_pqhead,
-		    &entry->tc_pqlink);
-	}
+	timer_call_entry_unlink(entry, old_mpqueue);
 
 	remqueue(&entry->tc_qlink);
 
@@ -391,7 +670,9 @@ timer_call_entry_enqueue_deadline(
 	assert(new_mpqueue != timer_longterm_queue);
 	assert(old_mpqueue != timer_longterm_queue);
 
-	if (old_mpqueue == new_mpqueue) {
+	boolean_t on_wheel = timer_wheel_eligible(entry, deadline);
+
+	if (old_mpqueue == new_mpqueue && !entry->tc_on_wheel && !on_wheel) {
 		/* optimize the same-queue case to avoid a full re-insert */
 		uint64_t old_deadline = entry->tc_pqlink.deadline;
 		entry->tc_pqlink.deadline = deadline;
@@ -405,8 +686,7 @@ timer_call_entry_enqueue_deadline(
 		}
 	} else {
 		if (old_mpqueue != NULL) {
-			priority_queue_remove(&old_mpqueue->mpq_pqhead,
-			    &entry->tc_pqlink);
+			timer_call_entry_unlink(entry, old_mpqueue);
 
 			re_queue_tail(&new_mpqueue->head, &entry->tc_qlink);
 		} else {
@@ -416,7 +696,11 @@ timer_call_entry_enqueue_deadline(
 		entry->tc_queue = &new_mpqueue->head;
 		entry->tc_pqlink.deadline = deadline;
 
-		priority_queue_insert(&new_mpqueue->mpq_pqhead, &entry->tc_pqlink);
+		if (on_wheel) {
+			timer_wheel_insert(&new_mpqueue->mpq_wheel, entry, deadline);
+		} else {
+			priority_queue_insert(&new_mpqueue->mpq_pqhead, &entry->tc_pqlink);
+		}
 	}
 
 
@@ -424,9 +708,7 @@ timer_call_entry_enqueue_deadline(
 	 * so that fuzzy decisions can be made without lock acquisitions.
 	 */
 
-	timer_call_t thead = priority_queue_min(&new_mpqueue->mpq_pqhead, struct timer_call, tc_pqlink);
-
-	new_mpqueue->earliest_soft_deadline = thead->tc_flags & TIMER_CALL_RATELIMITED ? thead->tc_pqlink.deadline : thead->tc_soft_deadline;
+	(void)timer_queue_next_deadline(new_mpqueue, &new_mpqueue->earliest_soft_deadline);
 
 	if (old_mpqueue) {
 		old_mpqueue->count--;
@@ -470,10 +752,7 @@ timer_call_entry_dequeue_async(
 	if (old_mpqueue) {
 		old_mpqueue->count--;
 
-		if (old_mpqueue != timer_longterm_queue) {
-			priority_queue_remove(&old_mpqueue->mpq_pqhead,
-			    &entry->tc_pqlink);
-		}
+		timer_call_entry_unlink(entry, old_mpqueue);
 
 		remqueue(&entry->tc_qlink);
 		entry->tc_async_dequeue = true;
@@ -794,15 +1073,10 @@ timer_call_cancel(
 	if (old_queue != NULL) {
 		timer_queue_lock_spin(old_queue);
 
-		timer_call_t new_head = priority_queue_min(&old_queue->mpq_pqhead, struct timer_call, tc_pqlink);
+		uint64_t new_deadline = timer_queue_next_deadline(old_queue,
+		    &old_queue->earliest_soft_deadline);
 
-		if (new_head) {
-			timer_queue_cancel(old_queue, call->tc_pqlink.deadline, new_head->tc_pqlink.deadline);
-			old_queue->earliest_soft_deadline = new_head->tc_flags & TIMER_CALL_RATELIMITED ? new_head->tc_pqlink.deadline : new_head->tc_soft_deadline;
-		} else {
-			timer_queue_cancel(old_queue, call->tc_pqlink.deadline, UINT64_MAX);
-			old_queue->earliest_soft_deadline = UINT64_MAX;
-		}
+		timer_queue_cancel(old_queue, call->tc_pqlink.deadline, new_deadline);
 
 		timer_queue_unlock(old_queue);
 	}
@@ -954,7 +1228,15 @@ timer_queue_expire_with_options(
 
 		if (call == NULL) {
 			if (rescan == FALSE) {
-				call = priority_queue_min(&queue->mpq_pqhead, struct timer_call, tc_pqlink);
+				/* whatever the wheel has due goes first, as a batch */
+				call = timer_wheel_first_due(&queue->mpq_wheel, cur_deadline);
+				if (call == NULL) {
+					call = priority_queue_min(&queue->mpq_pqhead, struct timer_call, tc_pqlink);
+				}
+				if (call == NULL) {
+					/* only wheel timers that aren't due yet are left */
+					break;
+				}
 			} else {
 				call = qe_queue_first(&queue->head, struct timer_call, tc_qlink);
 			}
@@ -987,6 +1269,9 @@ timer_queue_expire_with_options(
 				continue;
 			}
 
+			if (call->tc_on_wheel) {
+				counter_inc(&timer_wheel_expires_cnt);
+			}
 			timer_call_entry_dequeue(call);
 
 			func = call->tc_func;
@@ -1067,28 +1352,29 @@ timer_queue_expire_with_options(
 	}
 
 	call = priority_queue_min(&queue->mpq_pqhead, struct timer_call, tc_pqlink);
+	uint64_t next_deadline = timer_queue_next_deadline(queue,
+	    &queue->earliest_soft_deadline);
 
-	if (call) {
+	if (next_deadline != UINT64_MAX) {
 		/*
 		 * Even if the time limit has been hit, it doesn't mean a hard
 		 * deadline will be missed - the next hard deadline may be in
 		 * future.
 		 */
-		if (time_limit_deadline > call->tc_pqlink.deadline) {
+		if (time_limit_deadline > next_deadline) {
 			TIMER_KDEBUG_TRACE(KDEBUG_TRACE,
 			    DECR_TIMER_POSTPONE | DBG_FUNC_NONE,
 			    VM_KERNEL_UNSLIDE_OR_PERM(call),
-			    call->tc_pqlink.deadline,
+			    next_deadline,
 			    time_limit_deadline,
 			    0, 0);
 			counter_inc(&timer_scan_postpones_cnt);
 			cur_deadline = time_limit_deadline;
 		} else {
-			cur_deadline = call->tc_pqlink.deadline;
+			cur_deadline = next_deadline;
 		}
-		queue->earliest_soft_deadline = (call->tc_flags & TIMER_CALL_RATELIMITED) ? call->tc_pqlink.deadline: call->tc_soft_deadline;
 	} else {
-		queue->earliest_soft_deadline = cur_deadline = UINT64_MAX;
+		cur_deadline = UINT64_MAX;
 	}
 
 	timer_queue_unlock(queue);
@@ -1104,7 +1390,6 @@ timer_queue_expire(
 	return timer_queue_expire_with_options(queue, deadline, FALSE);
 }
 
-extern int serverperfmode;
 static uint32_t timer_queue_migrate_lock_skips;
 /*
  * timer_queue_migrate() is called by timer_queue_migrate_cpu()
@@ -1115,7 +1400,6 @@ int
 timer_queue_migrate(mpqueue_head_t *queue_from, mpqueue_head_t *queue_to)
 {
 	timer_call_t    call;
-	timer_call_t    head_to;
 	int             timers_migrated = 0;
 
 	DBG("timer_queue_migrate(%p,%p)\n", queue_from, queue_to);
@@ -1147,23 +1431,20 @@ timer_queue_migrate(mpqueue_head_t *queue_from, mpqueue_head_t *queue_to)
 
 	timer_queue_lock_spin(queue_to);
 
-	head_to = priority_queue_min(&queue_to->mpq_pqhead, struct timer_call, tc_pqlink);
-
-	if (head_to == NULL) {
+	if (queue_empty(&queue_to->head)) {
 		timers_migrated = -1;
 		goto abort1;
 	}
 
 	timer_queue_lock_spin(queue_from);
 
-	call = priority_queue_min(&queue_from->mpq_pqhead, struct timer_call, tc_pqlink);
-
-	if (call == NULL) {
+	if (queue_empty(&queue_from->head)) {
 		timers_migrated = -2;
 		goto abort2;
 	}
 
-	if (call->tc_pqlink.deadline < head_to->tc_pqlink.deadline) {
+	if (timer_queue_next_deadline(queue_from, NULL) <
+	    timer_queue_next_deadline(queue_to, NULL)) {
 		timers_migrated = 0;
 		goto abort2;
 	}
@@ -1589,6 +1870,7 @@ timer_longterm_init(void)
 	tlp->threshold.deadline = TIMER_LONGTERM_NONE;
 
 	mpqueue_init(&tlp->queue, &timer_longterm_lck_grp, LCK_ATTR_NULL);
+	timer_wheel_init(&tlp->queue.mpq_wheel);
 
 	timer_call_setup(&tlp->threshold.timer,
 	    timer_longterm_callout, (timer_call_param_t) tlp);
@@ -1602,6 +1884,7 @@ enum {
 	LATENCY, LATENCY_MIN, LATENCY_MAX, LONG_TERM_SCAN_LIMIT,
 	LONG_TERM_SCAN_INTERVAL, LONG_TERM_SCAN_PAUSES,
 	SCAN_LIMIT, SCAN_INTERVAL, SCAN_PAUSES, SCAN_POSTPONES,
+	WHEEL_ENQUEUES, WHEEL_EXPIRES,
 };
 uint64_t
 timer_sysctl_get(int oid)
@@ -1644,6 +1927,10 @@ timer_sysctl_get(int oid)
 		return counter_load(&timer_scan_pauses_cnt);
 	case SCAN_POSTPONES:
 		return counter_load(&timer_scan_postpones_cnt);
+	case WHEEL_ENQUEUES:
+		return counter_load(&timer_wheel_enqueues_cnt);
+	case WHEEL_EXPIRES:
+		return counter_load(&timer_wheel_expires_cnt);
 
 	default:
 		return 0;
@@ -2176,3 +2463,168 @@ running_timers_deactivate(processor_t processor)
 	processor->running_timers_active = false;
 	running_timers_sync();
 }
+
+#if DEVELOPMENT || DEBUG
+
+/*
+ * Arm, cancel and expire timers on a private queue's timer wheel, with
+ * deadlines spread over every level and the overflow list so that their
+ * slots have to be cascaded down before they expire.
+ */
+
+#define TIMER_WHEEL_TEST_CALLS  7
+
+struct timer_wheel_test {
+	mpqueue_head_t          twt_queue;
+	timer_call_data_t       twt_calls[TIMER_WHEEL_TEST_CALLS];
+	uint64_t                twt_soft[TIMER_WHEEL_TEST_CALLS];
+	uint64_t                twt_hard[TIMER_WHEEL_TEST_CALLS];
+	uint64_t                twt_fired_at[TIMER_WHEEL_TEST_CALLS];
+	uint64_t                twt_now;
+	uint32_t                twt_fired;
+};
+
+static void
+timer_wheel_test_func(timer_call_param_t p0, timer_call_param_t p1)
+{
+	struct timer_wheel_test *twt = p0;
+	uintptr_t i = (uintptr_t)p1;
+
+	assert(twt->twt_fired_at[i] == 0);
+	twt->twt_fired_at[i] = twt->twt_now;
+	twt->twt_fired++;
+}
+
+/* Expire everything due at @now, returns the queue's next deadline */
+static uint64_t
+timer_wheel_test_expire(struct timer_wheel_test *twt, uint64_t now)
+{
+	uint64_t deadline;
+	uint32_t fired;
+	spl_t s;
+
+	twt->twt_now = now;
+	/* the scan looks at the real time after each callout, repeat until quiet */
+	do {
+		fired = twt->twt_fired;
+		s = splclock();
+		deadline = timer_queue_expire_with_options(&twt->twt_queue, now, FALSE);
+		splx(s);
+	} while (twt->twt_fired != fired);
+
+	return deadline;
+}
+
+static int
+timer_wheel_basic_test(__unused int64_t in, int64_t *out)
+{
+	/* soft deadlines in ticks from now, each leeway is two ticks */
+	static const uint64_t ticks[TIMER_WHEEL_TEST_CALLS] = {
+		3,                      /* level 0 */
+		40,                     /* level 1, cancelled */
+		45,                     /* level 1 */
+		1500,                   /* level 2 */
+		40000,                  /* level 3 or overflow */
+		(1ULL << 20) + 7,       /* overflow */
+		10,                     /* no leeway, on the priority queue */
+	};
+	struct timer_wheel_test *twt;
+	boolean_t wheel_enabled = timer_wheel_enabled;
+	uint64_t tick = 1ULL << timer_wheel_tick_shift;
+	uint64_t base, deadline, pending;
+	spl_t s;
+
+	twt = kalloc_type(struct timer_wheel_test, Z_WAITOK | Z_ZERO | Z_NOFAIL);
+	timer_call_queue_init(&twt->twt_queue);
+
+	/* each timer remembers where it went, so flipping this is safe */
+	timer_wheel_enabled = TRUE;
+
+	base = mach_absolute_time();
+	for (uintptr_t i = 0; i < TIMER_WHEEL_TEST_CALLS; i++) {
+		timer_call_setup(&twt->twt_calls[i], timer_wheel_test_func, twt);
+		twt->twt_soft[i] = base + ticks[i] * tick;
+		twt->twt_hard[i] = twt->twt_soft[i] + (i == 6 ? 0 : 2 * tick);
+
+		s = splclock();
+		timer_call_enqueue_deadline_unlocked(&twt->twt_calls[i], &twt->twt_queue,
+		    twt->twt_hard[i], twt->twt_soft[i], 0, (timer_call_param_t)i, 0);
+		splx(s);
+	}
+
+	timer_wheel_enabled = wheel_enabled;
+
+	for (int i = 0; i < TIMER_WHEEL_TEST_CALLS; i++) {
+		assert(twt->twt_calls[i].tc_on_wheel == (i != 6));
+	}
+	assert(twt->twt_calls[1].tc_wheel_level >= 1);
+	assert(twt->twt_calls[3].tc_wheel_level >= 2);
+	assert(twt->twt_calls[4].tc_wheel_level >= 3);
+	assert(twt->twt_calls[5].tc_wheel_level == MPQ_WHEEL_LEVELS);
+	assert(twt->twt_queue.mpq_wheel.mpw_count == 6);
+
+	/* cancel */
+	s = splclock();
+	assert(timer_call_dequeue_unlocked(&twt->twt_calls[1]) == &twt->twt_queue);
+	splx(s);
+	assert(!twt->twt_calls[1].tc_on_wheel);
+	assert(twt->twt_queue.mpq_wheel.mpw_count == 5);
+
+	/*
+	 * Step through every soft and hard deadline: a timer must not fire
+	 * before its soft deadline, and must have fired by its hard one.
+	 * The next deadline of the queue must never be past a pending hard
+	 * deadline, including when only timers on the wheel are left.
+	 */
+	for (int step = 0; step < TIMER_WHEEL_TEST_CALLS; step++) {
+		uint64_t now = UINT64_MAX;
+
+		for (int i = 0; i < TIMER_WHEEL_TEST_CALLS; i++) {
+			if (i != 1 && twt->twt_fired_at[i] == 0) {
+				now = MIN(now, twt->twt_soft[i] - 1);
+			}
+		}
+		if (now == UINT64_MAX) {
+			break;
+		}
+
+		for (int pass = 0; pass < 2; pass++) {
+			deadline = timer_wheel_test_expire(twt, now);
+
+			pending = UINT64_MAX;
+			for (int i = 0; i < TIMER_WHEEL_TEST_CALLS; i++) {
+				if (i == 1) {
+					continue;
+				}
+				if (twt->twt_fired_at[i] != 0) {
+					assert(twt->twt_fired_at[i] >= twt->twt_soft[i]);
+				} else {
+					assert(now < twt->twt_hard[i]);
+					pending = MIN(pending, twt->twt_hard[i]);
+				}
+			}
+			assert(deadline <= pending);
+			assert(pending == UINT64_MAX || deadline != UINT64_MAX);
+
+			/* then jump to the earliest pending hard deadline */
+			now = pending;
+			if (now == UINT64_MAX) {
+				break;
+			}
+		}
+	}
+
+	assert(twt->twt_fired == TIMER_WHEEL_TEST_CALLS - 1);
+	assert(twt->twt_fired_at[1] == 0);
+	assert(twt->twt_queue.mpq_wheel.mpw_count == 0);
+	assert(queue_empty(&twt->twt_queue.head));
+
+	lck_ticket_destroy(&twt->twt_queue.lock_data, &timer_call_lck_grp);
+	kfree_type(struct timer_wheel_test, twt);
+
+	*out = 1;
+	return 0;
+}
+SYSCTL_TEST_REGISTER(timer_wheel_basic, timer_wheel_basic_test);
+
+#endif /* DEVELOPMENT || DEBUG */
@@ -75,6 +75,7 @@ typedef struct timer_call {
 	struct priority_queue_entry_deadline    tc_pqlink;
 	queue_head_t                            *tc_queue;
 	queue_chain_t                           tc_qlink;
+	queue_chain_t                           tc_wlink; /* timer wheel slot */
 	timer_call_func_t                       tc_func;
 	timer_call_param_t                      tc_param0;
 	timer_call_param_t                      tc_param1;
@@ -83,8 +84,11 @@ typedef struct timer_call {
 	uint64_t                                tc_entry_time;
 #endif
 	uint32_t                                tc_flags;
-	/* this field is locked by the lock in the object tc_queue points at */
+	/* these fields are locked by the lock in the object tc_queue points at */
 	bool                                    tc_async_dequeue;
+	bool                                    tc_on_wheel;
+	uint8_t                                 tc_wheel_level;
+	uint8_t                                 tc_wheel_slot;
 } timer_call_data_t, *timer_call_t;
 
 #define EndOfAllTime            0xFFFFFFFFFFFFFFFFULL
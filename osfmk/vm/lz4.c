@@ -69,6 +69,10 @@ lz4raw_decode_buffer(uint8_t * __restrict dst_buffer, size_t dst_size,
 
 #if !LZ4_ENABLE_ASSEMBLY_ENCODE
 
+#if LZ4_ENABLE_ASSEMBLY_ENCODE_SIMD_X86_64
+int lz4_encode_simd = 0;
+#endif
+
 #if defined(__x86_64__) || defined(__x86_64h__)
 # define LZ4_MATCH_SEARCH_INIT_SIZE 32
 # define LZ4_MATCH_SEARCH_LOOP_SIZE 32
@@ -175,6 +179,12 @@ __attribute__((overloadable))
 static inline uint8_t *
 copy_literal(uint8_t *dst, const uint8_t * restrict src, uint32_t L)
 {
+#if LZ4_ENABLE_ASSEMBLY_ENCODE_SIMD_X86_64
+	// Short literals are cheaper inline than through a call
+	if (lz4_encode_simd && L > 32) {
+		return lz4_copy_literal_simd(dst, src, L);
+	}
+#endif
 	uint8_t *end = dst + L;
 	{ copy16(dst, src); dst += 16; src += 16; }
 	while (dst < end) {
@@ -359,6 +369,14 @@ EXPAND_FORWARD:
 		// Expand match forward
 		{
 			const uint8_t * ref_end = match_end - match_distance;
+#if LZ4_ENABLE_ASSEMBLY_ENCODE_SIMD_X86_64
+			if (lz4_encode_simd) {
+				if (match_end < src_end) {
+					match_end += lz4_nmatch_simd(ref_end, match_end, (size_t)(src_end - match_end));
+				}
+				goto EXPAND_BACKWARD;
+			}
+#endif
 			while (match_end < src_end) {
 				size_t n = lz4_nmatch(LZ4_MATCH_SEARCH_LOOP_SIZE, ref_end, match_end);
 				if (n < LZ4_MATCH_SEARCH_LOOP_SIZE) {
@@ -369,6 +387,10 @@ EXPAND_FORWARD:
 			}
 		}
 
+#if LZ4_ENABLE_ASSEMBLY_ENCODE_SIMD_X86_64
+EXPAND_BACKWARD:
+#endif
+
 		// Expand match backward
 		{
 			// match_begin_min = max(src_begin + match_distance,literal)
@@ -68,6 +68,14 @@ extern int lz4_decode_asm(uint8_t **dst_ptr, uint8_t *dst_begin, uint8_t *dst_en
     const uint8_t **src_ptr, const uint8_t *src_end);
 #endif
 
+#if LZ4_ENABLE_ASSEMBLY_ENCODE_SIMD_X86_64
+// Vector match length and literal copy helpers for the C encoder, used when
+// lz4_encode_simd is set (see vm_compressor_algorithm_init()).
+extern int lz4_encode_simd;
+extern size_t lz4_nmatch_simd(const uint8_t *a, const uint8_t *b, size_t max);
+extern uint8_t *lz4_copy_literal_simd(uint8_t *dst, const uint8_t *src, uint32_t L);
+#endif
+
 #pragma mark - Buffer interfaces
 
 static const size_t lz4_encode_scratch_size = lz4_hash_table_size;
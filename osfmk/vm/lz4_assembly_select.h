@@ -40,6 +40,7 @@
 #define LZ4_ENABLE_ASSEMBLY_DECODE_ARMV7 1
 #elif defined __x86_64__
 #define LZ4_ENABLE_ASSEMBLY_DECODE_X86_64 1
+#define LZ4_ENABLE_ASSEMBLY_ENCODE_SIMD_X86_64 1
 #endif
 
 //  To disable C
@@ -4630,6 +4630,132 @@ c_compressed_record_data(char *src, int c_size)
 #endif
 
 
+/*
+ * Compress the page at src into dst, which has room for max_csize bytes.
+ * Returns the compressed size, 0 for a single value page, or -1 if the
+ * page did not compress into the budget.
+ */
+static inline int
+c_compress_buffer(const char *src, char *dst, int max_csize, uint16_t *codec,
+    boolean_t *incomp_copy, char *scratch_buf)
+{
+	int c_size = -1;
+	int max_csize_adj = (max_csize - 4);
+
+	*codec = CCWK;
+
+	if (vm_compressor_algorithm() != VM_COMPRESSOR_DEFAULT_CODEC) {
+#if defined(__arm64__)
+		uint16_t ccodec = CINVALID;
+		uint32_t inline_popcount;
+		if (max_csize >= C_SEG_OFFSET_ALIGNMENT_BOUNDARY) {
+			c_size = metacompressor((const uint8_t *) src,
+			    (uint8_t *) dst,
+			    max_csize_adj, &ccodec,
+			    scratch_buf, incomp_copy, &inline_popcount);
+			assert(inline_popcount == C_SLOT_NO_POPCOUNT);
+
+#if C_SEG_OFFSET_ALIGNMENT_BOUNDARY > 4
+			if (c_size > max_csize_adj) {
+				c_size = -1;
+			}
+#endif
+		} else {
+			c_size = -1;
+		}
+		assert(ccodec == CCWK || ccodec == CCLZ4);
+		*codec = ccodec;
+#endif
+	} else {
+#if defined(__arm64__)
+		__unreachable_ok_push
+		if (PAGE_SIZE == 4096) {
+			c_size = WKdm_compress_4k((WK_word *)(uintptr_t)src, (WK_word *)(uintptr_t)dst,
+			    (WK_word *)(uintptr_t)scratch_buf, max_csize_adj);
+		} else {
+			c_size = WKdm_compress_16k((WK_word *)(uintptr_t)src, (WK_word *)(uintptr_t)dst,
+			    (WK_word *)(uintptr_t)scratch_buf, max_csize_adj);
+		}
+		__unreachable_ok_pop
+#else
+		c_size = WKdm_compress_new((const WK_word *)(uintptr_t)src, (WK_word *)(uintptr_t)dst,
+		    (WK_word *)(uintptr_t)scratch_buf, max_csize_adj);
+#endif
+	}
+	assertf(((c_size <= max_csize_adj) && (c_size >= -1)),
+	    "c_size invalid (%d, %d), cur compressions: %d", c_size, max_csize_adj, c_segment_pages_compressed);
+
+	return c_size;
+}
+
+/*
+ * Finish filling in a slot whose c_size bytes of data have been stored at
+ * cs->c_offset, advance the segment past it and point slot_ptr at it.
+ * Called with the c_seg lock held; returns the rounded size consumed.
+ */
+static inline int
+c_slot_commit(c_segment_t c_seg, c_slot_t cs, c_slot_mapping_t slot_ptr, int c_size)
+{
+	int c_rounded_size;
+
+#if RECORD_THE_COMPRESSED_DATA
+	c_compressed_record_data((char *)&c_seg->c_store.c_buffer[cs->c_offset], c_size);
+#endif
+#if CHECKSUM_THE_COMPRESSED_DATA
+	cs->c_hash_compressed_data = vmc_hash((char *)&c_seg->c_store.c_buffer[cs->c_offset], c_size);
+#endif
+#if POPCOUNT_THE_COMPRESSED_DATA
+	cs->c_pop_cdata = vmc_pop((uintptr_t) &c_seg->c_store.c_buffer[cs->c_offset], c_size);
+#endif
+	c_rounded_size = (c_size + C_SEG_OFFSET_ALIGNMENT_MASK) & ~C_SEG_OFFSET_ALIGNMENT_MASK;
+
+	PACK_C_SIZE(cs, c_size);
+	c_seg->c_bytes_used += c_rounded_size;
+	c_seg->c_nextoffset += C_SEG_BYTES_TO_OFFSET(c_rounded_size);
+	c_seg->c_slots_used++;
+
+#if CONFIG_FREEZE
+	/* TODO: should c_segment_pages_compressed be up here too? See 88598046 for details */
+	OSAddAtomic(1, &c_segment_pages_compressed_incore);
+	if (c_seg->c_has_donated_pages) {
+		OSAddAtomic(1, &c_segment_pages_compressed_incore_late_swapout);
+	}
+#endif /* CONFIG_FREEZE */
+
+	slot_ptr->s_cindx = c_seg->c_nextslot++;
+	/* <csegno=0,indx=0> would mean "empty slot", so use csegno+1 */
+	slot_ptr->s_cseg = c_seg->c_mysegno + 1;
+
+#if CONFIG_TRACK_UNMODIFIED_ANON_PAGES
+	slot_ptr->s_uncompressed = 0;
+#endif /* CONFIG_TRACK_UNMODIFIED_ANON_PAGES */
+
+	return c_rounded_size;
+}
+
+static inline void
+c_compress_page_account(int c_size, int c_rounded_size)
+{
+	if (c_size) {
+		OSAddAtomic64(c_size, &c_segment_compressed_bytes);
+		OSAddAtomic64(c_rounded_size, &compressor_bytes_used);
+	}
+	OSAddAtomic64(PAGE_SIZE, &c_segment_input_bytes);
+
+	OSAddAtomic(1, &c_segment_pages_compressed);
+#if DEVELOPMENT || DEBUG
+	if (!compressor_running_perf_test) {
+		/*
+		 * The perf_compressor benchmark should not be able to trigger
+		 * compressor thrashing jetsams.
+		 */
+		OSAddAtomic(1, &sample_period_compression_count);
+	}
+#else /* DEVELOPMENT || DEBUG */
+	OSAddAtomic(1, &sample_period_compression_count);
+#endif /* DEVELOPMENT || DEBUG */
+}
+
 static int
 c_compress_page(char *src, c_slot_mapping_t slot_ptr, c_segment_t *current_chead, char *scratch_buf)
 {
@@ -4670,49 +4796,13 @@ retry:
 	cs->c_hash_data = vmc_hash(src, PAGE_SIZE);
 #endif
 	boolean_t incomp_copy = FALSE;
-	int max_csize_adj = (max_csize - 4);
+	__unused uint16_t ccodec;
 
-	if (vm_compressor_algorithm() != VM_COMPRESSOR_DEFAULT_CODEC) {
-#if defined(__arm64__)
-		uint16_t ccodec = CINVALID;
-		uint32_t inline_popcount;
-		if (max_csize >= C_SEG_OFFSET_ALIGNMENT_BOUNDARY) {
-			c_size = metacompressor((const uint8_t *) src,
-			    (uint8_t *) &c_seg->c_store.c_buffer[cs->c_offset],
-			    max_csize_adj, &ccodec,
-			    scratch_buf, &incomp_copy, &inline_popcount);
-			assert(inline_popcount == C_SLOT_NO_POPCOUNT);
-
-#if C_SEG_OFFSET_ALIGNMENT_BOUNDARY > 4
-			if (c_size > max_csize_adj) {
-				c_size = -1;
-			}
-#endif
-		} else {
-			c_size = -1;
-		}
-		assert(ccodec == CCWK || ccodec == CCLZ4);
-		cs->c_codec = ccodec;
-#endif
-	} else {
-#if defined(__arm64__)
-		cs->c_codec = CCWK;
-		__unreachable_ok_push
-		if (PAGE_SIZE == 4096) {
-			c_size = WKdm_compress_4k((WK_word *)(uintptr_t)src, (WK_word *)(uintptr_t)&c_seg->c_store.c_buffer[cs->c_offset],
-			    (WK_word *)(uintptr_t)scratch_buf, max_csize_adj);
-		} else {
-			c_size = WKdm_compress_16k((WK_word *)(uintptr_t)src, (WK_word *)(uintptr_t)&c_seg->c_store.c_buffer[cs->c_offset],
-			    (WK_word *)(uintptr_t)scratch_buf, max_csize_adj);
-		}
-		__unreachable_ok_pop
-#else
-		c_size = WKdm_compress_new((const WK_word *)(uintptr_t)src, (WK_word *)(uintptr_t)&c_seg->c_store.c_buffer[cs->c_offset],
-		    (WK_word *)(uintptr_t)scratch_buf, max_csize_adj);
+	c_size = c_compress_buffer(src, (char *)&c_seg->c_store.c_buffer[cs->c_offset],
+	    max_csize, &ccodec, &incomp_copy, scratch_buf);
+#if C_SLOT_C_CODEC_BITS
+	cs->c_codec = ccodec;
 #endif
-	}
-	assertf(((c_size <= max_csize_adj) && (c_size >= -1)),
-	    "c_size invalid (%d, %d), cur compressions: %d", c_size, max_csize_adj, c_segment_pages_compressed);
 
 	if (c_size == -1) {
 		if (max_csize < PAGE_SIZE) {
@@ -4763,47 +4853,313 @@ retry:
 		OSAddAtomic(1, &c_segment_svp_hash_failed);
 	}
 
+	c_rounded_size = c_slot_commit(c_seg, cs, slot_ptr, c_size);
+
+sv_compression:
+	if (c_seg->c_nextoffset >= c_seg_off_limit || c_seg->c_nextslot >= C_SLOT_MAX_INDEX) {
+		c_current_seg_filled(c_seg, current_chead);
+		assert(*current_chead == NULL);
+	}
+
+	lck_mtx_unlock_always(&c_seg->c_lock);
+
+	PAGE_REPLACEMENT_DISALLOWED(FALSE);
+
 #if RECORD_THE_COMPRESSED_DATA
-	c_compressed_record_data((char *)&c_seg->c_store.c_buffer[cs->c_offset], c_size);
+	if ((c_compressed_record_cptr - c_compressed_record_sbuf) >= c_seg_allocsize) {
+		c_compressed_record_write(c_compressed_record_sbuf, (int)(c_compressed_record_cptr - c_compressed_record_sbuf));
+		c_compressed_record_cptr = c_compressed_record_sbuf;
+	}
 #endif
-#if CHECKSUM_THE_COMPRESSED_DATA
-	cs->c_hash_compressed_data = vmc_hash((char *)&c_seg->c_store.c_buffer[cs->c_offset], c_size);
+	c_compress_page_account(c_size, c_rounded_size);
+
+	KERNEL_DEBUG(0xe0400000 | DBG_FUNC_END, *current_chead, c_size, c_segment_input_bytes, c_segment_compressed_bytes, 0);
+
+	return 0;
+}
+
+/*
+ * Batched compression
+ *
+ * vm_compressor_put_batch() compresses up to C_BATCH_MAX_PAGES pages bound
+ * for the same segment in two phases:
+ *
+ * - every page is first compressed into a private staging area, without
+ *   holding any segment lock. When vm_compressor_batch_helpers is non zero,
+ *   the batch is split into chunks and all but the first are handed to
+ *   thread calls, so the pages are compressed concurrently on other cores
+ *   while the calling compressor thread works on its own chunk;
+ *
+ * - the results are then copied into the filling segment, reserving as many
+ *   slots as fit in one hold of the c_seg lock instead of one lock round
+ *   trip (and one c_seg_allocate()) per page.
+ *
+ * The compressor threads store the pages they take off the internal
+ * pageout queue this way, through vm_pageout_compress_pages().
+ */
+#define C_BATCH_MAX_PAGES       VM_COMPRESSOR_BATCH_MAX_PAGES
+#define C_BATCH_MAX_HELPERS     3
+
+TUNABLE(uint32_t, vm_compressor_batch_helpers, "vm_compressor_batch_helpers", 0);
+
+struct c_batch_entry {
+	char                   *cbe_src;
+	c_slot_mapping_t        cbe_slot;
+	int                     cbe_size;       /* -1: incompressible, 0: single value */
+	uint16_t                cbe_codec;
+	boolean_t               cbe_incomp_copy;
+#if CHECKSUM_THE_DATA
+	unsigned int            cbe_hash_data;
 #endif
-#if POPCOUNT_THE_COMPRESSED_DATA
-	cs->c_pop_cdata = vmc_pop((uintptr_t) &c_seg->c_store.c_buffer[cs->c_offset], c_size);
+};
+
+struct c_batch {
+	uint32_t                cb_count;
+	uint32_t                cb_chunk;       /* entries per chunk */
+	uint32_t                cb_nhelpers;
+	uint32_t _Atomic        cb_pending;     /* chunks still compressing */
+	thread_call_t           cb_calls[C_BATCH_MAX_HELPERS];
+	char                   *cb_scratch[C_BATCH_MAX_HELPERS];
+	char                   *cb_staging;
+	struct c_batch_entry    cb_entries[C_BATCH_MAX_PAGES];
+};
+
+#define C_BATCH_STAGING(batch, i)       (&(batch)->cb_staging[(i) * PAGE_SIZE])
+
+static void
+c_batch_compress_range(c_batch_t batch, uint32_t first, uint32_t count, char *scratch_buf)
+{
+	for (uint32_t i = first; i < first + count && i < batch->cb_count; i++) {
+		struct c_batch_entry *cbe = &batch->cb_entries[i];
+
+#if CHECKSUM_THE_DATA
+		cbe->cbe_hash_data = vmc_hash(cbe->cbe_src, PAGE_SIZE);
 #endif
-	c_rounded_size = (c_size + C_SEG_OFFSET_ALIGNMENT_MASK) & ~C_SEG_OFFSET_ALIGNMENT_MASK;
+		cbe->cbe_incomp_copy = FALSE;
+		cbe->cbe_size = c_compress_buffer(cbe->cbe_src, C_BATCH_STAGING(batch, i),
+		    PAGE_SIZE, &cbe->cbe_codec, &cbe->cbe_incomp_copy, scratch_buf);
+	}
+}
 
-	PACK_C_SIZE(cs, c_size);
-	c_seg->c_bytes_used += c_rounded_size;
-	c_seg->c_nextoffset += C_SEG_BYTES_TO_OFFSET(c_rounded_size);
-	c_seg->c_slots_used++;
+static void
+c_batch_helper(thread_call_param_t p0, thread_call_param_t p1)
+{
+	c_batch_t batch = p0;
+	uint32_t  chunk = (uint32_t)(uintptr_t)p1;
 
-#if CONFIG_FREEZE
-	/* TODO: should c_segment_pages_compressed be up here too? See 88598046 for details */
-	OSAddAtomic(1, &c_segment_pages_compressed_incore);
-	if (c_seg->c_has_donated_pages) {
-		OSAddAtomic(1, &c_segment_pages_compressed_incore_late_swapout);
+	c_batch_compress_range(batch, chunk * batch->cb_chunk, batch->cb_chunk,
+	    batch->cb_scratch[chunk - 1]);
+
+	if (os_atomic_dec(&batch->cb_pending, release) == 0) {
+		thread_wakeup(&batch->cb_pending);
 	}
-#endif /* CONFIG_FREEZE */
+}
 
-	slot_ptr->s_cindx = c_seg->c_nextslot++;
-	/* <csegno=0,indx=0> would mean "empty slot", so use csegno+1 */
-	slot_ptr->s_cseg = c_seg->c_mysegno + 1;
+static c_batch_t
+c_batch_create(uint32_t nhelpers)
+{
+	c_batch_t batch;
+
+	nhelpers = MIN(nhelpers, C_BATCH_MAX_HELPERS);
+	batch = kalloc_type(struct c_batch, Z_WAITOK | Z_ZERO | Z_NOFAIL);
+	batch->cb_staging = kalloc_data(C_BATCH_MAX_PAGES * PAGE_SIZE, Z_WAITOK | Z_NOFAIL);
+
+	for (uint32_t i = 0; i < nhelpers; i++) {
+		batch->cb_scratch[i] = kalloc_data(vm_compressor_get_encode_scratch_size(),
+		    Z_WAITOK | Z_NOFAIL);
+		batch->cb_calls[i] = thread_call_allocate_with_options(c_batch_helper,
+		    batch, THREAD_CALL_PRIORITY_KERNEL_HIGH, THREAD_CALL_OPTIONS_ONCE);
+	}
+	batch->cb_nhelpers = nhelpers;
+
+	return batch;
+}
+
+c_batch_t
+vm_compressor_batch_create(void)
+{
+	return c_batch_create(vm_compressor_batch_helpers);
+}
 
+void
+vm_compressor_batch_destroy(c_batch_t batch)
+{
+	for (uint32_t i = 0; i < batch->cb_nhelpers; i++) {
+		thread_call_cancel_wait(batch->cb_calls[i]);
+		thread_call_free(batch->cb_calls[i]);
+		kfree_data(batch->cb_scratch[i], vm_compressor_get_encode_scratch_size());
+	}
+	kfree_data(batch->cb_staging, C_BATCH_MAX_PAGES * PAGE_SIZE);
+	kfree_type(struct c_batch, batch);
+}
+
+static void
+c_batch_compress(c_batch_t batch, char *scratch_buf)
+{
+	uint32_t nchunks = MIN(batch->cb_nhelpers + 1, batch->cb_count);
+
+	if (nchunks <= 1) {
+		batch->cb_chunk = batch->cb_count;
+		c_batch_compress_range(batch, 0, batch->cb_count, scratch_buf);
+		return;
+	}
+
+	batch->cb_chunk = (batch->cb_count + nchunks - 1) / nchunks;
+	nchunks = (batch->cb_count + batch->cb_chunk - 1) / batch->cb_chunk;
+	os_atomic_store(&batch->cb_pending, nchunks, relaxed);
+
+	for (uint32_t chunk = 1; chunk < nchunks; chunk++) {
+		thread_call_enter1(batch->cb_calls[chunk - 1], (thread_call_param_t)(uintptr_t)chunk);
+	}
+	c_batch_compress_range(batch, 0, batch->cb_chunk, scratch_buf);
+
+	if (os_atomic_dec(&batch->cb_pending, acq_rel) != 0) {
+		assert_wait(&batch->cb_pending, THREAD_UNINT);
+		if (os_atomic_load(&batch->cb_pending, acquire) != 0) {
+			thread_block(THREAD_CONTINUE_NULL);
+		} else {
+			clear_wait(current_thread(), THREAD_AWAKENED);
+		}
+	}
+	assert(os_atomic_load(&batch->cb_pending, acquire) == 0);
+}
+
+/*
+ * Returns true if the entry was recorded in the single value hash and
+ * needs no space in a segment.
+ */
+static bool
+c_batch_commit_sv(struct c_batch_entry *cbe)
+{
+	int hash_index;
+
+	hash_index = c_segment_sv_hash_insert(*(uint32_t *)(uintptr_t)cbe->cbe_src);
+	if (hash_index == -1) {
+		return false;
+	}
+
+	cbe->cbe_slot->s_cindx = hash_index;
+	cbe->cbe_slot->s_cseg = C_SV_CSEG_ID;
 #if CONFIG_TRACK_UNMODIFIED_ANON_PAGES
-	slot_ptr->s_uncompressed = 0;
+	cbe->cbe_slot->s_uncompressed = 0;
 #endif /* CONFIG_TRACK_UNMODIFIED_ANON_PAGES */
 
-sv_compression:
-	if (c_seg->c_nextoffset >= c_seg_off_limit || c_seg->c_nextslot >= C_SLOT_MAX_INDEX) {
-		c_current_seg_filled(c_seg, current_chead);
-		assert(*current_chead == NULL);
-	}
+	OSAddAtomic(1, &c_segment_svp_hash_succeeded);
+#if RECORD_THE_COMPRESSED_DATA
+	c_compressed_record_data(cbe->cbe_src, 4);
+#endif
+	c_compress_page_account(0, 0);
+	return true;
+}
 
-	lck_mtx_unlock_always(&c_seg->c_lock);
+/*
+ * Copy the staged results into the filling segment(s). Returns the number
+ * of entries committed, which is short of the batch only if no segment
+ * could be allocated.
+ */
+static uint32_t
+c_batch_commit(c_batch_t batch, c_segment_t *current_chead)
+{
+	uint32_t i = 0;
 
-	PAGE_REPLACEMENT_DISALLOWED(FALSE);
+	while (i < batch->cb_count) {
+		struct c_batch_entry *cbe = &batch->cb_entries[i];
+		c_segment_t           c_seg;
+
+		if (cbe->cbe_size == 0 && c_batch_commit_sv(cbe)) {
+			i++;
+			continue;
+		}
+
+		if ((c_seg = c_seg_allocate(current_chead)) == NULL) {
+			break;
+		}
+		/*
+		 * returns with c_seg lock held
+		 * and PAGE_REPLACEMENT_DISALLOWED(TRUE)...
+		 * c_nextslot has been allocated and at least
+		 * a page worth of c_store.c_buffer populated
+		 */
+		assert(c_seg->c_state == C_IS_FILLING);
+
+		while (i < batch->cb_count) {
+			const char *data;
+			c_slot_t    cs;
+			int         c_size, c_rounded_size;
+			uint32_t    space;
+
+			cbe = &batch->cb_entries[i];
+
+			if (cbe->cbe_size == -1) {
+				c_size = PAGE_SIZE;
+				data = cbe->cbe_incomp_copy ? C_BATCH_STAGING(batch, i) : cbe->cbe_src;
+			} else if (cbe->cbe_size == 0) {
+				if (c_batch_commit_sv(cbe)) {
+					i++;
+					continue;
+				}
+				c_size = 4;
+				data = cbe->cbe_src;
+			} else {
+				c_size = cbe->cbe_size;
+				data = C_BATCH_STAGING(batch, i);
+			}
+			c_rounded_size = (c_size + C_SEG_OFFSET_ALIGNMENT_MASK) & ~C_SEG_OFFSET_ALIGNMENT_MASK;
+
+			space = c_seg_bufsize - C_SEG_OFFSET_TO_BYTES(c_seg->c_nextoffset);
+			if ((uint32_t)c_rounded_size > space) {
+				/* doesn't fit: retire this segment and move to a new one */
+				c_current_seg_filled(c_seg, current_chead);
+				assert(*current_chead == NULL);
+				break;
+			}
+			/*
+			 * Further slots can only be taken without dropping the lock
+			 * while the slot array and the populated part of the buffer
+			 * have room; otherwise go back through c_seg_allocate().
+			 */
+			if (c_seg->c_nextslot >= c_seg_fixed_array_len &&
+			    (c_seg->c_nextslot - c_seg_fixed_array_len) >= c_seg->c_slot_var_array_len) {
+				break;
+			}
+			if (C_SEG_OFFSET_TO_BYTES(c_seg->c_populated_offset - c_seg->c_nextoffset) < (uint32_t)c_rounded_size) {
+				break;
+			}
+
+			cs = C_SEG_SLOT_FROM_INDEX(c_seg, c_seg->c_nextslot);
+
+			C_SLOT_ASSERT_PACKABLE(cbe->cbe_slot);
+			cs->c_packed_ptr = C_SLOT_PACK_PTR(cbe->cbe_slot);
+			cs->c_offset = c_seg->c_nextoffset;
+#if C_SLOT_C_CODEC_BITS
+			cs->c_codec = cbe->cbe_codec;
+#endif
+#if CHECKSUM_THE_DATA
+			cs->c_hash_data = cbe->cbe_hash_data;
+#endif
+			memcpy(&c_seg->c_store.c_buffer[cs->c_offset], data, c_size);
+
+			if (cbe->cbe_size == -1) {
+				OSAddAtomic(1, &c_segment_noncompressible_pages);
+			} else if (cbe->cbe_size == 0) {
+				OSAddAtomic(1, &c_segment_svp_hash_failed);
+			}
+
+			c_rounded_size = c_slot_commit(c_seg, cs, cbe->cbe_slot, c_size);
+			c_compress_page_account(c_size, c_rounded_size);
+			i++;
+
+			if (c_seg->c_nextoffset >= c_seg_off_limit || c_seg->c_nextslot >= C_SLOT_MAX_INDEX) {
+				c_current_seg_filled(c_seg, current_chead);
+				assert(*current_chead == NULL);
+				break;
+			}
+		}
+
+		lck_mtx_unlock_always(&c_seg->c_lock);
+
+		PAGE_REPLACEMENT_DISALLOWED(FALSE);
+	}
 
 #if RECORD_THE_COMPRESSED_DATA
 	if ((c_compressed_record_cptr - c_compressed_record_sbuf) >= c_seg_allocsize) {
@@ -4811,29 +5167,181 @@ sv_compression:
 		c_compressed_record_cptr = c_compressed_record_sbuf;
 	}
 #endif
-	if (c_size) {
-		OSAddAtomic64(c_size, &c_segment_compressed_bytes);
-		OSAddAtomic64(c_rounded_size, &compressor_bytes_used);
+	return i;
+}
+
+/*
+ * Compress `count` (at most C_BATCH_MAX_PAGES) modified pages into the
+ * segment headed by *current_chead, recording each page's location in the
+ * matching slot. Returns the number of pages committed, counting from the
+ * start of the arrays; the remainder (if any) were not stored because the
+ * compressor ran out of segments, as vm_compressor_put() would report.
+ */
+int
+vm_compressor_put_batch(c_batch_t batch, ppnum_t *pns, int **slots, int count,
+    void **current_chead, char *scratch_buf)
+{
+	uint32_t committed;
+
+	assert(count > 0 && count <= C_BATCH_MAX_PAGES);
+
+	KERNEL_DEBUG(0xe0400000 | DBG_FUNC_START, *current_chead, count, 0, 0, 0);
+
+	batch->cb_count = (uint32_t)count;
+	for (int i = 0; i < count; i++) {
+		batch->cb_entries[i].cbe_src = pmap_map_compressor_page(pns[i]);
+		batch->cb_entries[i].cbe_slot = (c_slot_mapping_t)slots[i];
+		assert(batch->cb_entries[i].cbe_src != NULL);
 	}
-	OSAddAtomic64(PAGE_SIZE, &c_segment_input_bytes);
 
-	OSAddAtomic(1, &c_segment_pages_compressed);
+	c_batch_compress(batch, scratch_buf);
+	committed = c_batch_commit(batch, (c_segment_t *)current_chead);
+
+	for (int i = 0; i < count; i++) {
+		pmap_unmap_compressor_page(pns[i], batch->cb_entries[i].cbe_src);
+	}
+
+	KERNEL_DEBUG(0xe0400000 | DBG_FUNC_END, *current_chead, committed, c_segment_input_bytes, c_segment_compressed_bytes, 0);
+
+	return (int)committed;
+}
+
 #if DEVELOPMENT || DEBUG
-	if (!compressor_running_perf_test) {
-		/*
-		 * The perf_compressor benchmark should not be able to trigger
-		 * compressor thrashing jetsams.
-		 */
-		OSAddAtomic(1, &sample_period_compression_count);
+/*
+ * Fill page i of a batch: single value, compressible, incompressible
+ * or zero, in turn.
+ */
+static void
+c_batch_test_fill(char *dst, uint32_t i)
+{
+	uint32_t *words = (uint32_t *)(uintptr_t)dst;
+	uint32_t x = 0x9e3779b9 * (i + 1);
+
+	for (uint32_t j = 0; j < PAGE_SIZE / sizeof(uint32_t); j++) {
+		switch (i % 4) {
+		case 0:
+			words[j] = 0x5a5a0000 | i;
+			break;
+		case 1:
+			words[j] = (j % 64) | (i << 16);
+			break;
+		case 2:
+			x ^= x << 13;
+			x ^= x >> 17;
+			x ^= x << 5;
+			words[j] = x;
+			break;
+		default:
+			words[j] = 0;
+			break;
+		}
 	}
-#else /* DEVELOPMENT || DEBUG */
-	OSAddAtomic(1, &sample_period_compression_count);
-#endif /* DEVELOPMENT || DEBUG */
+}
 
-	KERNEL_DEBUG(0xe0400000 | DBG_FUNC_END, *current_chead, c_size, c_segment_input_bytes, c_segment_compressed_bytes, 0);
+/*
+ * Store a full batch with vm_compressor_put_batch() and read every page
+ * back with vm_compressor_get(), once compressing on the calling thread
+ * only and once with helper thread calls.
+ */
+static int
+c_batch_test_run(uint32_t nhelpers, char *scratch_buf, char *expected)
+{
+	vm_page_t       page_list = VM_PAGE_NULL, m;
+	ppnum_t         pns[C_BATCH_MAX_PAGES];
+	int             *slots[C_BATCH_MAX_PAGES];
+	int             *slot_array;
+	c_segment_t     chead = NULL, c_seg;
+	c_batch_t       batch;
+	char            *dst;
+	int             committed, error = 0;
+
+	slot_array = kalloc_data(C_BATCH_MAX_PAGES * sizeof(int), Z_WAITOK | Z_ZERO | Z_NOFAIL);
+	for (uint32_t i = 0; i < C_BATCH_MAX_PAGES; i++) {
+		while ((m = vm_page_grab()) == VM_PAGE_NULL) {
+			VM_PAGE_WAIT();
+		}
+		m->vmp_snext = page_list;
+		page_list = m;
+		pns[i] = VM_PAGE_GET_PHYS_PAGE(m);
+		slots[i] = &slot_array[i];
+
+		dst = pmap_map_compressor_page(pns[i]);
+		c_batch_test_fill(dst, i);
+		memcpy(&expected[i * PAGE_SIZE], dst, PAGE_SIZE);
+		pmap_unmap_compressor_page(pns[i], dst);
+	}
+
+	batch = c_batch_create(nhelpers);
+	committed = vm_compressor_put_batch(batch, pns, slots, C_BATCH_MAX_PAGES,
+	    (void **)&chead, scratch_buf);
+	vm_compressor_batch_destroy(batch);
+
+	/* close the segment we were filling, as the freezer does */
+	if ((c_seg = chead) != NULL) {
+		lck_mtx_lock_spin_always(&c_seg->c_lock);
+		c_current_seg_filled(c_seg, &chead);
+		lck_mtx_unlock_always(&c_seg->c_lock);
+	}
 
-	return 0;
+	if (committed != C_BATCH_MAX_PAGES) {
+		printf("%s: only %d of %d pages stored\n", __func__,
+		    committed, C_BATCH_MAX_PAGES);
+		error = ENOSPC;
+	}
+
+	for (int i = 0; i < committed; i++) {
+		dst = pmap_map_compressor_page(pns[i]);
+		memset(dst, 0xff, PAGE_SIZE);
+		pmap_unmap_compressor_page(pns[i], dst);
+
+		if (vm_compressor_get(pns[i], slots[i], 0) < 0 || *slots[i] != 0) {
+			printf("%s: page %d could not be decompressed\n", __func__, i);
+			error = EIO;
+			continue;
+		}
+
+		dst = pmap_map_compressor_page(pns[i]);
+		if (memcmp(dst, &expected[i * PAGE_SIZE], PAGE_SIZE) != 0) {
+			printf("%s: page %d came back different\n", __func__, i);
+			error = EILSEQ;
+		}
+		pmap_unmap_compressor_page(pns[i], dst);
+	}
+
+	vm_page_free_list(page_list, FALSE);
+	kfree_data(slot_array, C_BATCH_MAX_PAGES * sizeof(int));
+
+	return error;
+}
+
+static int
+vm_compressor_batch_test(__unused int64_t in, int64_t *out)
+{
+	char    *scratch_buf, *expected;
+	int     error;
+
+	if (!VM_CONFIG_COMPRESSOR_IS_ACTIVE) {
+		return ENOTSUP;
+	}
+
+	scratch_buf = kalloc_data(vm_compressor_get_encode_scratch_size(), Z_WAITOK | Z_NOFAIL);
+	expected = kalloc_data(C_BATCH_MAX_PAGES * PAGE_SIZE, Z_WAITOK | Z_NOFAIL);
+
+	error = c_batch_test_run(0, scratch_buf, expected);
+	if (error == 0) {
+		error = c_batch_test_run(C_BATCH_MAX_HELPERS, scratch_buf, expected);
+	}
+
+	kfree_data(expected, C_BATCH_MAX_PAGES * PAGE_SIZE);
+	kfree_data(scratch_buf, vm_compressor_get_encode_scratch_size());
+
+	if (error == 0) {
+		*out = 1;
+	}
+	return error;
 }
+SYSCTL_TEST_REGISTER(vm_compressor_batch, vm_compressor_batch_test);
+#endif /* DEVELOPMENT || DEBUG */
 
 static inline void
 sv_decompress(int32_t *ddst, int32_t pattern)
@@ -472,4 +472,15 @@ vm_compressor_algorithm_init(void)
 
 	vm_compressor_current_codec = new_codec;
 #endif /* arm/arm64 */
+
+#if LZ4_ENABLE_ASSEMBLY_ENCODE_SIMD_X86_64
+	/*
+	 * SSE2 is architectural on x86_64, so the vector match length and
+	 * literal copy helpers are always usable by the C LZ4 encoder;
+	 * vm_compressor_lz4_simd=0 selects the scalar loops instead.
+	 */
+	uint32_t lz4_simd = 1;
+	PE_parse_boot_argn("vm_compressor_lz4_simd", &lz4_simd, sizeof(lz4_simd));
+	lz4_encode_simd = (lz4_simd != 0);
+#endif /* LZ4_ENABLE_ASSEMBLY_ENCODE_SIMD_X86_64 */
 }
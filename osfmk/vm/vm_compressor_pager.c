@@ -805,6 +805,67 @@ vm_compressor_pager_put(
 	return KERN_SUCCESS;
 }
 
+/*
+ * vm_compressor_pager_put() for up to VM_COMPRESSOR_BATCH_MAX_PAGES modified
+ * pages bound for the same segment, compressed with vm_compressor_put_batch().
+ * Returns the number of pages stored, counting from the start of the arrays.
+ */
+int
+vm_compressor_pager_put_batch(
+	struct c_batch                  *batch,
+	memory_object_t                 *mem_objs,
+	memory_object_offset_t          *offsets,
+	ppnum_t                         *ppnums,
+	int                             count,
+	void                            **current_chead,
+	char                            *scratch_buf,
+	int                             *compressed_count_deltas)
+{
+	compressor_pager_t      pager;
+	compressor_slot_t       *slots[VM_COMPRESSOR_BATCH_MAX_PAGES];
+	int                     committed;
+
+	assert(count > 0 && count <= VM_COMPRESSOR_BATCH_MAX_PAGES);
+
+	for (int i = 0; i < count; i++) {
+		compressor_pager_stats.put++;
+
+		compressed_count_deltas[i] = 0;
+
+		compressor_pager_lookup(mem_objs[i], pager);
+
+		if ((uint32_t)(offsets[i] / PAGE_SIZE) != (offsets[i] / PAGE_SIZE)) {
+			/* overflow */
+			panic("%s: offset 0x%llx overflow",
+			    __FUNCTION__, (uint64_t) offsets[i]);
+		}
+
+		compressor_pager_slot_lookup(pager, TRUE, offsets[i], &slots[i]);
+
+		if (slots[i] == NULL) {
+			/* out of range ? */
+			panic("vm_compressor_pager_put_batch: out of range");
+		}
+		if (*slots[i] != 0) {
+			/*
+			 * Already compressed: forget about the old one,
+			 * as in vm_compressor_pager_put().
+			 */
+			vm_compressor_free(slots[i], 0);
+			compressed_count_deltas[i] -= 1;
+		}
+	}
+
+	committed = vm_compressor_put_batch(batch, ppnums, slots, count,
+	    current_chead, scratch_buf);
+
+	for (int i = 0; i < committed; i++) {
+		compressed_count_deltas[i] += 1;
+	}
+
+	return committed;
+}
+
 
 kern_return_t
 vm_compressor_pager_get(
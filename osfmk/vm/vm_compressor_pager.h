@@ -43,6 +43,15 @@ extern kern_return_t vm_compressor_pager_put(
 	void                            **current_chead,
 	char                            *scratch_buf,
 	int                             *compressed_count_delta_p);
+extern int vm_compressor_pager_put_batch(
+	struct c_batch                  *batch,
+	memory_object_t                 *mem_objs,
+	memory_object_offset_t          *offsets,
+	ppnum_t                         *ppnums,
+	int                             count,
+	void                            **current_chead,
+	char                            *scratch_buf,
+	int                             *compressed_count_deltas);
 extern kern_return_t vm_compressor_pager_get(
 	memory_object_t         mem_obj,
 	memory_object_offset_t  offset,
@@ -116,6 +125,12 @@ extern bool osenvironment_is_diagnostics(void);
 extern void vm_compressor_init(void);
 extern bool vm_compressor_is_slot_compressed(int *slot);
 extern int vm_compressor_put(ppnum_t pn, int *slot, void **current_chead, char *scratch_buf, bool unmodified);
+#define VM_COMPRESSOR_BATCH_MAX_PAGES   16
+typedef struct c_batch *c_batch_t;
+extern c_batch_t vm_compressor_batch_create(void);
+extern void vm_compressor_batch_destroy(c_batch_t batch);
+extern int vm_compressor_put_batch(c_batch_t batch, ppnum_t *pns, int **slots, int count,
+    void **current_chead, char *scratch_buf);
 extern int vm_compressor_get(ppnum_t pn, int *slot, vm_compressor_options_t flags);
 extern int vm_compressor_free(int *slot, vm_compressor_options_t flags);
 
@@ -305,6 +305,7 @@ boolean_t VM_PRESSURE_CRITICAL_TO_WARNING(void);
 static void vm_pageout_iothread_external(struct pgo_iothread_state *, wait_result_t);
 static void vm_pageout_iothread_internal(struct pgo_iothread_state *, wait_result_t);
 static void vm_pageout_adjust_eq_iothrottle(struct pgo_iothread_state *, boolean_t);
+static int vm_pageout_compress_pages(struct pgo_iothread_state *, vm_page_t *, vm_page_t *);
 
 extern void vm_pageout_continue(void);
 extern void vm_pageout_scan(void);
@@ -4096,7 +4097,6 @@ vm_pageout_iothread_internal_continue(struct pgo_iothread_state *cq, __unused wa
 	boolean_t marked_active = FALSE;
 	int       num_pages_processed = 0;
 #endif
-	void *chead = NULL;
 
 	KERNEL_DEBUG(0xe040000c | DBG_FUNC_END, 0, 0, 0, 0, 0);
 
@@ -4199,40 +4199,20 @@ vm_pageout_iothread_internal_continue(struct pgo_iothread_state *cq, __unused wa
 			KERNEL_DEBUG(0xe0400018 | DBG_FUNC_END, q->pgo_laundry, 0, 0, 0, 0);
 
 			while (local_q) {
+				vm_page_t       compressed_q = NULL;
+				__unused int    npages;
+
 				KERNEL_DEBUG(0xe0400024 | DBG_FUNC_START, local_cnt, 0, 0, 0, 0);
 
-				m = local_q;
-				local_q = m->vmp_snext;
-				m->vmp_snext = NULL;
+				npages = vm_pageout_compress_pages(cq, &local_q, &compressed_q);
 
-				/*
-				 * Technically we need the pageq locks to manipulate this field.
-				 * However, this page has been removed from all queues and is only
-				 * known to this compressor thread dealing with this local queue.
-				 *
-				 * TODO LIONEL: Add a second localq that is the early localq and
-				 * put special pages like this one on that queue in the block above
-				 * under the pageq lock to avoid this 'works but not clean' logic.
-				 */
-				void *donate_queue_head;
-#if XNU_TARGET_OS_OSX
-				donate_queue_head = &cq->current_early_swapout_chead;
-#else /* XNU_TARGET_OS_OSX */
-				donate_queue_head = &cq->current_late_swapout_chead;
-#endif /* XNU_TARGET_OS_OSX */
-				if (m->vmp_on_specialq == VM_PAGE_SPECIAL_Q_DONATE) {
-					m->vmp_on_specialq = VM_PAGE_SPECIAL_Q_EMPTY;
-					chead = donate_queue_head;
-				} else {
-					chead = &cq->current_regular_swapout_chead;
-				}
+				KERNEL_DEBUG(0xe0400024 | DBG_FUNC_END, local_cnt, 0, 0, 0, 0);
 
-				if (vm_pageout_compress_page(chead, cq->scratch_buf, m) == KERN_SUCCESS) {
+				while ((m = compressed_q) != NULL) {
+					compressed_q = m->vmp_snext;
 #if DEVELOPMENT || DEBUG
 					ncomps++;
 #endif
-					KERNEL_DEBUG(0xe0400024 | DBG_FUNC_END, local_cnt, 0, 0, 0, 0);
-
 					m->vmp_snext = local_freeq;
 					local_freeq = m;
 					local_freed++;
@@ -4247,7 +4227,7 @@ vm_pageout_iothread_internal_continue(struct pgo_iothread_state *cq, __unused wa
 					}
 				}
 #if DEVELOPMENT || DEBUG
-				num_pages_processed++;
+				num_pages_processed += npages;
 #endif /* DEVELOPMENT || DEBUG */
 #if !CONFIG_JETSAM
 				while (vm_page_free_count < COMPRESSOR_FREE_RESERVED_LIMIT) {
@@ -4365,13 +4345,16 @@ vm_pageout_iothread_internal_continue(struct pgo_iothread_state *cq, __unused wa
 }
 
 
-kern_return_t
-vm_pageout_compress_page(void **current_chead, char *scratch_buf, vm_page_t m)
+/*
+ * Make sure the object of a page on its way to the compressor has a
+ * compressor pager.  If it can't get one, the page is reactivated, the
+ * object's activity dropped and MEMORY_OBJECT_NULL returned.
+ */
+static memory_object_t
+vm_pageout_compress_page_pager(vm_page_t m)
 {
 	vm_object_t     object;
 	memory_object_t pager;
-	int             compressed_count_delta;
-	kern_return_t   retval;
 
 	object = VM_PAGE_OBJECT(m);
 
@@ -4421,7 +4404,7 @@ vm_pageout_compress_page(void **current_chead, char *scratch_buf, vm_page_t m)
 			vm_object_activity_end(object);
 			vm_object_unlock(object);
 
-			return KERN_FAILURE;
+			return MEMORY_OBJECT_NULL;
 		}
 		vm_object_unlock(object);
 
@@ -4430,24 +4413,20 @@ vm_pageout_compress_page(void **current_chead, char *scratch_buf, vm_page_t m)
 	assert(object->pager_initialized && pager != MEMORY_OBJECT_NULL);
 	assert(object->activity_in_progress > 0);
 
-#if CONFIG_TRACK_UNMODIFIED_ANON_PAGES
-	if (m->vmp_unmodified_ro == true) {
-		os_atomic_inc(&compressor_ro_uncompressed_total_returned, relaxed);
-	}
-#endif /* CONFIG_TRACK_UNMODIFIED_ANON_PAGES */
+	return pager;
+}
 
-	retval = vm_compressor_pager_put(
-		pager,
-		m->vmp_offset + object->paging_offset,
-		VM_PAGE_GET_PHYS_PAGE(m),
-#if CONFIG_TRACK_UNMODIFIED_ANON_PAGES
-		m->vmp_unmodified_ro,
-#else /* CONFIG_TRACK_UNMODIFIED_ANON_PAGES */
-		false,
-#endif /* CONFIG_TRACK_UNMODIFIED_ANON_PAGES */
-		current_chead,
-		scratch_buf,
-		&compressed_count_delta);
+/*
+ * Account for the page once the compressor pager is done with it:
+ * free it from its object if it was compressed, reactivate it if not.
+ */
+static void
+vm_pageout_compress_page_done(vm_page_t m, memory_object_t pager,
+    kern_return_t retval, int compressed_count_delta)
+{
+	vm_object_t     object;
+
+	object = VM_PAGE_OBJECT(m);
 
 	vm_object_lock(object);
 
@@ -4492,10 +4471,150 @@ vm_pageout_compress_page(void **current_chead, char *scratch_buf, vm_page_t m)
 	}
 	vm_object_activity_end(object);
 	vm_object_unlock(object);
+}
+
+kern_return_t
+vm_pageout_compress_page(void **current_chead, char *scratch_buf, vm_page_t m)
+{
+	vm_object_t     object;
+	memory_object_t pager;
+	int             compressed_count_delta;
+	kern_return_t   retval;
+
+	object = VM_PAGE_OBJECT(m);
+
+	pager = vm_pageout_compress_page_pager(m);
+	if (pager == MEMORY_OBJECT_NULL) {
+		return KERN_FAILURE;
+	}
+
+#if CONFIG_TRACK_UNMODIFIED_ANON_PAGES
+	if (m->vmp_unmodified_ro == true) {
+		os_atomic_inc(&compressor_ro_uncompressed_total_returned, relaxed);
+	}
+#endif /* CONFIG_TRACK_UNMODIFIED_ANON_PAGES */
+
+	retval = vm_compressor_pager_put(
+		pager,
+		m->vmp_offset + object->paging_offset,
+		VM_PAGE_GET_PHYS_PAGE(m),
+#if CONFIG_TRACK_UNMODIFIED_ANON_PAGES
+		m->vmp_unmodified_ro,
+#else /* CONFIG_TRACK_UNMODIFIED_ANON_PAGES */
+		false,
+#endif /* CONFIG_TRACK_UNMODIFIED_ANON_PAGES */
+		current_chead,
+		scratch_buf,
+		&compressed_count_delta);
+
+	vm_pageout_compress_page_done(m, pager, retval, compressed_count_delta);
 
 	return retval;
 }
 
+/*
+ * Compress pages off the head of a compressor thread's local queue, as
+ * many as go to the same segment (up to VM_COMPRESSOR_BATCH_MAX_PAGES),
+ * with one vm_compressor_pager_put_batch().  The pages that got compressed
+ * are put on *compressed_q.  Returns the number of pages taken off *local_q.
+ */
+static int
+vm_pageout_compress_pages(struct pgo_iothread_state *cq, vm_page_t *local_q,
+    vm_page_t *compressed_q)
+{
+	vm_page_t               pages[VM_COMPRESSOR_BATCH_MAX_PAGES];
+	memory_object_t         pagers[VM_COMPRESSOR_BATCH_MAX_PAGES];
+	memory_object_offset_t  offsets[VM_COMPRESSOR_BATCH_MAX_PAGES];
+	ppnum_t                 pns[VM_COMPRESSOR_BATCH_MAX_PAGES];
+	int                     deltas[VM_COMPRESSOR_BATCH_MAX_PAGES];
+	void                    **chead = NULL;
+	void                    *donate_queue_head;
+	int                     taken = 0, count = 0, committed;
+	vm_page_t               m;
+
+#if XNU_TARGET_OS_OSX
+	donate_queue_head = &cq->current_early_swapout_chead;
+#else /* XNU_TARGET_OS_OSX */
+	donate_queue_head = &cq->current_late_swapout_chead;
+#endif /* XNU_TARGET_OS_OSX */
+
+	while ((m = *local_q) != NULL && count < VM_COMPRESSOR_BATCH_MAX_PAGES) {
+		void    **m_chead;
+
+		if (m->vmp_on_specialq == VM_PAGE_SPECIAL_Q_DONATE) {
+			m_chead = donate_queue_head;
+		} else {
+			m_chead = &cq->current_regular_swapout_chead;
+		}
+		if (count > 0 && m_chead != chead) {
+			break;
+		}
+#if CONFIG_TRACK_UNMODIFIED_ANON_PAGES
+		if (m->vmp_unmodified_ro == true && count > 0) {
+			break;
+		}
+#endif /* CONFIG_TRACK_UNMODIFIED_ANON_PAGES */
+
+		*local_q = m->vmp_snext;
+		m->vmp_snext = NULL;
+		taken++;
+
+		/*
+		 * Technically we need the pageq locks to manipulate this field.
+		 * However, this page has been removed from all queues and is only
+		 * known to this compressor thread dealing with this local queue.
+		 *
+		 * TODO LIONEL: Add a second localq that is the early localq and
+		 * put special pages like this one on that queue in the block above
+		 * under the pageq lock to avoid this 'works but not clean' logic.
+		 */
+		if (m->vmp_on_specialq == VM_PAGE_SPECIAL_Q_DONATE) {
+			m->vmp_on_specialq = VM_PAGE_SPECIAL_Q_EMPTY;
+		}
+
+#if CONFIG_TRACK_UNMODIFIED_ANON_PAGES
+		if (m->vmp_unmodified_ro == true) {
+			/* kept uncompressed: goes through vm_compressor_put() */
+			if (vm_pageout_compress_page(m_chead, cq->scratch_buf, m) == KERN_SUCCESS) {
+				m->vmp_snext = *compressed_q;
+				*compressed_q = m;
+			}
+			return taken;
+		}
+#endif /* CONFIG_TRACK_UNMODIFIED_ANON_PAGES */
+
+		pagers[count] = vm_pageout_compress_page_pager(m);
+		if (pagers[count] == MEMORY_OBJECT_NULL) {
+			continue;
+		}
+		offsets[count] = m->vmp_offset + VM_PAGE_OBJECT(m)->paging_offset;
+		pns[count] = VM_PAGE_GET_PHYS_PAGE(m);
+		pages[count] = m;
+		chead = m_chead;
+		count++;
+	}
+
+	if (count == 0) {
+		return taken;
+	}
+
+	committed = vm_compressor_pager_put_batch(cq->batch, pagers, offsets,
+	    pns, count, chead, cq->scratch_buf, deltas);
+
+	for (int i = 0; i < count; i++) {
+		kern_return_t retval = (i < committed) ? KERN_SUCCESS : KERN_RESOURCE_SHORTAGE;
+
+		vm_pageout_compress_page_done(pages[i], pagers[i], retval, deltas[i]);
+
+		if (retval == KERN_SUCCESS) {
+			pages[i]->vmp_snext = *compressed_q;
+			*compressed_q = pages[i];
+		}
+	}
+
+	return taken;
+}
+
 
 static void
 vm_pageout_adjust_eq_iothrottle(struct pgo_iothread_state *ethr, boolean_t req_lowpriority)
@@ -5250,6 +5369,7 @@ vm_pageout(void)
 	ethr->current_regular_swapout_chead = NULL;
 	ethr->current_late_swapout_chead = NULL;
 	ethr->scratch_buf = NULL;
+	ethr->batch = NULL;
 #if DEVELOPMENT || DEBUG
 	ethr->benchmark_q = NULL;
 #endif /* DEVELOPMENT || DEBUG */
@@ -5410,6 +5530,7 @@ vm_pageout_internal_start(void)
 		iq->current_regular_swapout_chead = NULL;
 		iq->current_late_swapout_chead = NULL;
 		iq->scratch_buf = (char *)(buf + i * bufsize);
+		iq->batch = vm_compressor_batch_create();
 #if DEVELOPMENT || DEBUG
 		iq->benchmark_q = &vm_pageout_queue_benchmark;
 #endif /* DEVELOPMENT || DEBUG */
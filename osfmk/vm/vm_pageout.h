@@ -850,6 +850,7 @@ struct pgo_iothread_state {
 	void                    *current_regular_swapout_chead;
 	void                    *current_late_swapout_chead;
 	char                    *scratch_buf;
+	struct c_batch          *batch;         // unused by external thread
 	int                     id;
 	thread_t                pgo_iothread; // holds a +1 ref
 	sched_cond_atomic_t     pgo_wakeup;
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+#include <vm/lz4_assembly_select.h>
+#if LZ4_ENABLE_ASSEMBLY_ENCODE_SIMD_X86_64
+
+/*
+
+  Vector building blocks for the C LZ4 encoder (lz4_encode_2gb in osfmk/vm/lz4.c).
+  Only xmm registers are used, with VEX encodings on the x86_64h slice, like
+  lz4_decode_asm.
+
+  size_t lz4_nmatch_simd(
+    const uint8_t * a,                      reference bytes
+    const uint8_t * b,                      candidate bytes
+    size_t max)                             keep comparing while fewer than MAX bytes matched
+
+  Return the number of leading bytes that match at A and B. Bytes are compared 32 at a time,
+  so like the scalar loop it replaces this may read up to 31 bytes past A+MAX and B+MAX and
+  may return up to MAX+31. Callers stay within LZ4_GOFAST_SAFETY_MARGIN.
+
+  uint8_t * lz4_copy_literal_simd(
+    uint8_t * dst,
+    const uint8_t * src,
+    uint32_t L)
+
+  Copy L bytes from SRC to DST in 32 byte chunks and return DST+L. Like copy_literal(), this
+  always copies at least 32 bytes and may write up to 31 bytes past DST+L.
+
+*/
+
+#if MSVC_CALLING_CONVENTIONS
+#error TODO implement MSVC calling conventions for LZ4 x86_64 assembly
+#endif
+
+// compare_1x16 OFFSET, clobber: xmm0, xmm1, ecx
+// Leaves a bit set in ecx for every mismatching byte of a[rax+OFFSET..] vs b[rax+OFFSET..]
+.macro compare_1x16
+#ifdef __AVX2__
+    vmovdqu	$0(%rdi,%rax),%xmm0
+    vpcmpeqb	$0(%rsi,%rax),%xmm0,%xmm0
+    vpmovmskb	%xmm0,%ecx
+#else
+    movdqu	$0(%rdi,%rax),%xmm0
+    movdqu	$0(%rsi,%rax),%xmm1
+    pcmpeqb	%xmm1,%xmm0
+    pmovmskb	%xmm0,%ecx
+#endif
+    xor		$$0xffff,%ecx
+.endm
+
+.macro clear_frame_and_return
+    pop		%rbp
+#ifdef __AVX2__
+    vzeroupper
+#endif
+    ret
+.endm
+
+	.text
+	.globl _lz4_nmatch_simd
+	.align 4,0x90
+_lz4_nmatch_simd:
+    push	%rbp
+    mov		%rsp,%rbp
+    xor		%eax,%eax               // n = 0
+    test	%rdx,%rdx
+    jz		L_nmatch_done
+
+	.align 4,0x90
+L_nmatch_loop:
+    compare_1x16 0
+    jnz		L_nmatch_partial
+    compare_1x16 16
+    jnz		L_nmatch_partial_16
+    add		$32,%rax
+    cmp		%rdx,%rax
+    jb		L_nmatch_loop
+L_nmatch_done:
+    clear_frame_and_return
+
+L_nmatch_partial_16:
+    add		$16,%rax
+L_nmatch_partial:
+    bsf		%ecx,%ecx               // index of the first mismatching byte
+    add		%rcx,%rax
+    clear_frame_and_return
+
+	.globl _lz4_copy_literal_simd
+	.align 4,0x90
+_lz4_copy_literal_simd:
+    push	%rbp
+    mov		%rsp,%rbp
+    mov		%edx,%edx               // zero extend L
+    lea		(%rdi,%rdx),%rax        // return dst + L
+
+	.align 4,0x90
+L_copy_literal_loop:
+#ifdef __AVX2__
+    vmovdqu	(%rsi),%xmm0
+    vmovdqu	16(%rsi),%xmm1
+    vmovdqu	%xmm0,(%rdi)
+    vmovdqu	%xmm1,16(%rdi)
+#else
+    movdqu	(%rsi),%xmm0
+    movdqu	16(%rsi),%xmm1
+    movdqu	%xmm0,(%rdi)
+    movdqu	%xmm1,16(%rdi)
+#endif
+    add		$32,%rsi
+    add		$32,%rdi
+    cmp		%rax,%rdi
+    jb		L_copy_literal_loop
+    clear_frame_and_return
+
+#endif // LZ4_ENABLE_ASSEMBLY_ENCODE_SIMD_X86_64
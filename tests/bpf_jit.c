@@ -0,0 +1,285 @@
+/*
+ * Copyright (c) 2024 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Filters set with BIOCSETF are compiled (see bpf_jit_compile()) unless
+ * debug.bpf_jit_enable is 0.  Run the same programs over the same loopback
+ * traffic both ways and check they accept the same packets with the same
+ * capture lengths, and the ones they are meant to.
+ */
+
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/sysctl.h>
+
+#include <net/bpf.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <darwintest.h>
+
+#include "bpflib.h"
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.net"),
+	T_META_ASROOT(true),
+	T_META_RADAR_COMPONENT_NAME("xnu"),
+	T_META_RADAR_COMPONENT_VERSION("networking"),
+	T_META_CHECK_LEAKS(false));
+
+#define JIT_MAGIC       0x4a49545fu     /* "JIT_" */
+#define JIT_NPKTS       8
+#define JIT_SNAPLEN     64
+
+/* lo0 is DLT_NULL: a 4 byte address family precedes the IP header */
+#define NULL_HDRLEN     4
+
+struct jit_payload {
+	uint32_t        jp_magic;
+	uint32_t        jp_id;
+};
+
+struct jit_result {
+	u_int           jr_caplen[JIT_NPKTS];   /* 0 when not captured */
+};
+
+static int saved_jit_enable = -1;
+static in_port_t match_port;    /* network order */
+static in_port_t other_port;
+
+static void
+jit_enable_set(int value)
+{
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("debug.bpf_jit_enable",
+	    NULL, NULL, &value, sizeof(value)), "debug.bpf_jit_enable=%d", value);
+}
+
+static void
+jit_enable_restore(void)
+{
+	if (saved_jit_enable != -1) {
+		jit_enable_set(saved_jit_enable);
+	}
+}
+
+static int
+udp_bound_socket(in_port_t *port)
+{
+	struct sockaddr_in sin = {
+		.sin_len = sizeof(sin),
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	socklen_t len = sizeof(sin);
+	int fd;
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(fd = socket(AF_INET, SOCK_DGRAM, 0), "socket");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(bind(fd, (struct sockaddr *)&sin, sizeof(sin)), "bind");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(getsockname(fd, (struct sockaddr *)&sin, &len), "getsockname");
+	*port = sin.sin_port;
+	return fd;
+}
+
+/*
+ * Packet i goes to match_port when i is even, carries JIT_MAGIC unless
+ * i % 3 == 2, and has a payload that grows with i up to a few clusters.
+ */
+static void
+send_packets(int sfd)
+{
+	static uint8_t buf[8 * 1024];
+
+	for (uint32_t i = 0; i < JIT_NPKTS; i++) {
+		struct sockaddr_in sin = {
+			.sin_len = sizeof(sin),
+			.sin_family = AF_INET,
+			.sin_port = (i % 2) == 0 ? match_port : other_port,
+			.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+		};
+		struct jit_payload jp = {
+			.jp_magic = htonl((i % 3) == 2 ? ~JIT_MAGIC : JIT_MAGIC),
+			.jp_id = htonl(i),
+		};
+		size_t len = sizeof(jp) + i * 1000;
+
+		memset(buf, (int)i, sizeof(buf));
+		memcpy(buf, &jp, sizeof(jp));
+		T_QUIET; T_ASSERT_EQ(sendto(sfd, buf, len, 0, (struct sockaddr *)&sin,
+		    sizeof(sin)), (ssize_t)len, "sendto %u", i);
+	}
+}
+
+static void
+run_filter(struct bpf_insn *insns, u_int len, int jit, struct jit_result *res)
+{
+	struct bpf_program prog = { .bf_len = len, .bf_insns = insns };
+	struct timeval tv = { .tv_sec = 1 };
+	int blen, bfd, sfd;
+	in_port_t sport;
+	char *buf;
+	ssize_t n;
+
+	jit_enable_set(jit);
+	memset(res, 0, sizeof(*res));
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(bfd = bpf_new(), "bpf_new");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(bpf_get_blen(bfd, &blen), "bpf_get_blen");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(ioctl(bfd, BIOCSETF, &prog), "BIOCSETF");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(bpf_setif(bfd, "lo0"), "bpf_setif lo0");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(bpf_set_immediate(bfd, 1), "bpf_set_immediate");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(bpf_set_timeout(bfd, &tv), "bpf_set_timeout");
+	T_QUIET; T_ASSERT_NOTNULL(buf = malloc((size_t)blen), "malloc");
+
+	sfd = udp_bound_socket(&sport);
+	send_packets(sfd);
+
+	while ((n = read(bfd, buf, (size_t)blen)) > 0) {
+		for (char *p = buf; p < buf + n;) {
+			struct bpf_hdr *bh = (struct bpf_hdr *)(void *)p;
+			struct jit_payload jp;
+			size_t off = bh->bh_hdrlen + NULL_HDRLEN;
+			struct ip *ip = (struct ip *)(void *)(p + off);
+
+			off += (size_t)ip->ip_hl * 4 + 8;
+			if (bh->bh_caplen >= off - bh->bh_hdrlen + sizeof(jp)) {
+				memcpy(&jp, p + off, sizeof(jp));
+				if (ntohl(jp.jp_id) < JIT_NPKTS) {
+					res->jr_caplen[ntohl(jp.jp_id)] = bh->bh_caplen;
+				}
+			}
+			p += BPF_WORDALIGN(bh->bh_hdrlen + bh->bh_caplen);
+		}
+	}
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(n, "read bpf");
+
+	free(buf);
+	close(sfd);
+	bpf_dispose(bfd);
+}
+
+static void
+check_filter(const char *what, struct bpf_insn *insns, u_int len,
+    bool (^accepts)(uint32_t i), u_int snaplen)
+{
+	struct jit_result jit, interp;
+
+	T_SETUPBEGIN;
+	if (saved_jit_enable == -1) {
+		size_t size = sizeof(saved_jit_enable);
+
+		T_ASSERT_POSIX_SUCCESS(sysctlbyname("debug.bpf_jit_enable",
+		    &saved_jit_enable, &size, NULL, 0), "debug.bpf_jit_enable");
+		T_ATEND(jit_enable_restore);
+	}
+	if (match_port == 0) {
+		close(udp_bound_socket(&match_port));
+		close(udp_bound_socket(&other_port));
+	}
+	T_SETUPEND;
+
+	run_filter(insns, len, 1, &jit);
+	run_filter(insns, len, 0, &interp);
+
+	for (uint32_t i = 0; i < JIT_NPKTS; i++) {
+		T_EXPECT_EQ(jit.jr_caplen[i], interp.jr_caplen[i],
+		    "%s: packet %u captured alike", what, i);
+		if (accepts(i)) {
+			T_EXPECT_NE(jit.jr_caplen[i], 0u, "%s: packet %u accepted", what, i);
+			if (snaplen != 0) {
+				T_EXPECT_LE(jit.jr_caplen[i], snaplen, "%s: packet %u snapped", what, i);
+			}
+		} else {
+			T_EXPECT_EQ(jit.jr_caplen[i], 0u, "%s: packet %u rejected", what, i);
+		}
+	}
+}
+
+/* udp and dst port match_port: fused ldh + jeq through the index register */
+T_DECL(bpf_jit_port, "compiled and interpreted port filters agree")
+{
+	struct bpf_insn insns[] = {
+		BPF_STMT(BPF_LD + BPF_B + BPF_ABS, NULL_HDRLEN + 9),
+		BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, IPPROTO_UDP, 0, 4),
+		BPF_STMT(BPF_LDX + BPF_B + BPF_MSH, NULL_HDRLEN),
+		BPF_STMT(BPF_LD + BPF_H + BPF_IND, NULL_HDRLEN + 2),
+		BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 0, 0, 1),
+		BPF_STMT(BPF_RET + BPF_K, (u_int)-1),
+		BPF_STMT(BPF_RET + BPF_K, 0),
+	};
+
+	insns[4].k = ntohs(match_port);
+	check_filter("port", insns, sizeof(insns) / sizeof(insns[0]),
+	    ^bool (uint32_t i) { return (i % 2) == 0; }, 0);
+}
+
+/* payload magic through scratch memory, snapped to JIT_SNAPLEN */
+T_DECL(bpf_jit_scratch, "compiled and interpreted scratch memory filters agree")
+{
+	struct bpf_insn insns[] = {
+		BPF_STMT(BPF_LD + BPF_B + BPF_ABS, NULL_HDRLEN + 9),
+		BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, IPPROTO_UDP, 0, 8),
+		BPF_STMT(BPF_LDX + BPF_B + BPF_MSH, NULL_HDRLEN),
+		BPF_STMT(BPF_LD + BPF_W + BPF_IND, NULL_HDRLEN + 8),
+		BPF_STMT(BPF_ST, 3),
+		BPF_STMT(BPF_LD + BPF_IMM, 0),
+		BPF_STMT(BPF_LDX + BPF_MEM, 3),
+		BPF_STMT(BPF_MISC + BPF_TXA, 0),
+		BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, JIT_MAGIC, 0, 1),
+		BPF_STMT(BPF_RET + BPF_K, JIT_SNAPLEN),
+		BPF_STMT(BPF_RET + BPF_K, 0),
+	};
+
+	check_filter("scratch", insns, sizeof(insns) / sizeof(insns[0]),
+	    ^bool (uint32_t i) { return (i % 3) != 2; }, JIT_SNAPLEN);
+}
+
+/* odd ids with a byte at payload offset 4000: jset and a load past the first mbuf */
+T_DECL(bpf_jit_jset, "compiled and interpreted jset and long loads agree")
+{
+	struct bpf_insn insns[] = {
+		BPF_STMT(BPF_LD + BPF_B + BPF_ABS, NULL_HDRLEN + 9),
+		BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, IPPROTO_UDP, 0, 7),
+		BPF_STMT(BPF_LDX + BPF_B + BPF_MSH, NULL_HDRLEN),
+		BPF_STMT(BPF_LD + BPF_W + BPF_IND, NULL_HDRLEN + 8),
+		BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, JIT_MAGIC, 0, 4),
+		BPF_STMT(BPF_LD + BPF_W + BPF_IND, NULL_HDRLEN + 12),
+		BPF_JUMP(BPF_JMP + BPF_JSET + BPF_K, 1, 0, 2),
+		/* a load past the end of the packet rejects it */
+		BPF_STMT(BPF_LD + BPF_B + BPF_IND, NULL_HDRLEN + 8 + 4000),
+		BPF_STMT(BPF_RET + BPF_K, (u_int)-1),
+		BPF_STMT(BPF_RET + BPF_K, 0),
+	};
+
+	check_filter("jset", insns, sizeof(insns) / sizeof(insns[0]),
+	    ^bool (uint32_t i) { return (i % 3) != 2 && (i % 2) == 1 && sizeof(struct jit_payload) + i * 1000 > 4000; }, 0);
+}
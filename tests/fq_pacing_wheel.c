@@ -0,0 +1,34 @@
+#include <errno.h>
+#include <sys/sysctl.h>
+#include <darwintest.h>
+#include <darwintest_utils.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.net"),
+	T_META_RADAR_COMPONENT_NAME("xnu"),
+	T_META_RADAR_COMPONENT_VERSION("networking"),
+	T_META_ASROOT(true));
+
+static int64_t
+run_sysctl_test(const char *t, int64_t value)
+{
+	char name[1024];
+	int64_t result = 0;
+	size_t s = sizeof(value);
+	int rc;
+
+	snprintf(name, sizeof(name), "debug.test.%s", t);
+	rc = sysctlbyname(name, &result, &s, &value, s);
+	if (rc == -1 && errno == ENOTSUP) {
+		T_SKIP("L4S pacing or the pacing wheel is disabled");
+	}
+	T_ASSERT_POSIX_SUCCESS(rc, "sysctlbyname(%s)", t);
+	return result;
+}
+
+T_DECL(fq_pacing_wheel, "park and release paced flows on the FQ-CoDel pacing wheel",
+    T_META_REQUIRES_SYSCTL_EQ("kern.development", 1),
+    T_META_CHECK_LEAKS(false))
+{
+	T_EXPECT_EQ(1ll, run_sysctl_test("fq_pacing_wheel", 0), "test succeeded");
+}
@@ -3,6 +3,7 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <inttypes.h>
+#include <mach/mach_time.h>
 
 #include <darwintest.h>
 
@@ -233,3 +234,74 @@ T_DECL(in_cksum_49479689b, "tests os_cpu_in_cksum with many random packets in va
 		test_one_random_packet(4096);
 	}
 }
+
+T_DECL(in_cksum_long, "tests os_cpu_in_cksum with long buffers at every alignment")
+{
+	const uint32_t lens[] = { 255, 256, 257, 1024, 1500, 4093, 9000, 65535 };
+	const uint32_t maxlen = 65535, MAXALIGN = 8;
+	uint8_t *data = malloc(maxlen + MAXALIGN);
+
+	T_QUIET; T_ASSERT_NOTNULL(data, "malloc");
+	arc4random_buf(data, maxlen + MAXALIGN);
+	for (unsigned i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+		for (uint32_t align = 0; align < MAXALIGN; align++) {
+			uint16_t dsum = dumb_in_cksum(data + align, lens[i]);
+			uint16_t osum = ~os_cpu_in_cksum(data + align, lens[i], 0) & 0xffff;
+
+			T_QUIET; T_ASSERT_EQ(osum, dsum, "len %u align %u", lens[i], align);
+		}
+	}
+	free(data);
+	T_PASS("OK");
+}
+
+/*
+ * Throughput of os_cpu_in_cksum across packet sizes and buffer
+ * alignments, reported in MB/s; each size is checksummed over a
+ * buffer larger than the L1 cache so that the loads are not all hits.
+ */
+T_DECL(in_cksum_throughput, "os_cpu_in_cksum throughput by length and alignment",
+    T_META_TAG_PERF, T_META_RUN_CONCURRENTLY(false))
+{
+	const uint32_t lens[] = { 20, 64, 256, 576, 1500, 4096, 9000, 16384, 65535 };
+	const uint32_t aligns[] = { 0, 1, 2, 4 };
+	const size_t bufsize = 1024 * 1024;
+	const uint64_t total = 256 * 1024 * 1024;
+	mach_timebase_info_data_t tb;
+	uint8_t *buf = malloc(bufsize + 8);
+	volatile uint32_t sink = 0;
+
+	T_QUIET; T_ASSERT_NOTNULL(buf, "malloc");
+	T_QUIET; T_ASSERT_MACH_SUCCESS(mach_timebase_info(&tb), "mach_timebase_info");
+	arc4random_buf(buf, bufsize + 8);
+
+	for (unsigned i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+		uint32_t len = lens[i];
+		uint32_t stride = (len + 63) & ~63U;
+		uint64_t iters = total / len;
+
+		for (unsigned j = 0; j < sizeof(aligns) / sizeof(aligns[0]); j++) {
+			size_t off = 0;
+			uint64_t start, elapsed_ns;
+			double mbps;
+			char name[64];
+
+			start = mach_absolute_time();
+			for (uint64_t n = 0; n < iters; n++) {
+				sink += os_cpu_in_cksum(buf + off + aligns[j], len, 0);
+				off += stride;
+				if (off + len > bufsize) {
+					off = 0;
+				}
+			}
+			elapsed_ns = (mach_absolute_time() - start) * tb.numer / tb.denom;
+			mbps = (double)(iters * len) * 1000.0 / (double)elapsed_ns;
+
+			snprintf(name, sizeof(name), "in_cksum_%u_align%u", len, aligns[j]);
+			T_LOG("len %5u align %u: %8.1f MB/s", len, aligns[j], mbps);
+			T_PERF(name, mbps, "MB/s", "os_cpu_in_cksum throughput");
+		}
+	}
+	free(buf);
+	T_PASS("checksum %u", sink);
+}
@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) 2024 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Inbound packets for connected sockets are matched to their pcb without
+ * ipi_lock (see in_pcblookup_hash_smr()).  Check that datagrams still reach
+ * the connected socket with the exact 4-tuple rather than a wildcard one on
+ * the same port, including while other sockets on that port are being
+ * created, connected (rehashed) and disposed of.
+ */
+
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <netinet/in.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <darwintest.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.net"),
+	T_META_RADAR_COMPONENT_NAME("xnu"),
+	T_META_RADAR_COMPONENT_VERSION("networking"),
+	T_META_CHECK_LEAKS(false));
+
+#define NPAIRS          16
+#define CHURN_SECONDS   5
+
+struct pair {
+	int     p_conn;         /* connected, bound to the shared port */
+	int     p_peer;         /* its peer */
+};
+
+static struct sockaddr_storage shared_addr;
+static int wildcard_fd;
+static struct pair pairs[NPAIRS];
+static atomic_bool churn_stop;
+
+static socklen_t
+loopback_addr(int family, struct sockaddr_storage *ss, in_port_t port)
+{
+	memset(ss, 0, sizeof(*ss));
+	if (family == AF_INET) {
+		struct sockaddr_in *sin = (struct sockaddr_in *)ss;
+
+		sin->sin_len = sizeof(*sin);
+		sin->sin_family = AF_INET;
+		sin->sin_port = port;
+		sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		return sizeof(*sin);
+	} else {
+		struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)ss;
+
+		sin6->sin6_len = sizeof(*sin6);
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_port = port;
+		sin6->sin6_addr = in6addr_loopback;
+		return sizeof(*sin6);
+	}
+}
+
+static in_port_t
+sock_port(int fd)
+{
+	struct sockaddr_storage ss;
+	socklen_t len = sizeof(ss);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(getsockname(fd, (struct sockaddr *)&ss, &len), "getsockname");
+	return ss.ss_family == AF_INET ?
+	       ((struct sockaddr_in *)&ss)->sin_port :
+	       ((struct sockaddr_in6 *)&ss)->sin6_port;
+}
+
+static int
+udp_socket(int family, bool reuse)
+{
+	struct timeval tv = { .tv_sec = 2 };
+	int one = 1;
+	int fd;
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(fd = socket(family, SOCK_DGRAM, 0), "socket");
+	if (reuse) {
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)), NULL);
+	}
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)), NULL);
+	return fd;
+}
+
+/* A socket on the shared port, connected to a new peer */
+static void
+pair_open(int family, struct pair *p)
+{
+	struct sockaddr_storage ss;
+	socklen_t len;
+
+	p->p_peer = udp_socket(family, false);
+	len = loopback_addr(family, &ss, 0);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(bind(p->p_peer, (struct sockaddr *)&ss, len), "bind peer");
+
+	p->p_conn = udp_socket(family, true);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(bind(p->p_conn, (struct sockaddr *)&shared_addr,
+	    shared_addr.ss_len), "bind shared port");
+	len = loopback_addr(family, &ss, sock_port(p->p_peer));
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(connect(p->p_conn, (struct sockaddr *)&ss, len), "connect");
+}
+
+static void
+pair_close(struct pair *p)
+{
+	close(p->p_conn);
+	close(p->p_peer);
+}
+
+/* Each peer sends its index, which must only show up on its own socket */
+static void
+pairs_check(void)
+{
+	for (uint32_t i = 0; i < NPAIRS; i++) {
+		T_QUIET; T_ASSERT_EQ(sendto(pairs[i].p_peer, &i, sizeof(i), 0,
+		    (struct sockaddr *)&shared_addr, shared_addr.ss_len), (ssize_t)sizeof(i), "send %u", i);
+	}
+	for (uint32_t i = 0; i < NPAIRS; i++) {
+		uint32_t got = UINT32_MAX;
+
+		T_QUIET; T_ASSERT_EQ(recv(pairs[i].p_conn, &got, sizeof(got), 0), (ssize_t)sizeof(got), "recv %u", i);
+		T_QUIET; T_ASSERT_EQ(got, i, "datagram reached the connected socket");
+	}
+
+	uint32_t stray;
+	T_QUIET; T_ASSERT_EQ(recv(wildcard_fd, &stray, sizeof(stray), MSG_DONTWAIT), -1L,
+	    "nothing reached the wildcard socket");
+	T_QUIET; T_ASSERT_EQ(errno, EAGAIN, NULL);
+}
+
+static void
+setup(int family)
+{
+	socklen_t len;
+
+	wildcard_fd = udp_socket(family, true);
+	len = loopback_addr(family, &shared_addr, 0);
+	T_ASSERT_POSIX_SUCCESS(bind(wildcard_fd, (struct sockaddr *)&shared_addr, len), "bind wildcard");
+	loopback_addr(family, &shared_addr, sock_port(wildcard_fd));
+
+	for (int i = 0; i < NPAIRS; i++) {
+		pair_open(family, &pairs[i]);
+	}
+}
+
+static void
+teardown(void)
+{
+	for (int i = 0; i < NPAIRS; i++) {
+		pair_close(&pairs[i]);
+	}
+	close(wildcard_fd);
+}
+
+/* Keep creating, connecting and closing sockets on the shared port */
+static void *
+churn(void *arg)
+{
+	int family = (int)(intptr_t)arg;
+	struct pair p;
+
+	while (!atomic_load(&churn_stop)) {
+		pair_open(family, &p);
+		pair_close(&p);
+	}
+	return NULL;
+}
+
+static void
+run_exact(int family)
+{
+	setup(family);
+	for (int round = 0; round < 100; round++) {
+		pairs_check();
+	}
+	teardown();
+}
+
+static void
+run_churn(int family)
+{
+	pthread_t threads[4];
+	time_t end;
+	uint64_t rounds = 0;
+
+	setup(family);
+	atomic_store(&churn_stop, false);
+	for (int i = 0; i < 4; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&threads[i], NULL, churn,
+		    (void *)(intptr_t)family), "pthread_create");
+	}
+
+	end = time(NULL) + CHURN_SECONDS;
+	while (time(NULL) < end) {
+		pairs_check();
+		rounds++;
+	}
+
+	atomic_store(&churn_stop, true);
+	for (int i = 0; i < 4; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_join(threads[i], NULL), "pthread_join");
+	}
+	teardown();
+	T_PASS("%llu rounds of %d datagrams delivered to the exact match", rounds, NPAIRS);
+}
+
+T_DECL(inpcb_smr_lookup_exact_v4, "IPv4 datagrams reach the connected socket over a wildcard one")
+{
+	run_exact(AF_INET);
+	T_PASS("IPv4 exact matches");
+}
+
+T_DECL(inpcb_smr_lookup_exact_v6, "IPv6 datagrams reach the connected socket over a wildcard one")
+{
+	run_exact(AF_INET6);
+	T_PASS("IPv6 exact matches");
+}
+
+T_DECL(inpcb_smr_lookup_churn_v4, "IPv4 exact matches while sockets on the port come and go")
+{
+	run_churn(AF_INET);
+}
+
+T_DECL(inpcb_smr_lookup_churn_v6, "IPv6 exact matches while sockets on the port come and go")
+{
+	run_churn(AF_INET6);
+}
@@ -0,0 +1,359 @@
+/*
+ * Copyright (c) 2024 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Software receive aggregation in DLIL (net.link.generic.system.gro).
+ *
+ * TCP segments are written as one BPF batch on one end of a feth pair
+ * that simulates hardware checksum offload, so they come in on the peer
+ * back to back.  The per interface counters of the peer then tell how
+ * the segments were merged and why each aggregate was closed.  The
+ * input thread may still split a batch, in which case the counters
+ * differ from the single batch expectation and the batch is resent.
+ */
+
+#include <darwintest.h>
+
+#include <sys/ioctl.h>
+#include <sys/sysctl.h>
+#include <sys/uio.h>
+
+#include <net/if.h>
+#include <net/if_var_private.h>
+#include <net/if_fake_var.h>
+#include <net/bpf.h>
+#include <net/ethernet.h>
+
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "net_test_lib.h"
+#include "bpflib.h"
+#include "in_cksum.h"
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.net"),
+	T_META_ASROOT(true),
+	T_META_RADAR_COMPONENT_NAME("xnu"),
+	T_META_RADAR_COMPONENT_VERSION("networking"),
+	T_META_CHECK_LEAKS(false));
+
+#define GRO_MSS                 1000
+#define GRO_MAX_SEGS            8
+#define GRO_ATTEMPTS            20
+
+static int s_fd = -1;
+static int bpf_fd = -1;
+static char ifname1[IF_NAMESIZE];
+static char ifname2[IF_NAMESIZE];
+static int ifindex2;
+static int saved_gro = -1;
+static int saved_hwcsum = -1;
+static uint16_t next_port = 20000;
+
+struct gro_seg {
+	uint32_t        gs_off;         /* payload offset in the flow */
+	uint8_t         gs_flags;
+};
+
+static void
+cleanup(void)
+{
+	if (bpf_fd != -1) {
+		(void) close(bpf_fd);
+	}
+	if (s_fd != -1) {
+		(void) ifnet_destroy(s_fd, ifname1, false);
+		(void) ifnet_destroy(s_fd, ifname2, false);
+		(void) close(s_fd);
+	}
+	if (saved_gro != -1) {
+		(void) sysctlbyname("net.link.generic.system.gro", NULL, NULL,
+		    &saved_gro, sizeof(saved_gro));
+	}
+	if (saved_hwcsum != -1) {
+		(void) sysctlbyname("net.link.fake.hwcsum", NULL, NULL,
+		    &saved_hwcsum, sizeof(saved_hwcsum));
+	}
+}
+
+static void
+set_sysctl(const char *name, int value, int *saved)
+{
+	size_t len = sizeof(*saved);
+
+	T_ASSERT_POSIX_SUCCESS(sysctlbyname(name, saved, &len, &value, sizeof(value)),
+	    "sysctl %s %d -> %d", name, *saved, value);
+}
+
+static void
+init(void)
+{
+	T_ATEND(cleanup);
+
+	/* the peer must see the segments as checksum verified */
+	set_sysctl("net.link.fake.hwcsum", 1, &saved_hwcsum);
+	set_sysctl("net.link.generic.system.gro", 1, &saved_gro);
+
+	s_fd = inet_dgram_socket();
+
+	strlcpy(ifname1, FETH_NAME, sizeof(ifname1));
+	T_ASSERT_POSIX_ZERO(ifnet_create_2(s_fd, ifname1, sizeof(ifname1)), NULL);
+	strlcpy(ifname2, FETH_NAME, sizeof(ifname2));
+	T_ASSERT_POSIX_ZERO(ifnet_create_2(s_fd, ifname2, sizeof(ifname2)), NULL);
+	T_ASSERT_POSIX_ZERO(fake_set_peer(s_fd, ifname1, ifname2), NULL);
+
+	ifnet_attach_ip(s_fd, ifname2);
+	T_ASSERT_POSIX_ZERO(ifnet_set_flags(s_fd, ifname1, IFF_UP, 0), NULL);
+	T_ASSERT_POSIX_ZERO(ifnet_set_flags(s_fd, ifname2, IFF_UP, 0), NULL);
+	ifindex2 = (int)if_nametoindex(ifname2);
+	T_ASSERT_GT(ifindex2, 0, "%s index", ifname2);
+
+	T_ASSERT_POSIX_SUCCESS(bpf_fd = bpf_new(), NULL);
+	T_ASSERT_POSIX_SUCCESS(bpf_setif(bpf_fd, ifname1), "bpf set if %s", ifname1);
+	T_ASSERT_POSIX_SUCCESS(bpf_set_header_complete(bpf_fd, 1), NULL);
+#ifdef BIOCSBATCHWRITE
+	T_ASSERT_POSIX_SUCCESS(bpf_set_batch_write(bpf_fd, 1), NULL);
+#else
+	T_SKIP("BIOCSBATCHWRITE not supported");
+#endif
+}
+
+static void
+get_gro_stats(struct if_gro_stats *stats)
+{
+	int mib[CTL_MAXNAME];
+	size_t miblen = CTL_MAXNAME;
+	size_t len = sizeof(*stats);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlnametomib("net.link.generic.system.gro_stats",
+	    mib, &miblen), NULL);
+	mib[miblen++] = ifindex2;
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctl(mib, (u_int)miblen, stats, &len, NULL, 0),
+	    "gro_stats %s", ifname2);
+	T_QUIET; T_ASSERT_EQ(len, sizeof(*stats), NULL);
+}
+
+/* One Ethernet/IPv4/TCP segment, prefixed by the BPF batch write header */
+static void
+make_segment(struct iovec *iov, const ether_addr_t *src, const ether_addr_t *dst,
+    uint16_t sport, uint32_t seq0, const struct gro_seg *seg)
+{
+	size_t frame_len = ETHER_HDR_LEN + sizeof(ip_tcp_header_t) + GRO_MSS;
+	size_t hdrlen = BPF_WORDALIGN(sizeof(struct bpf_hdr));
+	struct bpf_hdr *bh;
+	ether_header_t *eh;
+	ip_tcp_header_t *iptcp;
+	uint8_t *payload;
+
+	iov->iov_len = BPF_WORDALIGN(hdrlen + frame_len);
+	iov->iov_base = calloc(1, iov->iov_len);
+	T_QUIET; T_ASSERT_NOTNULL(iov->iov_base, NULL);
+
+	bh = (struct bpf_hdr *)iov->iov_base;
+	bh->bh_hdrlen = (u_short)hdrlen;
+	bh->bh_caplen = bh->bh_datalen = (bpf_u_int32)frame_len;
+
+	eh = (ether_header_t *)(void *)((uint8_t *)iov->iov_base + hdrlen);
+	bcopy(src, eh->ether_shost, ETHER_ADDR_LEN);
+	bcopy(dst, eh->ether_dhost, ETHER_ADDR_LEN);
+	eh->ether_type = htons(ETHERTYPE_IP);
+
+	iptcp = (ip_tcp_header_t *)(void *)(eh + 1);
+	iptcp->ip.ip_v = IPVERSION;
+	iptcp->ip.ip_hl = sizeof(struct ip) >> 2;
+	iptcp->ip.ip_len = htons((uint16_t)(sizeof(*iptcp) + GRO_MSS));
+	iptcp->ip.ip_ttl = MAXTTL;
+	iptcp->ip.ip_p = IPPROTO_TCP;
+	iptcp->ip.ip_src.s_addr = htonl(0x0a2a0002);  /* 10.42.0.2 */
+	iptcp->ip.ip_dst.s_addr = htonl(0x0a2a0001);  /* 10.42.0.1 */
+	iptcp->ip.ip_sum = in_cksum(&iptcp->ip, sizeof(iptcp->ip));
+
+	/* feth marks the TCP checksum as verified, so th_sum is left at 0 */
+	iptcp->tcp.th_sport = htons(sport);
+	iptcp->tcp.th_dport = htons(9);
+	iptcp->tcp.th_seq = htonl(seq0 + seg->gs_off);
+	iptcp->tcp.th_ack = htonl(1);
+	iptcp->tcp.th_off = sizeof(struct tcphdr) >> 2;
+	iptcp->tcp.th_flags = seg->gs_flags;
+	iptcp->tcp.th_win = htons(65535);
+
+	payload = (uint8_t *)(iptcp + 1);
+	memset(payload, (int)(seg->gs_off / GRO_MSS), GRO_MSS);
+}
+
+#define STAT_DELTA(f)   (after.f - before.f)
+
+static bool
+gro_stats_match(const struct if_gro_stats *want, const struct if_gro_stats *got)
+{
+	T_LOG("pkts %llu merged %llu aggs %llu psh %llu ooo %llu size %llu "
+	    "mismatch %llu evict %llu batch %llu",
+	    got->ifgro_pkts, got->ifgro_merged, got->ifgro_aggs,
+	    got->ifgro_flush_psh, got->ifgro_flush_ooo, got->ifgro_flush_size,
+	    got->ifgro_flush_mismatch, got->ifgro_flush_evict,
+	    got->ifgro_flush_batch);
+	return bcmp(want, got, sizeof(*want)) == 0;
+}
+
+/*
+ * Send the segments as one batch of a new flow until the counters of
+ * the receiving interface move exactly as expected for a single batch.
+ */
+static void
+gro_check(const char *what, const struct gro_seg *segs, int nsegs,
+    const struct if_gro_stats *want)
+{
+	struct iovec iovs[GRO_MAX_SEGS];
+	ether_addr_t src, dst;
+	struct if_gro_stats before, after, delta;
+	ssize_t total, nwritten;
+
+	T_QUIET; T_ASSERT_LE(nsegs, GRO_MAX_SEGS, NULL);
+	ifnet_get_lladdr(s_fd, ifname1, &src);
+	ifnet_get_lladdr(s_fd, ifname2, &dst);
+
+	for (int attempt = 0; attempt < GRO_ATTEMPTS; attempt++) {
+		uint16_t sport = next_port++;
+
+		total = 0;
+		for (int i = 0; i < nsegs; i++) {
+			make_segment(&iovs[i], &src, &dst, sport, 1000, &segs[i]);
+			total += (ssize_t)iovs[i].iov_len;
+		}
+
+		get_gro_stats(&before);
+		nwritten = writev(bpf_fd, iovs, nsegs);
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(nwritten, "write bpf");
+		T_QUIET; T_ASSERT_EQ(nwritten, total, "bpf wrote the whole batch");
+		for (int i = 0; i < nsegs; i++) {
+			free(iovs[i].iov_base);
+		}
+
+		/* give the input thread time to process the batch */
+		usleep(100000);
+		get_gro_stats(&after);
+
+		delta.ifgro_pkts = STAT_DELTA(ifgro_pkts);
+		delta.ifgro_merged = STAT_DELTA(ifgro_merged);
+		delta.ifgro_aggs = STAT_DELTA(ifgro_aggs);
+		delta.ifgro_flush_psh = STAT_DELTA(ifgro_flush_psh);
+		delta.ifgro_flush_ooo = STAT_DELTA(ifgro_flush_ooo);
+		delta.ifgro_flush_size = STAT_DELTA(ifgro_flush_size);
+		delta.ifgro_flush_mismatch = STAT_DELTA(ifgro_flush_mismatch);
+		delta.ifgro_flush_evict = STAT_DELTA(ifgro_flush_evict);
+		delta.ifgro_flush_batch = STAT_DELTA(ifgro_flush_batch);
+		if (gro_stats_match(want, &delta)) {
+			T_PASS("%s: counters match after %d attempt(s)", what, attempt + 1);
+			return;
+		}
+		T_LOG("%s: batch was split or not merged as expected, resending", what);
+	}
+	T_FAIL("%s: counters never matched a single input batch", what);
+}
+
+T_DECL(net_gro_merge, "in-order segments are merged into one aggregate")
+{
+	const struct gro_seg segs[] = {
+		{ 0 * GRO_MSS, TH_ACK },
+		{ 1 * GRO_MSS, TH_ACK },
+		{ 2 * GRO_MSS, TH_ACK },
+		{ 3 * GRO_MSS, TH_ACK },
+	};
+	const struct if_gro_stats want = {
+		.ifgro_pkts = 4,
+		.ifgro_merged = 3,
+		.ifgro_aggs = 1,
+		.ifgro_flush_batch = 1,
+	};
+
+	init();
+	gro_check("merge", segs, 4, &want);
+}
+
+T_DECL(net_gro_psh, "PSH closes the aggregate it is merged into")
+{
+	const struct gro_seg segs[] = {
+		{ 0 * GRO_MSS, TH_ACK },
+		{ 1 * GRO_MSS, TH_ACK },
+		{ 2 * GRO_MSS, TH_ACK | TH_PUSH },
+		{ 3 * GRO_MSS, TH_ACK | TH_PUSH },
+	};
+	/* the last segment can't start an aggregate because of its PSH */
+	const struct if_gro_stats want = {
+		.ifgro_pkts = 4,
+		.ifgro_merged = 2,
+		.ifgro_aggs = 1,
+		.ifgro_flush_psh = 1,
+	};
+
+	init();
+	gro_check("psh", segs, 4, &want);
+}
+
+T_DECL(net_gro_ooo, "an out-of-order segment closes the aggregate")
+{
+	const struct gro_seg segs[] = {
+		{ 0 * GRO_MSS, TH_ACK },
+		{ 1 * GRO_MSS, TH_ACK },
+		{ 3 * GRO_MSS, TH_ACK },
+		{ 4 * GRO_MSS, TH_ACK },
+	};
+	/* the segment after the hole starts a second aggregate */
+	const struct if_gro_stats want = {
+		.ifgro_pkts = 4,
+		.ifgro_merged = 2,
+		.ifgro_aggs = 2,
+		.ifgro_flush_ooo = 1,
+		.ifgro_flush_batch = 1,
+	};
+
+	init();
+	gro_check("ooo", segs, 4, &want);
+}
+
+T_DECL(net_gro_noagg, "SIOCSIFNOGRO turns aggregation off for the interface")
+{
+	const struct gro_seg segs[] = {
+		{ 0 * GRO_MSS, TH_ACK },
+		{ 1 * GRO_MSS, TH_ACK },
+	};
+	const struct if_gro_stats want = { };
+	struct ifreq ifr;
+
+	init();
+	bzero(&ifr, sizeof(ifr));
+	strlcpy(ifr.ifr_name, ifname2, sizeof(ifr.ifr_name));
+	ifr.ifr_intval = 1;
+	T_ASSERT_POSIX_SUCCESS(ioctl(s_fd, SIOCSIFNOGRO, &ifr), "SIOCSIFNOGRO %s", ifname2);
+	gro_check("nogro", segs, 2, &want);
+}
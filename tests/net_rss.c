@@ -0,0 +1,297 @@
+/*
+ * Copyright (c) 2024 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Receive side scaling in DLIL (net.link.generic.system.rss_queues).
+ *
+ * Frames are written with BPF on one end of a feth pair attached after
+ * turning RSS on, and the per queue counters of the peer
+ * (net.link.generic.system.rss_queue_stats) tell which input thread each
+ * one was queued to.  Every packet of a flow must go to the same thread,
+ * flows must be spread over more than one, and non-IP traffic and
+ * interfaces lowered to one queue (SIOCSIFRSSQUEUES) use the regular
+ * input thread.
+ */
+
+#include <darwintest.h>
+
+#include <sys/ioctl.h>
+#include <sys/param.h>
+#include <sys/sysctl.h>
+
+#include <net/if.h>
+#include <net/if_private.h>
+#include <net/ethernet.h>
+
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "net_test_lib.h"
+#include "bpflib.h"
+#include "in_cksum.h"
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.net"),
+	T_META_ASROOT(true),
+	T_META_RADAR_COMPONENT_NAME("xnu"),
+	T_META_RADAR_COMPONENT_VERSION("networking"),
+	T_META_CHECK_LEAKS(false));
+
+#define RSS_QUEUES              4
+#define RSS_MAX_QUEUES          16
+#define RSS_FLOWS               16
+#define RSS_PKTS_PER_FLOW       4
+#define RSS_ATTEMPTS            5
+
+static int s_fd = -1;
+static int bpf_fd = -1;
+static char ifname1[IF_NAMESIZE];
+static char ifname2[IF_NAMESIZE];
+static int ifindex2;
+static int saved_rss_queues = -1;
+static ether_addr_t src_ea, dst_ea;
+
+static void
+cleanup(void)
+{
+	if (bpf_fd != -1) {
+		(void) close(bpf_fd);
+	}
+	if (s_fd != -1) {
+		(void) ifnet_destroy(s_fd, ifname1, false);
+		(void) ifnet_destroy(s_fd, ifname2, false);
+		(void) close(s_fd);
+	}
+	if (saved_rss_queues != -1) {
+		(void) sysctlbyname("net.link.generic.system.rss_queues", NULL, NULL,
+		    &saved_rss_queues, sizeof(saved_rss_queues));
+	}
+}
+
+static uint32_t
+get_rss_queues(void)
+{
+	struct ifreq ifr;
+
+	bzero(&ifr, sizeof(ifr));
+	strlcpy(ifr.ifr_name, ifname2, sizeof(ifr.ifr_name));
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(ioctl(s_fd, SIOCGIFRSSQUEUES, &ifr),
+	    "SIOCGIFRSSQUEUES %s", ifname2);
+	return ifr.ifr_rss_queues;
+}
+
+static int
+set_rss_queues(uint32_t n)
+{
+	struct ifreq ifr;
+
+	bzero(&ifr, sizeof(ifr));
+	strlcpy(ifr.ifr_name, ifname2, sizeof(ifr.ifr_name));
+	ifr.ifr_rss_queues = n;
+	return ioctl(s_fd, SIOCSIFRSSQUEUES, &ifr);
+}
+
+static uint32_t
+init(void)
+{
+	int value = RSS_QUEUES;
+	size_t len = sizeof(saved_rss_queues);
+	int ncpu = 0;
+	size_t ncpu_len = sizeof(ncpu);
+	uint32_t nqueues;
+
+	T_ATEND(cleanup);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("hw.ncpu", &ncpu, &ncpu_len,
+	    NULL, 0), "hw.ncpu");
+	if (ncpu < 2) {
+		T_SKIP("RSS needs more than one CPU");
+	}
+
+	/* the input threads are created at attach */
+	T_ASSERT_POSIX_SUCCESS(sysctlbyname("net.link.generic.system.rss_queues",
+	    &saved_rss_queues, &len, &value, sizeof(value)),
+	    "rss_queues %d -> %d", saved_rss_queues, value);
+
+	s_fd = inet_dgram_socket();
+	strlcpy(ifname1, FETH_NAME, sizeof(ifname1));
+	T_ASSERT_POSIX_ZERO(ifnet_create_2(s_fd, ifname1, sizeof(ifname1)), NULL);
+	strlcpy(ifname2, FETH_NAME, sizeof(ifname2));
+	T_ASSERT_POSIX_ZERO(ifnet_create_2(s_fd, ifname2, sizeof(ifname2)), NULL);
+	T_ASSERT_POSIX_ZERO(fake_set_peer(s_fd, ifname1, ifname2), NULL);
+	T_ASSERT_POSIX_ZERO(ifnet_set_flags(s_fd, ifname1, IFF_UP, 0), NULL);
+	T_ASSERT_POSIX_ZERO(ifnet_set_flags(s_fd, ifname2, IFF_UP, 0), NULL);
+	ifindex2 = (int)if_nametoindex(ifname2);
+	T_ASSERT_GT(ifindex2, 0, "%s index", ifname2);
+	ifnet_get_lladdr(s_fd, ifname1, &src_ea);
+	ifnet_get_lladdr(s_fd, ifname2, &dst_ea);
+
+	T_ASSERT_POSIX_SUCCESS(bpf_fd = bpf_new(), NULL);
+	T_ASSERT_POSIX_SUCCESS(bpf_setif(bpf_fd, ifname1), "bpf set if %s", ifname1);
+	T_ASSERT_POSIX_SUCCESS(bpf_set_header_complete(bpf_fd, 1), NULL);
+
+	nqueues = get_rss_queues();
+	T_ASSERT_EQ(nqueues, (uint32_t)MIN(RSS_QUEUES, ncpu), "%s has %u RSS queues",
+	    ifname2, nqueues);
+	return nqueues;
+}
+
+static uint32_t
+get_rss_stats(struct if_rss_queue_stats *stats)
+{
+	int mib[CTL_MAXNAME];
+	size_t miblen = CTL_MAXNAME;
+	size_t len = RSS_MAX_QUEUES * sizeof(*stats);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlnametomib("net.link.generic.system.rss_queue_stats",
+	    mib, &miblen), NULL);
+	mib[miblen++] = ifindex2;
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctl(mib, (u_int)miblen, stats, &len, NULL, 0),
+	    "rss_queue_stats %s", ifname2);
+	T_QUIET; T_ASSERT_EQ(len % sizeof(*stats), 0UL, NULL);
+	return (uint32_t)(len / sizeof(*stats));
+}
+
+/* One Ethernet frame: IPv4/UDP from sport when ip is set, else ARP sized junk */
+static void
+send_frame(bool ip, uint16_t sport)
+{
+	ether_packet pkt;
+	ether_header_t *eh = (ether_header_t *)(void *)&pkt;
+	size_t len = ETHER_HDR_LEN + sizeof(ip_udp_header_t) + 32;
+
+	bzero(&pkt, sizeof(pkt));
+	bcopy(&src_ea, eh->ether_shost, ETHER_ADDR_LEN);
+	bcopy(&dst_ea, eh->ether_dhost, ETHER_ADDR_LEN);
+
+	if (ip) {
+		ip_udp_header_t *ipudp = (ip_udp_header_t *)(void *)(eh + 1);
+
+		eh->ether_type = htons(ETHERTYPE_IP);
+		ipudp->ip.ip_v = IPVERSION;
+		ipudp->ip.ip_hl = sizeof(struct ip) >> 2;
+		ipudp->ip.ip_len = htons((uint16_t)(sizeof(*ipudp) + 32));
+		ipudp->ip.ip_ttl = MAXTTL;
+		ipudp->ip.ip_p = IPPROTO_UDP;
+		ipudp->ip.ip_src.s_addr = htonl(0x0a2b0002);  /* 10.43.0.2 */
+		ipudp->ip.ip_dst.s_addr = htonl(0x0a2b0001);  /* 10.43.0.1 */
+		ipudp->ip.ip_sum = in_cksum(&ipudp->ip, sizeof(ipudp->ip));
+		ipudp->udp.uh_sport = htons(sport);
+		ipudp->udp.uh_dport = htons(9);
+		ipudp->udp.uh_ulen = htons(sizeof(ipudp->udp) + 32);
+	} else {
+		eh->ether_type = htons(ETHERTYPE_ARP);
+	}
+
+	T_QUIET; T_ASSERT_EQ(write(bpf_fd, &pkt, len), (ssize_t)len, "write bpf");
+}
+
+/*
+ * Send RSS_PKTS_PER_FLOW frames of a flow and return the one queue they
+ * were all queued to, retrying if stray traffic got in the way.
+ */
+static uint32_t
+flow_queue(bool ip, uint16_t sport)
+{
+	struct if_rss_queue_stats before[RSS_MAX_QUEUES], after[RSS_MAX_QUEUES];
+
+	for (int attempt = 0; attempt < RSS_ATTEMPTS; attempt++) {
+		uint32_t n, q, found = UINT32_MAX;
+		bool stray = false;
+
+		n = get_rss_stats(before);
+		for (int i = 0; i < RSS_PKTS_PER_FLOW; i++) {
+			send_frame(ip, sport);
+		}
+		T_QUIET; T_ASSERT_EQ(get_rss_stats(after), n, NULL);
+
+		for (q = 0; q < n; q++) {
+			uint64_t delta = after[q].ifrq_packets - before[q].ifrq_packets;
+
+			if (delta == RSS_PKTS_PER_FLOW && found == UINT32_MAX) {
+				found = q;
+			} else if (delta != 0) {
+				stray = true;
+			}
+		}
+		if (found != UINT32_MAX && !stray) {
+			return found;
+		}
+		T_LOG("port %u: packets not all on one queue, resending", sport);
+	}
+	T_FAIL("port %u: packets of the flow were spread over several queues", sport);
+	return UINT32_MAX;
+}
+
+T_DECL(net_rss_flows, "a flow sticks to one input thread and flows are spread")
+{
+	uint32_t nqueues = init();
+	uint32_t used = 0;
+
+	for (uint16_t f = 0; f < RSS_FLOWS; f++) {
+		uint32_t q = flow_queue(true, (uint16_t)(30000 + f));
+
+		T_QUIET; T_ASSERT_LT(q, nqueues, "port %u queue", 30000 + f);
+		T_QUIET; T_ASSERT_EQ(flow_queue(true, (uint16_t)(30000 + f)), q,
+		    "port %u stays on queue %u", 30000 + f, q);
+		used |= 1u << q;
+	}
+	T_EXPECT_GT(__builtin_popcount(used), 1, "%d flows used queues 0x%x",
+	    RSS_FLOWS, used);
+}
+
+T_DECL(net_rss_non_ip, "non-IP frames go to the regular input thread")
+{
+	(void) init();
+	T_EXPECT_EQ(flow_queue(false, 0), 0u, "ARP frames on queue 0");
+}
+
+T_DECL(net_rss_set_queues, "SIOCSIFRSSQUEUES lowers the queues flows hash onto")
+{
+	uint32_t nqueues = init();
+
+	T_EXPECT_POSIX_FAILURE(set_rss_queues(0), EINVAL, "0 queues");
+	T_EXPECT_POSIX_FAILURE(set_rss_queues(nqueues + 1), EINVAL,
+	    "%u queues", nqueues + 1);
+
+	T_ASSERT_POSIX_SUCCESS(set_rss_queues(1), "1 queue");
+	T_ASSERT_EQ(get_rss_queues(), 1u, NULL);
+	for (uint16_t f = 0; f < RSS_FLOWS; f++) {
+		T_QUIET; T_ASSERT_EQ(flow_queue(true, (uint16_t)(30000 + f)), 0u,
+		    "port %u on queue 0", 30000 + f);
+	}
+	T_PASS("%d flows on queue 0", RSS_FLOWS);
+
+	T_ASSERT_POSIX_SUCCESS(set_rss_queues(nqueues), "%u queues", nqueues);
+	T_ASSERT_EQ(get_rss_queues(), nqueues, NULL);
+}
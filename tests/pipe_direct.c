@@ -0,0 +1,186 @@
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/event.h>
+#include <sys/ioctl.h>
+#include <sys/param.h>
+#include <sys/mman.h>
+#include <sys/sysctl.h>
+
+#include <darwintest.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("xnu.ipc"),
+    T_META_RADAR_COMPONENT_NAME("xnu"),
+    T_META_RADAR_COMPONENT_VERSION("IPC"),
+    T_META_RUN_CONCURRENTLY(true));
+
+#define DIRECT_WRITE_SIZE (4 << 20)
+
+struct writer_args {
+	int      fd;
+	uint8_t *buf;
+	size_t   len;
+	ssize_t  written;
+	int      error;
+};
+
+static void *
+writer_thread(void *arg)
+{
+	struct writer_args *wa = arg;
+
+	wa->written = write(wa->fd, wa->buf, wa->len);
+	wa->error = wa->written < 0 ? errno : 0;
+	return NULL;
+}
+
+static uint8_t *
+pattern_alloc(size_t len)
+{
+	uint8_t *buf = mmap(NULL, len, PROT_READ | PROT_WRITE,
+	    MAP_ANON | MAP_PRIVATE, -1, 0);
+
+	T_QUIET; T_ASSERT_NE((void *)buf, MAP_FAILED, "mmap");
+	for (size_t i = 0; i < len; i++) {
+		buf[i] = (uint8_t)(i * 7 + (i >> 12));
+	}
+	return buf;
+}
+
+T_DECL(pipe_direct_write, "large aligned pipe writes are read back intact")
+{
+	struct writer_args wa = { .len = DIRECT_WRITE_SIZE };
+	uint8_t *rbuf = malloc(DIRECT_WRITE_SIZE);
+	unsigned int direct_min;
+	size_t direct_min_len = sizeof(direct_min);
+	size_t nread = 0;
+	pthread_t th;
+	int fds[2];
+	int avail = 0;
+
+	T_ASSERT_POSIX_SUCCESS(sysctlbyname("kern.ipc.pipe_direct_min",
+	    &direct_min, &direct_min_len, NULL, 0), "kern.ipc.pipe_direct_min");
+	T_QUIET; T_ASSERT_NOTNULL(rbuf, "malloc");
+
+	T_ASSERT_POSIX_SUCCESS(pipe(fds), NULL);
+	wa.fd = fds[1];
+	wa.buf = pattern_alloc(wa.len);
+	T_ASSERT_POSIX_ZERO(pthread_create(&th, NULL, writer_thread, &wa), NULL);
+
+	/* the pending write must be visible to FIONREAD before it is read */
+	while (avail == 0) {
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(ioctl(fds[0], FIONREAD, &avail), NULL);
+		if (avail == 0) {
+			usleep(1000);
+		}
+	}
+	T_EXPECT_GT(avail, 0, "FIONREAD sees the pending write");
+
+	/* use an odd read size so reads straddle the write's pages */
+	while (nread < wa.len) {
+		size_t chunk = MIN(wa.len - nread, (size_t)12345);
+		ssize_t n = read(fds[0], rbuf + nread, chunk);
+
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(n, "read");
+		T_QUIET; T_ASSERT_GT(n, 0L, "read made progress");
+		nread += (size_t)n;
+	}
+
+	T_ASSERT_POSIX_ZERO(pthread_join(th, NULL), NULL);
+	T_ASSERT_EQ(wa.written, (ssize_t)wa.len, "write completed");
+	T_ASSERT_EQ(memcmp(rbuf, wa.buf, wa.len), 0, "data read back intact");
+
+	munmap(wa.buf, wa.len);
+	free(rbuf);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+T_DECL(pipe_direct_write_reader_closes, "a direct write fails when the reader goes away")
+{
+	struct writer_args wa = { .len = DIRECT_WRITE_SIZE };
+	uint8_t rbuf[4096];
+	pthread_t th;
+	int fds[2];
+
+	T_SETUPBEGIN;
+	signal(SIGPIPE, SIG_IGN);
+	T_ASSERT_POSIX_SUCCESS(pipe(fds), NULL);
+	wa.fd = fds[1];
+	wa.buf = pattern_alloc(wa.len);
+	T_SETUPEND;
+
+	T_ASSERT_POSIX_ZERO(pthread_create(&th, NULL, writer_thread, &wa), NULL);
+
+	T_ASSERT_EQ(read(fds[0], rbuf, sizeof(rbuf)), (ssize_t)sizeof(rbuf),
+	    "read the start of the write");
+	T_EXPECT_EQ(memcmp(rbuf, wa.buf, sizeof(rbuf)), 0, "data intact");
+	close(fds[0]);
+
+	T_ASSERT_POSIX_ZERO(pthread_join(th, NULL), NULL);
+	if (wa.written < 0) {
+		T_EXPECT_EQ(wa.error, EPIPE, "write failed with EPIPE");
+	} else {
+		T_EXPECT_LT(wa.written, (ssize_t)wa.len, "write was cut short");
+	}
+
+	munmap(wa.buf, wa.len);
+	close(fds[1]);
+}
+
+T_DECL(pipe_direct_write_kevent, "EVFILT_WRITE fires once a direct write drains")
+{
+	struct writer_args wa = { .len = DIRECT_WRITE_SIZE };
+	struct timespec timeout = { .tv_sec = 5 };
+	uint8_t *rbuf = malloc(DIRECT_WRITE_SIZE);
+	struct kevent ev;
+	size_t nread = 0;
+	pthread_t th;
+	int fds[2];
+	int avail = 0;
+	int kq;
+
+	T_SETUPBEGIN;
+	T_QUIET; T_ASSERT_NOTNULL(rbuf, "malloc");
+	T_ASSERT_POSIX_SUCCESS(pipe(fds), NULL);
+	T_ASSERT_POSIX_SUCCESS(kq = kqueue(), NULL);
+	wa.fd = fds[1];
+	wa.buf = pattern_alloc(wa.len);
+	T_SETUPEND;
+
+	T_ASSERT_POSIX_ZERO(pthread_create(&th, NULL, writer_thread, &wa), NULL);
+	while (avail == 0) {
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(ioctl(fds[0], FIONREAD, &avail), NULL);
+		if (avail == 0) {
+			usleep(1000);
+		}
+	}
+
+	/* registered while the write is pending, so it must not fire yet */
+	EV_SET(&ev, fds[1], EVFILT_WRITE, EV_ADD | EV_CLEAR, 0, 0, NULL);
+	T_ASSERT_POSIX_SUCCESS(kevent(kq, &ev, 1, NULL, 0, NULL), "EVFILT_WRITE");
+
+	while (nread < wa.len) {
+		ssize_t n = read(fds[0], rbuf + nread, wa.len - nread);
+
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(n, "read");
+		T_QUIET; T_ASSERT_GT(n, 0L, "read made progress");
+		nread += (size_t)n;
+	}
+	T_ASSERT_POSIX_ZERO(pthread_join(th, NULL), NULL);
+	T_ASSERT_EQ(wa.written, (ssize_t)wa.len, "write completed");
+
+	T_ASSERT_EQ(kevent(kq, NULL, 0, &ev, 1, &timeout), 1,
+	    "EVFILT_WRITE fired after the pipe drained");
+	T_EXPECT_EQ(ev.filter, (int16_t)EVFILT_WRITE, NULL);
+	T_EXPECT_GT(ev.data, 0L, "space is available");
+
+	munmap(wa.buf, wa.len);
+	free(rbuf);
+	close(kq);
+	close(fds[0]);
+	close(fds[1]);
+}
@@ -66,6 +66,7 @@ static uint64_t global_flags = 0;
 #define PARSE_STACKSHOT_DRIVERKIT            0x4000
 #define PARSE_STACKSHOT_THROTTLED_SP         0x8000
 #define PARSE_STACKSHOT_SUSPENDINFO          0x10000
+#define PARSE_STACKSHOT_PARALLEL             0x20000
 
 /* keys for 'extra' dictionary for parse_stackshot */
 static const NSString* zombie_child_pid_key = @"zombie_child_pid"; // -> @(pid), required for PARSE_STACKSHOT_ZOMBIE
@@ -278,6 +279,63 @@ T_DECL(simple_compressed, "take a simple compressed stackshot")
 	});
 }
 
+T_DECL(simple_lz4_compressed, "take a simple LZ4 compressed stackshot")
+{
+	struct scenario scenario = {
+		.name = "kcdata_lz4_compressed",
+		.flags = (STACKSHOT_DO_COMPRESS | STACKSHOT_DO_COMPRESS_LZ4 | STACKSHOT_SAVE_LOADINFO |
+				STACKSHOT_THREAD_WAITINFO | STACKSHOT_GET_GLOBAL_MEM_STATS |
+				STACKSHOT_SAVE_IMP_DONATION_PIDS | STACKSHOT_KCDATA_FORMAT),
+	};
+
+	T_LOG("taking LZ4 compressed kcdata stackshot");
+	take_stackshot(&scenario, false, ^(void *ssbuf, size_t sslen) {
+		parse_stackshot(0, ssbuf, sslen, nil);
+	});
+}
+
+/* helper CPUs must have recorded tasks unless there is only one CPU */
+static uint64_t
+parallel_parse_flags(void)
+{
+	int ncpu = 0;
+	size_t len = sizeof(ncpu);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("hw.ncpu", &ncpu, &len, NULL, 0), "hw.ncpu");
+	return (ncpu > 1) ? PARSE_STACKSHOT_PARALLEL : 0;
+}
+
+T_DECL(parallel, "take a stackshot with the task walk spread across CPUs")
+{
+	uint64_t parse_flags = parallel_parse_flags();
+	struct scenario scenario = {
+		.name = "kcdata_parallel",
+		.flags = (STACKSHOT_PARALLEL | STACKSHOT_SAVE_LOADINFO | STACKSHOT_THREAD_WAITINFO |
+				STACKSHOT_GET_GLOBAL_MEM_STATS | STACKSHOT_SAVE_IMP_DONATION_PIDS | STACKSHOT_KCDATA_FORMAT),
+	};
+
+	T_LOG("taking parallel kcdata stackshot");
+	take_stackshot(&scenario, true, ^(void *ssbuf, size_t sslen) {
+		parse_stackshot(parse_flags, ssbuf, sslen, nil);
+	});
+}
+
+T_DECL(parallel_compressed, "take a compressed stackshot with the task walk spread across CPUs")
+{
+	uint64_t parse_flags = parallel_parse_flags();
+	struct scenario scenario = {
+		.name = "kcdata_parallel_compressed",
+		.flags = (STACKSHOT_PARALLEL | STACKSHOT_DO_COMPRESS | STACKSHOT_SAVE_LOADINFO |
+				STACKSHOT_THREAD_WAITINFO | STACKSHOT_GET_GLOBAL_MEM_STATS |
+				STACKSHOT_SAVE_IMP_DONATION_PIDS | STACKSHOT_KCDATA_FORMAT),
+	};
+
+	T_LOG("taking parallel compressed kcdata stackshot");
+	take_stackshot(&scenario, false, ^(void *ssbuf, size_t sslen) {
+		parse_stackshot(parse_flags, ssbuf, sslen, nil);
+	});
+}
+
 T_DECL(panic_compressed, "take a compressed stackshot with the same flags as a panic stackshot")
 {
 	uint64_t stackshot_flags = (STACKSHOT_SAVE_KEXT_LOADINFO |
@@ -2536,6 +2594,7 @@ parse_stackshot(uint64_t stackshot_parsing_flags, void *ssbuf, size_t sslen, NSD
 	bool expect_asyncstack = (stackshot_parsing_flags & PARSE_STACKSHOT_ASYNCSTACK);
 	bool expect_driverkit = (stackshot_parsing_flags & PARSE_STACKSHOT_DRIVERKIT);
 	bool expect_suspendinfo = (stackshot_parsing_flags & PARSE_STACKSHOT_SUSPENDINFO);
+	bool expect_parallel = (stackshot_parsing_flags & PARSE_STACKSHOT_PARALLEL);
 	bool found_zombie_child = false, found_postexec_child = false, found_shared_cache_layout = false, found_shared_cache_uuid = false;
 	bool found_translated_child = false, found_transitioning_task = false;
 	bool found_dispatch_queue_label = false, found_turnstile_lock = false;
@@ -2543,6 +2602,7 @@ parse_stackshot(uint64_t stackshot_parsing_flags, void *ssbuf, size_t sslen, NSD
 	bool found_sharedcache_child = false, found_sharedcache_badflags = false, found_sharedcache_self = false;
 	bool found_asyncstack = false;
 	bool found_throttled_service = false;
+	bool found_parallel_cpus = false;
 	uint64_t srp_expected_threadid = 0;
 	pid_t zombie_child_pid = -1, srp_expected_pid = -1, sharedcache_child_pid = -1, throttled_service_ctx = -1;
 	pid_t translated_child_pid = -1, transistioning_task_pid = -1;
@@ -2708,50 +2768,65 @@ parse_stackshot(uint64_t stackshot_parsing_flags, void *ssbuf, size_t sslen, NSD
 				iter = kcdata_iter_next(iter);
 			}
 
-			T_ASSERT_EQ(compression_type, UINT64_C(1), "zlib compression is used");
+			T_ASSERT_TRUE(compression_type == KCDCT_ZLIB || compression_type == KCDCT_LZ4,
+					"zlib or LZ4 compression is used");
 			T_ASSERT_GT(totalout, UINT64_C(0), "successfully gathered how long the compressed buffer is");
 			T_ASSERT_GT(totalin, UINT64_C(0), "successfully gathered how long the uncompressed buffer will be at least");
 
 			/* progress to the next kcdata item */
 			T_ASSERT_EQ(kcdata_iter_type(iter), KCDATA_BUFFER_BEGIN_STACKSHOT, "compressed stackshot found");
 
-			char *bufferBase = kcdata_iter_payload(iter);
+			if (compression_type == KCDCT_LZ4) {
+				NSError *error = nil;
+				NSData *decompressed = decompressKCDataBuffer(ssbuf, (uint32_t)sslen, &error);
+				T_ASSERT_NOTNULL(decompressed, "decoded LZ4 blocks: %s",
+						error ? [[error description] UTF8String] : "ok");
 
-			/*
-			 * zlib is used, allocate a buffer based on the metadata, plus
-			 * extra scratch space (+12.5%) in case totalin was inconsistent
-			 */
-			size_t inflatedBufferSize = totalin + (totalin >> 3);
-			inflatedBufferBase = malloc(inflatedBufferSize);
-			T_QUIET; T_WITH_ERRNO; T_ASSERT_NOTNULL(inflatedBufferBase, "allocated temporary output buffer");
-
-			z_stream zs;
-			memset(&zs, 0, sizeof(zs));
-			T_QUIET; T_ASSERT_EQ(inflateInit(&zs), Z_OK, "inflateInit OK");
-			zs.next_in = (unsigned char *)bufferBase;
-			T_QUIET; T_ASSERT_LE(totalout, (uint64_t)UINT_MAX, "stackshot is not too large");
-			zs.avail_in = (uInt)totalout;
-			zs.next_out = (unsigned char *)inflatedBufferBase;
-			T_QUIET; T_ASSERT_LE(inflatedBufferSize, (size_t)UINT_MAX, "output region is not too large");
-			zs.avail_out = (uInt)inflatedBufferSize;
-			T_ASSERT_EQ(inflate(&zs, Z_FINISH), Z_STREAM_END, "inflated buffer");
-			inflateEnd(&zs);
-
-			T_ASSERT_EQ((uint64_t)zs.total_out, totalin, "expected number of bytes inflated");
+				inflatedBufferBase = malloc(decompressed.length);
+				T_QUIET; T_WITH_ERRNO; T_ASSERT_NOTNULL(inflatedBufferBase, "allocated temporary output buffer");
+				memcpy(inflatedBufferBase, decompressed.bytes, decompressed.length);
+
+				/* skip the inner stackshot header, the zlib stream doesn't have one */
+				iter = kcdata_iter_next(kcdata_iter(inflatedBufferBase, decompressed.length));
+			} else {
+				char *bufferBase = kcdata_iter_payload(iter);
+
+				/*
+				 * zlib is used, allocate a buffer based on the metadata, plus
+				 * extra scratch space (+12.5%) in case totalin was inconsistent
+				 */
+				size_t inflatedBufferSize = totalin + (totalin >> 3);
+				inflatedBufferBase = malloc(inflatedBufferSize);
+				T_QUIET; T_WITH_ERRNO; T_ASSERT_NOTNULL(inflatedBufferBase, "allocated temporary output buffer");
+
+				z_stream zs;
+				memset(&zs, 0, sizeof(zs));
+				T_QUIET; T_ASSERT_EQ(inflateInit(&zs), Z_OK, "inflateInit OK");
+				zs.next_in = (unsigned char *)bufferBase;
+				T_QUIET; T_ASSERT_LE(totalout, (uint64_t)UINT_MAX, "stackshot is not too large");
+				zs.avail_in = (uInt)totalout;
+				zs.next_out = (unsigned char *)inflatedBufferBase;
+				T_QUIET; T_ASSERT_LE(inflatedBufferSize, (size_t)UINT_MAX, "output region is not too large");
+				zs.avail_out = (uInt)inflatedBufferSize;
+				T_ASSERT_EQ(inflate(&zs, Z_FINISH), Z_STREAM_END, "inflated buffer");
+				inflateEnd(&zs);
+
+				T_ASSERT_EQ((uint64_t)zs.total_out, totalin, "expected number of bytes inflated");
 			
-			/* copy the data after the compressed area */
-			T_QUIET; T_ASSERT_GE((void *)bufferBase, ssbuf,
-					"base of compressed stackshot is after the returned stackshot buffer");
-			size_t header_size = (size_t)(bufferBase - (char *)ssbuf);
-			size_t data_after_compressed_size = sslen - totalout - header_size;
-			T_QUIET; T_ASSERT_LE(data_after_compressed_size,
-					inflatedBufferSize - zs.total_out,
-					"footer fits in the buffer");
-			memcpy(inflatedBufferBase + zs.total_out,
-					bufferBase + totalout,
-					data_after_compressed_size);
-
-			iter = kcdata_iter(inflatedBufferBase, inflatedBufferSize);
+				/* copy the data after the compressed area */
+				T_QUIET; T_ASSERT_GE((void *)bufferBase, ssbuf,
+						"base of compressed stackshot is after the returned stackshot buffer");
+				size_t header_size = (size_t)(bufferBase - (char *)ssbuf);
+				size_t data_after_compressed_size = sslen - totalout - header_size;
+				T_QUIET; T_ASSERT_LE(data_after_compressed_size,
+						inflatedBufferSize - zs.total_out,
+						"footer fits in the buffer");
+				memcpy(inflatedBufferBase + zs.total_out,
+						bufferBase + totalout,
+						data_after_compressed_size);
+
+				iter = kcdata_iter(inflatedBufferBase, inflatedBufferSize);
+			}
 		}
 	}
 
@@ -3205,6 +3280,17 @@ parse_stackshot(uint64_t stackshot_parsing_flags, void *ssbuf, size_t sslen, NSD
 			found_shared_cache_uuid = true;
 			break;
 		}
+		case KCDATA_TYPE_UINT32_DESC: {
+			char *desc;
+			uint32_t *data;
+
+			kcdata_iter_get_data_with_desc(iter, &desc, (void **)&data, NULL);
+			if (expect_parallel && strcmp(desc, "stackshot_parallel_cpus") == 0) {
+				T_QUIET; T_EXPECT_GT(*data, 0u, "helper CPUs recorded tasks");
+				found_parallel_cpus = true;
+			}
+			break;
+		}
 		}
 	}
 
@@ -3274,6 +3360,10 @@ parse_stackshot(uint64_t stackshot_parsing_flags, void *ssbuf, size_t sslen, NSD
 		T_QUIET; T_ASSERT_TRUE(found_asyncstack, "found async stack threadid");
 	}
 
+	if (expect_parallel) {
+		T_QUIET; T_ASSERT_TRUE(found_parallel_cpus, "found stackshot_parallel_cpus");
+	}
+
 
 	T_ASSERT_FALSE(KCDATA_ITER_FOREACH_FAILED(iter), "successfully iterated kcdata");
 
@@ -29,3 +29,9 @@ T_DECL(vm_map_non_aligned,
 {
 	T_EXPECT_EQ(1ull, run_sysctl_test("vm_map_non_aligned", 0), "vm_map_non_aligned");
 }
+
+T_DECL(vm_compressor_batch,
+    "Test that pages stored with vm_compressor_put_batch() decompress intact")
+{
+	T_EXPECT_EQ(1ull, run_sysctl_test("vm_compressor_batch", 0), "vm_compressor_batch");
+}
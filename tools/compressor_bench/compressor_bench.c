@@ -0,0 +1,680 @@
+/*
+ * compressor_bench.c
+ *
+ * Host-side benchmark for the VM compressor codecs.
+ *
+ * Links the unmodified WKdm assembly, osfmk/vm/lz4.c and the hybrid
+ * selector in osfmk/vm/vm_compressor_algorithms.c into a user-space driver
+ * that compresses and decompresses a synthetic (or file backed) page corpus
+ * through metacompressor() / metadecompressor(), exactly as
+ * c_compress_page() and c_decompress_page() do.
+ *
+ * Usage:
+ * compressor_bench [-c wk|lz4|hyb|all] [-n pages] [-i iterations]
+ *                  [-k zero|sv|pointer|text|random|mixed] [-f file]
+ *                  [-t tuneable=value ...] [-s seed] [-S]
+ *
+ * For every codec mode the tool reports compression and decompression
+ * throughput (MB/s of uncompressed data), the compression ratio, and a
+ * log2 histogram of per-page compression latency. In hybrid mode, every
+ * call is additionally classified by the decision compressor_selector_update()
+ * and compressor_preselect() made for it, with per-decision page counts,
+ * compressed bytes and latency.
+ *
+ * The -t option overrides fields of vmctune (e.g. -t lz4_threshold=3072)
+ * so selector heuristics can be evaluated without rebuilding. -S forces
+ * the scalar LZ4 encode loops where vector helpers are available.
+ *
+ * Build with the Makefile next to this file; it works on macOS and Linux.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "shim/compressor_bench_shim.h"
+#include <vm/vm_compressor_algorithms.h>
+
+extern vm_compressor_mode_t vm_compressor_current_codec;
+extern uint32_t vm_compressor_get_encode_scratch_size(void);
+extern uint32_t vm_compressor_get_decode_scratch_size(void);
+#if defined(__x86_64__)
+extern int lz4_encode_simd;
+#endif
+
+/* Matches the budget handed to metacompressor() by c_compress_page(). */
+#define CB_MAX_CSIZE            (PAGE_SIZE - 4)
+/* Codecs may store a little past the budget; give them room. */
+#define CB_DST_SLACK            (PAGE_SIZE)
+
+#define CB_HIST_BUCKETS         24      /* 1ns .. ~8ms, log2 */
+
+typedef struct {
+	uint64_t        hist[CB_HIST_BUCKETS];
+	uint64_t        count;
+	uint64_t        total_ns;
+	uint64_t        max_ns;
+} cb_latency_t;
+
+enum cb_decision {
+	CB_SEL_WK_EXCLUSIVE = 0,        /* WKdm result kept, LZ4 not evaluated */
+	CB_SEL_WK_FAIL_SKIPPED,         /* WKdm failed, LZ4 skipped by failure run */
+	CB_SEL_LZ4_PRESELECT,           /* LZ4 run preselected, WKdm not attempted */
+	CB_SEL_LZ4_PROFITABLE,          /* WKdm above lz4_threshold, LZ4 was smaller */
+	CB_SEL_LZ4_NEGATIVE,            /* WKdm above lz4_threshold, LZ4 was larger */
+	CB_SEL_LZ4_FAILURE,             /* LZ4 evaluated and failed */
+	CB_SEL_COUNT,
+};
+
+static const char *cb_decision_names[CB_SEL_COUNT] = {
+	[CB_SEL_WK_EXCLUSIVE]    = "wk-exclusive",
+	[CB_SEL_WK_FAIL_SKIPPED] = "wk-fail-lz4-skipped",
+	[CB_SEL_LZ4_PRESELECT]   = "lz4-preselect",
+	[CB_SEL_LZ4_PROFITABLE]  = "lz4-profitable",
+	[CB_SEL_LZ4_NEGATIVE]    = "lz4-negative",
+	[CB_SEL_LZ4_FAILURE]     = "lz4-failure",
+};
+
+typedef struct {
+	uint64_t        pages;
+	uint64_t        cbytes;
+	cb_latency_t    lat;
+} cb_decision_stats_t;
+
+typedef struct {
+	const char     *name;
+	vm_compressor_mode_t mode;
+
+	uint64_t        pages;
+	uint64_t        sv_pages;       /* single value, stored as 4 bytes */
+	uint64_t        incompressible; /* stored uncompressed */
+	uint64_t        cbytes;
+	uint64_t        lz4_pages;
+	uint64_t        wk_pages;
+
+	cb_latency_t    clat;
+	cb_latency_t    dlat;
+
+	cb_decision_stats_t decisions[CB_SEL_COUNT];
+} cb_result_t;
+
+typedef struct {
+	const char     *name;
+	void          (*fill)(uint8_t *page, size_t idx);
+} cb_kind_t;
+
+static uint64_t cb_seed = 0x5eed5eedull;
+
+static uint64_t
+cb_rand(void)
+{
+	/* xorshift64*, reproducible across hosts */
+	cb_seed ^= cb_seed >> 12;
+	cb_seed ^= cb_seed << 25;
+	cb_seed ^= cb_seed >> 27;
+	return cb_seed * 2685821657736338717ull;
+}
+
+#pragma mark corpus
+
+static void
+cb_fill_zero(uint8_t *page, __unused size_t idx)
+{
+	memset(page, 0, PAGE_SIZE);
+}
+
+static void
+cb_fill_sv(uint8_t *page, __unused size_t idx)
+{
+	uint32_t v = (uint32_t)cb_rand();
+
+	for (size_t i = 0; i < PAGE_SIZE / sizeof(v); i++) {
+		memcpy(page + i * sizeof(v), &v, sizeof(v));
+	}
+}
+
+/*
+ * Resembles a malloc heap: pointers into a few regions, small integers,
+ * zeroed padding and the occasional unrelated word.
+ */
+static void
+cb_fill_pointer(uint8_t *page, __unused size_t idx)
+{
+	static const uint64_t bases[] = {
+		0x0000000100000000ull, 0x0000600000000000ull,
+		0x00007ff800000000ull, 0x0000000280000000ull,
+	};
+
+	for (size_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++) {
+		uint64_t r = cb_rand();
+		uint64_t v;
+
+		switch (r & 7) {
+		case 0: case 1: case 2: case 3:
+			v = bases[(r >> 3) & 3] + ((r >> 16) & 0xffff0ull);
+			break;
+		case 4: case 5:
+			v = 0;
+			break;
+		case 6:
+			v = (r >> 32) & 0xff;
+			break;
+		default:
+			v = cb_rand();
+			break;
+		}
+		memcpy(page + i * sizeof(v), &v, sizeof(v));
+	}
+}
+
+static void
+cb_fill_text(uint8_t *page, __unused size_t idx)
+{
+	static const char *words[] = {
+		"the", "kernel", "page", "memory", "compressor", "segment",
+		"thread", "task", "of", "and", "to", "in", "is", "virtual",
+		"pressure", "swap", "pageout", "queue", "lock", "object",
+		"return", "static", "inline", "void", "struct", "int",
+		"if", "else", "while", "for", "{", "}", ";", "\n\t",
+	};
+	size_t off = 0;
+
+	while (off < PAGE_SIZE) {
+		const char *w = words[cb_rand() % (sizeof(words) / sizeof(words[0]))];
+		size_t len = MIN(strlen(w), PAGE_SIZE - off);
+
+		memcpy(page + off, w, len);
+		off += len;
+		if (off < PAGE_SIZE) {
+			page[off++] = ' ';
+		}
+	}
+}
+
+static void
+cb_fill_random(uint8_t *page, __unused size_t idx)
+{
+	for (size_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++) {
+		uint64_t v = cb_rand();
+		memcpy(page + i * sizeof(v), &v, sizeof(v));
+	}
+}
+
+static const cb_kind_t cb_kinds[] = {
+	{ "zero", cb_fill_zero },
+	{ "sv", cb_fill_sv },
+	{ "pointer", cb_fill_pointer },
+	{ "text", cb_fill_text },
+	{ "random", cb_fill_random },
+};
+#define CB_NKINDS (sizeof(cb_kinds) / sizeof(cb_kinds[0]))
+
+/*
+ * Roughly the mix seen on a pressured client: mostly heap, some text,
+ * a good share of zero-filled and single-value pages, little noise.
+ */
+static void
+cb_fill_mixed(uint8_t *page, size_t idx)
+{
+	static const uint8_t weights[CB_NKINDS] = { 15, 10, 45, 20, 10 };
+	uint64_t r = cb_rand() % 100;
+
+	for (size_t k = 0; k < CB_NKINDS; k++) {
+		if (r < weights[k]) {
+			cb_kinds[k].fill(page, idx);
+			return;
+		}
+		r -= weights[k];
+	}
+	cb_fill_random(page, idx);
+}
+
+static uint8_t *
+cb_corpus_from_file(const char *path, size_t *npages)
+{
+	struct stat st;
+	uint8_t *corpus;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		exit(1);
+	}
+	*npages = MIN(*npages, (size_t)st.st_size / PAGE_SIZE);
+	if (*npages == 0) {
+		fprintf(stderr, "%s: shorter than one page\n", path);
+		exit(1);
+	}
+
+	corpus = aligned_alloc(PAGE_SIZE, *npages * PAGE_SIZE);
+	for (size_t off = 0; off < *npages * PAGE_SIZE;) {
+		ssize_t n = read(fd, corpus + off, *npages * PAGE_SIZE - off);
+		if (n <= 0) {
+			fprintf(stderr, "%s: short read\n", path);
+			exit(1);
+		}
+		off += (size_t)n;
+	}
+	close(fd);
+	return corpus;
+}
+
+static uint8_t *
+cb_corpus_generate(const char *kind, size_t npages)
+{
+	void (*fill)(uint8_t *, size_t) = NULL;
+	uint8_t *corpus;
+
+	if (strcmp(kind, "mixed") == 0) {
+		fill = cb_fill_mixed;
+	}
+	for (size_t k = 0; fill == NULL && k < CB_NKINDS; k++) {
+		if (strcmp(kind, cb_kinds[k].name) == 0) {
+			fill = cb_kinds[k].fill;
+		}
+	}
+	if (fill == NULL) {
+		fprintf(stderr, "unknown corpus kind '%s'\n", kind);
+		exit(1);
+	}
+
+	corpus = aligned_alloc(PAGE_SIZE, npages * PAGE_SIZE);
+	for (size_t i = 0; i < npages; i++) {
+		fill(corpus + i * PAGE_SIZE, i);
+	}
+	return corpus;
+}
+
+#pragma mark measurement
+
+static void
+cb_latency_record(cb_latency_t *lat, uint64_t ns)
+{
+	unsigned b = ns ? (unsigned)(64 - __builtin_clzll(ns)) : 0;
+
+	lat->hist[MIN(b, CB_HIST_BUCKETS - 1)]++;
+	lat->count++;
+	lat->total_ns += ns;
+	lat->max_ns = MAX(lat->max_ns, ns);
+}
+
+static uint64_t
+cb_latency_percentile(const cb_latency_t *lat, double pct)
+{
+	uint64_t target = (uint64_t)ceil(lat->count * pct / 100.0);
+	uint64_t seen = 0;
+
+	for (unsigned b = 0; b < CB_HIST_BUCKETS; b++) {
+		seen += lat->hist[b];
+		if (seen >= target && seen != 0) {
+			return b ? (1ull << b) : 1;
+		}
+	}
+	return lat->max_ns;
+}
+
+/*
+ * Work out which path metacompressor() took for the last page from the
+ * deltas it left in compressor_stats (the tool builds with DEVELOPMENT=1,
+ * so VM_COMPRESSOR_STAT is live).
+ */
+static enum cb_decision
+cb_classify(const compressor_stats_t *before, const compressor_stats_t *after,
+    uint16_t codec, int sz)
+{
+	bool did_wk = after->wk_compressions != before->wk_compressions;
+	bool did_lz4 = after->lz4_compressions != before->lz4_compressions;
+
+	if (!did_lz4) {
+		/* A WKdm failure only skips LZ4 during a failure run. */
+		return sz == -1 ? CB_SEL_WK_FAIL_SKIPPED : CB_SEL_WK_EXCLUSIVE;
+	}
+	assert(codec == CCLZ4);
+	if (sz == -1) {
+		return CB_SEL_LZ4_FAILURE;
+	}
+	if (!did_wk) {
+		return CB_SEL_LZ4_PRESELECT;
+	}
+	if (after->lz4_wk_compression_negative_delta != before->lz4_wk_compression_negative_delta) {
+		return CB_SEL_LZ4_NEGATIVE;
+	}
+	return CB_SEL_LZ4_PROFITABLE;
+}
+
+static bool
+cb_page_is_sv(const uint8_t *page)
+{
+	uint32_t v, w;
+
+	memcpy(&v, page, sizeof(v));
+	for (size_t i = 1; i < PAGE_SIZE / sizeof(w); i++) {
+		memcpy(&w, page + i * sizeof(w), sizeof(w));
+		if (w != v) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static size_t
+cb_round64(size_t size)
+{
+	return (size + 63) & ~(size_t)63;
+}
+
+static void
+cb_run(cb_result_t *res, const uint8_t *corpus, size_t npages, unsigned iterations)
+{
+	uint32_t escratch_size, dscratch_size;
+	uint8_t *escratch, *dscratch, *cbuf, *dbuf;
+	uint32_t *csizes;
+	uint16_t *codecs;
+
+	vm_compressor_current_codec = res->mode;
+	escratch_size = vm_compressor_get_encode_scratch_size();
+	dscratch_size = vm_compressor_get_decode_scratch_size();
+	escratch = aligned_alloc(64, cb_round64(escratch_size));
+	dscratch = aligned_alloc(64, cb_round64(dscratch_size));
+	cbuf = aligned_alloc(PAGE_SIZE, npages * (PAGE_SIZE + CB_DST_SLACK));
+	dbuf = aligned_alloc(PAGE_SIZE, PAGE_SIZE);
+	csizes = calloc(npages, sizeof(*csizes));
+	codecs = calloc(npages, sizeof(*codecs));
+
+	for (unsigned it = 0; it < iterations; it++) {
+		for (size_t i = 0; i < npages; i++) {
+			const uint8_t *src = corpus + i * PAGE_SIZE;
+			uint8_t *dst = cbuf + i * (PAGE_SIZE + CB_DST_SLACK);
+			compressor_stats_t before = compressor_stats;
+			boolean_t incomp_copy = FALSE;
+			uint32_t pop_count;
+			uint16_t codec = CINVALID;
+			uint64_t t0, t1;
+			int sz;
+
+			t0 = mach_absolute_time();
+			sz = metacompressor(src, dst, CB_MAX_CSIZE, &codec,
+			    escratch, &incomp_copy, &pop_count);
+			t1 = mach_absolute_time();
+
+			cb_latency_record(&res->clat, t1 - t0);
+			res->pages++;
+			if (sz == -1) {
+				res->incompressible++;
+				res->cbytes += PAGE_SIZE;
+			} else if (sz == 0) {
+				res->sv_pages++;
+				res->cbytes += 4;
+			} else {
+				res->cbytes += (uint64_t)sz;
+			}
+			if (codec == CCLZ4) {
+				res->lz4_pages++;
+			} else {
+				res->wk_pages++;
+			}
+
+			if (res->mode == CMODE_HYB) {
+				enum cb_decision d = cb_classify(&before, &compressor_stats, codec, sz);
+				cb_decision_stats_t *ds = &res->decisions[d];
+
+				ds->pages++;
+				ds->cbytes += (sz == -1) ? PAGE_SIZE : (sz == 0 ? 4 : (uint64_t)sz);
+				cb_latency_record(&ds->lat, t1 - t0);
+			}
+			csizes[i] = (uint32_t)sz;
+			codecs[i] = codec;
+		}
+
+		for (size_t i = 0; i < npages; i++) {
+			const uint8_t *src = cbuf + i * (PAGE_SIZE + CB_DST_SLACK);
+			const uint8_t *orig = corpus + i * PAGE_SIZE;
+			int sz = (int)csizes[i];
+			uint32_t pop_count;
+			uint64_t t0, t1;
+			bool ok;
+
+			if (sz == -1) {
+				continue;
+			}
+			if (sz == 0) {
+				/* c_decompress_page() rebuilds these from the SV hash. */
+				if (!cb_page_is_sv(orig)) {
+					panic("page %zu reported single value but is not", i);
+				}
+				continue;
+			}
+
+			t0 = mach_absolute_time();
+			ok = metadecompressor(src, dbuf, (uint32_t)sz, codecs[i],
+			    dscratch, &pop_count);
+			t1 = mach_absolute_time();
+
+			if (!ok || memcmp(dbuf, orig, PAGE_SIZE) != 0) {
+				panic("%s: page %zu (codec %u, %d bytes) failed to round-trip",
+				    res->name, i, codecs[i], sz);
+			}
+			cb_latency_record(&res->dlat, t1 - t0);
+		}
+	}
+
+	free(codecs);
+	free(csizes);
+	free(dbuf);
+	free(cbuf);
+	free(dscratch);
+	free(escratch);
+}
+
+#pragma mark reporting
+
+static void
+cb_print_latency(const char *what, const cb_latency_t *lat)
+{
+	if (lat->count == 0) {
+		return;
+	}
+	printf("  %s latency (ns): avg %llu p50 <%llu p90 <%llu p99 <%llu max %llu\n",
+	    what, (unsigned long long)(lat->total_ns / lat->count),
+	    (unsigned long long)cb_latency_percentile(lat, 50),
+	    (unsigned long long)cb_latency_percentile(lat, 90),
+	    (unsigned long long)cb_latency_percentile(lat, 99),
+	    (unsigned long long)lat->max_ns);
+	for (unsigned b = 0; b < CB_HIST_BUCKETS; b++) {
+		if (lat->hist[b] == 0) {
+			continue;
+		}
+		printf("    < %8llu ns: %10llu (%5.1f%%)\n",
+		    b ? (unsigned long long)(1ull << b) : 1ull,
+		    (unsigned long long)lat->hist[b],
+		    100.0 * (double)lat->hist[b] / (double)lat->count);
+	}
+}
+
+static double
+cb_mbps(uint64_t pages, uint64_t ns)
+{
+	if (ns == 0) {
+		return 0;
+	}
+	return ((double)pages * PAGE_SIZE / (1024.0 * 1024.0)) / ((double)ns / 1e9);
+}
+
+static void
+cb_report(const cb_result_t *res)
+{
+	printf("%s: %llu pages, ratio %.3f (%llu lz4, %llu wk, %llu sv, %llu incompressible)\n",
+	    res->name, (unsigned long long)res->pages,
+	    (double)res->pages * PAGE_SIZE / (double)MAX(res->cbytes, 1),
+	    (unsigned long long)res->lz4_pages, (unsigned long long)res->wk_pages,
+	    (unsigned long long)res->sv_pages, (unsigned long long)res->incompressible);
+	printf("  compress %.1f MB/s, decompress %.1f MB/s\n",
+	    cb_mbps(res->clat.count, res->clat.total_ns),
+	    cb_mbps(res->dlat.count, res->dlat.total_ns));
+	cb_print_latency("compress", &res->clat);
+	cb_print_latency("decompress", &res->dlat);
+
+	if (res->mode != CMODE_HYB) {
+		return;
+	}
+	printf("  selector decisions:\n");
+	for (unsigned d = 0; d < CB_SEL_COUNT; d++) {
+		const cb_decision_stats_t *ds = &res->decisions[d];
+
+		if (ds->pages == 0) {
+			continue;
+		}
+		printf("    %-20s %10llu pages (%5.1f%%) ratio %.3f avg %llu ns p99 <%llu ns\n",
+		    cb_decision_names[d], (unsigned long long)ds->pages,
+		    100.0 * (double)ds->pages / (double)res->pages,
+		    (double)ds->pages * PAGE_SIZE / (double)MAX(ds->cbytes, 1),
+		    (unsigned long long)(ds->lat.total_ns / ds->pages),
+		    (unsigned long long)cb_latency_percentile(&ds->lat, 99));
+	}
+}
+
+#pragma mark tuneables
+
+static const struct {
+	const char *name;
+	size_t      offset;
+	bool        is_signed;
+} cb_tuneables[] = {
+#define CB_TUNEABLE(f, s) { #f, offsetof(compressor_tuneables_t, f), s }
+	CB_TUNEABLE(wkdm_reeval_threshold, true),
+	CB_TUNEABLE(lz4_threshold, true),
+	CB_TUNEABLE(lz4_max_failure_skips, false),
+	CB_TUNEABLE(lz4_max_failure_run_length, false),
+	CB_TUNEABLE(lz4_max_preselects, false),
+	CB_TUNEABLE(lz4_run_preselection_threshold, false),
+	CB_TUNEABLE(lz4_run_continue_bytes, false),
+	CB_TUNEABLE(lz4_profitable_bytes, false),
+#undef CB_TUNEABLE
+};
+
+static void
+cb_set_tuneable(const char *arg)
+{
+	const char *eq = strchr(arg, '=');
+
+	for (size_t i = 0; eq && i < sizeof(cb_tuneables) / sizeof(cb_tuneables[0]); i++) {
+		if (strlen(cb_tuneables[i].name) == (size_t)(eq - arg) &&
+		    strncmp(arg, cb_tuneables[i].name, (size_t)(eq - arg)) == 0) {
+			uint32_t v = (uint32_t)strtoll(eq + 1, NULL, 0);
+			memcpy((char *)&vmctune + cb_tuneables[i].offset, &v, sizeof(v));
+			return;
+		}
+	}
+	fprintf(stderr, "unknown tuneable '%s'\n", arg);
+	exit(1);
+}
+
+static void
+cb_print_tuneables(void)
+{
+	printf("vmctune:");
+	for (size_t i = 0; i < sizeof(cb_tuneables) / sizeof(cb_tuneables[0]); i++) {
+		uint32_t v;
+
+		memcpy(&v, (char *)&vmctune + cb_tuneables[i].offset, sizeof(v));
+		if (cb_tuneables[i].is_signed) {
+			printf(" %s=%d", cb_tuneables[i].name, (int32_t)v);
+		} else {
+			printf(" %s=%u", cb_tuneables[i].name, v);
+		}
+	}
+	printf("\n");
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr,
+	    "usage: %s [-c wk|lz4|hyb|all] [-n pages] [-i iterations]\n"
+	    "       [-k zero|sv|pointer|text|random|mixed] [-f file]\n"
+	    "       [-t tuneable=value ...] [-s seed] [-S]\n", prog);
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *codec = "all", *kind = "mixed", *file = NULL;
+	size_t npages = 4096;
+	unsigned iterations = 5;
+	uint8_t *corpus;
+	cb_result_t results[] = {
+		{ .name = "wk", .mode = CMODE_WK },
+		{ .name = "lz4", .mode = CMODE_LZ4 },
+		{ .name = "hyb", .mode = CMODE_HYB },
+	};
+	bool scalar = false;
+	int ch;
+
+	/* Same defaults as boot, before any command line overrides. */
+	vm_compressor_algorithm_init();
+
+	while ((ch = getopt(argc, argv, "c:n:i:k:f:t:s:Sh")) != -1) {
+		switch (ch) {
+		case 'c':
+			codec = optarg;
+			break;
+		case 'n':
+			npages = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			iterations = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		case 'k':
+			kind = optarg;
+			break;
+		case 'f':
+			file = optarg;
+			break;
+		case 't':
+			cb_set_tuneable(optarg);
+			break;
+		case 's':
+			cb_seed = strtoull(optarg, NULL, 0) | 1;
+			break;
+		case 'S':
+			scalar = true;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (npages == 0 || iterations == 0) {
+		usage(argv[0]);
+	}
+#if defined(__x86_64__)
+	if (scalar) {
+		lz4_encode_simd = 0;
+	}
+	printf("lz4 encode: %s\n", lz4_encode_simd ? "simd" : "scalar");
+#else
+	(void)scalar;
+#endif
+
+	corpus = file ? cb_corpus_from_file(file, &npages) : cb_corpus_generate(kind, npages);
+
+	printf("corpus: %s, %zu pages of %d bytes, %u iterations\n",
+	    file ? file : kind, npages, PAGE_SIZE, iterations);
+	cb_print_tuneables();
+
+	for (size_t r = 0; r < sizeof(results) / sizeof(results[0]); r++) {
+		if (strcmp(codec, "all") != 0 && strcmp(codec, results[r].name) != 0) {
+			continue;
+		}
+		memset(&compressor_stats, 0, sizeof(compressor_stats));
+		cb_run(&results[r], corpus, npages, iterations);
+		cb_report(&results[r]);
+	}
+
+	free(corpus);
+	return 0;
+}
@@ -0,0 +1,3 @@
+/* Host-side shim for <arm64/proc_reg.h>, see compressor_bench_shim.h */
+#pragma once
+#include "../compressor_bench_shim.h"
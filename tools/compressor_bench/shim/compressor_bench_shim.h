@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Minimal user-space stand-ins for the kernel interfaces used by
+ * osfmk/vm/lz4.c and osfmk/vm/vm_compressor_algorithms.c, so that both can
+ * be compiled unmodified into the host-side compressor benchmark.
+ */
+
+#pragma once
+
+#include <assert.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__APPLE__)
+#include <mach/boolean.h>
+#else
+typedef int boolean_t;
+#ifndef TRUE
+#define TRUE    1
+#define FALSE   0
+#endif
+#endif /* __APPLE__ */
+
+#ifndef PAGE_SIZE
+#if defined(__arm64__) || defined(__aarch64__)
+#define PAGE_SIZE       16384
+#else
+#define PAGE_SIZE       4096
+#endif
+#endif /* PAGE_SIZE */
+
+#if defined(__aarch64__) && !defined(__arm64__)
+#define __arm64__       1
+#endif
+
+#ifndef __unused
+#define __unused        __attribute__((__unused__))
+#endif
+#ifndef __probable
+#define __probable(x)   __builtin_expect(!!(x), 1)
+#define __improbable(x) __builtin_expect(!!(x), 0)
+#endif
+
+#ifndef MAX
+#define MAX(a, b)       (((a) > (b)) ? (a) : (b))
+#endif
+#ifndef MIN
+#define MIN(a, b)       (((a) < (b)) ? (a) : (b))
+#endif
+
+#define panic(fmt, ...) ({                                              \
+	fprintf(stderr, "panic: " fmt "\n", ## __VA_ARGS__);            \
+	abort();                                                        \
+})
+
+#define assertf(e, fmt, ...) ({                                         \
+	if (__improbable(!(e))) {                                       \
+	        panic("assertion failed: %s: " fmt, #e, ## __VA_ARGS__);  \
+	}                                                               \
+})
+
+/* Slot bookkeeping from vm_compressor.h that the codecs report through. */
+#define C_SLOT_NO_POPCOUNT      UINT32_MAX
+
+static inline uint64_t
+mach_absolute_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* Boot-args are never present on the host; tuneables are set directly. */
+static inline boolean_t
+PE_parse_boot_argn(__unused const char *arg, __unused void *ptr, __unused int max_len)
+{
+	return FALSE;
+}
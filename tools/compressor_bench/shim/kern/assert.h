@@ -0,0 +1,3 @@
+/* Host-side shim for <kern/assert.h>, see compressor_bench_shim.h */
+#pragma once
+#include "../compressor_bench_shim.h"
@@ -0,0 +1,3 @@
+/* Host-side shim for <mach/vm_param.h>, see compressor_bench_shim.h */
+#pragma once
+#include "../compressor_bench_shim.h"
@@ -0,0 +1,7 @@
+/* Host-side shim for <machine/limits.h>, see compressor_bench_shim.h */
+#pragma once
+#if defined(__APPLE__)
+#include_next <machine/limits.h>
+#else
+#include <limits.h>
+#endif
@@ -0,0 +1,3 @@
+/* Host-side shim for <vm/vm_compressor.h>, see compressor_bench_shim.h */
+#pragma once
+#include "../compressor_bench_shim.h"
@@ -0,0 +1,428 @@
+/*
+ * kd-decode.cpp
+ *
+ * Tool to decode and summarize kdebug trace files on any host.
+ * Usage:
+ * kd-decode [-c trace_codes] [-s syscalls.master] [-j jobs] [-t numer/denom]
+ *           [-n count] [-H] <info|dump|sched|syscalls|intervals|replay> <trace>
+ *
+ * "info" prints the trace header, CPU and thread maps.  "dump" prints the
+ * events, named using the trace codes given with -c (typically
+ * bsd/kern/trace_codes) and the BSD system calls given with -s (typically
+ * bsd/kern/syscalls.master).
+ *
+ * "sched" prints the scheduling latency of the threads that waited the
+ * longest, "syscalls" the count and duration of each system call, and
+ * "intervals" the same for every other DBG_FUNC_START/DBG_FUNC_END event
+ * pair.  These summaries are computed by -j worker threads (one per CPU by
+ * default); -n limits how many rows are printed (or events, for "dump"),
+ * and -H adds the latency histograms.
+ *
+ * "replay" converts the scheduler events into a workload for the Clutch/Edge
+ * simulator in tools/sched_sim: a thread per thread made runnable, in a
+ * group per process and in the bucket of its priority, and a wakeup per
+ * MACH_MAKE_RUNNABLE event, with the CPU time the thread used until its next
+ * wakeup as the work to do.  The topology is left to a separate file.
+ *
+ * Timestamps are converted with the timebase recorded in the trace, which
+ * legacy traces lack: use -t to provide it (e.g. 125/3 for a 24MHz arm64
+ * timebase).
+ */
+
+#include "kdanalysis.hpp"
+#include "kdtrace.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace kdtrace;
+
+struct Options {
+	std::string trace_codes;
+	std::string syscalls;
+	std::string command;
+	std::string path;
+	uint32_t numer = 0;
+	uint32_t denom = 0;
+	unsigned jobs = 0;
+	size_t limit = 0;
+	bool histograms = false;
+};
+
+static void
+usage(const char *progname)
+{
+	fprintf(stderr,
+	    "usage: %s [-c trace_codes] [-s syscalls.master] [-j jobs] [-t numer/denom]\n"
+	    "       %*s [-n count] [-H] <info|dump|sched|syscalls|intervals|replay> <trace>\n",
+	    progname, (int)strlen(progname), "");
+	exit(2);
+}
+
+static const char *
+version_name(uint32_t version)
+{
+	switch (version) {
+	case RAW_VERSION0:
+		return "RAW_VERSION0";
+	case RAW_VERSION1:
+		return "RAW_VERSION1";
+	case RAW_VERSION3:
+		return "RAW_VERSION3";
+	default:
+		return "unknown";
+	}
+}
+
+static std::string
+thread_name(const TraceFile &trace, uint64_t tid)
+{
+	const Thread *t = trace.thread(tid);
+	return t ? t->command + "[" + std::to_string(t->pid) + "]" : "";
+}
+
+static void
+print_info(const TraceFile &trace)
+{
+	printf("version:  %s (0x%08x)\n", version_name(trace.version()), trace.version());
+	printf("timebase: %u/%u%s\n", trace.timebase_numer(), trace.timebase_denom(),
+	    trace.has_timebase() ? "" : " (assumed)");
+	if (trace.walltime_secs()) {
+		printf("walltime: %" PRIu64 ".%06u\n", trace.walltime_secs(), trace.walltime_usecs());
+	}
+	printf("events:   %" PRIu64 " in %zu chunk(s)%s\n", trace.event_count(),
+	    trace.event_spans().size(), trace.truncated() ? ", truncated" : "");
+
+	printf("cpus:     %zu\n", trace.cpus().size());
+	for (const Cpu &cpu : trace.cpus()) {
+		printf("  %4u %s%s\n", cpu.id, cpu.name.c_str(),
+		    (cpu.flags & KDBG_CPUMAP_IS_IOP) ? " (coprocessor)" : "");
+	}
+
+	printf("threads:  %zu\n", trace.threads().size());
+	for (const Thread &t : trace.threads()) {
+		printf("  0x%-12" PRIx64 " %6d %s\n", t.tid, t.pid, t.command.c_str());
+	}
+}
+
+static void
+print_events(const TraceFile &trace, const CodeTable &codes, size_t limit)
+{
+	uint64_t first = 0;
+	size_t printed = 0;
+	bool have_first = false;
+
+	printf("%16s %4s %-14s %-32s %18s %18s %18s %18s  %s\n", "ns", "cpu",
+	    "tid", "event", "arg1", "arg2", "arg3", "arg4", "thread");
+	for (const auto &span : trace.event_spans()) {
+		for (const Event &ev : span) {
+			if (limit && printed++ == limit) {
+				return;
+			}
+			if (!have_first) {
+				first = ev.timestamp;
+				have_first = true;
+			}
+
+			static const char func_tag[] = { ' ', '>', '<', ' ' };
+			std::string name = codes.describe(ev.debugid);
+			name.insert(name.begin(), func_tag[ev.func()]);
+
+			printf("%16" PRIu64 " %4u 0x%-12" PRIx64 " %-32s 0x%016" PRIx64 " 0x%016" PRIx64
+			    " 0x%016" PRIx64 " 0x%016" PRIx64 "  %s\n",
+			    ev.timestamp >= first ? trace.to_ns(ev.timestamp - first) : 0,
+			    ev.cpuid, ev.tid, name.c_str(), ev.arg[0], ev.arg[1], ev.arg[2],
+			    ev.arg[3], thread_name(trace, ev.tid).c_str());
+		}
+	}
+}
+
+static void
+print_histogram(const Histogram &hist)
+{
+	uint64_t peak = *std::max_element(hist.buckets.begin(), hist.buckets.end());
+
+	for (unsigned i = 0; i < Histogram::BUCKETS; i++) {
+		if (hist.buckets[i] == 0) {
+			continue;
+		}
+		uint64_t lo = i ? (uint64_t)1 << (i - 1) : 0;
+		int width = (int)(hist.buckets[i] * 50 / peak);
+		printf("      %12" PRIu64 " ns %10" PRIu64 " |%.*s\n", lo, hist.buckets[i], width,
+		    "**************************************************");
+	}
+}
+
+static void
+print_stats_header(const char *what)
+{
+	printf("%-40s %10s %12s %10s %10s %10s %10s\n", what, "count",
+	    "total(us)", "mean(us)", "p50(us)", "p99(us)", "max(us)");
+}
+
+static void
+print_stats(const std::string &name, const Histogram &hist, bool histograms)
+{
+	printf("%-40s %10" PRIu64 " %12.1f %10.2f %10.2f %10.2f %10.2f\n", name.c_str(),
+	    hist.count, hist.total / 1e3, hist.mean() / 1e3, hist.percentile(50) / 1e3,
+	    hist.percentile(99) / 1e3, hist.max / 1e3);
+	if (histograms) {
+		print_histogram(hist);
+	}
+}
+
+static void
+print_sched(const TraceFile &trace, const Analysis &analysis, const Options &opts)
+{
+	std::vector<std::pair<uint64_t, const Histogram *>> rows;
+	Histogram all;
+
+	for (const auto &[tid, hist] : analysis.sched_latency) {
+		rows.emplace_back(tid, &hist);
+		all.merge(hist);
+	}
+	std::sort(rows.begin(), rows.end(), [](const auto &a, const auto &b) {
+		if (a.second->max != b.second->max) {
+			return a.second->max > b.second->max;
+		}
+		return a.first < b.first;
+	});
+
+	print_stats_header("thread");
+	print_stats("(all threads)", all, opts.histograms);
+	for (size_t i = 0; i < rows.size() && (!opts.limit || i < opts.limit); i++) {
+		char name[64];
+		snprintf(name, sizeof(name), "0x%" PRIx64 " %s", rows[i].first,
+		    thread_name(trace, rows[i].first).c_str());
+		print_stats(name, *rows[i].second, opts.histograms);
+	}
+}
+
+static void
+print_intervals(const CodeTable &codes, const Analysis &analysis,
+    const Options &opts, bool syscalls)
+{
+	std::vector<std::pair<uint32_t, const Histogram *>> rows;
+
+	for (const auto &[debugid, hist] : analysis.intervals) {
+		if (is_syscall(debugid) == syscalls) {
+			rows.emplace_back(debugid, &hist);
+		}
+	}
+	std::sort(rows.begin(), rows.end(), [](const auto &a, const auto &b) {
+		if (a.second->total != b.second->total) {
+			return a.second->total > b.second->total;
+		}
+		return a.first < b.first;
+	});
+
+	print_stats_header(syscalls ? "syscall" : "interval");
+	for (size_t i = 0; i < rows.size() && (!opts.limit || i < opts.limit); i++) {
+		print_stats(codes.describe(rows[i].first), *rows[i].second, opts.histograms);
+	}
+	if (analysis.unmatched_starts || analysis.unmatched_ends) {
+		printf("(%" PRIu64 " start and %" PRIu64 " end events could not be paired)\n",
+		    analysis.unmatched_starts, analysis.unmatched_ends);
+	}
+}
+
+/* sched_convert_pri_to_bucket(), with priorities above MAXPRI_USER as fixed priority */
+static const char *
+bucket_name(uint64_t pri)
+{
+	if (pri > 63) {
+		return "FIXPRI";
+	} else if (pri > 37) {
+		return "FG";
+	} else if (pri > 31) {
+		return "IN";
+	} else if (pri > 20) {
+		return "DF";
+	} else if (pri > 4) {
+		return "UT";
+	}
+	return "BG";
+}
+
+static std::string
+group_name(const TraceFile &trace, uint64_t tid)
+{
+	const Thread *t = trace.thread(tid);
+	if (t == nullptr) {
+		return "unknown";
+	}
+
+	std::string name = t->command.substr(0, 20);
+	for (char &c : name) {
+		if (!isgraph((unsigned char)c)) {
+			c = '_';
+		}
+	}
+	return (name.empty() ? "_" : name) + "." + std::to_string(t->pid);
+}
+
+static void
+print_replay(const TraceFile &trace, const Options &opts)
+{
+	constexpr uint32_t MAKE_RUNNABLE = kdbg_code(DBG_MACH, DBG_MACH_SCHED, MACH_MAKE_RUNNABLE);
+	constexpr uint32_t SWITCH = kdbg_code(DBG_MACH, DBG_MACH_SCHED, MACH_SCHED);
+	constexpr uint32_t HANDOFF = kdbg_code(DBG_MACH, DBG_MACH_SCHED, MACH_STACK_HANDOFF);
+
+	struct Wake {
+		uint64_t time;
+		uint64_t tid;
+		uint64_t work;
+	};
+	struct ReplayThread {
+		uint64_t pri = 0;
+		size_t wake = SIZE_MAX;
+	};
+	struct OnCpu {
+		uint64_t tid;
+		uint64_t since;
+	};
+
+	std::vector<Wake> wakes;
+	std::map<uint64_t, ReplayThread> threads;
+	std::unordered_map<uint32_t, OnCpu> cpus;
+	uint64_t first = 0;
+	bool have_first = false;
+
+	for (const auto &span : trace.event_spans()) {
+		for (const Event &ev : span) {
+			if (!have_first) {
+				first = ev.timestamp;
+				have_first = true;
+			}
+			if (ev.func() != 0) {
+				continue;
+			}
+			uint32_t base = ev.base();
+			uint64_t now = ev.timestamp >= first ? ev.timestamp - first : 0;
+
+			if (base == MAKE_RUNNABLE) {
+				/* arg1 is the thread made runnable, arg2 its priority */
+				ReplayThread &t = threads[ev.arg[0]];
+				t.pri = std::max(t.pri, ev.arg[1]);
+				t.wake = wakes.size();
+				wakes.push_back(Wake{ now, ev.arg[0], 0 });
+			} else if (base == SWITCH || base == HANDOFF) {
+				/* the thread on the CPU is charged until it switches to arg2 */
+				auto it = cpus.find(ev.cpuid);
+				if (it != cpus.end() && now > it->second.since) {
+					auto t = threads.find(it->second.tid);
+					if (t != threads.end() && t->second.wake != SIZE_MAX) {
+						wakes[t->second.wake].work += now - it->second.since;
+					}
+				}
+				cpus[ev.cpuid] = OnCpu{ ev.arg[1], now };
+			}
+		}
+	}
+
+	printf("# sched_sim workload converted from %s by kd-decode replay\n", opts.path.c_str());
+	for (const auto &[tid, t] : threads) {
+		printf("thread 0x%" PRIx64 " %s pri %" PRIu64 " group %s\n", tid,
+		    bucket_name(t.pri), std::min<uint64_t>(t.pri, 127),
+		    group_name(trace, tid).c_str());
+	}
+	/* events of different CPUs can be slightly out of order */
+	std::stable_sort(wakes.begin(), wakes.end(), [](const Wake &a, const Wake &b) {
+		return a.time < b.time;
+	});
+	for (const Wake &w : wakes) {
+		printf("wake %" PRIu64 " 0x%" PRIx64 " %" PRIu64 "\n", trace.to_ns(w.time), w.tid,
+		    trace.to_ns(w.work));
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	Options opts;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "c:s:j:t:n:Hh")) != -1) {
+		switch (ch) {
+		case 'c':
+			opts.trace_codes = optarg;
+			break;
+		case 's':
+			opts.syscalls = optarg;
+			break;
+		case 'j':
+			opts.jobs = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			if (sscanf(optarg, "%u/%u", &opts.numer, &opts.denom) != 2 ||
+			    opts.numer == 0 || opts.denom == 0) {
+				usage(argv[0]);
+			}
+			break;
+		case 'n':
+			opts.limit = strtoul(optarg, NULL, 0);
+			break;
+		case 'H':
+			opts.histograms = true;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (argc - optind != 2) {
+		usage(argv[0]);
+	}
+	opts.command = argv[optind];
+	opts.path = argv[optind + 1];
+
+	try {
+		TraceFile trace(opts.path);
+		CodeTable codes;
+
+		if (!opts.trace_codes.empty()) {
+			codes.load_trace_codes(opts.trace_codes);
+		}
+		if (!opts.syscalls.empty()) {
+			codes.load_syscalls(opts.syscalls);
+		}
+		if (opts.numer) {
+			trace.set_timebase(opts.numer, opts.denom);
+		}
+
+		AnalysisOptions aopts;
+		aopts.jobs = opts.jobs;
+
+		if (opts.command == "info") {
+			print_info(trace);
+		} else if (opts.command == "dump") {
+			print_events(trace, codes, opts.limit);
+		} else if (opts.command == "sched") {
+			aopts.intervals = false;
+			print_sched(trace, analyze(trace, aopts), opts);
+		} else if (opts.command == "syscalls" || opts.command == "intervals") {
+			aopts.sched_latency = false;
+			print_intervals(codes, analyze(trace, aopts), opts,
+			    opts.command == "syscalls");
+		} else if (opts.command == "replay") {
+			print_replay(trace, opts);
+		} else {
+			usage(argv[0]);
+		}
+	} catch (const std::exception &e) {
+		fprintf(stderr, "%s: %s\n", argv[0], e.what());
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,231 @@
+/*
+ * kdanalysis.cpp
+ *
+ * Parallel trace summaries, see kdanalysis.hpp.
+ */
+
+#include "kdanalysis.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <thread>
+#include <vector>
+
+namespace kdtrace {
+
+unsigned
+Histogram::bucket(uint64_t ns)
+{
+	return ns ? std::min<unsigned>((unsigned)std::bit_width(ns), BUCKETS - 1) : 0;
+}
+
+void
+Histogram::add(uint64_t ns)
+{
+	buckets[bucket(ns)]++;
+	count++;
+	total += ns;
+	min = std::min(min, ns);
+	max = std::max(max, ns);
+}
+
+void
+Histogram::merge(const Histogram &other)
+{
+	for (unsigned i = 0; i < BUCKETS; i++) {
+		buckets[i] += other.buckets[i];
+	}
+	count += other.count;
+	total += other.total;
+	min = std::min(min, other.min);
+	max = std::max(max, other.max);
+}
+
+uint64_t
+Histogram::percentile(double pct) const
+{
+	uint64_t target = (uint64_t)((double)count * pct / 100.0);
+	uint64_t seen = 0;
+
+	for (unsigned i = 0; i < BUCKETS; i++) {
+		seen += buckets[i];
+		if (seen > target || seen == count) {
+			return std::min(i ? (uint64_t)1 << i : 0, max);
+		}
+	}
+	return max;
+}
+
+void
+Analysis::merge(Analysis &&other)
+{
+	for (auto &[tid, hist] : other.sched_latency) {
+		sched_latency[tid].merge(hist);
+	}
+	for (auto &[debugid, hist] : other.intervals) {
+		intervals[debugid].merge(hist);
+	}
+	unmatched_ends += other.unmatched_ends;
+	unmatched_starts += other.unmatched_starts;
+}
+
+namespace {
+
+struct IntervalKey {
+	uint64_t tid;
+	uint32_t debugid;
+
+	bool operator==(const IntervalKey &) const = default;
+};
+
+struct IntervalKeyHash {
+	size_t
+	operator()(const IntervalKey &k) const
+	{
+		return std::hash<uint64_t>()(k.tid * 31 + k.debugid);
+	}
+};
+
+/* spreads thread IDs, which are mostly sequential, over the workers */
+inline unsigned
+owner(uint64_t tid, unsigned jobs)
+{
+	tid ^= tid >> 33;
+	tid *= 0xff51afd7ed558ccdULL;
+	tid ^= tid >> 33;
+	return (unsigned)(tid % jobs);
+}
+
+constexpr uint32_t MAKE_RUNNABLE = kdbg_code(DBG_MACH, DBG_MACH_SCHED, MACH_MAKE_RUNNABLE);
+constexpr uint32_t SWITCH = kdbg_code(DBG_MACH, DBG_MACH_SCHED, MACH_SCHED);
+constexpr uint32_t HANDOFF = kdbg_code(DBG_MACH, DBG_MACH_SCHED, MACH_STACK_HANDOFF);
+
+class Worker {
+public:
+	Worker(const TraceFile &trace, const AnalysisOptions &options,
+	    unsigned index, unsigned jobs)
+		: trace_(trace), options_(options), index_(index), jobs_(jobs)
+	{
+	}
+
+	void
+	run()
+	{
+		for (const auto &span : trace_.event_spans()) {
+			for (const Event &ev : span) {
+				process(ev);
+			}
+		}
+		for (const auto &[key, starts] : open_) {
+			result.unmatched_starts += starts.size();
+		}
+	}
+
+	Analysis result;
+
+private:
+	void
+	process(const Event &ev)
+	{
+		uint32_t base = ev.base();
+
+		if (options_.sched_latency && ev.func() == 0) {
+			if (base == MAKE_RUNNABLE) {
+				/* arg1 is the thread made runnable */
+				if (owner(ev.arg[0], jobs_) == index_) {
+					runnable_.try_emplace(ev.arg[0], ev.timestamp);
+				}
+				return;
+			}
+			if (base == SWITCH || base == HANDOFF) {
+				/* arg2 is the thread switched to */
+				if (owner(ev.arg[1], jobs_) == index_) {
+					switched_in(ev.arg[1], ev.timestamp);
+				}
+				return;
+			}
+		}
+
+		if (!options_.intervals || owner(ev.tid, jobs_) != index_) {
+			return;
+		}
+
+		switch (ev.func()) {
+		case DBG_FUNC_START:
+			open_[IntervalKey{ev.tid, base}].push_back(ev.timestamp);
+			break;
+		case DBG_FUNC_END: {
+			auto it = open_.find(IntervalKey{ev.tid, base});
+			if (it == open_.end() || it->second.empty()) {
+				result.unmatched_ends++;
+				break;
+			}
+			uint64_t start = it->second.back();
+			it->second.pop_back();
+			result.intervals[base].add(duration(start, ev.timestamp));
+			break;
+		}
+		default:
+			break;
+		}
+	}
+
+	void
+	switched_in(uint64_t tid, uint64_t now)
+	{
+		auto it = runnable_.find(tid);
+		if (it == runnable_.end()) {
+			return;
+		}
+		result.sched_latency[tid].add(duration(it->second, now));
+		runnable_.erase(it);
+	}
+
+	uint64_t
+	duration(uint64_t start, uint64_t end) const
+	{
+		/* events from different CPUs can be slightly out of order */
+		return end > start ? trace_.to_ns(end - start) : 0;
+	}
+
+	const TraceFile &trace_;
+	const AnalysisOptions &options_;
+	unsigned index_;
+	unsigned jobs_;
+
+	std::unordered_map<uint64_t, uint64_t> runnable_;
+	std::unordered_map<IntervalKey, std::vector<uint64_t>, IntervalKeyHash> open_;
+};
+
+} // namespace
+
+Analysis
+analyze(const TraceFile &trace, const AnalysisOptions &options)
+{
+	unsigned jobs = options.jobs ? options.jobs : std::max(1U, std::thread::hardware_concurrency());
+	std::vector<Worker> workers;
+	std::vector<std::thread> threads;
+	Analysis analysis;
+
+	/* not worth a thread per CPU for small traces */
+	jobs = (unsigned)std::min<uint64_t>(jobs, std::max<uint64_t>(1, trace.event_count() / 65536));
+
+	workers.reserve(jobs);
+	for (unsigned i = 0; i < jobs; i++) {
+		workers.emplace_back(trace, options, i, jobs);
+	}
+	for (unsigned i = 1; i < jobs; i++) {
+		threads.emplace_back(&Worker::run, &workers[i]);
+	}
+	workers[0].run();
+	for (auto &t : threads) {
+		t.join();
+	}
+
+	for (auto &w : workers) {
+		analysis.merge(std::move(w.result));
+	}
+	return analysis;
+}
+
+} // namespace kdtrace
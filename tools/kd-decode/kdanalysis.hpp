@@ -0,0 +1,83 @@
+/*
+ * kdanalysis.hpp
+ *
+ * Summaries computed over the events of a kdebug trace:
+ *
+ * - scheduling latency: for every thread, the time from being made runnable
+ *   (MACH_MAKE_RUNNABLE) to being switched in (MACH_SCHED or
+ *   MACH_STACK_HANDOFF),
+ *
+ * - intervals: for every debugid with DBG_FUNC_START/DBG_FUNC_END events,
+ *   the durations between matching start and end events on a thread.  The
+ *   BSD and Mach system call events are such intervals.
+ *
+ * The work is spread over several threads by hashing the thread ID each
+ * summary is keyed by, so that every worker sees all of the events of the
+ * threads it owns, in order, and results only need to be added up.
+ */
+
+#ifndef KDANALYSIS_HPP
+#define KDANALYSIS_HPP
+
+#include "kdtrace.hpp"
+
+#include <array>
+#include <cstdint>
+#include <unordered_map>
+
+namespace kdtrace {
+
+/* Durations in nanoseconds, in power-of-2 buckets. */
+struct Histogram {
+	static constexpr unsigned BUCKETS = 64;
+
+	std::array<uint64_t, BUCKETS> buckets{};
+	uint64_t count = 0;
+	uint64_t total = 0;
+	uint64_t min = UINT64_MAX;
+	uint64_t max = 0;
+
+	/* bucket i holds durations in [2^(i-1), 2^i), bucket 0 holds 0 */
+	static unsigned bucket(uint64_t ns);
+
+	void add(uint64_t ns);
+	void merge(const Histogram &other);
+	uint64_t mean() const { return count ? total / count : 0; }
+	/* Upper bound of the bucket holding the given percentile. */
+	uint64_t percentile(double pct) const;
+};
+
+struct AnalysisOptions {
+	/* Number of worker threads, 0 picks one per CPU. */
+	unsigned jobs = 0;
+	bool sched_latency = true;
+	bool intervals = true;
+};
+
+struct Analysis {
+	/* per thread ID */
+	std::unordered_map<uint64_t, Histogram> sched_latency;
+	/* per debugid, without the DBG_FUNC_* qualifier */
+	std::unordered_map<uint32_t, Histogram> intervals;
+
+	/* end events with no start on their thread, e.g. at the trace start */
+	uint64_t unmatched_ends = 0;
+	/* start events never ended before the trace stopped */
+	uint64_t unmatched_starts = 0;
+
+	void merge(Analysis &&other);
+};
+
+Analysis analyze(const TraceFile &trace, const AnalysisOptions &options);
+
+inline bool
+is_syscall(uint32_t debugid)
+{
+	uint32_t cls = debugid >> 24, subcls = (debugid >> 16) & 0xff;
+	return (cls == DBG_BSD && subcls == DBG_BSD_EXCP_SC) ||
+	       (cls == DBG_MACH && subcls == DBG_MACH_EXCP_SC);
+}
+
+} // namespace kdtrace
+
+#endif /* KDANALYSIS_HPP */
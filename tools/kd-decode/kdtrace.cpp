@@ -0,0 +1,401 @@
+/*
+ * kdtrace.cpp
+ *
+ * Parsing of kdebug trace files and trace code tables, see kdtrace.hpp.
+ */
+
+#include "kdtrace.hpp"
+
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace kdtrace {
+
+/* RAW_header: int version_no, int thread_count, uint64_t TOD_secs, uint32_t TOD_usecs */
+constexpr size_t RAW_HEADER_SIZE = 24;
+/* kd_threadmap: uint64_t thread, int valid, char command[20] */
+constexpr size_t THREADMAP_SIZE = 32;
+constexpr size_t THREADMAP_COMMAND_SIZE = 20;
+/* kd_cpumap_header: uint32_t version_no, uint32_t cpu_count */
+constexpr size_t CPUMAP_HEADER_SIZE = 8;
+/* kd_cpumap: uint32_t cpu_id, uint32_t flags, char name[8], or name[32] for kd_cpumap_ext */
+constexpr size_t CPUMAP_NAME_SIZE = 8;
+constexpr size_t CPUMAP_EXT_NAME_SIZE = 32;
+
+/* Legacy events start on the first 4K boundary after the thread map. */
+constexpr size_t LEGACY_EVENTS_ALIGN = 4096;
+
+/* chunk header: uint32_t tag, uint32_t sub_tag, uint64_t length */
+constexpr size_t V3_CHUNK_HEADER_SIZE = 16;
+/* event chunks add a uint64_t future_events_timestamp, see event_chunk_header */
+constexpr size_t V3_EVENT_CHUNK_HEADER_SIZE = 24;
+/* header chunk payload: timebase numer/denom, timestamp, walltime secs/usecs, ... */
+constexpr size_t V3_HEADER_PAYLOAD_MIN = 28;
+
+template <typename T>
+T
+TraceFile::read(size_t off) const
+{
+	T value;
+
+	if (off > size_ || size_ - off < sizeof(T)) {
+		throw FormatError("unexpected end of file at offset " + std::to_string(off));
+	}
+	memcpy(&value, base_ + off, sizeof(T));
+	return value;
+}
+
+static std::string
+fixed_string(const uint8_t *p, size_t len)
+{
+	return std::string(reinterpret_cast<const char *>(p), strnlen(reinterpret_cast<const char *>(p), len));
+}
+
+TraceFile::TraceFile(const std::string &path)
+{
+	struct stat st;
+	int fd = ::open(path.c_str(), O_RDONLY);
+
+	if (fd < 0) {
+		throw std::system_error(errno, std::generic_category(), path);
+	}
+	if (fstat(fd, &st) != 0) {
+		int error = errno;
+		::close(fd);
+		throw std::system_error(error, std::generic_category(), path);
+	}
+	if (st.st_size < (off_t)sizeof(uint32_t)) {
+		::close(fd);
+		throw FormatError(path + ": file too small to be a trace");
+	}
+
+	size_ = (size_t)st.st_size;
+	void *addr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+	int error = errno;
+	::close(fd);
+	if (addr == MAP_FAILED) {
+		throw std::system_error(error, std::generic_category(), path);
+	}
+	base_ = static_cast<const uint8_t *>(addr);
+	(void)madvise(addr, size_, MADV_SEQUENTIAL);
+
+	try {
+		version_ = read<uint32_t>(0);
+		switch (version_) {
+		case RAW_VERSION0:
+		case RAW_VERSION1:
+			parse_legacy();
+			break;
+		case RAW_VERSION3:
+			parse_v3();
+			break;
+		default:
+			char buf[64];
+			snprintf(buf, sizeof(buf), "unknown trace version 0x%08x", version_);
+			throw FormatError(path + ": " + buf);
+		}
+	} catch (...) {
+		munmap(const_cast<uint8_t *>(base_), size_);
+		throw;
+	}
+
+	for (size_t i = 0; i < threads_.size(); i++) {
+		thread_index_.emplace(threads_[i].tid, i);
+	}
+}
+
+TraceFile::~TraceFile()
+{
+	munmap(const_cast<uint8_t *>(base_), size_);
+}
+
+void
+TraceFile::set_timebase(uint32_t numer, uint32_t denom)
+{
+	if (numer == 0 || denom == 0) {
+		throw std::invalid_argument("timebase must be non-zero");
+	}
+	numer_ = numer;
+	denom_ = denom;
+	has_timebase_ = true;
+}
+
+uint64_t
+TraceFile::to_ns(uint64_t abstime) const
+{
+	if (numer_ == denom_) {
+		return abstime;
+	}
+	return (uint64_t)((unsigned __int128)abstime * numer_ / denom_);
+}
+
+const Thread *
+TraceFile::thread(uint64_t tid) const
+{
+	auto it = thread_index_.find(tid);
+	return it == thread_index_.end() ? nullptr : &threads_[it->second];
+}
+
+void
+TraceFile::parse_thread_map(size_t off, size_t count)
+{
+	if (count > (size_ - off) / THREADMAP_SIZE) {
+		throw FormatError("thread map runs past the end of the file");
+	}
+
+	threads_.reserve(threads_.size() + count);
+	for (size_t i = 0; i < count; i++, off += THREADMAP_SIZE) {
+		uint64_t tid = read<uint64_t>(off);
+		int pid = read<int32_t>(off + 8);
+
+		/* RAW_VERSION1 pads the map with empty entries */
+		if (tid == 0 && pid == 0) {
+			continue;
+		}
+		threads_.push_back(Thread{
+			.tid = tid,
+			.pid = pid,
+			.command = fixed_string(base_ + off + 12, THREADMAP_COMMAND_SIZE),
+		});
+	}
+}
+
+void
+TraceFile::parse_cpu_map(size_t off, size_t len, bool ext)
+{
+	size_t name_size = ext ? CPUMAP_EXT_NAME_SIZE : CPUMAP_NAME_SIZE;
+	size_t stride = 8 + name_size;
+
+	if (len < CPUMAP_HEADER_SIZE) {
+		return;
+	}
+	uint32_t count = read<uint32_t>(off + 4);
+	off += CPUMAP_HEADER_SIZE;
+	len -= CPUMAP_HEADER_SIZE;
+	if (count > len / stride) {
+		throw FormatError("CPU map runs past its chunk");
+	}
+
+	cpus_.reserve(count);
+	for (uint32_t i = 0; i < count; i++, off += stride) {
+		cpus_.push_back(Cpu{
+			.id = read<uint32_t>(off),
+			.flags = read<uint32_t>(off + 4),
+			.name = fixed_string(base_ + off + 8, name_size),
+		});
+	}
+}
+
+void
+TraceFile::add_events(size_t off, size_t len)
+{
+	if (off > size_) {
+		truncated_ = true;
+		return;
+	}
+	if (len > size_ - off) {
+		len = size_ - off;
+		truncated_ = true;
+	}
+	if (len % sizeof(Event)) {
+		truncated_ = true;
+	}
+
+	size_t count = len / sizeof(Event);
+	if (count == 0) {
+		return;
+	}
+	if (off % alignof(Event)) {
+		throw FormatError("misaligned event chunk at offset " + std::to_string(off));
+	}
+	spans_.emplace_back(reinterpret_cast<const Event *>(base_ + off), count);
+	nevents_ += count;
+}
+
+void
+TraceFile::parse_legacy()
+{
+	if (size_ < RAW_HEADER_SIZE) {
+		throw FormatError("file too small for a legacy header");
+	}
+
+	int32_t thread_count = read<int32_t>(4);
+	size_t off = RAW_HEADER_SIZE;
+
+	if (thread_count < 0) {
+		throw FormatError("negative thread count in header");
+	}
+	wall_secs_ = read<uint64_t>(8);
+	wall_usecs_ = read<uint32_t>(16);
+
+	parse_thread_map(off, (size_t)thread_count);
+	off += (size_t)thread_count * THREADMAP_SIZE;
+
+	if (version_ == RAW_VERSION1) {
+		/*
+		 * The CPU map sits in the padding right after the (padded)
+		 * thread map, and events start on the next 4K boundary.
+		 */
+		size_t events = (off + LEGACY_EVENTS_ALIGN - 1) & ~(LEGACY_EVENTS_ALIGN - 1);
+		if (off + CPUMAP_HEADER_SIZE <= events &&
+		    read<uint32_t>(off) == RAW_VERSION1) {
+			parse_cpu_map(off, events - off, false);
+		}
+		off = events;
+	}
+
+	add_events(off, off < size_ ? size_ - off : 0);
+}
+
+void
+TraceFile::parse_v3()
+{
+	uint64_t length = read<uint64_t>(8);
+	size_t off = V3_CHUNK_HEADER_SIZE;
+
+	if (length >= V3_HEADER_PAYLOAD_MIN) {
+		uint32_t numer = read<uint32_t>(off);
+		uint32_t denom = read<uint32_t>(off + 4);
+		if (numer != 0 && denom != 0) {
+			set_timebase(numer, denom);
+		}
+		wall_secs_ = read<uint64_t>(off + 16);
+		wall_usecs_ = read<uint32_t>(off + 24);
+	}
+	if (length > size_ - off) {
+		throw FormatError("header chunk runs past the end of the file");
+	}
+	off += length;
+
+	while (size_ - off >= V3_CHUNK_HEADER_SIZE) {
+		uint32_t tag = read<uint32_t>(off);
+		length = read<uint64_t>(off + 8);
+
+		if (tag == V3_RAW_EVENTS) {
+			if (size_ - off < V3_EVENT_CHUNK_HEADER_SIZE) {
+				truncated_ = true;
+				break;
+			}
+			off += V3_EVENT_CHUNK_HEADER_SIZE;
+			add_events(off, length);
+		} else {
+			off += V3_CHUNK_HEADER_SIZE;
+			if (length > size_ - off) {
+				truncated_ = true;
+				break;
+			}
+			if (tag == V3_CPU_MAP) {
+				bool ext = length >= CPUMAP_HEADER_SIZE &&
+				    read<uint32_t>(off) != RAW_VERSION1;
+				parse_cpu_map(off, length, ext);
+			} else if (tag == V3_THREAD_MAP) {
+				parse_thread_map(off, length / THREADMAP_SIZE);
+			}
+		}
+
+		if (length > size_ - off) {
+			break;
+		}
+		off += length;
+	}
+}
+
+void
+CodeTable::load_trace_codes(const std::string &path)
+{
+	std::ifstream in(path);
+	std::string line;
+
+	if (!in) {
+		throw std::system_error(errno, std::generic_category(), path);
+	}
+
+	while (std::getline(in, line)) {
+		const char *p = line.c_str();
+		char *end;
+
+		errno = 0;
+		unsigned long debugid = strtoul(p, &end, 16);
+		if (end == p || errno != 0 || debugid > UINT32_MAX) {
+			continue;
+		}
+		while (isspace((unsigned char)*end)) {
+			end++;
+		}
+		const char *name = end;
+		while (*end && !isspace((unsigned char)*end)) {
+			end++;
+		}
+		if (end != name) {
+			names_[(uint32_t)debugid] = std::string(name, (size_t)(end - name));
+		}
+	}
+}
+
+void
+CodeTable::load_syscalls(const std::string &path)
+{
+	std::ifstream in(path);
+	std::string line;
+
+	if (!in) {
+		throw std::system_error(errno, std::generic_category(), path);
+	}
+
+	/* "<number>\t<audit event>\t<files>\t{ <return type> <name>(<args>); }" */
+	while (std::getline(in, line)) {
+		if (line.empty() || !isdigit((unsigned char)line[0])) {
+			continue;
+		}
+
+		unsigned long number = strtoul(line.c_str(), nullptr, 10);
+		size_t brace = line.find('{');
+		size_t paren = line.find('(', brace == std::string::npos ? 0 : brace);
+		if (brace == std::string::npos || paren == std::string::npos || number > 0x3fff) {
+			continue;
+		}
+
+		size_t start = paren;
+		while (start > brace && (isalnum((unsigned char)line[start - 1]) || line[start - 1] == '_')) {
+			start--;
+		}
+		std::string name = line.substr(start, paren - start);
+		if (name.empty() || name == "nosys" || name == "enosys") {
+			continue;
+		}
+
+		/* trace_codes wins if it already names this one */
+		names_.try_emplace(kdbg_code(DBG_BSD, DBG_BSD_EXCP_SC, (uint32_t)number), "BSC_" + name);
+	}
+}
+
+std::string_view
+CodeTable::name(uint32_t debugid) const
+{
+	auto it = names_.find(debugid & ~DBG_FUNC_MASK);
+	return it == names_.end() ? std::string_view() : std::string_view(it->second);
+}
+
+std::string
+CodeTable::describe(uint32_t debugid) const
+{
+	std::string_view n = name(debugid);
+	if (!n.empty()) {
+		return std::string(n);
+	}
+
+	char buf[16];
+	snprintf(buf, sizeof(buf), "0x%08x", debugid & ~DBG_FUNC_MASK);
+	return buf;
+}
+
+} // namespace kdtrace
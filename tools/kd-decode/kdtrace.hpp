@@ -0,0 +1,194 @@
+/*
+ * kdtrace.hpp
+ *
+ * Host-side reader for kdebug trace files, as written by the kernel through
+ * KDWRITEMAP/KDWRITETR (see bsd/kern/kdebug.c) or captured by ktrace(1).
+ *
+ * Two file layouts are understood:
+ *
+ * - Legacy (RAW_VERSION0 and RAW_VERSION1): a RAW_header, the thread map,
+ *   and for RAW_VERSION1 a CPU map embedded in the padding that page aligns
+ *   the events which follow, up to the end of the file.
+ *
+ * - Chunked (RAW_VERSION3): a header chunk carrying the timebase, followed
+ *   by tagged chunks.  The CPU and thread map chunks are decoded, event
+ *   chunks (V3_RAW_EVENTS) are exposed as-is, anything else is skipped.
+ *
+ * Files are mapped read-only and events are never copied: consumers walk
+ * spans of kd_buf records straight out of the mapping.  Only traces from
+ * 64-bit kernels (LP64 kd_buf records) are supported.
+ */
+
+#ifndef KDTRACE_HPP
+#define KDTRACE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace kdtrace {
+
+/* Note: these must be kept in sync with the defs in kdebug_private.h/kdebug.c */
+
+constexpr uint32_t RAW_VERSION0   = 0x55aa0000;
+constexpr uint32_t RAW_VERSION1   = 0x55aa0101;
+constexpr uint32_t RAW_VERSION3   = 0x00001000;
+
+constexpr uint32_t V3_CONFIG      = 0x00001b00;
+constexpr uint32_t V3_CPU_MAP     = 0x00001c00;
+constexpr uint32_t V3_THREAD_MAP  = 0x00001d00;
+constexpr uint32_t V3_RAW_EVENTS  = 0x00001e00;
+constexpr uint32_t V3_NULL_CHUNK  = 0x00002000;
+
+constexpr uint32_t KDBG_CPUMAP_IS_IOP = 0x1;
+
+constexpr uint32_t DBG_FUNC_START = 0x1;
+constexpr uint32_t DBG_FUNC_END   = 0x2;
+constexpr uint32_t DBG_FUNC_MASK  = 0x3;
+
+constexpr uint32_t DBG_MACH         = 1;
+constexpr uint32_t DBG_BSD          = 4;
+constexpr uint32_t DBG_MACH_EXCP_SC = 0x0c;
+constexpr uint32_t DBG_MACH_SCHED   = 0x40;
+constexpr uint32_t DBG_BSD_EXCP_SC  = 0x0c;
+
+constexpr uint32_t MACH_SCHED         = 0x0;
+constexpr uint32_t MACH_STACK_HANDOFF = 0x2;
+constexpr uint32_t MACH_MAKE_RUNNABLE = 0x6;
+
+constexpr uint32_t
+kdbg_code(uint32_t cls, uint32_t subcls, uint32_t code)
+{
+	return ((cls & 0xff) << 24) | ((subcls & 0xff) << 16) | ((code & 0x3fff) << 2);
+}
+
+/*
+ * An event, laid out like the LP64 kd_buf: arg5 of the kernel's record is
+ * always the ID of the thread that emitted the event.
+ */
+struct Event {
+	uint64_t timestamp;
+	uint64_t arg[4];
+	uint64_t tid;
+	uint32_t debugid;
+	uint32_t cpuid;
+	uint64_t unused;
+
+	uint32_t cls() const { return debugid >> 24; }
+	uint32_t subclass() const { return (debugid >> 16) & 0xff; }
+	uint32_t code() const { return (debugid >> 2) & 0x3fff; }
+	uint32_t func() const { return debugid & DBG_FUNC_MASK; }
+	/* debugid without the DBG_FUNC_* qualifier */
+	uint32_t base() const { return debugid & ~DBG_FUNC_MASK; }
+};
+static_assert(sizeof(Event) == 64, "Event must match the LP64 kd_buf");
+
+struct Thread {
+	uint64_t    tid;
+	int         pid;
+	std::string command;
+};
+
+struct Cpu {
+	uint32_t    id;
+	uint32_t    flags;
+	std::string name;
+};
+
+class FormatError : public std::runtime_error {
+public:
+	using std::runtime_error::runtime_error;
+};
+
+class TraceFile {
+public:
+	/* Maps and parses the trace at `path`, throws FormatError or
+	 * std::system_error on failure. */
+	explicit TraceFile(const std::string &path);
+	~TraceFile();
+
+	TraceFile(const TraceFile &) = delete;
+	TraceFile &operator=(const TraceFile &) = delete;
+
+	uint32_t version() const { return version_; }
+	const std::vector<Thread> &threads() const { return threads_; }
+	const std::vector<Cpu> &cpus() const { return cpus_; }
+
+	/* Events in file order, which is timestamp order within each span. */
+	const std::vector<std::span<const Event>> &event_spans() const { return spans_; }
+	uint64_t event_count() const { return nevents_; }
+	/* The last event span was cut short (e.g. an interrupted capture). */
+	bool truncated() const { return truncated_; }
+
+	/* Timebase used to convert timestamps to nanoseconds.  Chunked traces
+	 * record it; legacy ones are assumed to be in nanoseconds. */
+	bool has_timebase() const { return has_timebase_; }
+	void set_timebase(uint32_t numer, uint32_t denom);
+	uint64_t to_ns(uint64_t abstime) const;
+	uint32_t timebase_numer() const { return numer_; }
+	uint32_t timebase_denom() const { return denom_; }
+
+	/* Wall clock time at the start of the trace, when recorded. */
+	uint64_t walltime_secs() const { return wall_secs_; }
+	uint32_t walltime_usecs() const { return wall_usecs_; }
+
+	const Thread *thread(uint64_t tid) const;
+
+private:
+	void parse_legacy();
+	void parse_v3();
+	void parse_cpu_map(size_t off, size_t len, bool ext);
+	void parse_thread_map(size_t off, size_t count);
+	void add_events(size_t off, size_t len);
+
+	template <typename T>
+	T read(size_t off) const;
+
+	const uint8_t *base_ = nullptr;
+	size_t         size_ = 0;
+
+	uint32_t version_ = 0;
+	std::vector<Thread> threads_;
+	std::unordered_map<uint64_t, size_t> thread_index_;
+	std::vector<Cpu> cpus_;
+	std::vector<std::span<const Event>> spans_;
+	uint64_t nevents_ = 0;
+	bool     truncated_ = false;
+
+	bool     has_timebase_ = false;
+	uint32_t numer_ = 1;
+	uint32_t denom_ = 1;
+	uint64_t wall_secs_ = 0;
+	uint32_t wall_usecs_ = 0;
+};
+
+/*
+ * Maps debugids to names, from bsd/kern/trace_codes ("0x<debugid>\t<name>")
+ * and optionally bsd/kern/syscalls.master for the BSD system call events,
+ * which trace_codes does not list.
+ */
+class CodeTable {
+public:
+	void load_trace_codes(const std::string &path);
+	void load_syscalls(const std::string &path);
+
+	/* Returns an empty view for unknown debugids. */
+	std::string_view name(uint32_t debugid) const;
+	/* Like name(), but formats unknown debugids as hex. */
+	std::string describe(uint32_t debugid) const;
+
+	size_t size() const { return names_.size(); }
+
+private:
+	std::unordered_map<uint32_t, std::string> names_;
+};
+
+} // namespace kdtrace
+
+#endif /* KDTRACE_HPP */
@@ -720,6 +720,69 @@ class KCBufferObject(KCContainerObject):
 
     no_end_message = "could not find buffer end marker"
 
+KCDATA_LZ4_BLOCK_MAGIC = 0x31347662      # 'bv41'
+KCDATA_LZ4_RAW_BLOCK_MAGIC = 0x2d347662  # 'bv4-'
+KCDATA_LZ4_END_MAGIC = 0x24347662        # 'bv4$'
+
+def DecompressLZ4Blocks(blob):
+    """ decode the block stream of an LZ4 compressed kcdata buffer (kcd_c_type 2).
+        Matches can reach back into earlier blocks, so everything is decoded into one buffer.
+    """
+    out = bytearray()
+    pos = 0
+    while True:
+        magic = struct.unpack_from('<I', blob, pos)[0]
+        if magic == KCDATA_LZ4_END_MAGIC:
+            return bytes(out)
+        if magic == KCDATA_LZ4_RAW_BLOCK_MAGIC:
+            size = struct.unpack_from('<I', blob, pos + 4)[0]
+            pos += 8
+            out += blob[pos:pos + size]
+            pos += size
+            continue
+        if magic != KCDATA_LZ4_BLOCK_MAGIC:
+            raise ValueError("bad LZ4 block magic 0x%x at offset %d" % (magic, pos))
+
+        decoded, encoded = struct.unpack_from('<II', blob, pos + 4)
+        block_start = len(out)
+        pos += 12
+        end = pos + encoded
+        while pos < end:
+            token = blob[pos]
+            pos += 1
+            length = token >> 4
+            if length == 15:
+                while True:
+                    b = blob[pos]
+                    pos += 1
+                    length += b
+                    if b != 255:
+                        break
+            out += blob[pos:pos + length]
+            pos += length
+            if pos >= end:
+                break
+            distance = blob[pos] | (blob[pos + 1] << 8)
+            pos += 2
+            length = (token & 15) + 4
+            if length == 19:
+                while True:
+                    b = blob[pos]
+                    pos += 1
+                    length += b
+                    if b != 255:
+                        break
+            if distance == 0 or distance > len(out):
+                raise ValueError("bad LZ4 match distance %d at offset %d" % (distance, pos))
+            ref = len(out) - distance
+            if distance >= length:
+                out += out[ref:ref + length]
+            else:
+                for i in range(length):
+                    out.append(out[ref + i])
+        if pos != end or len(out) - block_start != decoded:
+            raise ValueError("LZ4 block ending at offset %d decoded to %d bytes, expected %d" % (end, len(out) - block_start, decoded))
+
 class KCCompressedBufferObject(KCContainerObject):
 
     def ReadItems(self, iterator):
@@ -738,7 +801,7 @@ class KCCompressedBufferObject(KCContainerObject):
         return o.i_type in KNOWN_TOPLEVEL_CONTAINER_TYPES
 
     def GetCompressedBlob(self, data):
-        if self.header['kcd_c_type'] != 1:
+        if self.header['kcd_c_type'] not in (1, 2):
             raise NotImplementedError
         blob = data[self.blob_start:self.blob_start+self.header['kcd_c_totalout']]
         if len(blob) != self.header['kcd_c_totalout']:
@@ -748,7 +811,10 @@ class KCCompressedBufferObject(KCContainerObject):
     def Decompress(self, data):
         start_marker = struct.pack('<IIII', self.compressed_type, 0, 0, 0)
         end_marker = struct.pack('<IIII', GetTypeForName('KCDATA_TYPE_BUFFER_END'), 0, 0, 0)
-        decompressed = zlib.decompress(self.GetCompressedBlob(data))
+        if self.header['kcd_c_type'] == 2:
+            decompressed = DecompressLZ4Blocks(self.GetCompressedBlob(data))
+        else:
+            decompressed = zlib.decompress(self.GetCompressedBlob(data))
         if len(decompressed) != self.header['kcd_c_totalin']:
             raise ValueError("length of decompressed: %d vs expected %d" % (len(decompressed), self.header['kcd_c_totalin']))
         alignbytes = b'\x00' * (-len(decompressed) % 16)
@@ -2206,6 +2272,8 @@ PRETTIFY_FLAGS = {
         'disable_latency_info',
         'save_dyld_compactinfo',
         'include_driver_threads_in_kernel',
+        'do_compress_lz4',
+        'parallel',
     ],
     'system_state_flags': [
         'kUser64_p',
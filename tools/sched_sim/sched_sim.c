@@ -0,0 +1,1483 @@
+/*
+ * sched_sim.c
+ *
+ * User-space simulator for the Clutch/Edge scheduler policy.
+ *
+ * Replays a workload of thread wakeups across an AMP cluster topology and
+ * schedules it with the decisions in osfmk/kern/sched_clutch_policy.h, the
+ * same code sched_clutch.c uses: root bucket EDF, warp and starvation
+ * avoidance, clutch bucket group interactivity scoring with CPU usage ageout,
+ * and Edge migration across cluster edges. The hierarchy itself (root
+ * buckets, clutch buckets, thread run queues) is modeled the way
+ * sched_clutch.c maintains it.
+ *
+ * Usage:
+ * sched_sim [-e] [-s starvation_ms] [-n threads] [-o tunable=usecs ...]
+ *           workload ...
+ *
+ * The workload files are read in order; all of them make up one workload
+ * (e.g. a topology file and a trace converted with "kd-decode replay").
+ * Each line is one of:
+ *
+ *   cluster <name> <E|P> <ncpus> [speed <percent>]
+ *   edge <src> <dst> <migration weight> [steal]
+ *   group <name> [E|P]
+ *   thread <tid> <FIXPRI|FG|IN|DF|UT|BG> [pri <n>] [group <name>]
+ *   wake <time> <tid> <work>
+ *
+ * Times accept a ns (default), us, ms or s suffix. "wake" makes the thread
+ * runnable at <time> with <work> to do, measured on a cluster with 100%
+ * speed; once done, it blocks. A wakeup for a thread that has not blocked
+ * yet adds to its outstanding work. "edge" allows threads preferring <src>
+ * to be placed on <dst> when the load of <src> exceeds the load of <dst> by
+ * at least the migration weight, and with "steal", idle CPUs of <dst> to take
+ * threads from <src>. Threads prefer the first cluster of their group's type,
+ * or by default the first P cluster for FIXPRI to DF and the first E cluster
+ * for UT and BG.
+ *
+ * The cluster load is the platform shim's stand-in for the kernel's load
+ * average: 0 while a CPU of the cluster is idle, otherwise the number of
+ * threads running or waiting at the thread's QoS or higher per CPU, in
+ * hundredths (100 means every CPU busy and nothing waiting).
+ *
+ * The report gives, per QoS bucket, the latency from wakeup to first running
+ * percentiles, the wakeups that waited longer than the starvation threshold
+ * (-s, 100ms by default), the CPU time on each cluster type and how often
+ * the root bucket policy warped or avoided starvation; then the Edge
+ * migrations and, with -n, the threads that waited the longest.
+ *
+ * -e uses the embedded thread quantums instead of the macOS ones, and -o
+ * overrides a tunable in usecs: wcel.<bucket>, warp.<bucket>,
+ * quantum.<bucket>, pending.<bucket>, or interactive_pri (a priority).
+ *
+ * Build with the Makefile next to this file; it works on macOS and Linux.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <kern/sched_clutch_policy.h>
+
+#define NBUCKETS                SCHED_CLUTCH_POLICY_BUCKETS
+#define SS_MAX_CLUSTERS         16
+#define SS_MAX_CPUS             256
+#define SS_NAME_LEN             32
+
+#define SS_NSEC_PER_USEC        1000ULL
+#define SS_NSEC_PER_MSEC        1000000ULL
+
+#define MIN(a, b)               ((a) < (b) ? (a) : (b))
+
+/* threads of this bucket and below prefer E clusters by default */
+#define SS_BUCKET_SHARE_UT      (4)
+
+static const char *ss_bucket_names[NBUCKETS] = {
+	"FIXPRI", "FG", "IN", "DF", "UT", "BG",
+};
+
+/* default priority of threads in each bucket */
+static const int ss_bucket_default_pri[NBUCKETS] = {
+	47, 47, 37, 31, 20, 4,
+};
+
+/*
+ * Tunables, in usecs as in sched_clutch.c, and the nanosecond values the
+ * simulation uses.
+ */
+static uint32_t ss_wcel_us[NBUCKETS] = SCHED_CLUTCH_ROOT_BUCKET_WCEL_US_DEFAULT;
+static uint32_t ss_warp_us[NBUCKETS] = SCHED_CLUTCH_ROOT_BUCKET_WARP_US_DEFAULT;
+static uint32_t ss_quantum_us[NBUCKETS] = SCHED_CLUTCH_THREAD_QUANTUM_US_OSX;
+static uint32_t ss_quantum_embedded_us[NBUCKETS] = SCHED_CLUTCH_THREAD_QUANTUM_US_EMBEDDED;
+static uint32_t ss_pending_delta_us[NBUCKETS] = SCHED_CLUTCH_BUCKET_GROUP_PENDING_DELTA_US_DEFAULT;
+static uint8_t ss_interactive_pri = SCHED_CLUTCH_BUCKET_GROUP_INTERACTIVE_PRI_DEFAULT;
+
+static uint64_t ss_wcel[NBUCKETS];
+static uint64_t ss_warp[NBUCKETS];
+static uint64_t ss_quantum[NBUCKETS];
+static uint64_t ss_pending_delta[NBUCKETS];
+static uint64_t ss_adjust_threshold;
+
+/* Initial value for voluntary blocking time for the clutch_bucket */
+#define SS_BLOCKED_TS_INVALID   ((uint64_t)~0)
+
+struct ss_cluster;
+struct ss_clutch_bucket;
+
+/* sched_clutch_bucket_group: one per thread group and bucket */
+struct ss_bucket_group {
+	int                     bucket;
+	uint64_t                cpu_used;
+	uint64_t                cpu_blocked;
+	uint32_t                run_count;
+	uint64_t                blocked_ts;
+	uint32_t                pending_count;
+	uint64_t                pending_ts;
+	uint8_t                 interactivity;
+	uint64_t                interactivity_ts;
+	/* one clutch bucket per cluster */
+	struct ss_clutch_bucket *clutch_buckets;
+};
+
+struct ss_group {
+	char                    name[SS_NAME_LEN];
+	char                    type;           /* preferred cluster type, or 0 */
+	struct ss_bucket_group  buckets[NBUCKETS];
+};
+
+enum ss_thread_state {
+	SS_BLOCKED,
+	SS_RUNNABLE,
+	SS_RUNNING,
+};
+
+struct ss_thread {
+	uint64_t                tid;
+	int                     bucket;
+	int                     pri;
+	struct ss_group        *group;
+	size_t                  group_index;
+	enum ss_thread_state    state;
+	/* outstanding work, in ns at 100% speed */
+	uint64_t                work;
+	uint64_t                wake_ts;
+	bool                    wake_pending;
+	int                     cluster;
+	int                     last_cluster;
+	struct ss_thread       *next;
+
+	uint64_t                wakeups;
+	uint64_t                max_latency;
+	uint64_t                total_latency;
+};
+
+/* sched_clutch_bucket: the runnable threads of a group/bucket on a cluster */
+struct ss_clutch_bucket {
+	struct ss_bucket_group *group;
+	uint8_t                 priority;
+	uint32_t                thr_count;
+	struct ss_thread       *threads;        /* by priority, FIFO within one */
+	struct ss_clutch_bucket *next;
+};
+
+/* sched_clutch_root_bucket */
+struct ss_root_bucket {
+	int                     bucket;
+	struct ss_clutch_bucket *clutch_buckets; /* by priority, FIFO within one */
+	bool                    runnable;
+	uint64_t                deadline;
+	uint64_t                warp_remaining;
+	uint64_t                warped_deadline;
+	bool                    warp_available;
+	bool                    starvation_avoidance;
+	uint64_t                starvation_ts;
+};
+
+struct ss_edge {
+	bool                    migration_allowed;
+	bool                    steal_allowed;
+	uint32_t                migration_weight;
+};
+
+struct ss_cluster {
+	char                    name[SS_NAME_LEN];
+	char                    type;
+	int                     ncpus;
+	int                     speed;
+	int                     first_cpu;
+	int                     idle_cpus;
+	struct ss_root_bucket   root_buckets[NBUCKETS];
+	/* runnable threads, per bucket */
+	uint32_t                runnable[NBUCKETS];
+	struct ss_edge          edges[SS_MAX_CLUSTERS];
+	uint64_t                busy_ns;
+};
+
+struct ss_cpu {
+	int                     cluster;
+	struct ss_thread       *thread;
+	uint64_t                slice_start;
+	uint64_t                slice_end;
+};
+
+struct ss_wake {
+	uint64_t                time;
+	uint64_t                work;
+	struct ss_thread       *thread;
+};
+
+struct ss_samples {
+	uint64_t               *values;
+	size_t                  count;
+	size_t                  capacity;
+};
+
+struct ss_bucket_stats {
+	struct ss_samples       latency;
+	uint64_t                starved;
+	uint64_t                coalesced;
+	uint64_t                cpu_ns[2];      /* on E and P clusters */
+	uint64_t                selected;
+	uint64_t                warp_windows;
+	uint64_t                starvation_windows;
+};
+
+static struct {
+	struct ss_cluster       clusters[SS_MAX_CLUSTERS];
+	int                     nclusters;
+	struct ss_cpu           cpus[SS_MAX_CPUS];
+	int                     ncpus;
+
+	struct ss_group        *groups;
+	size_t                  ngroups;
+	struct ss_thread      **threads;
+	size_t                  nthreads;
+	/* open addressed thread ID table */
+	struct ss_thread      **thread_table;
+	size_t                  thread_table_size;
+
+	struct ss_wake         *wakes;
+	size_t                  nwakes;
+	size_t                  wakes_capacity;
+
+	/* sched_clutch_global_bucket_load: runnable clutch buckets per bucket */
+	uint32_t                bucket_load[NBUCKETS];
+
+	uint64_t                now;
+	struct ss_bucket_stats  stats[NBUCKETS];
+	uint64_t                off_preferred;
+	uint64_t                cluster_switches;
+	uint64_t                steals;
+	uint64_t                preemptions;
+} ss;
+
+static uint64_t ss_starvation_threshold = 100 * SS_NSEC_PER_MSEC;
+
+static const char *ss_file;
+static int ss_line;
+
+static void __attribute__((noreturn, format(printf, 1, 2)))
+ss_parse_error(const char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "%s:%d: ", ss_file, ss_line);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+	exit(1);
+}
+
+static void *
+ss_realloc(void *p, size_t count, size_t size)
+{
+	p = realloc(p, count * size);
+	if (p == NULL && count) {
+		perror("realloc");
+		exit(1);
+	}
+	return p;
+}
+
+static void
+ss_samples_add(struct ss_samples *s, uint64_t value)
+{
+	if (s->count == s->capacity) {
+		s->capacity = s->capacity ? s->capacity * 2 : 256;
+		s->values = ss_realloc(s->values, s->capacity, sizeof(uint64_t));
+	}
+	s->values[s->count++] = value;
+}
+
+static int
+ss_u64_compare(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+/* nearest rank percentile of sorted samples */
+static uint64_t
+ss_percentile(const struct ss_samples *s, unsigned pct)
+{
+	if (s->count == 0) {
+		return 0;
+	}
+	size_t rank = (s->count * pct + 99) / 100;
+	return s->values[rank ? rank - 1 : 0];
+}
+
+/*
+ * Workload parsing
+ */
+
+static int
+ss_bucket_from_name(const char *name)
+{
+	for (int i = 0; i < NBUCKETS; i++) {
+		if (strcasecmp(name, ss_bucket_names[i]) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static uint64_t
+ss_parse_u64(const char *s, const char *what)
+{
+	char *end;
+
+	if (s == NULL) {
+		ss_parse_error("missing %s", what);
+	}
+	errno = 0;
+	unsigned long long v = strtoull(s, &end, 0);
+	if (end == s || *end != '\0' || errno != 0) {
+		ss_parse_error("invalid %s '%s'", what, s);
+	}
+	return v;
+}
+
+static uint64_t
+ss_parse_time(const char *s, const char *what)
+{
+	char *end;
+
+	if (s == NULL) {
+		ss_parse_error("missing %s", what);
+	}
+	errno = 0;
+	double v = strtod(s, &end);
+	if (end == s || errno != 0 || v < 0) {
+		ss_parse_error("invalid %s '%s'", what, s);
+	}
+	if (*end == '\0' || strcmp(end, "ns") == 0) {
+		/* nanoseconds */
+	} else if (strcmp(end, "us") == 0) {
+		v *= SS_NSEC_PER_USEC;
+	} else if (strcmp(end, "ms") == 0) {
+		v *= SS_NSEC_PER_MSEC;
+	} else if (strcmp(end, "s") == 0) {
+		v *= 1e9;
+	} else {
+		ss_parse_error("invalid %s '%s'", what, s);
+	}
+	return (uint64_t)(v + 0.5);
+}
+
+static int
+ss_cluster_lookup(const char *name)
+{
+	for (int i = 0; i < ss.nclusters; i++) {
+		if (strcmp(ss.clusters[i].name, name) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static struct ss_group *
+ss_group_lookup(const char *name, bool create)
+{
+	for (size_t i = 0; i < ss.ngroups; i++) {
+		if (strcmp(ss.groups[i].name, name) == 0) {
+			return &ss.groups[i];
+		}
+	}
+	if (!create) {
+		return NULL;
+	}
+	if (strlen(name) >= SS_NAME_LEN) {
+		ss_parse_error("group name '%s' too long", name);
+	}
+
+	ss.groups = ss_realloc(ss.groups, ss.ngroups + 1, sizeof(struct ss_group));
+	struct ss_group *group = &ss.groups[ss.ngroups++];
+	memset(group, 0, sizeof(*group));
+	strcpy(group->name, name);
+	return group;
+}
+
+static size_t
+ss_thread_hash(uint64_t tid)
+{
+	tid ^= tid >> 33;
+	tid *= 0xff51afd7ed558ccdULL;
+	tid ^= tid >> 33;
+	return (size_t)(tid & (ss.thread_table_size - 1));
+}
+
+static struct ss_thread *
+ss_thread_lookup(uint64_t tid)
+{
+	if (ss.thread_table_size == 0) {
+		return NULL;
+	}
+	for (size_t i = ss_thread_hash(tid);; i = (i + 1) & (ss.thread_table_size - 1)) {
+		if (ss.thread_table[i] == NULL || ss.thread_table[i]->tid == tid) {
+			return ss.thread_table[i];
+		}
+	}
+}
+
+static void
+ss_thread_table_insert(struct ss_thread *thread)
+{
+	size_t i = ss_thread_hash(thread->tid);
+	while (ss.thread_table[i] != NULL) {
+		i = (i + 1) & (ss.thread_table_size - 1);
+	}
+	ss.thread_table[i] = thread;
+}
+
+static void
+ss_thread_add(struct ss_thread *thread)
+{
+	if ((ss.nthreads + 1) * 2 > ss.thread_table_size) {
+		size_t size = ss.thread_table_size ? ss.thread_table_size * 2 : 1024;
+		free(ss.thread_table);
+		ss.thread_table = calloc(size, sizeof(struct ss_thread *));
+		if (ss.thread_table == NULL) {
+			perror("calloc");
+			exit(1);
+		}
+		ss.thread_table_size = size;
+		for (size_t i = 0; i < ss.nthreads; i++) {
+			ss_thread_table_insert(ss.threads[i]);
+		}
+	}
+	ss.threads = ss_realloc(ss.threads, ss.nthreads + 1, sizeof(struct ss_thread *));
+	ss.threads[ss.nthreads++] = thread;
+	ss_thread_table_insert(thread);
+}
+
+static void
+ss_parse_line(char *line)
+{
+	char *save = NULL;
+	char *cmd = strtok_r(line, " \t\r\n", &save);
+
+	if (cmd == NULL || cmd[0] == '#') {
+		return;
+	}
+#define NEXT() strtok_r(NULL, " \t\r\n", &save)
+
+	if (strcmp(cmd, "cluster") == 0) {
+		const char *name = NEXT(), *type = NEXT();
+		if (name == NULL || type == NULL || (strcmp(type, "E") != 0 && strcmp(type, "P") != 0)) {
+			ss_parse_error("usage: cluster <name> <E|P> <ncpus> [speed <percent>]");
+		}
+		uint64_t ncpus = ss_parse_u64(NEXT(), "CPU count");
+		uint64_t speed = 100;
+		const char *opt = NEXT();
+		if (opt != NULL) {
+			if (strcmp(opt, "speed") != 0) {
+				ss_parse_error("unknown cluster option '%s'", opt);
+			}
+			speed = ss_parse_u64(NEXT(), "speed");
+		}
+		if (ss.nclusters == SS_MAX_CLUSTERS || ncpus == 0 ||
+		    ss.ncpus + ncpus > SS_MAX_CPUS || speed == 0 || speed > 1000 ||
+		    strlen(name) >= SS_NAME_LEN || ss_cluster_lookup(name) != -1) {
+			ss_parse_error("invalid or duplicate cluster '%s'", name);
+		}
+		struct ss_cluster *cluster = &ss.clusters[ss.nclusters];
+		strcpy(cluster->name, name);
+		cluster->type = type[0];
+		cluster->ncpus = (int)ncpus;
+		cluster->idle_cpus = (int)ncpus;
+		cluster->speed = (int)speed;
+		cluster->first_cpu = ss.ncpus;
+		for (int i = 0; i < (int)ncpus; i++) {
+			ss.cpus[ss.ncpus++].cluster = ss.nclusters;
+		}
+		ss.nclusters++;
+	} else if (strcmp(cmd, "edge") == 0) {
+		const char *src = NEXT(), *dst = NEXT();
+		int s = src ? ss_cluster_lookup(src) : -1;
+		int d = dst ? ss_cluster_lookup(dst) : -1;
+		if (s == -1 || d == -1 || s == d) {
+			ss_parse_error("usage: edge <src> <dst> <migration weight> [steal]");
+		}
+		struct ss_edge *edge = &ss.clusters[s].edges[d];
+		edge->migration_allowed = true;
+		edge->migration_weight = (uint32_t)ss_parse_u64(NEXT(), "migration weight");
+		const char *opt = NEXT();
+		if (opt != NULL) {
+			if (strcmp(opt, "steal") != 0) {
+				ss_parse_error("unknown edge option '%s'", opt);
+			}
+			edge->steal_allowed = true;
+		}
+	} else if (strcmp(cmd, "group") == 0) {
+		const char *name = NEXT(), *type = NEXT();
+		if (name == NULL || (type != NULL && strcmp(type, "E") != 0 && strcmp(type, "P") != 0)) {
+			ss_parse_error("usage: group <name> [E|P]");
+		}
+		ss_group_lookup(name, true)->type = type ? type[0] : 0;
+	} else if (strcmp(cmd, "thread") == 0) {
+		uint64_t tid = ss_parse_u64(NEXT(), "thread ID");
+		const char *bucket_name = NEXT();
+		int bucket = bucket_name ? ss_bucket_from_name(bucket_name) : -1;
+		if (bucket == -1) {
+			ss_parse_error("usage: thread <tid> <FIXPRI|FG|IN|DF|UT|BG> [pri <n>] [group <name>]");
+		}
+		if (ss_thread_lookup(tid) != NULL) {
+			ss_parse_error("duplicate thread 0x%" PRIx64, tid);
+		}
+		struct ss_thread *thread = calloc(1, sizeof(*thread));
+		if (thread == NULL) {
+			perror("calloc");
+			exit(1);
+		}
+		thread->tid = tid;
+		thread->bucket = bucket;
+		thread->pri = ss_bucket_default_pri[bucket];
+		thread->last_cluster = -1;
+		const char *group_name = "default";
+		const char *opt;
+		while ((opt = NEXT()) != NULL) {
+			if (strcmp(opt, "pri") == 0) {
+				uint64_t pri = ss_parse_u64(NEXT(), "priority");
+				if (pri > 127) {
+					ss_parse_error("invalid priority %" PRIu64, pri);
+				}
+				thread->pri = (int)pri;
+			} else if (strcmp(opt, "group") == 0) {
+				group_name = NEXT();
+				if (group_name == NULL) {
+					ss_parse_error("missing group name");
+				}
+			} else {
+				ss_parse_error("unknown thread option '%s'", opt);
+			}
+		}
+		/* the groups may still move; thread->group is set up once they are all known */
+		thread->group_index = (size_t)(ss_group_lookup(group_name, true) - ss.groups);
+		ss_thread_add(thread);
+	} else if (strcmp(cmd, "wake") == 0) {
+		uint64_t time = ss_parse_time(NEXT(), "time");
+		uint64_t tid = ss_parse_u64(NEXT(), "thread ID");
+		uint64_t work = ss_parse_time(NEXT(), "work");
+		struct ss_thread *thread = ss_thread_lookup(tid);
+		if (thread == NULL) {
+			ss_parse_error("unknown thread 0x%" PRIx64, tid);
+		}
+		if (ss.nwakes == ss.wakes_capacity) {
+			ss.wakes_capacity = ss.wakes_capacity ? ss.wakes_capacity * 2 : 4096;
+			ss.wakes = ss_realloc(ss.wakes, ss.wakes_capacity, sizeof(struct ss_wake));
+		}
+		ss.wakes[ss.nwakes++] = (struct ss_wake){ .time = time, .work = work, .thread = thread };
+	} else {
+		ss_parse_error("unknown directive '%s'", cmd);
+	}
+	if (NEXT() != NULL) {
+		ss_parse_error("trailing characters");
+	}
+#undef NEXT
+}
+
+static void
+ss_parse_file(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	char *line = NULL;
+	size_t cap = 0;
+
+	if (f == NULL) {
+		perror(path);
+		exit(1);
+	}
+	ss_file = path;
+	ss_line = 0;
+	while (getline(&line, &cap, f) != -1) {
+		ss_line++;
+		ss_parse_line(line);
+	}
+	free(line);
+	fclose(f);
+}
+
+static int
+ss_wake_compare(const void *a, const void *b)
+{
+	const struct ss_wake *x = a, *y = b;
+	if (x->time != y->time) {
+		return (x->time > y->time) - (x->time < y->time);
+	}
+	/* keep the workload order for simultaneous wakeups */
+	return (x > y) - (x < y);
+}
+
+/*
+ * Clutch bucket group CPU accounting and interactivity
+ * (sched_clutch_bucket_group_*)
+ */
+
+static void
+ss_bucket_group_init(struct ss_bucket_group *bg, int bucket)
+{
+	bg->bucket = bucket;
+	bg->interactivity = (uint8_t)(ss_interactive_pri * 2);
+	bg->interactivity_ts = 0;
+	bg->cpu_blocked = ss_adjust_threshold;
+	bg->blocked_ts = SS_BLOCKED_TS_INVALID;
+	bg->pending_ts = SCHED_CLUTCH_BUCKET_GROUP_PENDING_INVALID;
+	bg->clutch_buckets = calloc((size_t)ss.nclusters, sizeof(struct ss_clutch_bucket));
+	if (bg->clutch_buckets == NULL) {
+		perror("calloc");
+		exit(1);
+	}
+	for (int i = 0; i < ss.nclusters; i++) {
+		bg->clutch_buckets[i].group = bg;
+	}
+}
+
+static void
+ss_bucket_group_run_count_inc(struct ss_bucket_group *bg)
+{
+	if (bg->run_count++ == 0 && bg->blocked_ts != SS_BLOCKED_TS_INVALID) {
+		if (ss.now > bg->blocked_ts) {
+			bg->cpu_blocked += MIN(ss.now - bg->blocked_ts, ss_adjust_threshold);
+		}
+		bg->blocked_ts = SS_BLOCKED_TS_INVALID;
+	}
+}
+
+static void
+ss_bucket_group_run_count_dec(struct ss_bucket_group *bg)
+{
+	if (--bg->run_count == 0) {
+		bg->blocked_ts = ss.now;
+	}
+}
+
+static void
+ss_bucket_group_cpu_usage_update(struct ss_bucket_group *bg, uint64_t delta)
+{
+	if (bg->bucket == SCHED_CLUTCH_POLICY_BUCKET_FIXPRI) {
+		/* Since Above UI bucket has maximum interactivity score always, nothing to do here */
+		return;
+	}
+	bg->cpu_used += MIN(delta, ss_adjust_threshold);
+}
+
+static void
+ss_bucket_group_thr_count_inc(struct ss_bucket_group *bg)
+{
+	if (bg->pending_count++ == 0) {
+		bg->pending_ts = ss.now;
+	}
+}
+
+static void
+ss_bucket_group_thr_count_dec(struct ss_bucket_group *bg)
+{
+	if (--bg->pending_count == 0) {
+		bg->pending_ts = SCHED_CLUTCH_BUCKET_GROUP_PENDING_INVALID;
+	} else {
+		bg->pending_ts = ss.now;
+	}
+}
+
+static uint8_t
+ss_bucket_group_interactivity(struct ss_bucket_group *bg)
+{
+	if (bg->bucket == SCHED_CLUTCH_POLICY_BUCKET_FIXPRI) {
+		return bg->interactivity;
+	}
+
+	uint8_t pending_intervals = sched_clutch_policy_pending_ageout(&bg->pending_ts, ss.now,
+	    ss_pending_delta[bg->bucket], ss.bucket_load[bg->bucket]);
+	sched_clutch_policy_cpu_adjust(&bg->cpu_used, &bg->cpu_blocked, pending_intervals,
+	    ss_adjust_threshold, ss_interactive_pri);
+
+	uint8_t score = bg->interactivity;
+	if (bg->cpu_used != 0 || bg->cpu_blocked != 0) {
+		score = sched_clutch_policy_interactivity_score(bg->cpu_used, bg->cpu_blocked, ss_interactive_pri);
+	}
+	/* the Edge scheduler keeps the initial score until the first update */
+	if (bg->interactivity_ts < ss.now) {
+		if (bg->interactivity_ts != 0) {
+			bg->interactivity = score;
+		}
+		bg->interactivity_ts = ss.now;
+	}
+	return bg->interactivity;
+}
+
+/*
+ * Clutch hierarchy (sched_clutch_root_*, sched_clutch_bucket_*)
+ */
+
+static uint8_t
+ss_clutch_bucket_pri(struct ss_clutch_bucket *cb)
+{
+	if (cb->thr_count == 0) {
+		return 0;
+	}
+	/* threads are kept by priority, the first one is the highest */
+	return (uint8_t)(cb->threads->pri + ss_bucket_group_interactivity(cb->group));
+}
+
+static void
+ss_root_bucket_deadline_update(struct ss_root_bucket *rb)
+{
+	if (rb->bucket == SCHED_CLUTCH_POLICY_BUCKET_FIXPRI) {
+		return;
+	}
+	rb->deadline = sched_clutch_policy_root_bucket_deadline(rb->bucket, ss.now, ss_wcel[rb->bucket]);
+}
+
+static void
+ss_root_bucket_runnable(struct ss_root_bucket *rb)
+{
+	rb->runnable = true;
+	if (rb->bucket == SCHED_CLUTCH_POLICY_BUCKET_FIXPRI) {
+		return;
+	}
+	if (!rb->starvation_avoidance) {
+		rb->deadline = sched_clutch_policy_root_bucket_deadline(rb->bucket, ss.now, ss_wcel[rb->bucket]);
+	}
+	if (rb->warp_remaining) {
+		rb->warp_available = true;
+	}
+}
+
+static void
+ss_root_bucket_empty(struct ss_root_bucket *rb)
+{
+	rb->runnable = false;
+	if (rb->bucket == SCHED_CLUTCH_POLICY_BUCKET_FIXPRI) {
+		return;
+	}
+	rb->warp_available = false;
+	rb->warp_remaining = sched_clutch_policy_warp_remaining(rb->warp_remaining, rb->warped_deadline, ss.now);
+}
+
+static void
+ss_clutch_bucket_runq_enqueue(struct ss_root_bucket *rb, struct ss_clutch_bucket *cb)
+{
+	struct ss_clutch_bucket **p = &rb->clutch_buckets;
+	while (*p != NULL && (*p)->priority >= cb->priority) {
+		p = &(*p)->next;
+	}
+	cb->next = *p;
+	*p = cb;
+}
+
+static void
+ss_clutch_bucket_runq_remove(struct ss_root_bucket *rb, struct ss_clutch_bucket *cb)
+{
+	struct ss_clutch_bucket **p = &rb->clutch_buckets;
+	while (*p != cb) {
+		p = &(*p)->next;
+	}
+	*p = cb->next;
+	cb->next = NULL;
+}
+
+static void
+ss_clutch_bucket_hierarchy_insert(struct ss_cluster *cluster, struct ss_clutch_bucket *cb)
+{
+	struct ss_root_bucket *rb = &cluster->root_buckets[cb->group->bucket];
+
+	if (rb->clutch_buckets == NULL) {
+		ss_root_bucket_runnable(rb);
+	}
+	ss_clutch_bucket_runq_enqueue(rb, cb);
+	ss.bucket_load[cb->group->bucket]++;
+}
+
+static void
+ss_clutch_bucket_hierarchy_remove(struct ss_cluster *cluster, struct ss_clutch_bucket *cb)
+{
+	struct ss_root_bucket *rb = &cluster->root_buckets[cb->group->bucket];
+
+	ss_clutch_bucket_runq_remove(rb, cb);
+	if (rb->clutch_buckets == NULL) {
+		ss_root_bucket_empty(rb);
+	}
+	ss.bucket_load[cb->group->bucket]--;
+}
+
+/* sched_clutch_bucket_update(); round robin moves the bucket behind its peers */
+static void
+ss_clutch_bucket_update(struct ss_cluster *cluster, struct ss_clutch_bucket *cb, bool round_robin)
+{
+	struct ss_root_bucket *rb = &cluster->root_buckets[cb->group->bucket];
+	uint8_t pri = ss_clutch_bucket_pri(cb);
+
+	if (pri == cb->priority && !round_robin) {
+		return;
+	}
+	ss_clutch_bucket_runq_remove(rb, cb);
+	cb->priority = pri;
+	ss_clutch_bucket_runq_enqueue(rb, cb);
+}
+
+static void
+ss_thread_insert(struct ss_cluster *cluster, struct ss_thread *thread, bool head)
+{
+	int cid = (int)(cluster - ss.clusters);
+	struct ss_bucket_group *bg = &thread->group->buckets[thread->bucket];
+	struct ss_clutch_bucket *cb = &bg->clutch_buckets[cid];
+
+	ss_bucket_group_thr_count_inc(bg);
+
+	struct ss_thread **p = &cb->threads;
+	while (*p != NULL && ((*p)->pri > thread->pri || ((*p)->pri == thread->pri && !head))) {
+		p = &(*p)->next;
+	}
+	thread->next = *p;
+	*p = thread;
+	thread->state = SS_RUNNABLE;
+	thread->cluster = cid;
+
+	if (cb->thr_count++ == 0) {
+		cb->priority = ss_clutch_bucket_pri(cb);
+		ss_clutch_bucket_hierarchy_insert(cluster, cb);
+	} else {
+		ss_clutch_bucket_update(cluster, cb, false);
+	}
+	cluster->runnable[thread->bucket]++;
+}
+
+static void
+ss_thread_remove(struct ss_cluster *cluster, struct ss_thread *thread)
+{
+	struct ss_bucket_group *bg = &thread->group->buckets[thread->bucket];
+	struct ss_clutch_bucket *cb = &bg->clutch_buckets[cluster - ss.clusters];
+
+	struct ss_thread **p = &cb->threads;
+	while (*p != thread) {
+		p = &(*p)->next;
+	}
+	*p = thread->next;
+	thread->next = NULL;
+	cluster->runnable[thread->bucket]--;
+	ss_bucket_group_thr_count_dec(bg);
+
+	if (--cb->thr_count == 0) {
+		ss_clutch_bucket_hierarchy_remove(cluster, cb);
+		cb->priority = 0;
+	} else {
+		ss_clutch_bucket_update(cluster, cb, true);
+	}
+}
+
+/* sched_clutch_root_highest_root_bucket() for the unbound hierarchy */
+static struct ss_root_bucket *
+ss_highest_root_bucket(struct ss_cluster *cluster)
+{
+	struct ss_root_bucket *rbs = cluster->root_buckets;
+	int highest = -1;
+
+	for (int i = 0; i < NBUCKETS; i++) {
+		if (rbs[i].runnable) {
+			highest = i;
+			break;
+		}
+	}
+	if (highest == -1) {
+		return NULL;
+	}
+
+	/* Above UI root bucket selection */
+	struct ss_root_bucket *aboveui = &rbs[SCHED_CLUTCH_POLICY_BUCKET_FIXPRI];
+	struct ss_root_bucket *sharefg = &rbs[SCHED_CLUTCH_POLICY_BUCKET_SHARE_FG];
+	if (aboveui->runnable && (!sharefg->runnable ||
+	    aboveui->clutch_buckets->priority >= sharefg->clutch_buckets->priority)) {
+		return aboveui;
+	}
+
+	for (;;) {
+		struct ss_root_bucket *edf = NULL;
+		int warp_index = -1;
+
+		for (int i = SCHED_CLUTCH_POLICY_BUCKET_SHARE_FG; i < NBUCKETS; i++) {
+			if (rbs[i].runnable && (edf == NULL || rbs[i].deadline < edf->deadline)) {
+				edf = &rbs[i];
+			}
+			if (warp_index == -1 && rbs[i].warp_available) {
+				warp_index = i;
+			}
+		}
+		struct ss_root_bucket *warp = (warp_index != -1 && warp_index < edf->bucket) ? &rbs[warp_index] : NULL;
+		uint64_t starvation_window = 0;
+		if (edf->starvation_avoidance) {
+			starvation_window = sched_clutch_policy_starvation_window(ss_quantum[edf->bucket], (uint32_t)cluster->ncpus);
+		}
+
+		switch (sched_clutch_policy_root_select(highest, edf->bucket, edf->starvation_avoidance,
+		    edf->starvation_ts, starvation_window, warp_index, warp ? warp->warped_deadline : 0, ss.now)) {
+		case SCHED_CLUTCH_ROOT_SELECT_EDF_STARVATION:
+			return edf;
+		case SCHED_CLUTCH_ROOT_SELECT_STARVATION_EXPIRED:
+			edf->starvation_avoidance = false;
+			edf->starvation_ts = 0;
+			ss_root_bucket_deadline_update(edf);
+			continue;
+		case SCHED_CLUTCH_ROOT_SELECT_EDF_STARVATION_START:
+			edf->starvation_avoidance = true;
+			edf->starvation_ts = ss.now;
+			ss.stats[edf->bucket].starvation_windows++;
+			return edf;
+		case SCHED_CLUTCH_ROOT_SELECT_EDF:
+			ss_root_bucket_deadline_update(edf);
+			edf->warp_remaining = ss_warp[edf->bucket];
+			edf->warped_deadline = SCHED_CLUTCH_ROOT_BUCKET_WARP_UNUSED;
+			edf->warp_available = true;
+			return edf;
+		case SCHED_CLUTCH_ROOT_SELECT_WARP_START:
+			warp->warped_deadline = ss.now + warp->warp_remaining;
+			ss_root_bucket_deadline_update(warp);
+			ss.stats[warp->bucket].warp_windows++;
+			return warp;
+		case SCHED_CLUTCH_ROOT_SELECT_WARP:
+			ss_root_bucket_deadline_update(warp);
+			return warp;
+		case SCHED_CLUTCH_ROOT_SELECT_WARP_EXPIRED:
+			warp->warp_remaining = 0;
+			warp->warp_available = false;
+			continue;
+		}
+		abort();
+	}
+}
+
+static struct ss_thread *
+ss_cluster_choose_thread(struct ss_cluster *cluster)
+{
+	struct ss_root_bucket *rb = ss_highest_root_bucket(cluster);
+	if (rb == NULL) {
+		return NULL;
+	}
+	struct ss_thread *thread = rb->clutch_buckets->threads;
+	ss_thread_remove(cluster, thread);
+	ss.stats[rb->bucket].selected++;
+	return thread;
+}
+
+static uint32_t
+ss_cluster_total_runnable(const struct ss_cluster *cluster)
+{
+	uint32_t n = 0;
+	for (int i = 0; i < NBUCKETS; i++) {
+		n += cluster->runnable[i];
+	}
+	return n;
+}
+
+/*
+ * Edge cluster selection
+ */
+
+/* see the description of the load at the top of the file */
+static uint32_t
+ss_cluster_load(const struct ss_cluster *cluster, int bucket)
+{
+	if (cluster->idle_cpus > 0) {
+		return 0;
+	}
+	uint32_t waiting = 0;
+	for (int i = 0; i <= bucket; i++) {
+		waiting += cluster->runnable[i];
+	}
+	return (uint32_t)(((uint64_t)cluster->ncpus + waiting) * 100 / (uint64_t)cluster->ncpus);
+}
+
+static int
+ss_preferred_cluster(const struct ss_thread *thread)
+{
+	char type = thread->group->type;
+	if (type == 0) {
+		type = (thread->bucket < SS_BUCKET_SHARE_UT) ? 'P' : 'E';
+	}
+	for (int i = 0; i < ss.nclusters; i++) {
+		if (ss.clusters[i].type == type) {
+			return i;
+		}
+	}
+	return 0;
+}
+
+/* sched_edge_migrate_edges_evaluate() */
+static int
+ss_choose_cluster(const struct ss_thread *thread)
+{
+	int preferred = ss_preferred_cluster(thread);
+	const struct ss_cluster *pc = &ss.clusters[preferred];
+	uint32_t preferred_load = ss_cluster_load(pc, thread->bucket);
+	uint32_t max_edge_delta = 0;
+	int selected = preferred;
+
+	if (preferred_load == 0) {
+		return preferred;
+	}
+	/* native clusters first, then the others */
+	for (int pass = 0; pass < 2; pass++) {
+		for (int i = 0; i < ss.nclusters; i++) {
+			const struct ss_cluster *dst = &ss.clusters[i];
+			if (i == preferred || (dst->type == pc->type) != (pass == 0) ||
+			    !pc->edges[i].migration_allowed) {
+				continue;
+			}
+			switch (sched_edge_policy_migration_check(preferred_load, ss_cluster_load(dst, thread->bucket),
+			    pc->edges[i].migration_weight, false, ss.clusters[selected].type == pc->type,
+			    dst->type == pc->type, &max_edge_delta)) {
+			case SCHED_EDGE_MIGRATE_IDLE:
+				return i;
+			case SCHED_EDGE_MIGRATE_CANDIDATE:
+				selected = i;
+				break;
+			case SCHED_EDGE_MIGRATE_SKIP:
+				break;
+			}
+		}
+	}
+	return selected;
+}
+
+/*
+ * Processors
+ */
+
+static void ss_cpu_dispatch(struct ss_cpu *cpu, struct ss_thread *thread);
+
+/* time the thread needs to finish its work on a cluster */
+static uint64_t
+ss_work_time(const struct ss_thread *thread, const struct ss_cluster *cluster)
+{
+	return (thread->work * 100 + (uint64_t)cluster->speed - 1) / (uint64_t)cluster->speed;
+}
+
+/* end the running slice of the CPU at the current time, and account for it */
+static struct ss_thread *
+ss_cpu_slice_end(struct ss_cpu *cpu)
+{
+	struct ss_thread *thread = cpu->thread;
+	struct ss_cluster *cluster = &ss.clusters[cpu->cluster];
+	uint64_t elapsed = ss.now - cpu->slice_start;
+
+	if (elapsed >= ss_work_time(thread, cluster)) {
+		thread->work = 0;
+	} else {
+		thread->work -= MIN(thread->work, elapsed * (uint64_t)cluster->speed / 100);
+	}
+	ss_bucket_group_cpu_usage_update(&thread->group->buckets[thread->bucket], elapsed);
+	cluster->busy_ns += elapsed;
+	ss.stats[thread->bucket].cpu_ns[cluster->type == 'P'] += elapsed;
+
+	cpu->thread = NULL;
+	cluster->idle_cpus++;
+	return thread;
+}
+
+static struct ss_cpu *
+ss_cluster_idle_cpu(const struct ss_cluster *cluster)
+{
+	for (int i = 0; i < cluster->ncpus; i++) {
+		struct ss_cpu *cpu = &ss.cpus[cluster->first_cpu + i];
+		if (cpu->thread == NULL) {
+			return cpu;
+		}
+	}
+	return NULL;
+}
+
+/* pick the next thread for a CPU, stealing from other clusters if allowed */
+static void
+ss_cpu_select(struct ss_cpu *cpu)
+{
+	struct ss_cluster *cluster = &ss.clusters[cpu->cluster];
+	struct ss_thread *thread = ss_cluster_choose_thread(cluster);
+
+	if (thread == NULL) {
+		int victim = -1;
+		uint32_t victim_load = 0;
+		for (int i = 0; i < ss.nclusters; i++) {
+			uint32_t n = ss_cluster_total_runnable(&ss.clusters[i]);
+			if (i != cpu->cluster && ss.clusters[i].edges[cpu->cluster].steal_allowed && n > victim_load) {
+				victim = i;
+				victim_load = n;
+			}
+		}
+		if (victim != -1) {
+			thread = ss_cluster_choose_thread(&ss.clusters[victim]);
+			ss.steals++;
+		}
+	}
+	if (thread != NULL) {
+		ss_cpu_dispatch(cpu, thread);
+	}
+}
+
+static void
+ss_thread_setrun(struct ss_thread *thread, bool head)
+{
+	int cid = ss_choose_cluster(thread);
+	struct ss_cluster *cluster = &ss.clusters[cid];
+
+	if (cid != ss_preferred_cluster(thread)) {
+		ss.off_preferred++;
+	}
+	ss_thread_insert(cluster, thread, head);
+
+	struct ss_cpu *cpu = ss_cluster_idle_cpu(cluster);
+	if (cpu != NULL) {
+		ss_cpu_select(cpu);
+		return;
+	}
+
+	/* preempt the lowest priority thread running on the cluster */
+	struct ss_cpu *victim = NULL;
+	for (int i = 0; i < cluster->ncpus; i++) {
+		struct ss_cpu *c = &ss.cpus[cluster->first_cpu + i];
+		if (victim == NULL || c->thread->pri < victim->thread->pri) {
+			victim = c;
+		}
+	}
+	if (victim->thread->pri < thread->pri) {
+		struct ss_thread *preempted = ss_cpu_slice_end(victim);
+		ss.preemptions++;
+		if (preempted->work == 0) {
+			preempted->state = SS_BLOCKED;
+			ss_bucket_group_run_count_dec(&preempted->group->buckets[preempted->bucket]);
+		} else {
+			ss_thread_insert(&ss.clusters[victim->cluster], preempted, true);
+		}
+		ss_cpu_select(victim);
+	}
+}
+
+static void
+ss_cpu_dispatch(struct ss_cpu *cpu, struct ss_thread *thread)
+{
+	struct ss_cluster *cluster = &ss.clusters[cpu->cluster];
+
+	if (thread->wake_pending) {
+		uint64_t latency = ss.now - thread->wake_ts;
+		struct ss_bucket_stats *stats = &ss.stats[thread->bucket];
+		ss_samples_add(&stats->latency, latency);
+		if (latency > ss_starvation_threshold) {
+			stats->starved++;
+		}
+		thread->wakeups++;
+		thread->total_latency += latency;
+		if (latency > thread->max_latency) {
+			thread->max_latency = latency;
+		}
+		thread->wake_pending = false;
+	}
+	if (thread->last_cluster != -1 && thread->last_cluster != cpu->cluster) {
+		ss.cluster_switches++;
+	}
+	thread->last_cluster = cpu->cluster;
+	thread->state = SS_RUNNING;
+	thread->cluster = cpu->cluster;
+
+	cpu->thread = thread;
+	cpu->slice_start = ss.now;
+	cpu->slice_end = ss.now + MIN(ss_quantum[thread->bucket], ss_work_time(thread, cluster));
+	cluster->idle_cpus--;
+}
+
+static void
+ss_thread_wakeup(struct ss_thread *thread, uint64_t work)
+{
+	if (thread->state != SS_BLOCKED) {
+		thread->work += work;
+		ss.stats[thread->bucket].coalesced++;
+		return;
+	}
+	thread->work = work;
+	thread->wake_ts = ss.now;
+	thread->wake_pending = true;
+	ss_bucket_group_run_count_inc(&thread->group->buckets[thread->bucket]);
+	ss_thread_setrun(thread, false);
+}
+
+static struct ss_cpu *
+ss_next_slice_end(void)
+{
+	struct ss_cpu *next = NULL;
+	for (int i = 0; i < ss.ncpus; i++) {
+		struct ss_cpu *cpu = &ss.cpus[i];
+		if (cpu->thread != NULL && (next == NULL || cpu->slice_end < next->slice_end)) {
+			next = cpu;
+		}
+	}
+	return next;
+}
+
+static void
+ss_run(void)
+{
+	size_t w = 0;
+
+	for (;;) {
+		struct ss_cpu *cpu = ss_next_slice_end();
+		if (w < ss.nwakes && (cpu == NULL || ss.wakes[w].time < cpu->slice_end)) {
+			ss.now = ss.wakes[w].time;
+			ss_thread_wakeup(ss.wakes[w].thread, ss.wakes[w].work);
+			w++;
+			continue;
+		}
+		if (cpu == NULL) {
+			break;
+		}
+
+		ss.now = cpu->slice_end;
+		struct ss_thread *thread = ss_cpu_slice_end(cpu);
+		if (thread->work == 0) {
+			thread->state = SS_BLOCKED;
+			ss_bucket_group_run_count_dec(&thread->group->buckets[thread->bucket]);
+			ss_cpu_select(cpu);
+		} else {
+			/* quantum expired: go through thread_setrun() again, the CPU being free */
+			ss_thread_setrun(thread, false);
+			if (cpu->thread == NULL) {
+				ss_cpu_select(cpu);
+			}
+		}
+	}
+}
+
+/*
+ * Report
+ */
+
+static int
+ss_thread_latency_compare(const void *a, const void *b)
+{
+	const struct ss_thread *x = *(struct ss_thread *const *)a;
+	const struct ss_thread *y = *(struct ss_thread *const *)b;
+	if (x->max_latency != y->max_latency) {
+		return x->max_latency < y->max_latency ? 1 : -1;
+	}
+	return (x->tid > y->tid) - (x->tid < y->tid);
+}
+
+static void
+ss_report(size_t top_threads)
+{
+	printf("topology:");
+	for (int i = 0; i < ss.nclusters; i++) {
+		const struct ss_cluster *c = &ss.clusters[i];
+		printf(" %s (%c, %d cpus, %d%%)", c->name, c->type, c->ncpus, c->speed);
+	}
+	printf("\n");
+	printf("simulated: %.3f ms, %zu threads, %zu wakeups\n\n",
+	    (double)ss.now / SS_NSEC_PER_MSEC, ss.nthreads, ss.nwakes);
+
+	printf("%-7s %9s %10s %10s %10s %10s %8s %9s %11s %11s %7s %10s\n", "bucket",
+	    "wakeups", "p50(us)", "p90(us)", "p99(us)", "max(us)", "starved", "coalesced",
+	    "cpuP(ms)", "cpuE(ms)", "warps", "starv.win");
+	for (int b = 0; b < NBUCKETS; b++) {
+		struct ss_bucket_stats *s = &ss.stats[b];
+		if (s->latency.count == 0 && s->cpu_ns[0] == 0 && s->cpu_ns[1] == 0) {
+			continue;
+		}
+		qsort(s->latency.values, s->latency.count, sizeof(uint64_t), ss_u64_compare);
+		printf("%-7s %9zu %10.1f %10.1f %10.1f %10.1f %8" PRIu64 " %9" PRIu64 " %11.3f %11.3f %7" PRIu64 " %10" PRIu64 "\n",
+		    ss_bucket_names[b], s->latency.count,
+		    (double)ss_percentile(&s->latency, 50) / SS_NSEC_PER_USEC,
+		    (double)ss_percentile(&s->latency, 90) / SS_NSEC_PER_USEC,
+		    (double)ss_percentile(&s->latency, 99) / SS_NSEC_PER_USEC,
+		    (double)ss_percentile(&s->latency, 100) / SS_NSEC_PER_USEC,
+		    s->starved, s->coalesced,
+		    (double)s->cpu_ns[1] / SS_NSEC_PER_MSEC, (double)s->cpu_ns[0] / SS_NSEC_PER_MSEC,
+		    s->warp_windows, s->starvation_windows);
+	}
+
+	printf("\nmigrations: %" PRIu64 " placed off the preferred cluster, %" PRIu64
+	    " stolen, %" PRIu64 " cluster switches, %" PRIu64 " preemptions\n",
+	    ss.off_preferred, ss.steals, ss.cluster_switches, ss.preemptions);
+	for (int i = 0; i < ss.nclusters; i++) {
+		const struct ss_cluster *c = &ss.clusters[i];
+		printf("  %-12s %6.1f%% busy\n", c->name,
+		    ss.now ? 100.0 * (double)c->busy_ns / ((double)ss.now * c->ncpus) : 0.0);
+	}
+
+	if (top_threads == 0) {
+		return;
+	}
+	struct ss_thread **sorted = ss_realloc(NULL, ss.nthreads, sizeof(struct ss_thread *));
+	memcpy(sorted, ss.threads, ss.nthreads * sizeof(struct ss_thread *));
+	qsort(sorted, ss.nthreads, sizeof(struct ss_thread *), ss_thread_latency_compare);
+	printf("\n%-18s %-6s %4s %-20s %9s %10s %10s\n", "thread", "bucket", "pri", "group",
+	    "wakeups", "mean(us)", "max(us)");
+	for (size_t i = 0; i < ss.nthreads && i < top_threads; i++) {
+		const struct ss_thread *t = sorted[i];
+		printf("0x%-16" PRIx64 " %-6s %4d %-20s %9" PRIu64 " %10.1f %10.1f\n", t->tid,
+		    ss_bucket_names[t->bucket], t->pri, t->group->name, t->wakeups,
+		    t->wakeups ? (double)t->total_latency / (double)t->wakeups / SS_NSEC_PER_USEC : 0.0,
+		    (double)t->max_latency / SS_NSEC_PER_USEC);
+	}
+	free(sorted);
+}
+
+/*
+ * Setup
+ */
+
+static void
+ss_set_tunable(const char *arg)
+{
+	char name[64];
+	const char *eq = strchr(arg, '=');
+	if (eq == NULL || (size_t)(eq - arg) >= sizeof(name)) {
+		fprintf(stderr, "invalid tunable '%s'\n", arg);
+		exit(2);
+	}
+	memcpy(name, arg, (size_t)(eq - arg));
+	name[eq - arg] = '\0';
+
+	char *end;
+	errno = 0;
+	unsigned long value = strtoul(eq + 1, &end, 0);
+	if (end == eq + 1 || *end != '\0' || errno != 0 || value > UINT32_MAX) {
+		fprintf(stderr, "invalid value in '%s'\n", arg);
+		exit(2);
+	}
+
+	if (strcmp(name, "interactive_pri") == 0) {
+		if (value == 0 || value > 31) {
+			fprintf(stderr, "interactive_pri must be in 1..31\n");
+			exit(2);
+		}
+		ss_interactive_pri = (uint8_t)value;
+		return;
+	}
+
+	static const struct {
+		const char *prefix;
+		uint32_t *values;
+	} tables[] = {
+		{ "wcel.", ss_wcel_us },
+		{ "warp.", ss_warp_us },
+		{ "quantum.", ss_quantum_us },
+		{ "pending.", ss_pending_delta_us },
+	};
+	for (size_t i = 0; i < sizeof(tables) / sizeof(tables[0]); i++) {
+		size_t len = strlen(tables[i].prefix);
+		if (strncmp(name, tables[i].prefix, len) == 0) {
+			int bucket = ss_bucket_from_name(name + len);
+			if (bucket == -1) {
+				break;
+			}
+			tables[i].values[bucket] = (uint32_t)value;
+			return;
+		}
+	}
+	fprintf(stderr, "unknown tunable '%s'\n", name);
+	exit(2);
+}
+
+/* sched_clutch_us_to_abstime(), with nanoseconds for abstime */
+static void
+ss_us_to_ns(const uint32_t *us_vals, uint64_t *ns_vals)
+{
+	for (int i = 0; i < NBUCKETS; i++) {
+		if (us_vals[i] == SCHED_CLUTCH_INVALID_TIME_32) {
+			ns_vals[i] = SCHED_CLUTCH_INVALID_TIME_64;
+		} else {
+			ns_vals[i] = (uint64_t)us_vals[i] * SS_NSEC_PER_USEC;
+		}
+	}
+}
+
+static void
+ss_setup(void)
+{
+	ss_us_to_ns(ss_wcel_us, ss_wcel);
+	ss_us_to_ns(ss_warp_us, ss_warp);
+	ss_us_to_ns(ss_quantum_us, ss_quantum);
+	ss_us_to_ns(ss_pending_delta_us, ss_pending_delta);
+	ss_adjust_threshold = SCHED_CLUTCH_BUCKET_GROUP_ADJUST_THRESHOLD_USECS * SS_NSEC_PER_USEC;
+
+	for (int i = 0; i < ss.nclusters; i++) {
+		for (int b = 0; b < NBUCKETS; b++) {
+			struct ss_root_bucket *rb = &ss.clusters[i].root_buckets[b];
+			rb->bucket = b;
+			rb->deadline = SCHED_CLUTCH_INVALID_TIME_64;
+			rb->warped_deadline = 0;
+			rb->warp_remaining = ss_warp[b];
+		}
+	}
+	for (size_t i = 0; i < ss.ngroups; i++) {
+		for (int b = 0; b < NBUCKETS; b++) {
+			ss_bucket_group_init(&ss.groups[i].buckets[b], b);
+		}
+	}
+	for (size_t i = 0; i < ss.nthreads; i++) {
+		ss.threads[i]->group = &ss.groups[ss.threads[i]->group_index];
+	}
+	qsort(ss.wakes, ss.nwakes, sizeof(struct ss_wake), ss_wake_compare);
+}
+
+static void __attribute__((noreturn))
+usage(const char *progname)
+{
+	fprintf(stderr,
+	    "usage: %s [-e] [-s starvation_ms] [-n threads] [-o tunable=usecs ...]\n"
+	    "       %*s workload ...\n", progname, (int)strlen(progname), "");
+	exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+	size_t top_threads = 0;
+	const char **tunables = NULL;
+	size_t ntunables = 0;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "es:n:o:h")) != -1) {
+		switch (ch) {
+		case 'e':
+			memcpy(ss_quantum_us, ss_quantum_embedded_us, sizeof(ss_quantum_us));
+			break;
+		case 's':
+			ss_starvation_threshold = strtoull(optarg, NULL, 0) * SS_NSEC_PER_MSEC;
+			break;
+		case 'n':
+			top_threads = strtoul(optarg, NULL, 0);
+			break;
+		case 'o':
+			/* applied after -e, whatever the order */
+			tunables = ss_realloc(tunables, ntunables + 1, sizeof(char *));
+			tunables[ntunables++] = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind == argc) {
+		usage(argv[0]);
+	}
+	for (size_t i = 0; i < ntunables; i++) {
+		ss_set_tunable(tunables[i]);
+	}
+	free(tunables);
+	for (int i = optind; i < argc; i++) {
+		ss_parse_file(argv[i]);
+	}
+	if (ss.nclusters == 0) {
+		fprintf(stderr, "%s: the workload defines no cluster\n", argv[0]);
+		return 1;
+	}
+
+	ss_setup();
+	ss_run();
+	ss_report(top_threads);
+	return 0;
+}